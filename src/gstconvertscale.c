@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "gstconvertscale.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+GST_DEBUG_CATEGORY_STATIC (convert_scale_debug);
+#define GST_CAT_DEFAULT convert_scale_debug
+
+GST_BOILERPLATE (GstConvertScale, gst_convert_scale, GstBaseTransform,
+    GST_TYPE_BASE_TRANSFORM);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ("{ I420, YV12, NV12, YUY2 }")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ("I420")));
+
+static void gst_convert_scale_base_init (gpointer gpkls);
+static void gst_convert_scale_class_init (GstConvertScaleClass * kls);
+static void gst_convert_scale_init (GstConvertScale * self,
+    GstConvertScaleClass * kls);
+static void gst_convert_scale_finalize (GObject * goself);
+
+static GstCaps *gst_convert_scale_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps);
+static void gst_convert_scale_fixate_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * othercaps);
+static gboolean gst_convert_scale_get_unit_size (GstBaseTransform * trans,
+    GstCaps * caps, guint * size);
+static gboolean gst_convert_scale_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static GstFlowReturn gst_convert_scale_transform (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer * outbuf);
+
+static void _free_components (GstConvertScale * self);
+
+static void
+gst_convert_scale_base_init (gpointer gpkls)
+{
+  GstElementClass *elemkls = GST_ELEMENT_CLASS (gpkls);
+
+  gst_element_class_set_details_simple (elemkls,
+      "Colorspace converter and scaler",
+      "Filter/Converter/Video/Scaler",
+      "Converts YUV video to I420 and scales it in a single pass.",
+      "David Wendt <dcrkid@yahoo.com>");
+
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&sink_template));
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&src_template));
+};
+
+static void
+gst_convert_scale_class_init (GstConvertScaleClass * kls)
+{
+  GObjectClass *gokls = G_OBJECT_CLASS (kls);
+  GstBaseTransformClass *btkls = GST_BASE_TRANSFORM_CLASS (kls);
+
+  gokls->finalize = gst_convert_scale_finalize;
+
+  btkls->transform_caps = GST_DEBUG_FUNCPTR (gst_convert_scale_transform_caps);
+  btkls->fixate_caps = GST_DEBUG_FUNCPTR (gst_convert_scale_fixate_caps);
+  btkls->get_unit_size = GST_DEBUG_FUNCPTR (gst_convert_scale_get_unit_size);
+  btkls->set_caps = GST_DEBUG_FUNCPTR (gst_convert_scale_set_caps);
+  btkls->transform = GST_DEBUG_FUNCPTR (gst_convert_scale_transform);
+  btkls->passthrough_on_same_caps = TRUE;
+
+  GST_DEBUG_CATEGORY_INIT (convert_scale_debug, "convertscale", 0,
+      "Single pass colorspace converter and scaler");
+};
+
+static void
+gst_convert_scale_init (GstConvertScale * self, GstConvertScaleClass * kls)
+{
+  self->in_format = GST_VIDEO_FORMAT_UNKNOWN;
+  self->out_format = GST_VIDEO_FORMAT_UNKNOWN;
+  memset (self->comp, 0, sizeof (self->comp));
+  self->chroma_span = 0;
+  self->line = NULL;
+};
+
+static void
+gst_convert_scale_finalize (GObject * goself)
+{
+  GstConvertScale *self = GST_CONVERT_SCALE (goself);
+
+  _free_components (self);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+static GstCaps *
+gst_convert_scale_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps)
+{
+  GstPad *other = direction == GST_PAD_SINK ?
+      GST_BASE_TRANSFORM_SRC_PAD (trans) : GST_BASE_TRANSFORM_SINK_PAD (trans);
+  GstCaps *ret, *result;
+  guint i;
+
+  ret = gst_caps_copy (caps);
+
+  /* Any size on the other side, and whatever formats it can take */
+  for (i = 0; i < gst_caps_get_size (ret); i++) {
+    GstStructure *s = gst_caps_get_structure (ret, i);
+
+    gst_structure_set (s,
+        "width", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+        "height", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+    gst_structure_remove_field (s, "format");
+
+    if (gst_structure_has_field (s, "pixel-aspect-ratio")) {
+      gst_structure_set (s, "pixel-aspect-ratio", GST_TYPE_FRACTION_RANGE,
+          1, G_MAXINT, G_MAXINT, 1, NULL);
+    }
+  }
+
+  result = gst_caps_intersect (ret, gst_pad_get_pad_template_caps (other));
+  gst_caps_unref (ret);
+
+  GST_DEBUG_OBJECT (trans, "transformed %" GST_PTR_FORMAT " into %"
+      GST_PTR_FORMAT, caps, result);
+
+  return result;
+};
+
+/* Same size as the input unless told otherwise. With only one dimension
+ * given, the other one keeps the display aspect ratio at the input's
+ * pixel aspect ratio, as videoscale does; with both given, the display
+ * aspect ratio is kept through the pixel aspect ratio where that's still
+ * open. */
+static void
+gst_convert_scale_fixate_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * othercaps)
+{
+  GstStructure *ins, *outs;
+  gint from_w, from_h, to_w, to_h;
+  gint from_par_n = 1, from_par_d = 1, to_par_n, to_par_d;
+  gint dar_n, dar_d;
+  const GValue *par, *w, *h;
+
+  if (gst_caps_is_empty (othercaps))
+    return;
+
+  ins = gst_caps_get_structure (caps, 0);
+  outs = gst_caps_get_structure (othercaps, 0);
+
+  if (!gst_structure_get_int (ins, "width", &from_w)
+      || !gst_structure_get_int (ins, "height", &from_h))
+    return;
+
+  w = gst_structure_get_value (outs, "width");
+  h = gst_structure_get_value (outs, "height");
+
+  if (direction != GST_PAD_SINK || w == NULL || h == NULL) {
+    gst_structure_fixate_field_nearest_int (outs, "width", from_w);
+    gst_structure_fixate_field_nearest_int (outs, "height", from_h);
+    return;
+  }
+
+  gst_structure_get_fraction (ins, "pixel-aspect-ratio", &from_par_n,
+      &from_par_d);
+  par = gst_structure_get_value (outs, "pixel-aspect-ratio");
+
+  if (gst_value_is_fixed (w) && gst_value_is_fixed (h)) {
+    gst_structure_get_int (outs, "width", &to_w);
+    gst_structure_get_int (outs, "height", &to_h);
+
+    if (par != NULL && GST_VALUE_HOLDS_FRACTION (par))
+      return;
+
+    if (!gst_util_fraction_multiply (from_par_n, from_par_d,
+            from_w * to_h, from_h * to_w, &to_par_n, &to_par_d))
+      return;
+
+    if (par != NULL) {
+      gst_structure_fixate_field_nearest_fraction (outs,
+          "pixel-aspect-ratio", to_par_n, to_par_d);
+    } else {
+      gst_structure_set (outs, "pixel-aspect-ratio", GST_TYPE_FRACTION,
+          to_par_n, to_par_d, NULL);
+    }
+    return;
+  }
+
+  /* Keep the input's pixel aspect ratio if we can, then size the open
+   * dimension to the display aspect ratio */
+  if (par != NULL)
+    gst_structure_fixate_field_nearest_fraction (outs, "pixel-aspect-ratio",
+        from_par_n, from_par_d);
+  if (!gst_structure_get_fraction (outs, "pixel-aspect-ratio", &to_par_n,
+          &to_par_d)) {
+    to_par_n = from_par_n;
+    to_par_d = from_par_d;
+  }
+
+  if (!gst_util_fraction_multiply (from_w, from_h, from_par_n, from_par_d,
+          &dar_n, &dar_d)
+      || !gst_util_fraction_multiply (dar_n, dar_d, to_par_d, to_par_n,
+          &dar_n, &dar_d)) {
+    gst_structure_fixate_field_nearest_int (outs, "width", from_w);
+    gst_structure_fixate_field_nearest_int (outs, "height", from_h);
+    return;
+  }
+
+  /* dar_n / dar_d is now the width to height ratio in output pixels */
+  if (gst_value_is_fixed (h)) {
+    gst_structure_get_int (outs, "height", &to_h);
+    gst_structure_fixate_field_nearest_int (outs, "width",
+        (gint) gst_util_uint64_scale_int (to_h, dar_n, dar_d));
+  } else {
+    if (!gst_value_is_fixed (w))
+      gst_structure_fixate_field_nearest_int (outs, "width", from_w);
+    gst_structure_get_int (outs, "width", &to_w);
+    gst_structure_fixate_field_nearest_int (outs, "height",
+        (gint) gst_util_uint64_scale_int (to_w, dar_d, dar_n));
+  }
+};
+
+static gboolean
+gst_convert_scale_get_unit_size (GstBaseTransform * trans, GstCaps * caps,
+    guint * size)
+{
+  GstVideoFormat format;
+  gint width, height;
+
+  if (!gst_video_format_parse_caps (caps, &format, &width, &height))
+    return FALSE;
+
+  *size = gst_video_format_get_size (format, width, height);
+
+  return TRUE;
+};
+
+/* Position of output sample i in input samples, in 1/256ths, with the
+ * sample centres of both grids lined up. Never past the last input sample,
+ * so the second filter tap is always inside the frame. */
+static gint
+_source_position (gint i, gint in_size, gint out_size)
+{
+  gint64 pos = ((gint64) (2 * i + 1) * in_size * 256) / (2 * out_size) - 128;
+
+  if (pos < 0)
+    return 0;
+  if ((pos >> 8) >= in_size - 1)
+    return (in_size - 1) << 8;
+
+  return (gint) pos;
+};
+
+static gboolean
+gst_convert_scale_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstConvertScale *self = GST_CONVERT_SCALE (trans);
+  gint i, x, offset, line_size = 0;
+
+  if (!gst_video_format_parse_caps (incaps, &self->in_format,
+          &self->in_width, &self->in_height)
+      || !gst_video_format_parse_caps (outcaps, &self->out_format,
+          &self->out_width, &self->out_height)) {
+    GST_WARNING_OBJECT (self, "Unsupported caps %" GST_PTR_FORMAT " -> %"
+        GST_PTR_FORMAT, incaps, outcaps);
+    return FALSE;
+  }
+
+  _free_components (self);
+
+  for (i = 0; i < 3; i++) {
+    GstConvertScaleComponent *c = &self->comp[i];
+
+    c->in_offset = gst_video_format_get_component_offset (self->in_format, i,
+        self->in_width, self->in_height);
+    c->in_stride = gst_video_format_get_row_stride (self->in_format, i,
+        self->in_width);
+    c->in_pstride = gst_video_format_get_pixel_stride (self->in_format, i);
+    c->in_width = gst_video_format_get_component_width (self->in_format, i,
+        self->in_width);
+    c->in_height = gst_video_format_get_component_height (self->in_format, i,
+        self->in_height);
+
+    c->out_offset = gst_video_format_get_component_offset (self->out_format,
+        i, self->out_width, self->out_height);
+    c->out_stride = gst_video_format_get_row_stride (self->out_format, i,
+        self->out_width);
+    c->out_width = gst_video_format_get_component_width (self->out_format, i,
+        self->out_width);
+    c->out_height = gst_video_format_get_component_height (self->out_format,
+        i, self->out_height);
+
+    c->xoff = g_new (gint, c->out_width);
+    c->xfrac = g_new (gint, c->out_width);
+    for (x = 0; x < c->out_width; x++) {
+      gint pos = _source_position (x, c->in_width, c->out_width);
+
+      c->xoff[x] = (pos >> 8) * c->in_pstride;
+      c->xfrac[x] = pos & 0xff;
+    }
+
+    line_size = MAX (line_size, c->in_stride);
+  }
+
+  /* NV12 and YUY2 interleave U and V, so one blended line serves both */
+  offset = self->comp[2].in_offset - self->comp[1].in_offset;
+  if (offset > 0 && offset < self->comp[1].in_pstride
+      && self->comp[1].in_stride == self->comp[2].in_stride) {
+    self->chroma_span = offset +
+        (self->comp[2].in_width - 1) * self->comp[2].in_pstride + 1;
+  } else {
+    self->chroma_span = 0;
+  }
+
+  self->line = g_malloc (line_size);
+
+  GST_DEBUG_OBJECT (self, "%" GST_FOURCC_FORMAT " %dx%d -> %"
+      GST_FOURCC_FORMAT " %dx%d",
+      GST_FOURCC_ARGS (gst_video_format_to_fourcc (self->in_format)),
+      self->in_width, self->in_height,
+      GST_FOURCC_ARGS (gst_video_format_to_fourcc (self->out_format)),
+      self->out_width, self->out_height);
+
+  return TRUE;
+};
+
+/* Vertical filter: dst = a + (b - a) * f / 256, on raw bytes so it works
+ * the same for planar and packed lines */
+static void
+_blend_line (guint8 * dst, const guint8 * a, const guint8 * b, gint n, gint f)
+{
+  gint i = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i round = _mm_set1_epi16 (128);
+  const __m128i fa = _mm_set1_epi16 (256 - f);
+  const __m128i fb = _mm_set1_epi16 (f);
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128 ((const __m128i *) (a + i));
+    __m128i vb = _mm_loadu_si128 ((const __m128i *) (b + i));
+    __m128i lo, hi;
+
+    lo = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (va, zero), fa),
+        _mm_mullo_epi16 (_mm_unpacklo_epi8 (vb, zero), fb));
+    hi = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (va, zero), fa),
+        _mm_mullo_epi16 (_mm_unpackhi_epi8 (vb, zero), fb));
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, round), 8);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, round), 8);
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+  }
+#endif
+
+  for (; i < n; i++)
+    dst[i] = (a[i] * (256 - f) + b[i] * f + 128) >> 8;
+};
+
+#ifdef __SSE2__
+/* 16 samples of one component from a line with the given pixel stride */
+static inline __m128i
+_load_samples (const guint8 * p, gint pstride)
+{
+  const __m128i *v = (const __m128i *) p;
+
+  if (pstride == 2) {
+    const __m128i mask = _mm_set1_epi16 (0x00ff);
+
+    return _mm_packus_epi16 (_mm_and_si128 (_mm_loadu_si128 (v), mask),
+        _mm_and_si128 (_mm_loadu_si128 (v + 1), mask));
+  }
+
+  if (pstride == 4) {
+    const __m128i mask = _mm_set1_epi32 (0x000000ff);
+    __m128i lo, hi;
+
+    lo = _mm_packs_epi32 (_mm_and_si128 (_mm_loadu_si128 (v), mask),
+        _mm_and_si128 (_mm_loadu_si128 (v + 1), mask));
+    hi = _mm_packs_epi32 (_mm_and_si128 (_mm_loadu_si128 (v + 2), mask),
+        _mm_and_si128 (_mm_loadu_si128 (v + 3), mask));
+    return _mm_packus_epi16 (lo, hi);
+  }
+
+  return _mm_loadu_si128 (v);
+};
+
+/* Same width: only pick the component out of the line. Returns how many
+ * samples were done; the loads stop a sample short of the end so they
+ * never reach past the component's last byte. */
+static gint
+_pick_line_sse2 (guint8 * dst, const guint8 * src, gint pstride, gint n)
+{
+  gint x = 0;
+
+  if (pstride != 1 && pstride != 2 && pstride != 4)
+    return 0;
+
+  for (; x + 17 <= n; x += 16) {
+    _mm_storeu_si128 ((__m128i *) (dst + x),
+        _load_samples (src + x * pstride, pstride));
+  }
+
+  return x;
+};
+
+/* Half width: every output sample is the rounded mean of two input
+ * samples, which is what the filter taps come to for an exact 2:1. */
+static gint
+_halve_line_sse2 (guint8 * dst, const guint8 * src, gint pstride, gint n)
+{
+  const __m128i mask = _mm_set1_epi16 (0x00ff);
+  gint x = 0;
+
+  if (pstride != 1 && pstride != 2 && pstride != 4)
+    return 0;
+
+  for (; x + 17 <= n; x += 16) {
+    __m128i a = _load_samples (src + 2 * x * pstride, pstride);
+    __m128i b = _load_samples (src + (2 * x + 16) * pstride, pstride);
+
+    a = _mm_avg_epu16 (_mm_and_si128 (a, mask), _mm_srli_epi16 (a, 8));
+    b = _mm_avg_epu16 (_mm_and_si128 (b, mask), _mm_srli_epi16 (b, 8));
+    _mm_storeu_si128 ((__m128i *) (dst + x), _mm_packus_epi16 (a, b));
+  }
+
+  return x;
+};
+#endif
+
+/* Horizontal filter, picking one component out of a possibly packed line */
+static void
+_scale_line (guint8 * dst, const guint8 * src, GstConvertScaleComponent * c)
+{
+  gint x = 0;
+
+  if (c->in_pstride == 1 && c->in_width == c->out_width) {
+    memcpy (dst, src, c->out_width);
+    return;
+  }
+#ifdef __SSE2__
+  if (c->in_width == c->out_width)
+    x = _pick_line_sse2 (dst, src, c->in_pstride, c->out_width);
+  else if (c->in_width == 2 * c->out_width)
+    x = _halve_line_sse2 (dst, src, c->in_pstride, c->out_width);
+#endif
+
+  for (; x < c->out_width; x++) {
+    const guint8 *p = src + c->xoff[x];
+    gint f = c->xfrac[x];
+
+    dst[x] = f ? (p[0] * (256 - f) + p[c->in_pstride] * f + 128) >> 8 : p[0];
+  }
+};
+
+/* The input line output line y of a component comes from, starting at the
+ * component's first sample. Lines in between two input lines are blended
+ * into the scratch line, span bytes of it. */
+static const guint8 *
+_source_line (GstConvertScale * self, GstConvertScaleComponent * c,
+    const guint8 * src, gint y, gint span)
+{
+  gint pos = _source_position (y, c->in_height, c->out_height);
+  const guint8 *row = src + c->in_offset + (pos >> 8) * c->in_stride;
+
+  if (!(pos & 0xff))
+    return row;
+
+  _blend_line (self->line, row, row + c->in_stride, span, pos & 0xff);
+
+  return self->line;
+};
+
+static void
+_convert_line (GstConvertScale * self, GstConvertScaleComponent * c,
+    const guint8 * src, guint8 * dst, gint y)
+{
+  gint span = (c->in_width - 1) * c->in_pstride + 1;
+
+  _scale_line (dst + c->out_offset + y * c->out_stride,
+      _source_line (self, c, src, y, span), c);
+};
+
+/* Works down the frame once, doing each chroma line after the luma lines
+ * next to it, so a packed input line is still in cache when its chroma is
+ * read. U and V sharing a plane are blended together. */
+static GstFlowReturn
+gst_convert_scale_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstConvertScale *self = GST_CONVERT_SCALE (trans);
+  GstConvertScaleComponent *luma = &self->comp[0];
+  GstConvertScaleComponent *u = &self->comp[1], *v = &self->comp[2];
+  const guint8 *src = GST_BUFFER_DATA (inbuf);
+  guint8 *dst = GST_BUFFER_DATA (outbuf);
+  gint y = 0, cy;
+
+  if (self->line == NULL) {
+    GST_ELEMENT_ERROR (self, CORE, NOT_IMPLEMENTED, (NULL),
+        ("Not negotiated"));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  for (cy = 0; cy < u->out_height; cy++) {
+    gint luma_end = (cy + 1) * luma->out_height / u->out_height;
+
+    for (; y < luma_end; y++)
+      _convert_line (self, luma, src, dst, y);
+
+    if (self->chroma_span > 0) {
+      const guint8 *row = _source_line (self, u, src, cy, self->chroma_span);
+
+      _scale_line (dst + u->out_offset + cy * u->out_stride, row, u);
+      _scale_line (dst + v->out_offset + cy * v->out_stride,
+          row + (v->in_offset - u->in_offset), v);
+    } else {
+      _convert_line (self, u, src, dst, cy);
+      _convert_line (self, v, src, dst, cy);
+    }
+  }
+
+  return GST_FLOW_OK;
+};
+
+static void
+_free_components (GstConvertScale * self)
+{
+  gint i;
+
+  for (i = 0; i < 3; i++) {
+    g_free (self->comp[i].xoff);
+    g_free (self->comp[i].xfrac);
+    self->comp[i].xoff = NULL;
+    self->comp[i].xfrac = NULL;
+  }
+
+  g_free (self->line);
+  self->line = NULL;
+};
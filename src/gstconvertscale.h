@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_CONVERT_SCALE_H__
+#define __GST_CONVERT_SCALE_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstConvertScale:
+ *
+ * Converts I420, YV12, NV12 or YUY2 video to I420 and scales it with a
+ * bilinear filter in the same pass. Each output line is built from at most
+ * two input lines that are blended into a one-line scratch buffer, so no
+ * full-size intermediate frame is ever written. The frame is read in one
+ * sweep, and interleaved U and V lines are blended once for both. Keeping
+ * the width, or halving it exactly, takes a vectorized path when built
+ * with SSE2; other widths use the scalar bilinear filter.
+ */
+
+#define GST_TYPE_CONVERT_SCALE              (gst_convert_scale_get_type ())
+#define GST_CONVERT_SCALE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_CONVERT_SCALE, GstConvertScale))
+#define GST_IS_CONVERT_SCALE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_CONVERT_SCALE))
+#define GST_CONVERT_SCALE_CLASS(kls)        (G_TYPE_CHECK_CLASS_CAST ((kls), GST_TYPE_CONVERT_SCALE, GstConvertScaleClass))
+#define GST_IS_CONVERT_SCALE_CLASS(kls)     (G_TYPE_CHECK_CLASS_TYPE ((kls), GST_TYPE_CONVERT_SCALE))
+#define GST_CONVERT_SCALE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_CONVERT_SCALE, GstConvertScaleClass))
+
+/* Where one colour component lives in the input and output frames, and the
+ * horizontal filter taps for it */
+typedef struct _GstConvertScaleComponent
+{
+    gint in_offset, in_stride, in_pstride;
+    gint in_width, in_height;
+    gint out_offset, out_stride;
+    gint out_width, out_height;
+
+    gint* xoff;
+    gint* xfrac;
+} GstConvertScaleComponent;
+
+typedef struct _GstConvertScale
+{
+    GstBaseTransform parent_instance;
+
+    GstVideoFormat in_format;
+    gint in_width, in_height;
+    GstVideoFormat out_format;
+    gint out_width, out_height;
+
+    GstConvertScaleComponent comp[3];
+    /* bytes of a line holding both U and V, 0 if they're separate planes */
+    gint chroma_span;
+    guint8* line;
+} GstConvertScale;
+
+typedef GstBaseTransformClass GstConvertScaleClass;
+
+GType gst_convert_scale_get_type(void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "gstmappedfilesrc.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+GST_DEBUG_CATEGORY_STATIC (mapped_file_src_debug);
+#define GST_CAT_DEFAULT mapped_file_src_debug
+
+GST_BOILERPLATE (GstMappedFileSrc, gst_mapped_file_src, GstBaseSrc,
+    GST_TYPE_BASE_SRC);
+
+/* Large enough that a whole stream of pushed blocks costs next to nothing,
+ * the mapping makes the size free anyway */
+#define     DEFAULT_BLOCKSIZE   (1024 * 1024)
+#define     DEFAULT_READAHEAD   (8 * 1024 * 1024)
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_READAHEAD
+};
+
+/* The mapping, shared by the element and the buffers pointing into it.
+ * It is private and writable: downstream may change a buffer in place,
+ * which copies the pages touched and never reaches the file. */
+typedef struct _GstFileMapping
+{
+  volatile gint refcount;
+  guint8 *data;
+  guint64 size;
+#ifndef G_OS_UNIX
+  GMappedFile *file;
+#endif
+} GstFileMapping;
+
+/* A buffer pointing into the mapping, keeping it alive */
+typedef struct _GstMappedBuffer
+{
+  GstBuffer buffer;
+  GstFileMapping *mapping;
+} GstMappedBuffer;
+
+static GstMiniObjectClass *buffer_parent_class = NULL;
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static void gst_mapped_file_src_base_init (gpointer gpkls);
+static void gst_mapped_file_src_class_init (GstMappedFileSrcClass * kls);
+static void gst_mapped_file_src_init (GstMappedFileSrc * self,
+    GstMappedFileSrcClass * kls);
+static void gst_mapped_file_src_set_property (GObject * goself, guint propid,
+    const GValue * val, GParamSpec * pspec);
+static void gst_mapped_file_src_get_property (GObject * goself, guint propid,
+    GValue * val, GParamSpec * pspec);
+static void gst_mapped_file_src_finalize (GObject * goself);
+
+static gboolean gst_mapped_file_src_start (GstBaseSrc * src);
+static gboolean gst_mapped_file_src_stop (GstBaseSrc * src);
+static gboolean gst_mapped_file_src_is_seekable (GstBaseSrc * src);
+static gboolean gst_mapped_file_src_get_size (GstBaseSrc * src,
+    guint64 * size);
+static GstFlowReturn gst_mapped_file_src_create (GstBaseSrc * src,
+    guint64 offset, guint length, GstBuffer ** buf);
+
+static GstFileMapping *
+_mapping_new (const gchar * location, GError ** err)
+{
+  GstFileMapping *mapping;
+#ifdef G_OS_UNIX
+  struct stat st;
+  gpointer data = NULL;
+  gint fd;
+
+  /* Read-only files can be mapped privately for writing too */
+  fd = g_open (location, O_RDONLY, 0);
+  if (fd < 0) {
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "%s", g_strerror (errno));
+    return NULL;
+  }
+
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode)
+      || (guint64) st.st_size > G_MAXSIZE) {
+    g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Not a regular file that fits in memory");
+    close (fd);
+    return NULL;
+  }
+
+  if (st.st_size > 0) {
+    data = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+        0);
+    if (data == MAP_FAILED) {
+      g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errno),
+          "%s", g_strerror (errno));
+      close (fd);
+      return NULL;
+    }
+  }
+  close (fd);
+
+  mapping = g_slice_new (GstFileMapping);
+  mapping->data = data;
+  mapping->size = st.st_size;
+#else
+  GMappedFile *file = g_mapped_file_new (location, TRUE, err);
+
+  if (file == NULL)
+    return NULL;
+
+  mapping = g_slice_new (GstFileMapping);
+  mapping->file = file;
+  mapping->data = (guint8 *) g_mapped_file_get_contents (file);
+  mapping->size = g_mapped_file_get_length (file);
+#endif
+  mapping->refcount = 1;
+
+  return mapping;
+};
+
+static GstFileMapping *
+_mapping_ref (GstFileMapping * mapping)
+{
+  g_atomic_int_inc (&mapping->refcount);
+
+  return mapping;
+};
+
+static void
+_mapping_unref (GstFileMapping * mapping)
+{
+  if (!g_atomic_int_dec_and_test (&mapping->refcount))
+    return;
+
+#ifdef G_OS_UNIX
+  if (mapping->data != NULL)
+    munmap (mapping->data, mapping->size);
+#else
+  g_mapped_file_unref (mapping->file);
+#endif
+  g_slice_free (GstFileMapping, mapping);
+};
+
+gboolean
+gst_mapped_file_src_can_map (const gchar * location)
+{
+  struct stat st;
+
+  /* Pipes and devices have no size to map, and a file may not fit in a
+   * 32-bit address space */
+  if (g_stat (location, &st) != 0 || !S_ISREG (st.st_mode))
+    return FALSE;
+
+  return (guint64) st.st_size <= G_MAXSIZE;
+};
+
+static void
+gst_mapped_buffer_finalize (GstMappedBuffer * mbuf)
+{
+  _mapping_unref (mbuf->mapping);
+
+  buffer_parent_class->finalize (GST_MINI_OBJECT_CAST (mbuf));
+};
+
+static void
+gst_mapped_buffer_class_init (gpointer g_class, gpointer class_data)
+{
+  GstMiniObjectClass *mokls = GST_MINI_OBJECT_CLASS (g_class);
+
+  buffer_parent_class = g_type_class_peek_parent (g_class);
+  mokls->finalize = (GstMiniObjectFinalizeFunction) gst_mapped_buffer_finalize;
+};
+
+static GType
+gst_mapped_buffer_get_type (void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter (&type)) {
+    static const GTypeInfo info = {
+      sizeof (GstBufferClass),
+      NULL,
+      NULL,
+      gst_mapped_buffer_class_init,
+      NULL,
+      NULL,
+      sizeof (GstMappedBuffer),
+      0,
+      NULL,
+      NULL
+    };
+    GType t = g_type_register_static (GST_TYPE_BUFFER, "GstMappedBuffer",
+        &info, 0);
+
+    g_once_init_leave (&type, t);
+  }
+
+  return type;
+};
+
+static void
+gst_mapped_file_src_base_init (gpointer gpkls)
+{
+  GstElementClass *elemkls = GST_ELEMENT_CLASS (gpkls);
+
+  gst_element_class_set_details_simple (elemkls,
+      "Memory-mapped file source",
+      "Source/File",
+      "Reads a local file through a memory mapping, without copying.",
+      "David Wendt <dcrkid@yahoo.com>");
+
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&src_template));
+};
+
+static void
+gst_mapped_file_src_class_init (GstMappedFileSrcClass * kls)
+{
+  GObjectClass *gokls = G_OBJECT_CLASS (kls);
+  GstBaseSrcClass *bskls = GST_BASE_SRC_CLASS (kls);
+
+  gokls->set_property = gst_mapped_file_src_set_property;
+  gokls->get_property = gst_mapped_file_src_get_property;
+  gokls->finalize = gst_mapped_file_src_finalize;
+
+  bskls->start = GST_DEBUG_FUNCPTR (gst_mapped_file_src_start);
+  bskls->stop = GST_DEBUG_FUNCPTR (gst_mapped_file_src_stop);
+  bskls->is_seekable = GST_DEBUG_FUNCPTR (gst_mapped_file_src_is_seekable);
+  bskls->get_size = GST_DEBUG_FUNCPTR (gst_mapped_file_src_get_size);
+  bskls->create = GST_DEBUG_FUNCPTR (gst_mapped_file_src_create);
+
+  GST_DEBUG_CATEGORY_INIT (mapped_file_src_debug, "mappedfilesrc", 0,
+      "Memory-mapped file source");
+
+  /** GstMappedFileSrc:location:
+   *
+   * The file to read. Can only be changed in NULL or READY.
+   */
+  g_object_class_install_property (gokls, PROP_LOCATION,
+      g_param_spec_string ("location", "location", "File to read", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstMappedFileSrc:readahead:
+   *
+   * How far past the latest block the kernel is asked to read ahead.
+   * 0 leaves it to the kernel's own sequential readahead.
+   */
+  g_object_class_install_property (gokls, PROP_READAHEAD,
+      g_param_spec_uint ("readahead", "readahead",
+          "Bytes to read ahead of the latest block (0=kernel default)",
+          0, G_MAXUINT, DEFAULT_READAHEAD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+};
+
+static void
+gst_mapped_file_src_init (GstMappedFileSrc * self,
+    GstMappedFileSrcClass * kls)
+{
+  self->location = NULL;
+  self->readahead = DEFAULT_READAHEAD;
+
+  self->mapping = NULL;
+  self->data = NULL;
+  self->size = 0;
+  self->advised = 0;
+
+  gst_base_src_set_blocksize (GST_BASE_SRC (self), DEFAULT_BLOCKSIZE);
+};
+
+static void
+gst_mapped_file_src_set_property (GObject * goself, guint propid,
+    const GValue * val, GParamSpec * pspec)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (goself);
+
+  switch (propid) {
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (self);
+      if (GST_STATE (self) > GST_STATE_READY) {
+        GST_OBJECT_UNLOCK (self);
+        GST_WARNING_OBJECT (self, "Can't change the location while running");
+        break;
+      }
+      g_free (self->location);
+      self->location = g_value_dup_string (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READAHEAD:
+      GST_OBJECT_LOCK (self);
+      self->readahead = g_value_get_uint (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_mapped_file_src_get_property (GObject * goself, guint propid,
+    GValue * val, GParamSpec * pspec)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (goself);
+
+  switch (propid) {
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (val, self->location);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_READAHEAD:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (val, self->readahead);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_mapped_file_src_finalize (GObject * goself)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (goself);
+
+  g_free (self->location);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+/* Tell the kernel what's coming; only a hint, failures don't matter */
+static void
+_advise (GstMappedFileSrc * self, guint64 offset, guint64 length, gint advice)
+{
+#if defined (G_OS_UNIX) && defined (MADV_WILLNEED)
+  static gsize page = 0;
+  guint64 start;
+
+  if (page == 0)
+    page = (gsize) sysconf (_SC_PAGESIZE);
+
+  if (offset >= self->size || length == 0)
+    return;
+
+  start = offset - offset % page;
+  length = MIN (length + (offset - start), self->size - start);
+
+  if (madvise (self->data + start, length, advice) != 0)
+    GST_DEBUG_OBJECT (self, "madvise failed: %s", g_strerror (errno));
+#endif
+};
+
+static gboolean
+gst_mapped_file_src_start (GstBaseSrc * src)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (src);
+  GError *err = NULL;
+  gchar *location;
+
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->location);
+  GST_OBJECT_UNLOCK (self);
+
+  if (location == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+        ("No file name specified for reading."), (NULL));
+    return FALSE;
+  }
+
+  self->mapping = _mapping_new (location, &err);
+  if (self->mapping == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ,
+        ("Could not open file \"%s\" for reading.", location),
+        ("%s", err->message));
+    g_error_free (err);
+    g_free (location);
+    return FALSE;
+  }
+  g_free (location);
+
+  self->data = self->mapping->data;
+  self->size = self->mapping->size;
+  self->advised = 0;
+
+#if defined (G_OS_UNIX) && defined (MADV_SEQUENTIAL)
+  _advise (self, 0, self->size, MADV_SEQUENTIAL);
+#endif
+
+  GST_DEBUG_OBJECT (self, "mapped %" G_GUINT64_FORMAT " bytes", self->size);
+
+  return TRUE;
+};
+
+/* Buffers still out keep their own ref on the mapping */
+static gboolean
+gst_mapped_file_src_stop (GstBaseSrc * src)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (src);
+
+  if (self->mapping != NULL)
+    _mapping_unref (self->mapping);
+  self->mapping = NULL;
+  self->data = NULL;
+  self->size = 0;
+
+  return TRUE;
+};
+
+static gboolean
+gst_mapped_file_src_is_seekable (GstBaseSrc * src)
+{
+  return TRUE;
+};
+
+static gboolean
+gst_mapped_file_src_get_size (GstBaseSrc * src, guint64 * size)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (src);
+
+  if (self->mapping == NULL)
+    return FALSE;
+
+  *size = self->size;
+
+  return TRUE;
+};
+
+static GstFlowReturn
+gst_mapped_file_src_create (GstBaseSrc * src, guint64 offset, guint length,
+    GstBuffer ** buf)
+{
+  GstMappedFileSrc *self = GST_MAPPED_FILE_SRC (src);
+  GstMappedBuffer *mbuf;
+  guint readahead;
+
+  if (offset >= self->size)
+    return GST_FLOW_UNEXPECTED;
+
+  length = MIN (length, self->size - offset);
+
+  /* Keep one window ahead of the reads, renewed when they get halfway */
+  GST_OBJECT_LOCK (self);
+  readahead = self->readahead;
+  GST_OBJECT_UNLOCK (self);
+
+#if defined (G_OS_UNIX) && defined (MADV_WILLNEED)
+  /* A seek back starts over from there */
+  if (offset + length + readahead < self->advised)
+    self->advised = offset + length;
+
+  if (readahead > 0 && offset + length + readahead / 2 > self->advised) {
+    guint64 from = MAX (offset + length, self->advised);
+
+    _advise (self, from, offset + length + readahead - from, MADV_WILLNEED);
+    self->advised = offset + length + readahead;
+  }
+#endif
+
+  mbuf = (GstMappedBuffer *)
+      gst_mini_object_new (gst_mapped_buffer_get_type ());
+  mbuf->mapping = _mapping_ref (self->mapping);
+  GST_BUFFER_DATA (mbuf) = self->data + offset;
+  GST_BUFFER_SIZE (mbuf) = length;
+  GST_BUFFER_OFFSET (mbuf) = offset;
+  GST_BUFFER_OFFSET_END (mbuf) = offset + length;
+
+  *buf = GST_BUFFER_CAST (mbuf);
+
+  return GST_FLOW_OK;
+};
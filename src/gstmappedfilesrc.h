@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_MAPPED_FILE_SRC_H__
+#define __GST_MAPPED_FILE_SRC_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesrc.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstMappedFileSrc:
+ *
+ * Reads a local file by mapping it into memory whole. Buffers point into
+ * the mapping instead of being read into, whatever their offset and size,
+ * so neither the default blocks nor the small pulls of typefinding and
+ * demuxers cost a syscall or a copy. The kernel is told the file is read
+ * front to back and asked to read ahead of the latest block.
+ *
+ * Only regular files that fit in the address space can be mapped, see
+ * gst_mapped_file_src_can_map().
+ */
+
+#define GST_TYPE_MAPPED_FILE_SRC              (gst_mapped_file_src_get_type ())
+#define GST_MAPPED_FILE_SRC(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_MAPPED_FILE_SRC, GstMappedFileSrc))
+#define GST_IS_MAPPED_FILE_SRC(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_MAPPED_FILE_SRC))
+#define GST_MAPPED_FILE_SRC_CLASS(kls)        (G_TYPE_CHECK_CLASS_CAST ((kls), GST_TYPE_MAPPED_FILE_SRC, GstMappedFileSrcClass))
+#define GST_IS_MAPPED_FILE_SRC_CLASS(kls)     (G_TYPE_CHECK_CLASS_TYPE ((kls), GST_TYPE_MAPPED_FILE_SRC))
+#define GST_MAPPED_FILE_SRC_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_MAPPED_FILE_SRC, GstMappedFileSrcClass))
+
+typedef struct _GstMappedFileSrc
+{
+    GstBaseSrc parent_instance;
+
+    /* properties */
+    gchar* location;
+    guint readahead;
+
+    /* between start and stop */
+    struct _GstFileMapping* mapping;
+    guint8* data;
+    guint64 size;
+    guint64 advised;
+} GstMappedFileSrc;
+
+typedef GstBaseSrcClass GstMappedFileSrcClass;
+
+GType gst_mapped_file_src_get_type(void);
+
+gboolean gst_mapped_file_src_can_map(const gchar* location);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,845 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "gstparalleltranscode.h"
+#include "gsttranscodebin.h"
+
+#include <unistd.h>
+
+GST_DEBUG_CATEGORY_STATIC (parallel_transcode_debug);
+#define GST_CAT_DEFAULT parallel_transcode_debug
+
+GST_BOILERPLATE (GstParallelTranscode, gst_parallel_transcode, GstPushSrc,
+    GST_TYPE_PUSH_SRC);
+
+#define     TRANSCODE_BIN   "transcodebin"
+#define     DECODE_BIN      "decodebin2"
+
+#define     DEFAULT_WORKERS             0
+#define     DEFAULT_SEGMENT_DURATION    (60 * GST_SECOND)
+#define     DEFAULT_MAX_PENDING         256
+
+/* How long the split point probe may take to preroll or finish a seek */
+#define     PROBE_TIMEOUT   (30 * GST_SECOND)
+/* How often a worker checks whether it should shut down */
+#define     WORKER_POLL     (100 * GST_MSECOND)
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_PROFILE,
+  PROP_WORKERS,
+  PROP_SEGMENT_DURATION,
+  PROP_MAX_PENDING,
+  PROP_COUNT
+};
+
+/* A keyframe-aligned piece of the input and its encoded output */
+typedef struct _GstTranscodeSegment
+{
+  GstClockTime start;
+  GstClockTime stop;
+  GQueue buffers;
+  gboolean done;
+  gboolean failed;
+} GstTranscodeSegment;
+
+typedef struct _GstTranscodeWorker
+{
+  GstParallelTranscode *self;
+  GThread *thread;
+  guint segment;
+} GstTranscodeWorker;
+
+/* State of the split point probe pipeline */
+typedef struct _GstSplitProbe
+{
+  GstElement *pipe;
+  GstPad *pad;
+  gboolean is_video;
+  gulong probe_id;
+  GstClockTime first_ts;
+} GstSplitProbe;
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static void gst_parallel_transcode_base_init (gpointer gpkls);
+static void gst_parallel_transcode_class_init (GstParallelTranscodeClass *
+    kls);
+static void gst_parallel_transcode_init (GstParallelTranscode * self,
+    GstParallelTranscodeClass * kls);
+static void gst_parallel_transcode_set_property (GObject * goself,
+    guint propid, const GValue * val, GParamSpec * pspec);
+static void gst_parallel_transcode_get_property (GObject * goself,
+    guint propid, GValue * val, GParamSpec * pspec);
+static void gst_parallel_transcode_finalize (GObject * goself);
+
+static gboolean gst_parallel_transcode_start (GstBaseSrc * bsrc);
+static gboolean gst_parallel_transcode_stop (GstBaseSrc * bsrc);
+static gboolean gst_parallel_transcode_unlock (GstBaseSrc * bsrc);
+static gboolean gst_parallel_transcode_unlock_stop (GstBaseSrc * bsrc);
+static gboolean gst_parallel_transcode_is_seekable (GstBaseSrc * bsrc);
+static GstFlowReturn gst_parallel_transcode_create (GstPushSrc * psrc,
+    GstBuffer ** outbuf);
+
+static gboolean _find_segments (GstParallelTranscode * self);
+static gpointer _worker_thread (gpointer user_data);
+
+static void
+gst_parallel_transcode_base_init (gpointer gpkls)
+{
+  GstElementClass *elemkls = GST_ELEMENT_CLASS (gpkls);
+
+  gst_element_class_set_details_simple (elemkls,
+      "Parallel Transcoder",
+      "Source/File/Transcoder",
+      "Transcodes a file by splitting it at keyframes and encoding "
+      "the pieces concurrently.",
+      "David Wendt <dcrkid@yahoo.com>");
+
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&src_template));
+};
+
+static void
+gst_parallel_transcode_class_init (GstParallelTranscodeClass * kls)
+{
+  GObjectClass *gokls = G_OBJECT_CLASS (kls);
+  GstBaseSrcClass *bsrckls = GST_BASE_SRC_CLASS (kls);
+  GstPushSrcClass *psrckls = GST_PUSH_SRC_CLASS (kls);
+
+  gokls->get_property = gst_parallel_transcode_get_property;
+  gokls->set_property = gst_parallel_transcode_set_property;
+  gokls->finalize = gst_parallel_transcode_finalize;
+
+  bsrckls->start = GST_DEBUG_FUNCPTR (gst_parallel_transcode_start);
+  bsrckls->stop = GST_DEBUG_FUNCPTR (gst_parallel_transcode_stop);
+  bsrckls->unlock = GST_DEBUG_FUNCPTR (gst_parallel_transcode_unlock);
+  bsrckls->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_parallel_transcode_unlock_stop);
+  bsrckls->is_seekable = GST_DEBUG_FUNCPTR (gst_parallel_transcode_is_seekable);
+  psrckls->create = GST_DEBUG_FUNCPTR (gst_parallel_transcode_create);
+
+  GST_DEBUG_CATEGORY_INIT (parallel_transcode_debug, "paralleltranscode", 0,
+      "Segment-parallel transcoder");
+
+  /* Properties */
+
+  /** GstParallelTranscode:location:
+   *
+   * File to transcode. It has to be seekable.
+   */
+  g_object_class_install_property (gokls, PROP_LOCATION,
+      g_param_spec_string ("location", "File Location",
+          "Location of the file to transcode", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstParallelTranscode:profile:
+   *
+   * Encoding profile every segment is transcoded with.
+   */
+  g_object_class_install_property (gokls, PROP_PROFILE,
+      gst_param_spec_mini_object ("profile", "profile",
+          "The GstEncodingProfile to use", GST_TYPE_ENCODING_PROFILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstParallelTranscode:workers:
+   *
+   * Number of segments transcoded at the same time, each in its own
+   * pipeline. 0 uses one per online CPU.
+   */
+  g_object_class_install_property (gokls, PROP_WORKERS,
+      g_param_spec_uint ("workers", "workers",
+          "Number of concurrent transcoding pipelines (0 = one per CPU)",
+          0, G_MAXUINT, DEFAULT_WORKERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstParallelTranscode:segment-duration:
+   *
+   * Target length of a segment. Segments always start on a keyframe, so the
+   * actual lengths vary with the input's keyframe interval.
+   */
+  g_object_class_install_property (gokls, PROP_SEGMENT_DURATION,
+      g_param_spec_uint64 ("segment-duration", "segment duration",
+          "Target duration of each segment (in ns)",
+          GST_SECOND, G_MAXUINT64, DEFAULT_SEGMENT_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstParallelTranscode:max-pending-buffers:
+   *
+   * Encoded buffers a worker may hold for a segment that isn't being pushed
+   * out yet before it has to wait. 0 means no limit.
+   */
+  g_object_class_install_property (gokls, PROP_MAX_PENDING,
+      g_param_spec_uint ("max-pending-buffers", "max pending buffers",
+          "Max. encoded buffers held per waiting segment (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_PENDING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+};
+
+static void
+gst_parallel_transcode_init (GstParallelTranscode * self,
+    GstParallelTranscodeClass * kls)
+{
+  self->location = NULL;
+  self->profile = NULL;
+  self->n_workers = DEFAULT_WORKERS;
+  self->segment_duration = DEFAULT_SEGMENT_DURATION;
+  self->max_pending = DEFAULT_MAX_PENDING;
+
+  self->lock = g_mutex_new ();
+  self->cond = g_cond_new ();
+  self->flushing = FALSE;
+  self->unlocked = FALSE;
+
+  self->segments = NULL;
+  self->next_segment = 0;
+  self->current_segment = 0;
+  self->offset = 0;
+
+  self->workers = NULL;
+};
+
+static void
+gst_parallel_transcode_set_property (GObject * goself, guint propid,
+    const GValue * val, GParamSpec * pspec)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (goself);
+
+  switch (propid) {
+    case PROP_LOCATION:
+      g_free (self->location);
+      self->location = g_value_dup_string (val);
+      break;
+    case PROP_PROFILE:{
+      GstEncodingProfile *prof = GST_ENCODING_PROFILE
+          (gst_value_get_mini_object (val));
+
+      if (self->profile != NULL)
+        gst_encoding_profile_unref (self->profile);
+      self->profile = prof ?
+          GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof)) : NULL;
+      break;
+    }
+    case PROP_WORKERS:
+      self->n_workers = g_value_get_uint (val);
+      break;
+    case PROP_SEGMENT_DURATION:
+      self->segment_duration = g_value_get_uint64 (val);
+      break;
+    case PROP_MAX_PENDING:
+      self->max_pending = g_value_get_uint (val);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_parallel_transcode_get_property (GObject * goself, guint propid,
+    GValue * val, GParamSpec * pspec)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (goself);
+
+  switch (propid) {
+    case PROP_LOCATION:
+      g_value_set_string (val, self->location);
+      break;
+    case PROP_PROFILE:
+      gst_value_set_mini_object (val, GST_MINI_OBJECT (self->profile));
+      break;
+    case PROP_WORKERS:
+      g_value_set_uint (val, self->n_workers);
+      break;
+    case PROP_SEGMENT_DURATION:
+      g_value_set_uint64 (val, self->segment_duration);
+      break;
+    case PROP_MAX_PENDING:
+      g_value_set_uint (val, self->max_pending);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_parallel_transcode_finalize (GObject * goself)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (goself);
+
+  g_free (self->location);
+  if (self->profile != NULL)
+    gst_encoding_profile_unref (self->profile);
+
+  g_mutex_free (self->lock);
+  g_cond_free (self->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+static guint
+_online_cpus (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (guint) n : 1;
+};
+
+static gboolean
+gst_parallel_transcode_start (GstBaseSrc * bsrc)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (bsrc);
+  guint i, n;
+
+  if (self->location == NULL || self->profile == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("Both a location and a profile have to be set"), (NULL));
+    return FALSE;
+  }
+
+  /* The encoded segments are glued together as they are */
+  if (!gst_transcode_profile_is_appendable (self->profile)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("The profile's container can't be concatenated"),
+        ("Use a profile with an MPEG-TS container or none at all"));
+    return FALSE;
+  }
+
+  self->segments = g_array_new (FALSE, TRUE, sizeof (GstTranscodeSegment));
+  self->next_segment = 0;
+  self->current_segment = 0;
+  self->offset = 0;
+  self->flushing = FALSE;
+
+  if (!_find_segments (self)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, READ,
+        ("Could not find split points in \"%s\"", self->location), (NULL));
+    g_array_free (self->segments, TRUE);
+    self->segments = NULL;
+    return FALSE;
+  }
+
+  n = self->n_workers ? self->n_workers : _online_cpus ();
+  n = MIN (n, self->segments->len);
+
+  GST_DEBUG_OBJECT (self, "transcoding %u segments with %u workers",
+      self->segments->len, n);
+
+  for (i = 0; i < n; i++) {
+    GstTranscodeWorker *worker = g_slice_new0 (GstTranscodeWorker);
+
+    worker->self = self;
+    worker->thread = g_thread_create (_worker_thread, worker, TRUE, NULL);
+
+    if (worker->thread == NULL) {
+      g_slice_free (GstTranscodeWorker, worker);
+      break;
+    }
+
+    self->workers = g_list_prepend (self->workers, worker);
+  }
+
+  if (self->workers == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
+        ("Could not start any worker threads"), (NULL));
+    gst_parallel_transcode_stop (bsrc);
+    return FALSE;
+  }
+
+  return TRUE;
+};
+
+static gboolean
+gst_parallel_transcode_stop (GstBaseSrc * bsrc)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (bsrc);
+  guint i;
+
+  g_mutex_lock (self->lock);
+  self->flushing = TRUE;
+  g_cond_broadcast (self->cond);
+  g_mutex_unlock (self->lock);
+
+  while (self->workers != NULL) {
+    GstTranscodeWorker *worker = (GstTranscodeWorker *) self->workers->data;
+
+    g_thread_join (worker->thread);
+    g_slice_free (GstTranscodeWorker, worker);
+
+    self->workers = g_list_delete_link (self->workers, self->workers);
+  }
+
+  if (self->segments != NULL) {
+    for (i = 0; i < self->segments->len; i++) {
+      GstTranscodeSegment *seg =
+          &g_array_index (self->segments, GstTranscodeSegment, i);
+      GstBuffer *buf;
+
+      while ((buf = g_queue_pop_head (&seg->buffers)) != NULL)
+        gst_buffer_unref (buf);
+    }
+
+    g_array_free (self->segments, TRUE);
+    self->segments = NULL;
+  }
+
+  return TRUE;
+};
+
+/* Only wakes up create(); the workers keep going unless we stop */
+static gboolean
+gst_parallel_transcode_unlock (GstBaseSrc * bsrc)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (bsrc);
+
+  g_mutex_lock (self->lock);
+  self->unlocked = TRUE;
+  g_cond_broadcast (self->cond);
+  g_mutex_unlock (self->lock);
+
+  return TRUE;
+};
+
+static gboolean
+gst_parallel_transcode_unlock_stop (GstBaseSrc * bsrc)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (bsrc);
+
+  g_mutex_lock (self->lock);
+  self->unlocked = FALSE;
+  g_mutex_unlock (self->lock);
+
+  return TRUE;
+};
+
+static gboolean
+gst_parallel_transcode_is_seekable (GstBaseSrc * bsrc)
+{
+  return FALSE;
+};
+
+static GstFlowReturn
+gst_parallel_transcode_create (GstPushSrc * psrc, GstBuffer ** outbuf)
+{
+  GstParallelTranscode *self = GST_PARALLEL_TRANSCODE (psrc);
+  GstFlowReturn ret = GST_FLOW_WRONG_STATE;
+  guint failed = 0;
+
+  g_mutex_lock (self->lock);
+  while (!self->unlocked) {
+    GstTranscodeSegment *seg = &g_array_index (self->segments,
+        GstTranscodeSegment, self->current_segment);
+    GstBuffer *buf = g_queue_pop_head (&seg->buffers);
+
+    if (buf != NULL) {
+      buf = gst_buffer_make_metadata_writable (buf);
+      GST_BUFFER_OFFSET (buf) = self->offset;
+      self->offset += GST_BUFFER_SIZE (buf);
+      GST_BUFFER_OFFSET_END (buf) = self->offset;
+
+      *outbuf = buf;
+      ret = GST_FLOW_OK;
+      break;
+    }
+
+    if (seg->failed) {
+      failed = self->current_segment;
+      ret = GST_FLOW_ERROR;
+      break;
+    }
+
+    if (seg->done) {
+      if (self->current_segment + 1 >= self->segments->len) {
+        ret = GST_FLOW_UNEXPECTED;
+        break;
+      }
+
+      /* Workers holding back output for the next segment may go on now */
+      self->current_segment++;
+      g_cond_broadcast (self->cond);
+      continue;
+    }
+
+    g_cond_wait (self->cond, self->lock);
+  }
+  g_mutex_unlock (self->lock);
+
+  if (ret == GST_FLOW_ERROR) {
+    GST_ELEMENT_ERROR (self, STREAM, ENCODE, (NULL),
+        ("Transcoding segment %u failed", failed));
+  }
+
+  return ret;
+};
+
+static gboolean
+_probe_have_buffer (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstSplitProbe *probe = (GstSplitProbe *) user_data;
+
+  GST_OBJECT_LOCK (probe->pipe);
+  if (!GST_CLOCK_TIME_IS_VALID (probe->first_ts))
+    probe->first_ts = GST_BUFFER_TIMESTAMP (buf);
+  GST_OBJECT_UNLOCK (probe->pipe);
+
+  return TRUE;
+};
+
+/* Sink every decoded stream, and watch the first video one (or the first
+ * one at all for audio-only input) for where seeks land. */
+static void
+_probe_pad_added (GstElement * dbin, GstPad * pad, gpointer user_data)
+{
+  GstSplitProbe *probe = (GstSplitProbe *) user_data;
+  GstElement *sink;
+  GstPad *sinkpad;
+  GstCaps *caps;
+  gboolean is_video = FALSE;
+
+  caps = gst_pad_get_caps (pad);
+  if (caps != NULL && gst_caps_get_size (caps) > 0) {
+    is_video = g_str_has_prefix (gst_structure_get_name
+        (gst_caps_get_structure (caps, 0)), "video/");
+  }
+  if (caps != NULL)
+    gst_caps_unref (caps);
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (sink == NULL)
+    return;
+
+  gst_bin_add (GST_BIN (probe->pipe), sink);
+  gst_element_sync_state_with_parent (sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+
+  GST_OBJECT_LOCK (probe->pipe);
+  if (probe->pad == NULL || (is_video && !probe->is_video)) {
+    if (probe->pad != NULL) {
+      gst_pad_remove_buffer_probe (probe->pad, probe->probe_id);
+      gst_object_unref (probe->pad);
+    }
+
+    probe->pad = gst_object_ref (sinkpad);
+    probe->is_video = is_video;
+    probe->probe_id = gst_pad_add_buffer_probe (sinkpad,
+        G_CALLBACK (_probe_have_buffer), probe);
+  }
+  GST_OBJECT_UNLOCK (probe->pipe);
+
+  gst_object_unref (sinkpad);
+};
+
+/* Find keyframe-aligned split points: key unit seeks snap to the keyframe
+ * before the target, so the first decoded buffer after each seek tells us
+ * where the segment can start. */
+static gboolean
+_find_segments (GstParallelTranscode * self)
+{
+  GstSplitProbe probe = { NULL, };
+  GstTranscodeSegment seg = { 0, };
+  GstElement *src, *dbin;
+  GstFormat fmt = GST_FORMAT_TIME;
+  gint64 duration = -1;
+  GstClockTime target;
+  gboolean ret = FALSE;
+
+  probe.pipe = gst_pipeline_new (NULL);
+  probe.first_ts = GST_CLOCK_TIME_NONE;
+
+  src = gst_element_factory_make ("filesrc", NULL);
+  dbin = gst_element_factory_make (DECODE_BIN, NULL);
+
+  if (src == NULL || dbin == NULL) {
+    if (src != NULL)
+      gst_object_unref (src);
+    if (dbin != NULL)
+      gst_object_unref (dbin);
+    gst_object_unref (probe.pipe);
+    return FALSE;
+  }
+
+  g_object_set (G_OBJECT (src), "location", self->location, NULL);
+  g_signal_connect (dbin, "pad-added", G_CALLBACK (_probe_pad_added), &probe);
+
+  gst_bin_add_many (GST_BIN (probe.pipe), src, dbin, NULL);
+  if (!gst_element_link (src, dbin))
+    goto done;
+
+  gst_element_set_state (probe.pipe, GST_STATE_PAUSED);
+  if (gst_element_get_state (probe.pipe, NULL, NULL, PROBE_TIMEOUT) !=
+      GST_STATE_CHANGE_SUCCESS)
+    goto done;
+
+  seg.start = 0;
+
+  if (!gst_element_query_duration (probe.pipe, &fmt, &duration)
+      || duration <= 0) {
+    GST_WARNING_OBJECT (self, "Unknown duration, not splitting the input");
+    duration = 0;
+  }
+
+  for (target = self->segment_duration; target < (GstClockTime) duration;
+      target += self->segment_duration) {
+    GstClockTime keyframe;
+
+    GST_OBJECT_LOCK (probe.pipe);
+    probe.first_ts = GST_CLOCK_TIME_NONE;
+    GST_OBJECT_UNLOCK (probe.pipe);
+
+    if (!gst_element_seek (probe.pipe, 1.0, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
+            GST_SEEK_TYPE_SET, target, GST_SEEK_TYPE_NONE, -1))
+      break;
+
+    if (gst_element_get_state (probe.pipe, NULL, NULL, PROBE_TIMEOUT) !=
+        GST_STATE_CHANGE_SUCCESS)
+      break;
+
+    GST_OBJECT_LOCK (probe.pipe);
+    keyframe = probe.first_ts;
+    GST_OBJECT_UNLOCK (probe.pipe);
+
+    /* A GOP longer than the segment duration snaps back to a keyframe we
+     * already split at */
+    if (!GST_CLOCK_TIME_IS_VALID (keyframe) || keyframe <= seg.start)
+      continue;
+
+    seg.stop = keyframe;
+    g_array_append_val (self->segments, seg);
+    seg.start = keyframe;
+  }
+
+  seg.stop = GST_CLOCK_TIME_NONE;
+  g_array_append_val (self->segments, seg);
+  ret = TRUE;
+
+done:
+  gst_element_set_state (probe.pipe, GST_STATE_NULL);
+  if (probe.pad != NULL)
+    gst_object_unref (probe.pad);
+  gst_object_unref (probe.pipe);
+
+  return ret;
+};
+
+static void
+_worker_handoff (GstElement * sink, GstBuffer * buf, GstPad * pad,
+    gpointer user_data)
+{
+  GstTranscodeWorker *worker = (GstTranscodeWorker *) user_data;
+  GstParallelTranscode *self = worker->self;
+  GstTranscodeSegment *seg;
+
+  g_mutex_lock (self->lock);
+  seg = &g_array_index (self->segments, GstTranscodeSegment, worker->segment);
+
+  /* Output of the segment being pushed out is drained right away; later
+   * segments wait here so a fast worker can't pile up a whole segment. */
+  while (!self->flushing && self->max_pending > 0
+      && worker->segment != self->current_segment
+      && seg->buffers.length >= self->max_pending)
+    g_cond_wait (self->cond, self->lock);
+
+  if (!self->flushing) {
+    g_queue_push_tail (&seg->buffers, gst_buffer_ref (buf));
+    g_cond_broadcast (self->cond);
+  }
+  g_mutex_unlock (self->lock);
+};
+
+static gboolean
+_worker_is_flushing (GstParallelTranscode * self)
+{
+  gboolean flushing;
+
+  g_mutex_lock (self->lock);
+  flushing = self->flushing;
+  g_mutex_unlock (self->lock);
+
+  return flushing;
+};
+
+/* Build the worker's filesrc ! transcodebin ! fakesink pipeline. It is made
+ * once per worker and taken back to READY between segments, which keeps
+ * transcodebin's encoders and autoplugging decisions around. */
+static GstElement *
+_worker_pipeline_new (GstTranscodeWorker * worker)
+{
+  GstParallelTranscode *self = worker->self;
+  GstElement *pipe, *src, *xcode, *sink;
+
+  pipe = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("filesrc", NULL);
+  xcode = gst_element_factory_make (TRANSCODE_BIN, NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+
+  if (src == NULL || xcode == NULL || sink == NULL) {
+    GST_WARNING_OBJECT (self, "Could not create worker pipeline elements");
+    if (src != NULL)
+      gst_object_unref (src);
+    if (xcode != NULL)
+      gst_object_unref (xcode);
+    if (sink != NULL)
+      gst_object_unref (sink);
+    gst_object_unref (pipe);
+    return NULL;
+  }
+
+  g_object_set (G_OBJECT (src), "location", self->location, NULL);
+  g_object_set (G_OBJECT (xcode), "profile", self->profile, NULL);
+  g_object_set (G_OBJECT (sink), "signal-handoffs", TRUE, "sync", FALSE,
+      NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (_worker_handoff), worker);
+
+  gst_bin_add_many (GST_BIN (pipe), src, xcode, sink, NULL);
+
+  if (!gst_element_link_many (src, xcode, sink, NULL)
+      || gst_element_set_state (pipe, GST_STATE_READY) ==
+      GST_STATE_CHANGE_FAILURE) {
+    GST_WARNING_OBJECT (self, "Could not set up the worker pipeline");
+    gst_element_set_state (pipe, GST_STATE_NULL);
+    gst_object_unref (pipe);
+    return NULL;
+  }
+
+  return pipe;
+};
+
+/* Transcode one segment with a pipeline in READY, and leave it in READY */
+static gboolean
+_worker_transcode (GstTranscodeWorker * worker, GstElement * pipe,
+    GstTranscodeSegment * seg)
+{
+  GstParallelTranscode *self = worker->self;
+  GstStateChangeReturn sret;
+  GstBus *bus;
+  gboolean ok = FALSE;
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipe));
+
+  /* Seek while paused: the sink only hands off what it renders, so nothing
+   * from before the segment start makes it into the output. */
+  gst_element_set_state (pipe, GST_STATE_PAUSED);
+  do {
+    sret = gst_element_get_state (pipe, NULL, NULL, WORKER_POLL);
+  } while (sret == GST_STATE_CHANGE_ASYNC && !_worker_is_flushing (self));
+
+  if (sret == GST_STATE_CHANGE_FAILURE || sret == GST_STATE_CHANGE_ASYNC)
+    goto done;
+
+  if (seg->start > 0 || GST_CLOCK_TIME_IS_VALID (seg->stop)) {
+    if (!gst_element_seek (pipe, 1.0, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+            GST_SEEK_TYPE_SET, seg->start,
+            GST_CLOCK_TIME_IS_VALID (seg->stop) ?
+            GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE,
+            GST_CLOCK_TIME_IS_VALID (seg->stop) ? (gint64) seg->stop : -1)) {
+      GST_WARNING_OBJECT (self, "Seek to %" GST_TIME_FORMAT " failed",
+          GST_TIME_ARGS (seg->start));
+      goto done;
+    }
+  }
+
+  gst_element_set_state (pipe, GST_STATE_PLAYING);
+
+  while (!_worker_is_flushing (self)) {
+    GstMessage *msg = gst_bus_timed_pop_filtered (bus, WORKER_POLL,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    if (msg == NULL)
+      continue;
+
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+      GError *err = NULL;
+      gchar *dbg = NULL;
+
+      gst_message_parse_error (msg, &err, &dbg);
+      GST_WARNING_OBJECT (self, "Worker error: %s (%s)", err->message,
+          GST_STR_NULL (dbg));
+      g_error_free (err);
+      g_free (dbg);
+    } else {
+      ok = TRUE;
+    }
+
+    gst_message_unref (msg);
+    break;
+  }
+
+done:
+  gst_element_set_state (pipe, GST_STATE_READY);
+
+  /* Nothing this segment posted may end the next one */
+  gst_bus_set_flushing (bus, TRUE);
+  gst_bus_set_flushing (bus, FALSE);
+  gst_object_unref (bus);
+
+  return ok;
+};
+
+static gpointer
+_worker_thread (gpointer user_data)
+{
+  GstTranscodeWorker *worker = (GstTranscodeWorker *) user_data;
+  GstParallelTranscode *self = worker->self;
+  GstElement *pipe = _worker_pipeline_new (worker);
+
+  g_mutex_lock (self->lock);
+  while (!self->flushing && self->next_segment < self->segments->len) {
+    GstTranscodeSegment *seg;
+    gboolean ok;
+
+    worker->segment = self->next_segment++;
+    seg = &g_array_index (self->segments, GstTranscodeSegment,
+        worker->segment);
+    g_mutex_unlock (self->lock);
+
+    GST_DEBUG_OBJECT (self, "transcoding segment %u (%" GST_TIME_FORMAT
+        " - %" GST_TIME_FORMAT ")", worker->segment,
+        GST_TIME_ARGS (seg->start), GST_TIME_ARGS (seg->stop));
+
+    /* Without a pipeline the segment fails, or create() would wait on it
+     * forever */
+    ok = pipe != NULL && _worker_transcode (worker, pipe, seg);
+
+    g_mutex_lock (self->lock);
+    seg->done = TRUE;
+    seg->failed = !ok && !self->flushing;
+    g_cond_broadcast (self->cond);
+
+    if (!ok)
+      break;
+  }
+  g_mutex_unlock (self->lock);
+
+  if (pipe != NULL) {
+    gst_element_set_state (pipe, GST_STATE_NULL);
+    gst_object_unref (pipe);
+  }
+
+  return NULL;
+};
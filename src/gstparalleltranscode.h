@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_PARALLEL_TRANSCODE_H__
+#define __GST_PARALLEL_TRANSCODE_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/pbutils/encoding-profile.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstParallelTranscode:
+ *
+ * Source element that transcodes one seekable file in several pieces at
+ * once. The input is cut at keyframes into segments of roughly
+ * #GstParallelTranscode:segment-duration, the segments are shared out among
+ * workers that each run one filesrc ! transcodebin pipeline, seeking it to
+ * every segment they take, and the encoded segments are pushed out in order
+ * as one byte stream.
+ *
+ * Since the segments are simply concatenated, the profile has to use a
+ * container that allows that, MPEG-TS, or none at all; other profiles
+ * are refused when starting.
+ */
+
+#define GST_TYPE_PARALLEL_TRANSCODE              (gst_parallel_transcode_get_type ())
+#define GST_PARALLEL_TRANSCODE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_PARALLEL_TRANSCODE, GstParallelTranscode))
+#define GST_IS_PARALLEL_TRANSCODE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_PARALLEL_TRANSCODE))
+#define GST_PARALLEL_TRANSCODE_CLASS(kls)        (G_TYPE_CHECK_CLASS_CAST ((kls), GST_TYPE_PARALLEL_TRANSCODE, GstParallelTranscodeClass))
+#define GST_IS_PARALLEL_TRANSCODE_CLASS(kls)     (G_TYPE_CHECK_CLASS_TYPE ((kls), GST_TYPE_PARALLEL_TRANSCODE))
+#define GST_PARALLEL_TRANSCODE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_PARALLEL_TRANSCODE, GstParallelTranscodeClass))
+
+typedef struct _GstParallelTranscode
+{
+    GstPushSrc parent_instance;
+
+    /* properties */
+    gchar* location;
+    GstEncodingProfile* profile;
+    guint n_workers;
+    GstClockTime segment_duration;
+    guint max_pending;
+
+    /* private state, protected by lock */
+    GMutex* lock;
+    GCond* cond;
+    gboolean flushing;
+    gboolean unlocked;
+
+    GArray* segments;
+    guint next_segment;
+    guint current_segment;
+    guint64 offset;
+
+    GList* workers;
+} GstParallelTranscode;
+
+typedef GstPushSrcClass GstParallelTranscodeClass;
+
+GType gst_parallel_transcode_get_type(void);
+
+G_END_DECLS
+
+#endif
@@ -18,21 +18,359 @@
  */
 
 #include "gsttranscodebin.h"
+#include "gsttranscodetaskpool.h"
+#include "gsttranscodebufferpool.h"
+#include "gstmappedfilesrc.h"
 
 #include <gst/pbutils/encoding-profile.h>
+#include <glib/gstdio.h>
 
-GST_BOILERPLATE (GstTranscodeBin, gst_transcode_bin, GstBin, GST_TYPE_BIN);
+#include <stdio.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (transcode_bin_debug);
+#define GST_CAT_DEFAULT transcode_bin_debug
+
+static void _do_init (GType type);
+
+GST_BOILERPLATE_FULL (GstTranscodeBin, gst_transcode_bin, GstBin,
+    GST_TYPE_BIN, _do_init);
 
 #define     ENCODE_BIN      "encodebin"
 #define     DECODE_BIN      "decodebin2"
 
+#define     DEFAULT_STREAM_COPY     TRUE
+#define     DEFAULT_EARLY_CONVERT   TRUE
+
+/* Same as the queue element's own defaults */
+#define     DEFAULT_QUEUE_MAX_BUFFERS   200
+#define     DEFAULT_QUEUE_MAX_BYTES     (10 * 1024 * 1024)
+#define     DEFAULT_QUEUE_MAX_TIME      GST_SECOND
+
+#define     DEFAULT_LATENCY_MODE    GST_TRANSCODE_LATENCY_BATCH
+#define     DEFAULT_STREAM_TYPES    (GST_TRANSCODE_STREAM_VIDEO | \
+    GST_TRANSCODE_STREAM_AUDIO | GST_TRANSCODE_STREAM_TEXT | \
+    GST_TRANSCODE_STREAM_OTHER)
+#define     DEFAULT_PRUNE_STREAMS   TRUE
+
+/* Queue limits in live mode; the configured ones apply when lower */
+#define     LIVE_QUEUE_MAX_BUFFERS      5
+#define     LIVE_QUEUE_MAX_TIME         (100 * GST_MSECOND)
+
+/* Share of max-memory each of decodebin2's and encodebin's own queues
+ * may use, as a divisor; the per-stream queues share the rest */
+#define     INTERNAL_MEMORY_SHARE   8
+
+#define     DEFAULT_CHECKPOINT_INTERVAL     (10 * GST_SECOND)
+
+/* Output formats that can be cut at a keyframe and appended to later
+ * without any muxer state: MPEG-TS, or no container at all */
+#define     APPENDABLE_CONTAINERS   "video/mpegts"
+
+#define     CHECKPOINT_GROUP    "checkpoint"
+
+/* Input timestamps remembered for matching against the output */
+#define     MAX_ARRIVALS    256
+
+/* Autoplug decisions remembered per bin, across inputs */
+#define     MAX_DECISIONS   64
+
+/* Idle frame buffers each stream keeps for reuse */
+#define     POOL_MAX_FREE   8
+
+#define     DEFAULT_PREVIEW_INTERVAL    (10 * GST_SECOND)
+#define     DEFAULT_PREVIEW_KEYFRAMES   FALSE
+#define     DEFAULT_PREVIEW_WIDTH       320
+#define     DEFAULT_PREVIEW_FORMAT      GST_TRANSCODE_PREVIEW_JPEG
+
+#define     DEFAULT_SEGMENT_DURATION    0
+#define     DEFAULT_SEGMENT_LOCATION    "segment%05u.ts"
+
+#define     DEFAULT_TARGET_SPEED    0.0
+
+/* The speed controller measures each stream over a window this long and
+ * makes at most one adjustment per window. Below the target by more than
+ * SPEED_SLOW it speeds up, above it by more than SPEED_FAST it gives
+ * quality back; in between it leaves the stream alone. */
+#define     SPEED_WINDOW    (2 * GST_SECOND)
+#define     SPEED_SLOW      0.95
+#define     SPEED_FAST      1.25
+/* An encoder busy for less of the window than this isn't what holds the
+ * stream back */
+#define     SPEED_MIN_BUSY  0.5
+/* videoscale methods given up, and frames dropped: one in 4, 3, then 2 */
+#define     MAX_SCALE_LEVEL     2
+#define     MAX_DECIMATE_LEVEL  3
+/* Streams that haven't moved to the new encodebin on their own this long
+ * after a profile change are moved by an event through their queue */
+#define     SWITCH_TIMEOUT  (2 * GST_SECOND)
+#define     SWITCH_EVENT    "transcodebin-switch"
+
+/* Elements between a stream's queue and its encoder, at most */
+#define     MAX_PATH_ELEMENTS   16
+
 enum
 {
   PROP_0,
   PROP_PROFILE,
+  PROP_STREAM_COPY,
+  PROP_PROFILES,
+  PROP_QUEUE_MAX_BUFFERS,
+  PROP_QUEUE_MAX_BYTES,
+  PROP_QUEUE_MAX_TIME,
+  PROP_SETUP_TIME,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_EARLY_CONVERT,
+  PROP_LATENCY_MODE,
+  PROP_MAX_MEMORY,
+  PROP_MEMORY,
+  PROP_PEAK_MEMORY,
+  PROP_STREAM_TYPES,
+  PROP_LANGUAGES,
+  PROP_PRUNE_STREAMS,
+  PROP_START_TIME,
+  PROP_STOP_TIME,
+  PROP_CHECKPOINT_LOCATION,
+  PROP_CHECKPOINT_INTERVAL,
+  PROP_RESUME_POSITION,
+  PROP_RESUME_OFFSET,
+  PROP_TASK_POOL,
+  PROP_POOL_THREADS,
+  PROP_PIN_THREADS,
+  PROP_SHARED_POOL,
+  PROP_POOL_STATS,
+  PROP_SWITCH_LATENCY,
+  PROP_PREVIEW_INTERVAL,
+  PROP_PREVIEW_KEYFRAMES,
+  PROP_PREVIEW_WIDTH,
+  PROP_PREVIEW_FORMAT,
+  PROP_URI,
+  PROP_LOCATION,
+  PROP_SEGMENT_DURATION,
+  PROP_SEGMENT_LOCATION,
+  PROP_TARGET_SPEED,
   PROP_COUNT
 };
 
+enum
+{
+  SIGNAL_SELECT_STREAM,
+  SIGNAL_CHECK_PROFILES,
+  LAST_SIGNAL
+};
+
+static guint transcode_bin_signals[LAST_SIGNAL] = { 0 };
+
+/* What happens to a stream coming out of a demuxer */
+typedef enum
+{
+  SELECT_UNDECIDED,
+  SELECT_KEEP,
+  SELECT_DROP,
+  SELECT_DEFER
+} GstStreamSelection;
+
+/* One extra rendition, behind a src_%d request pad */
+typedef struct _GstTranscodeOutput
+{
+  guint index;
+  GstEncodingProfile *profile;
+  GstElement *ebin;
+  GstPad *srcpad;
+} GstTranscodeOutput;
+
+/* A profile and the encodebin for it, as streaming threads see them */
+typedef struct _GstTranscodeTarget
+{
+  GstEncodingProfile *profile;
+  GstElement *ebin;
+} GstTranscodeTarget;
+
+/* What a profile makes of a particular set of caps. Cached entries hold a
+ * ref on the profile, so one worked out just as the profiles change can't
+ * be mistaken for a decision of a new profile at the same address. */
+typedef struct _GstAutoplugDecision
+{
+  GstEncodingProfile *profile;
+  GstCaps *caps;
+  gboolean stream_copy;
+  gboolean usable;
+} GstAutoplugDecision;
+
+/* Counters for one stream going through one of our queues into an
+ * encodebin. "in" is counted in the decoder's thread as buffers enter the
+ * queue, "out" in the encoder's thread as they leave it. */
+typedef struct _GstTranscodeStream
+{
+  GstTranscodeBin *self;
+  gchar *name;
+  gboolean stream_copy;
+  GstPad *qsink;
+  guint max_buffers;
+  guint max_bytes;
+  /* leaky queues drop buffers that are never counted out, so their level
+   * comes from the queue itself; not referenced, it outlives the stream */
+  GstElement *leaky_queue;
+
+  /* for moving the stream to another encodebin: the queue's src pad, the
+   * encodebin it feeds, its caps and latest segment, and the pad waiting
+   * for it in the new encodebin; protected by the bin's object lock */
+  GstPad *qsrc;
+  GstElement *ebin;
+  GstCaps *caps;
+  GstEvent *segment;
+  gboolean switch_pending;
+  GstPad *switch_sink;
+
+  /* recycles raw video frames between the decoder and the encoder and
+   * counts the copies made on the way; NULL for other streams */
+  GstTranscodeBufferPool *pool;
+
+  /* protected by the bin's mem_lock */
+  guint64 held_bytes;
+  gboolean flushing;
+
+  GMutex *lock;
+  guint64 in_buffers, in_bytes;
+  guint64 out_buffers, out_bytes;
+  GstClockTime first_wall, last_in_wall, last_out_wall;
+  GstClockTime decode_time, encode_time;
+  GstClockTime first_ts, last_ts;
+
+  /* speed control of re-encoded video, also under the stream lock: the
+   * start of the current window and the adjustments made so far */
+  gboolean controlled;
+  GstClockTime ctl_wall, ctl_ts, ctl_encode;
+  gint speed_steps;
+  gint scale_level;
+  gint decimate_level;
+  guint64 decimate_count, dropped;
+} GstTranscodeStream;
+
+/* Reduced decoding asked for by autoplug-continue, picked up by the
+ * element-added handler for the decoder that follows in the same thread */
+typedef struct _GstDecoderHint
+{
+  gint lowres;
+  gint skip_frame;
+} GstDecoderHint;
+
+static GStaticPrivate decoder_hint = G_STATIC_PRIVATE_INIT;
+
+/* The pool of the stream being linked, picked up by the element-added
+ * handler for the encoder that encodebin makes for it in the same thread */
+static GStaticPrivate stream_pool = G_STATIC_PRIVATE_INIT;
+
+static GQuark
+_buffer_pool_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("transcodebin-buffer-pool");
+
+  return quark;
+};
+
+/* When an input buffer with a given timestamp came in */
+typedef struct _GstTranscodeArrival
+{
+  GstClockTime ts;
+  GstClockTime wall;
+} GstTranscodeArrival;
+
+/* Settings that take lookahead and frame reordering out of the encoders
+ * that have them (x264enc, vp8enc) */
+static const struct
+{
+  const gchar *name;
+  const gchar *value;
+} live_encoder_settings[] = {
+  {"tune", "zerolatency"},
+  {"rc-lookahead", "0"},
+  {"bframes", "0"},
+  {"sliced-threads", "true"},
+  {"max-latency", "0"},
+  {"lag-in-frames", "0"},
+  {NULL, NULL}
+};
+
+/* A stream whose selection depends on its language tag. It is exposed
+ * undecoded and held back until its tags or first buffer show up. */
+typedef struct _GstDeferredStream
+{
+  GstTranscodeBin *self;
+  GstPad *pad;
+  gulong buffer_probe;
+  gulong event_probe;
+  GList *events;
+  gchar *language;
+} GstDeferredStream;
+
+/* Encoder properties that trade quality for speed, which way is faster
+ * and the fastest value that still makes sense, if not the property's
+ * own bound */
+static const struct
+{
+  const gchar *name;
+  gint faster;
+  gint limit;
+} encoder_speed_settings[] = {
+  {"speed-preset", -1, 1},
+  {"speed-level", 1, G_MAXINT},
+  {"speed", 1, G_MAXINT},
+  {"cpu-used", 1, G_MAXINT},
+  {NULL, 0, 0}
+};
+
+static GQuark selection_quark = 0;
+static GQuark scale_method_quark = 0;
+
+/* Relative costs for gst_transcode_bin_check_profiles(), in units of
+ * copying one stream; video scales with pixel rate relative to 720p30 */
+#define     COST_COPY           1.0
+#define     COST_AUDIO_DECODE   2.0
+#define     COST_AUDIO_ENCODE   8.0
+#define     COST_VIDEO_DECODE   25.0
+#define     COST_VIDEO_ENCODE   100.0
+#define     REFERENCE_PIXEL_RATE    (1280.0 * 720.0 * 30.0)
+
+/* Where the seek for start-time/stop-time is */
+enum
+{
+  SEEK_NONE,
+  SEEK_SENT,
+  SEEK_DONE,
+  SEEK_FAILED
+};
+
+/* Clipping and rebasing of one decoded (or stream-copied) pad */
+typedef struct _GstClipStream
+{
+  GstTranscodeBin *self;
+  GstPad *pad;
+  gulong buffer_probe;
+  gulong event_probe;
+  gboolean stream_copy;
+  /* protected by the bin's object lock */
+  gboolean seeked;
+  gboolean started;
+  gboolean ended;
+} GstClipStream;
+
+static GstStaticPadTemplate src_request_template =
+GST_STATIC_PAD_TEMPLATE ("src_%d",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate preview_template =
+GST_STATIC_PAD_TEMPLATE ("preview",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("image/jpeg; image/png"));
+
 static void gst_transcode_bin_base_init (gpointer gpkls);
 static void gst_transcode_bin_class_init (GstTranscodeBinClass * kls);
 static void gst_transcode_bin_init (GstTranscodeBin * self,
@@ -42,12 +380,240 @@ static void gst_transcode_bin_set_property (GObject * goself, guint propid,
 static void gst_transcode_bin_get_property (GObject * goself, guint propid,
     GValue * val, GParamSpec * pspec);
 static void gst_transcode_bin_dispose (GObject * goself);
+static void gst_transcode_bin_finalize (GObject * goself);
+static GstPad *gst_transcode_bin_request_new_pad (GstElement * geself,
+    GstPadTemplate * templ, const gchar * name);
+static void gst_transcode_bin_release_pad (GstElement * geself,
+    GstPad * pad);
+static GstStateChangeReturn gst_transcode_bin_change_state (GstElement *
+    geself, GstStateChange transition);
 
+static void _release_encoder_pads (GstTranscodeBin * self, GstElement * ebin);
+
+static gboolean _caps_is_raw (const GstCaps * caps);
+static gboolean _profile_accepts_stream (GstEncodingProfile * prof,
+    const GstCaps * caps);
+static void _clear_decisions (GstTranscodeBin * self);
+static GList *_get_encoders (GstTranscodeBin * self);
+static void _free_encoders (GList * ebins);
+static GstAutoplugDecision _decide (GstTranscodeBin * self,
+    GstEncodingProfile * prof, GstCaps * caps);
+static gboolean _all_profiles_accept_stream (GstTranscodeBin * self,
+    GstCaps * caps);
+static gboolean _link_encoder (GstTranscodeBin * self, GstElement * ebin,
+    GstPad * pad, GstCaps * caps);
+static void _add_stream (GstTranscodeBin * self, GstElement * queue,
+    GstPad * dpad, GstElement * ebin, GstCaps * caps,
+    GstTranscodeBufferPool * pool);
+static void _free_streams (GstTranscodeBin * self);
+static void _add_element (GstTranscodeBin * self, GstElement * element);
+static void _reset_streams (GstTranscodeBin * self);
+static GstPad *_request_preview_pad (GstTranscodeBin * self,
+    GstPadTemplate * templ);
+static gboolean _set_uri (GstTranscodeBin * self, const gchar * uri);
+static void _set_uri_property (GstTranscodeBin * self, const gchar * uri);
+static GstStructure *_build_stats (GstTranscodeBin * self);
+static GstElement *_make_early_convert (GstTranscodeBin * self,
+    GstElement * ebin, GstCaps * caps);
+static gboolean _link_encoder_queued (GstTranscodeBin * self,
+    GstElement * ebin, GstPad * dpad, GstPad * pad, GstCaps * caps);
+static gboolean _fan_out (GstTranscodeBin * self, GList * ebins,
+    GstPad * pad, GstCaps * caps, gboolean preview);
 static gboolean _cast_autoplug_spell (GstTranscodeBin * self, GstPad * pad);
+static void _post_stream_decision (GstTranscodeBin * self, GstPad * pad,
+    gboolean stream_copy);
 static gboolean _dbin_autoplug_continue (GstElement * bin, GstPad * pad,
     GstCaps * caps, gpointer user_data);
 static void _dbin_pad_added (GstElement * bin, GstPad * pad,
     gpointer user_data);
+static void _dbin_element_added (GstBin * bin, GstElement * element,
+    gpointer user_data);
+static void _ebin_element_added (GstBin * bin, GstElement * element,
+    gpointer user_data);
+static void _apply_latency_mode (GstTranscodeBin * self, GstElement * bin);
+static gboolean _is_live (GstTranscodeBin * self);
+static void _configure_queue (GstTranscodeBin * self, GstElement * queue);
+static gboolean _src_query (GstPad * pad, GstQuery * query);
+static gboolean _sink_probe_arrival (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+static gboolean _src_probe_latency (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+static void _record_arrival (GstTranscodeBin * self, GstClockTime ts,
+    GstClockTime wall);
+static void _clear_arrivals (GstTranscodeBin * self);
+static void _apply_memory_budget (GstTranscodeBin * self, GstElement * bin);
+static gboolean _memory_reserve (GstTranscodeBin * self,
+    GstTranscodeStream * stream, guint size);
+static void _memory_release (GstTranscodeBin * self,
+    GstTranscodeStream * stream, guint size);
+static void _memory_set_flushing (GstTranscodeBin * self, gboolean flushing);
+static GstStreamSelection _select_stream (GstTranscodeBin * self,
+    GstPad * pad, GstCaps * caps);
+static GstStreamSelection _pad_selection (GstPad * pad);
+static void _discard_pad (GstTranscodeBin * self, GstPad * pad);
+static void _defer_pad (GstTranscodeBin * self, GstPad * pad);
+static void _free_deferred (GstTranscodeBin * self);
+static gboolean _is_decodebin (GstElement * element);
+static GstClipStream *_add_clip (GstTranscodeBin * self, GstPad * pad,
+    gboolean stream_copy);
+static void _remove_clip (GstTranscodeBin * self, GstClipStream * clip);
+static GstClockTime _rebase (GstClockTime t, GstClockTime start);
+static void _free_clips (GstTranscodeBin * self);
+static void _join_seek_thread (GstTranscodeBin * self);
+static gboolean _src_probe_checkpoint (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+static gboolean _src_probe_segment (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+static gboolean _src_probe_event (GstPad * pad, GstEvent * event,
+    gpointer user_data);
+static void _load_checkpoint (GstTranscodeBin * self);
+static void gst_transcode_bin_handle_message (GstBin * bin,
+    GstMessage * message);
+static void _update_task_pool (GstTranscodeBin * self);
+static void _switch_profile (GstTranscodeBin * self,
+    GstEncodingProfile * prof);
+static gboolean _stream_probe_switch (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+static gboolean _stream_probe_segment (GstPad * pad, GstEvent * event,
+    gpointer user_data);
+static gboolean _stream_probe_switch_event (GstPad * pad, GstEvent * event,
+    gpointer user_data);
+static void _retire_encoders (GstTranscodeBin * self);
+static void _join_retire_thread (GstTranscodeBin * self);
+static gpointer _retire_thread (gpointer user_data);
+static void _remove_retired (GstTranscodeBin * self);
+static void _control_speed (GstTranscodeStream * stream, GstClockTime now);
+static gboolean _stream_probe_decimate (GstPad * pad, GstBuffer * buf,
+    gpointer user_data);
+
+GType
+gst_transcode_latency_mode_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_TRANSCODE_LATENCY_BATCH, "Throughput first", "batch"},
+    {GST_TRANSCODE_LATENCY_LIVE, "Latency first, for live sources", "live"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter ((gsize *) & type)) {
+    GType tmp = g_enum_register_static ("GstTranscodeLatencyMode", values);
+    g_once_init_leave ((gsize *) & type, tmp);
+  }
+
+  return type;
+};
+
+GType
+gst_transcode_preview_format_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_TRANSCODE_PREVIEW_JPEG, "JPEG images", "jpeg"},
+    {GST_TRANSCODE_PREVIEW_PNG, "PNG images", "png"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter ((gsize *) & type)) {
+    GType tmp = g_enum_register_static ("GstTranscodePreviewFormat", values);
+    g_once_init_leave ((gsize *) & type, tmp);
+  }
+
+  return type;
+};
+
+GType
+gst_transcode_stream_type_get_type (void)
+{
+  static GType type = 0;
+  static const GFlagsValue values[] = {
+    {GST_TRANSCODE_STREAM_VIDEO, "Video streams", "video"},
+    {GST_TRANSCODE_STREAM_AUDIO, "Audio streams", "audio"},
+    {GST_TRANSCODE_STREAM_TEXT, "Subtitle streams", "text"},
+    {GST_TRANSCODE_STREAM_OTHER, "Other streams", "other"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter ((gsize *) & type)) {
+    GType tmp = g_flags_register_static ("GstTranscodeStreamType", values);
+    g_once_init_leave ((gsize *) & type, tmp);
+  }
+
+  return type;
+};
+
+/* Stop at the first handler that rejects the stream */
+static gboolean
+_select_accumulator (GSignalInvocationHint * ihint, GValue * return_accu,
+    const GValue * handler_return, gpointer data)
+{
+  gboolean selected = g_value_get_boolean (handler_return);
+
+  g_value_set_boolean (return_accu, selected);
+
+  return selected;
+};
+
+static GstURIType
+gst_transcode_bin_uri_get_type (void)
+{
+  return GST_URI_SRC;
+};
+
+/* Other URIs work through the property, but for those the usual source
+ * elements are just as good */
+static gchar **
+gst_transcode_bin_uri_get_protocols (void)
+{
+  static gchar *protocols[] = { (gchar *) "file", NULL };
+
+  return protocols;
+};
+
+/* Interned, so it stays valid when the URI is changed from another
+ * thread after we've returned it */
+static const gchar *
+gst_transcode_bin_uri_get_uri (GstURIHandler * handler)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (handler);
+  const gchar *uri;
+
+  GST_OBJECT_LOCK (self);
+  uri = g_intern_string (self->uri);
+  GST_OBJECT_UNLOCK (self);
+
+  return uri;
+};
+
+static gboolean
+gst_transcode_bin_uri_set_uri (GstURIHandler * handler, const gchar * uri)
+{
+  return _set_uri (GST_TRANSCODE_BIN (handler), uri);
+};
+
+static void
+gst_transcode_bin_uri_handler_init (gpointer g_iface, gpointer iface_data)
+{
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *) g_iface;
+
+  iface->get_type = gst_transcode_bin_uri_get_type;
+  iface->get_protocols = gst_transcode_bin_uri_get_protocols;
+  iface->get_uri = gst_transcode_bin_uri_get_uri;
+  iface->set_uri = gst_transcode_bin_uri_set_uri;
+};
+
+static void
+_do_init (GType type)
+{
+  static const GInterfaceInfo uri_handler_info = {
+    gst_transcode_bin_uri_handler_init,
+    NULL,
+    NULL
+  };
+
+  g_type_add_interface_static (type, GST_TYPE_URI_HANDLER,
+      &uri_handler_info);
+};
 
 static void
 gst_transcode_bin_base_init (gpointer gpkls)
@@ -59,179 +625,5812 @@ gst_transcode_bin_base_init (gpointer gpkls)
       "Generic/Bin/Transcoder",
       "Convenience transcoding element.\n\nElement capable of taking any input GStreamer can decode and encoding to any profile GStreamer supports without hassle.",
       "David Wendt <dcrkid@yahoo.com>");
+
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&src_request_template));
+  gst_element_class_add_pad_template (elemkls,
+      gst_static_pad_template_get (&preview_template));
 };
 
 static void
 gst_transcode_bin_class_init (GstTranscodeBinClass * kls)
 {
   GObjectClass *gokls = G_OBJECT_CLASS (kls);
+  GstElementClass *elemkls = GST_ELEMENT_CLASS (kls);
+  GstBinClass *binkls = GST_BIN_CLASS (kls);
   gokls->get_property = gst_transcode_bin_get_property;
   gokls->set_property = gst_transcode_bin_set_property;
   gokls->dispose = gst_transcode_bin_dispose;
+  gokls->finalize = gst_transcode_bin_finalize;
+
+  elemkls->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_transcode_bin_request_new_pad);
+  elemkls->release_pad = GST_DEBUG_FUNCPTR (gst_transcode_bin_release_pad);
+  elemkls->change_state = GST_DEBUG_FUNCPTR (gst_transcode_bin_change_state);
+
+  binkls->handle_message = GST_DEBUG_FUNCPTR (gst_transcode_bin_handle_message);
+
+  GST_DEBUG_CATEGORY_INIT (transcode_bin_debug, "transcodebin", 0,
+      "Automatic transcoder");
 
   /* Properties */
 
   /** GstTranscodeBin:profile:
    *
-   * Encoding profile to target. Like #GstEncodeBin, must be set before going
-   * to %GST_STATE_PAUSED or higher.
+   * Encoding profile to target. Unlike with #GstEncodeBin, it can be
+   * changed while running: a second encodebin is set up for the new
+   * profile and each stream moves over to it at its next buffer, or next
+   * keyframe if it's stream-copied, while the old encodebin drains. The
+   * output continues with the new encodebin's once the old one is done
+   * and the old one is then removed. As that restarts the container, both
+   * profiles have to use MPEG-TS or no container at all, and stream-copied
+   * streams must be copyable into the new profile too, or the change is
+   * refused. See #GstTranscodeBin:switch-latency.
    */
   g_object_class_install_property (gokls, PROP_PROFILE,
       gst_param_spec_mini_object ("profile", "profile",
           "The GstEncodingProfile to use", GST_TYPE_ENCODING_PROFILE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
-};
 
-static void
-gst_transcode_bin_init (GstTranscodeBin * self, GstTranscodeBinClass * kls)
-{
-  GstBin *gbself = (GstBin *) self;
-  GstElement *geself = (GstElement *) self;
-  GstPad *isrcpad, *isinkpad;
+  /** GstTranscodeBin:stream-copy:
+   *
+   * Pass elementary streams which already satisfy one of the profile's stream
+   * formats and restrictions straight to the muxer instead of decoding and
+   * re-encoding them. The path chosen for each stream is announced with a
+   * "transcodebin-stream" element message.
+   */
+  g_object_class_install_property (gokls, PROP_STREAM_COPY,
+      g_param_spec_boolean ("stream-copy", "stream copy",
+          "Remux streams already matching the profile instead of re-encoding",
+          DEFAULT_STREAM_COPY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  self->ebin = gst_element_factory_make (ENCODE_BIN, ENCODE_BIN);
-  self->dbin = gst_element_factory_make (DECODE_BIN, DECODE_BIN);
+  /** GstTranscodeBin:profiles:
+   *
+   * Encoding profiles for the "src_\%d" request pads: requesting "src_N"
+   * adds a #GstEncodeBin for the Nth profile, and every decoded stream is
+   * split between all encodebins. Must be set before requesting the pads,
+   * and the pads must be requested before going to %GST_STATE_PAUSED.
+   */
+  g_object_class_install_property (gokls, PROP_PROFILES,
+      g_param_spec_value_array ("profiles", "profiles",
+          "The GstEncodingProfiles to use for the src_%d request pads",
+          gst_param_spec_mini_object ("profile", "profile",
+              "A GstEncodingProfile", GST_TYPE_ENCODING_PROFILE,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  gst_bin_add_many (gbself, self->dbin, self->ebin, NULL);
+  /** GstTranscodeBin:queue-max-size-buffers:
+   *
+   * Every decoded (or stream-copied) stream goes through its own queue
+   * before reaching an encodebin, so decoding and encoding of each stream
+   * run in separate streaming threads. This and the following properties
+   * limit those queues; 0 disables a limit. Applies to streams linked
+   * after the property is set.
+   */
+  g_object_class_install_property (gokls, PROP_QUEUE_MAX_BUFFERS,
+      g_param_spec_uint ("queue-max-size-buffers", "Max. queue size (buffers)",
+          "Max. number of buffers queued per stream (0=disable)",
+          0, G_MAXUINT, DEFAULT_QUEUE_MAX_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  g_signal_connect (self->dbin, "autoplug-continue",
-      G_CALLBACK (_dbin_autoplug_continue), self);
-  g_signal_connect (self->dbin, "pad-added",
-      G_CALLBACK (_dbin_pad_added), self);
+  g_object_class_install_property (gokls, PROP_QUEUE_MAX_BYTES,
+      g_param_spec_uint ("queue-max-size-bytes", "Max. queue size (bytes)",
+          "Max. amount of data queued per stream (bytes, 0=disable)",
+          0, G_MAXUINT, DEFAULT_QUEUE_MAX_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  isrcpad = gst_element_get_static_pad (self->ebin, "src");
-  isinkpad = gst_element_get_static_pad (self->dbin, "sink");
+  g_object_class_install_property (gokls, PROP_QUEUE_MAX_TIME,
+      g_param_spec_uint64 ("queue-max-size-time", "Max. queue size (ns)",
+          "Max. amount of data queued per stream (in ns, 0=disable)",
+          0, G_MAXUINT64, DEFAULT_QUEUE_MAX_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  self->srcpad = gst_ghost_pad_new ("src", isrcpad);
-  self->sinkpad = gst_ghost_pad_new ("sink", isinkpad);
+  /** GstTranscodeBin:setup-time:
+   *
+   * Time spent in autoplugging decisions and linking for the current input,
+   * reset when going to %GST_STATE_PAUSED. Decisions are cached per profile
+   * and caps, and the cache is kept across inputs for as long as the
+   * profiles don't change.
+   */
+  g_object_class_install_property (gokls, PROP_SETUP_TIME,
+      g_param_spec_uint64 ("setup-time", "setup time",
+          "Time spent autoplugging and linking streams (in ns)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-  gst_element_add_pad (geself, self->sinkpad);
-  gst_element_add_pad (geself, self->srcpad);
+  /** GstTranscodeBin:stats:
+   *
+   * Snapshot of per-stream statistics, measured on the queues between
+   * decodebin2 and the encodebins: buffers, bytes and buffers per second
+   * going to the encoder, estimated decode and encode time, queue fill,
+   * position and real-time factor, plus the overall real-time factor and
+   * an ETA when the input duration is known. Raw video streams also have
+   * the frames copied between decoder and encoder ("copies") and the
+   * buffers their pool handed out ("pooled-buffers") and reused
+   * ("recycled-buffers"), and the frames the speed controller dropped
+   * ("dropped-frames").
+   */
+  g_object_class_install_property (gokls, PROP_STATS,
+      g_param_spec_boxed ("stats", "stats", "Transcoding statistics",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-  self->dcaps = NULL;
-  self->reqpads = NULL;
-};
+  /** GstTranscodeBin:stats-interval:
+   *
+   * If non-zero, post the #GstTranscodeBin:stats structure as an element
+   * message at most this often while data flows.
+   */
+  g_object_class_install_property (gokls, PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "stats interval",
+          "Interval between statistics messages (in ns, 0=disable)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-static void
-gst_transcode_bin_set_property (GObject * goself, guint propid,
-    const GValue * val, GParamSpec * pspec)
-{
-  GstTranscodeBin *self = (GstTranscodeBin *) goself;
+  /** GstTranscodeBin:early-convert:
+   *
+   * When the video profile's restriction asks for a smaller size, a lower
+   * frame rate or another format than the decoder produces, drop surplus
+   * frames and convert right after the decoder rather than in encodebin,
+   * using convertscale to convert and scale in one pass where the formats
+   * allow it. Decoders that support it are also asked for reduced
+   * resolution or to skip non-reference frames.
+   */
+  g_object_class_install_property (gokls, PROP_EARLY_CONVERT,
+      g_param_spec_boolean ("early-convert", "early convert",
+          "Decimate and downscale video to the profile restriction early",
+          DEFAULT_EARLY_CONVERT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  switch (propid) {
-    case PROP_PROFILE:{
-      GstEncodingProfile *prof = GST_ENCODING_PROFILE
-          (gst_value_get_mini_object (val));
-      g_object_set (G_OBJECT (self->ebin), "profile", prof, NULL);
-      break;
-    }
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
-      break;
-  }
-};
+  /** GstTranscodeBin:latency-mode:
+   *
+   * In live mode the per-stream queues, decodebin2's and encodebin's queues
+   * are kept short and drop old data when full instead of blocking, and
+   * encoders are set up without lookahead or B-frames unless the profile
+   * names a preset of its own. Latency queries are then answered with the
+   * latency actually measured through the bin when that is higher than
+   * what the elements report, and the measurement shows up in the
+   * statistics.
+   */
+  g_object_class_install_property (gokls, PROP_LATENCY_MODE,
+      g_param_spec_enum ("latency-mode", "latency mode",
+          "Trade throughput for latency", GST_TYPE_TRANSCODE_LATENCY_MODE,
+          DEFAULT_LATENCY_MODE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-static void
-gst_transcode_bin_get_property (GObject * goself, guint propid,
-    GValue * val, GParamSpec * pspec)
-{
-  GstTranscodeBin *self = (GstTranscodeBin *) goself;
+  /** GstTranscodeBin:max-memory:
+   *
+   * Upper bound for the data held in the bin's queues. decodebin2's and
+   * encodebin's own queues each get 1/8th of it, and the per-stream queues
+   * behind the decoders share the whole amount: a stream that would go
+   * over it waits until others have drained, unless its own queue is
+   * empty, so that a muxer waiting for that stream can't deadlock the
+   * bin. Nothing is dropped. Not enforced on the leaky queues of live
+   * mode. 0 means no limit.
+   */
+  g_object_class_install_property (gokls, PROP_MAX_MEMORY,
+      g_param_spec_uint64 ("max-memory", "max memory",
+          "Max. bytes held in the bin's queues (0 = unlimited)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  switch (propid) {
-    case PROP_PROFILE:
-      g_object_get_property (G_OBJECT (self->ebin), "profile", val);
-      break;
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
-      break;
-  }
-};
+  /** GstTranscodeBin:memory:
+   *
+   * Bytes currently held in the per-stream queues.
+   */
+  g_object_class_install_property (gokls, PROP_MEMORY,
+      g_param_spec_uint64 ("memory", "memory",
+          "Bytes currently held in the per-stream queues",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-static void
-gst_transcode_bin_dispose (GObject * goself)
-{
-  GstTranscodeBin *self = GST_TRANSCODE_BIN (goself);
+  /** GstTranscodeBin:peak-memory:
+   *
+   * Most bytes held in the per-stream queues at any time for the current
+   * input, reset when going to %GST_STATE_PAUSED.
+   */
+  g_object_class_install_property (gokls, PROP_PEAK_MEMORY,
+      g_param_spec_uint64 ("peak-memory", "peak memory",
+          "Most bytes held in the per-stream queues for this input",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-  while (self->reqpads != NULL) {
-    GstPad *pad = GST_PAD (self->reqpads->data);
+  /** GstTranscodeBin:stream-types:
+   *
+   * Kinds of demuxed streams to transcode. Others are discarded at the
+   * demuxer, before a decoder is created for them.
+   */
+  g_object_class_install_property (gokls, PROP_STREAM_TYPES,
+      g_param_spec_flags ("stream-types", "stream types",
+          "Kinds of streams to transcode", GST_TYPE_TRANSCODE_STREAM_TYPE,
+          DEFAULT_STREAM_TYPES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-    gst_element_release_request_pad (self->ebin, pad);
-    gst_object_unref (pad);
+  /** GstTranscodeBin:languages:
+   *
+   * Comma separated language codes, as they appear in the streams'
+   * language-code tags. When set, audio and subtitle streams tagged with
+   * another language are discarded; untagged ones are kept. The tags are
+   * only known once the demuxer starts pushing data, so these streams are
+   * exposed undecoded and a decoder is only plugged once they're selected.
+   */
+  g_object_class_install_property (gokls, PROP_LANGUAGES,
+      g_param_spec_string ("languages", "languages",
+          "Comma separated languages of audio and subtitle streams to keep",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-    self->reqpads = g_list_delete_link (self->reqpads, self->reqpads);
-  }
+  /** GstTranscodeBin:prune-streams:
+   *
+   * Discard demuxed streams none of the profiles has a stream profile for
+   * at the demuxer, instead of decoding them and finding that out later.
+   */
+  g_object_class_install_property (gokls, PROP_PRUNE_STREAMS,
+      g_param_spec_boolean ("prune-streams", "prune streams",
+          "Discard streams the profiles have no use for before decoding",
+          DEFAULT_PRUNE_STREAMS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  G_OBJECT_CLASS (parent_class)->dispose (goself);
-};
+  /** GstTranscodeBin:start-time:
+   *
+   * Only transcode the input from this position on. As soon as data starts
+   * coming out of decodebin2, the bin does a flushing, accurate seek to the
+   * range, so only what overlaps it gets demuxed and decoded; until then
+   * nothing reaches the encoders. Output timestamps start at zero.
+   * Stream-copied streams are cut at the first keyframe from this position
+   * on. If the input can't seek, everything is read and what's outside the
+   * range dropped, each stream ending once it is past
+   * #GstTranscodeBin:stop-time. Changes take effect from the next time
+   * the bin goes to PAUSED.
+   */
+  g_object_class_install_property (gokls, PROP_START_TIME,
+      g_param_spec_uint64 ("start-time", "start time",
+          "Input position to start transcoding at (in ns)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-static gboolean
-_cast_autoplug_spell (GstTranscodeBin * self, GstPad * pad)
-{
-  GstPad *encode_sink;
-  gboolean is_request_pad = FALSE;
-  gboolean link_ok;
-  gchar *padname, *decaps, *epadname;
+  /** GstTranscodeBin:stop-time:
+   *
+   * Input position to stop transcoding at, see
+   * #GstTranscodeBin:start-time. -1 transcodes up to the end.
+   */
+  g_object_class_install_property (gokls, PROP_STOP_TIME,
+      g_param_spec_uint64 ("stop-time", "stop time",
+          "Input position to stop transcoding at (in ns, -1 = end)",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  encode_sink = gst_element_get_compatible_pad (self->ebin, pad, NULL);
+  /** GstTranscodeBin:checkpoint-location:
+   *
+   * Journal file for resuming an interrupted transcode. While running, the
+   * output position and byte offset of a keyframe are written to it every
+   * #GstTranscodeBin:checkpoint-interval or more, and it's removed once
+   * the output is complete. Each checkpoint is written an interval late,
+   * once that much more output has been pushed after it, so it has reached
+   * the file unless the sink holds back more than an interval: use an
+   * unbuffered sink (with filesink, "buffer-mode" 2) for low bitrates or
+   * short intervals, and one that syncs to disk to survive a power loss.
+   *
+   * If the file holds a checkpoint when set, the transcode resumes from
+   * there: #GstTranscodeBin:resume-offset says how many bytes of the old
+   * output to keep, and the application truncates the output to that size
+   * and appends to it (with filesink, "append") before going to PAUSED.
+   *
+   * Only works for outputs that need no muxer state to continue, which is
+   * MPEG-TS or a profile without a container; for others the location is
+   * ignored.
+   */
+  g_object_class_install_property (gokls, PROP_CHECKPOINT_LOCATION,
+      g_param_spec_string ("checkpoint-location", "checkpoint location",
+          "Journal file to checkpoint to and resume from", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  if (encode_sink == NULL) {
-    g_signal_emit_by_name (self->ebin, "request-pad", gst_pad_get_caps (pad),
-        &encode_sink, NULL);
-    is_request_pad = TRUE;
-
-    if (encode_sink == NULL) {
-      padname = gst_pad_get_name (pad);
-      decaps = gst_caps_to_string (self->dcaps);
-      GST_DEBUG
-          ("No compatible encodebin pad found for pad '%s' with caps '%s', ignoring...",
-          padname, decaps);
-
-      g_free (padname);
-      g_free (decaps);
-      return FALSE;
-    }
-  }
+  /** GstTranscodeBin:checkpoint-interval:
+   *
+   * Minimum output time between two checkpoints.
+   */
+  g_object_class_install_property (gokls, PROP_CHECKPOINT_INTERVAL,
+      g_param_spec_uint64 ("checkpoint-interval", "checkpoint interval",
+          "Minimum time between checkpoints (in ns)",
+          0, G_MAXUINT64, DEFAULT_CHECKPOINT_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  padname = gst_pad_get_name (pad);
-  decaps = gst_caps_to_string (self->dcaps);
-  epadname = gst_pad_get_name (encode_sink);
+  /** GstTranscodeBin:resume-position:
+   *
+   * Output position the transcode resumes from, or 0 when it starts from
+   * the beginning. Relative to #GstTranscodeBin:start-time.
+   */
+  g_object_class_install_property (gokls, PROP_RESUME_POSITION,
+      g_param_spec_uint64 ("resume-position", "resume position",
+          "Output position resumed from (in ns)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-  GST_DEBUG ("pad '%s' with caps '%s' is compatible with '%s'", padname,
-      decaps, epadname);
+  /** GstTranscodeBin:resume-offset:
+   *
+   * Bytes of the previous output to keep when resuming, see
+   * #GstTranscodeBin:checkpoint-location.
+   */
+  g_object_class_install_property (gokls, PROP_RESUME_OFFSET,
+      g_param_spec_uint64 ("resume-offset", "resume offset",
+          "Size the output is truncated to and appended at (in bytes)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
-  link_ok = (gst_pad_link (pad, encode_sink) == GST_PAD_LINK_OK);
+  /** GstTranscodeBin:task-pool:
+   *
+   * Task pool every streaming thread inside the bin is taken from: those of
+   * decodebin2's and encodebin's queues and elements, and of our own
+   * queues. Any #GstTaskPool will do; several bins may share one. Takes
+   * effect when going to %GST_STATE_PAUSED.
+   */
+  g_object_class_install_property (gokls, PROP_TASK_POOL,
+      g_param_spec_object ("task-pool", "task pool",
+          "Task pool for all streaming threads in the bin",
+          GST_TYPE_TASK_POOL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
-  if (!link_ok && is_request_pad) {
-    gst_element_release_request_pad (self->ebin, encode_sink);
-    gst_object_unref (encode_sink);
-  } else if (is_request_pad) {
-    self->reqpads = g_list_prepend (self->reqpads, encode_sink);
-  }
+  /** GstTranscodeBin:task-pool-threads:
+   *
+   * Without a #GstTranscodeBin:task-pool, give the bin a
+   * #GstTranscodeTaskPool of its own keeping this many threads. 0 leaves
+   * every element to create its own threads.
+   */
+  g_object_class_install_property (gokls, PROP_POOL_THREADS,
+      g_param_spec_uint ("task-pool-threads", "task pool threads",
+          "Threads of the bin's own task pool (0 = no pool)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:pin-threads:
+   *
+   * Pin the threads of the bin's own task pool, or of the shared one, to
+   * CPUs.
+   */
+  g_object_class_install_property (gokls, PROP_PIN_THREADS,
+      g_param_spec_boolean ("pin-threads", "pin threads",
+          "Pin the task pool's threads to CPUs", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:shared-task-pool:
+   *
+   * Without a #GstTranscodeBin:task-pool, use the process-wide pool from
+   * gst_transcode_task_pool_get_shared(), one thread per CPU, so all bins
+   * doing so share their threads. Bins with and without
+   * #GstTranscodeBin:pin-threads get separate shared pools.
+   */
+  g_object_class_install_property (gokls, PROP_SHARED_POOL,
+      g_param_spec_boolean ("shared-task-pool", "shared task pool",
+          "Use the process-wide task pool", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:task-pool-stats:
+   *
+   * Utilization of the task pool in use, if it's a #GstTranscodeTaskPool;
+   * see gst_transcode_task_pool_get_stats().
+   */
+  g_object_class_install_property (gokls, PROP_POOL_STATS,
+      g_param_spec_boxed ("task-pool-stats", "task pool stats",
+          "Utilization of the task pool in use", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:switch-latency:
+   *
+   * Time the latest profile change took, from setting the profile to the
+   * output continuing with the new encodebin. The same figure is posted
+   * in a "transcodebin-profile-switch" element message.
+   */
+  g_object_class_install_property (gokls, PROP_SWITCH_LATENCY,
+      g_param_spec_uint64 ("switch-latency", "switch latency",
+          "Time the latest profile change took (in ns)",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:preview-interval:
+   *
+   * Stream time between the frames taken for the preview pad; 0 takes
+   * every frame that passes #GstTranscodeBin:preview-keyframes. Frames
+   * in between are dropped before they're scaled or encoded.
+   */
+  g_object_class_install_property (gokls, PROP_PREVIEW_INTERVAL,
+      g_param_spec_uint64 ("preview-interval", "preview interval",
+          "Time between preview images (in ns, 0=every frame)",
+          0, G_MAXUINT64, DEFAULT_PREVIEW_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:preview-keyframes:
+   *
+   * Only take frames the decoder didn't mark as delta units, i.e. those
+   * decoded from keyframes, which tend to look best.
+   */
+  g_object_class_install_property (gokls, PROP_PREVIEW_KEYFRAMES,
+      g_param_spec_boolean ("preview-keyframes", "preview keyframes",
+          "Only take keyframes for preview images", DEFAULT_PREVIEW_KEYFRAMES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:preview-width:
+   *
+   * Width of the preview images; the height follows from the aspect
+   * ratio. 0 keeps the decoded size. Applies from the next input on.
+   */
+  g_object_class_install_property (gokls, PROP_PREVIEW_WIDTH,
+      g_param_spec_uint ("preview-width", "preview width",
+          "Width of preview images (0=decoded width)",
+          0, G_MAXINT, DEFAULT_PREVIEW_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:preview-format:
+   *
+   * Image format on the preview pad. Applies from the next input on.
+   */
+  g_object_class_install_property (gokls, PROP_PREVIEW_FORMAT,
+      g_param_spec_enum ("preview-format", "preview format",
+          "Image format of preview images", GST_TYPE_TRANSCODE_PREVIEW_FORMAT,
+          DEFAULT_PREVIEW_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:uri:
+   *
+   * Read the input from this URI instead of the sink pad, which is left
+   * without a target while it's set. file:// URIs of regular files are
+   * read through a memory mapping with #GstMappedFileSrc, others with
+   * whatever source element handles them. Can only be changed in NULL or
+   * READY.
+   */
+  g_object_class_install_property (gokls, PROP_URI,
+      g_param_spec_string ("uri", "uri", "URI to read the input from", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:location:
+   *
+   * Local file to read the input from; the same as setting
+   * #GstTranscodeBin:uri to its file:// URI.
+   */
+  g_object_class_install_property (gokls, PROP_LOCATION,
+      g_param_spec_string ("location", "location",
+          "File to read the input from", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:segment-duration:
+   *
+   * Cut the output into segments of at least this long, each starting at
+   * a keyframe, so they can be delivered while the transcode goes on.
+   * The encoders are asked for a keyframe once a segment is long enough,
+   * so segments run over by about the encoders' delay. Only for MPEG-TS
+   * or container-less profiles, like checkpointing. 0 disables it.
+   */
+  g_object_class_install_property (gokls, PROP_SEGMENT_DURATION,
+      g_param_spec_uint64 ("segment-duration", "segment duration",
+          "Target duration of output segments (in ns, 0=disable)",
+          0, G_MAXUINT64, DEFAULT_SEGMENT_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:segment-location:
+   *
+   * Name of each segment in the messages and the playlist, as a printf
+   * pattern taking the segment index; should match the location of the
+   * multifilesink writing them.
+   */
+  g_object_class_install_property (gokls, PROP_SEGMENT_LOCATION,
+      g_param_spec_string ("segment-location", "segment location",
+          "Segment name pattern for the playlist", DEFAULT_SEGMENT_LOCATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeBin:target-speed:
+   *
+   * Real-time factor every re-encoded video stream should keep up, e.g. 1.0
+   * for live input or 4.0 for a batch deadline. Each stream is measured
+   * every couple of seconds; while it falls short and its encoder is what
+   * holds it back, the encoder is switched to a faster speed setting, then
+   * scaling drops to cheaper methods, then frames are dropped. When the
+   * stream is well ahead again, that is undone in reverse order.
+   *
+   * Encoder settings are only changed when the profile has no preset and
+   * the encoder takes them while playing. Frames are only dropped for
+   * video profiles with variable frame rate and no frame rate restriction,
+   * as encodebin would otherwise fill the gaps back in.
+   *
+   * Every adjustment is posted as a "transcodebin-speed" element message
+   * with the stream, the control changed ("encoder-speed", "scaling" or
+   * "decimation"), its new level, the measured real-time factor and the
+   * target. 0 disables the controller.
+   */
+  g_object_class_install_property (gokls, PROP_TARGET_SPEED,
+      g_param_spec_double ("target-speed", "target speed",
+          "Real-time factor to keep re-encoded video at (0=disable)",
+          0.0, G_MAXDOUBLE, DEFAULT_TARGET_SPEED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /* Signals */
+
+  /** GstTranscodeBin::select-stream:
+   * @bin: the #GstTranscodeBin
+   * @pad: the demuxer's pad, as exposed by decodebin2
+   * @caps: the stream's caps
+   * @index: the stream's position among the demuxed streams of this input
+   *
+   * Emitted for every stream coming out of a demuxer that passed the
+   * stream-types and prune-streams checks. Tags aren't known yet at this
+   * point; use #GstTranscodeBin:languages to select by language.
+   *
+   * Returns: %FALSE to discard the stream without decoding it
+   */
+  transcode_bin_signals[SIGNAL_SELECT_STREAM] =
+      g_signal_new ("select-stream", G_TYPE_FROM_CLASS (kls),
+      G_SIGNAL_RUN_LAST, 0, _select_accumulator, NULL,
+      g_cclosure_marshal_generic, G_TYPE_BOOLEAN, 3, GST_TYPE_PAD,
+      GST_TYPE_CAPS, G_TYPE_UINT);
+
+  /** GstTranscodeBin::check-profiles:
+   * @bin: the #GstTranscodeBin
+   * @streams: caps of the input's streams, one structure per stream
+   * @profiles: a #GValueArray of #GstEncodingProfile
+   *
+   * Action signal for gst_transcode_bin_check_profiles().
+   *
+   * Returns: a "transcodebin-check" #GstStructure
+   */
+  transcode_bin_signals[SIGNAL_CHECK_PROFILES] =
+      g_signal_new_class_handler ("check-profiles", G_TYPE_FROM_CLASS (kls),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_CALLBACK (gst_transcode_bin_check_profiles), NULL, NULL,
+      g_cclosure_marshal_generic, GST_TYPE_STRUCTURE, 2, GST_TYPE_CAPS,
+      G_TYPE_VALUE_ARRAY);
+
+  selection_quark = g_quark_from_static_string ("transcodebin-selection");
+  scale_method_quark =
+      g_quark_from_static_string ("transcodebin-scale-method");
+};
+
+static void
+gst_transcode_bin_init (GstTranscodeBin * self, GstTranscodeBinClass * kls)
+{
+  GstBin *gbself = (GstBin *) self;
+  GstElement *geself = (GstElement *) self;
+  GstPad *isrcpad, *isinkpad;
+
+  self->ebin = gst_element_factory_make (ENCODE_BIN, ENCODE_BIN);
+  self->dbin = gst_element_factory_make (DECODE_BIN, DECODE_BIN);
+
+  gst_bin_add_many (gbself, self->dbin, self->ebin, NULL);
+
+  g_signal_connect (self->dbin, "autoplug-continue",
+      G_CALLBACK (_dbin_autoplug_continue), self);
+  g_signal_connect (self->dbin, "pad-added",
+      G_CALLBACK (_dbin_pad_added), self);
+  g_signal_connect (self->dbin, "element-added",
+      G_CALLBACK (_dbin_element_added), self);
+  g_signal_connect (self->ebin, "element-added",
+      G_CALLBACK (_ebin_element_added), self);
+
+  isrcpad = gst_element_get_static_pad (self->ebin, "src");
+  isinkpad = gst_element_get_static_pad (self->dbin, "sink");
+
+  self->srcpad = gst_ghost_pad_new ("src", isrcpad);
+  self->sinkpad = gst_ghost_pad_new ("sink", isinkpad);
+
+  gst_element_add_pad (geself, self->sinkpad);
+  gst_element_add_pad (geself, self->srcpad);
+
+  self->proxy_query = GST_PAD_QUERYFUNC (self->srcpad);
+  gst_pad_set_query_function (self->srcpad, GST_DEBUG_FUNCPTR (_src_query));
+
+  gst_pad_add_buffer_probe (self->sinkpad, G_CALLBACK (_sink_probe_arrival),
+      self);
+  gst_pad_add_buffer_probe (self->srcpad, G_CALLBACK (_src_probe_latency),
+      self);
+  gst_pad_add_buffer_probe (self->srcpad, G_CALLBACK (_src_probe_checkpoint),
+      self);
+  gst_pad_add_buffer_probe (self->srcpad, G_CALLBACK (_src_probe_segment),
+      self);
+  gst_pad_add_event_probe (self->srcpad, G_CALLBACK (_src_probe_event), self);
+
+  self->reqpads = NULL;
+  self->link_lock = g_mutex_new ();
+
+  self->profile = NULL;
+  self->stream_copy = DEFAULT_STREAM_COPY;
+
+  self->profiles = NULL;
+  self->outputs = NULL;
+
+  self->queue_max_buffers = DEFAULT_QUEUE_MAX_BUFFERS;
+  self->queue_max_bytes = DEFAULT_QUEUE_MAX_BYTES;
+  self->queue_max_time = DEFAULT_QUEUE_MAX_TIME;
+
+  self->decisions = NULL;
+  self->n_decisions = 0;
+  self->setup_time = 0;
+
+  self->streams = NULL;
+  self->stats_interval = 0;
+  self->last_stats_post = 0;
+
+  self->elements = NULL;
+
+  self->early_convert = DEFAULT_EARLY_CONVERT;
+
+  self->latency_mode = DEFAULT_LATENCY_MODE;
+  g_queue_init (&self->arrivals);
+  self->timed_input = FALSE;
+  self->latency = GST_CLOCK_TIME_NONE;
+  self->max_latency = GST_CLOCK_TIME_NONE;
+
+  self->mem_lock = g_mutex_new ();
+  self->mem_cond = g_cond_new ();
+  self->max_memory = 0;
+  self->memory = 0;
+  self->peak_memory = 0;
+  self->mem_flushing = FALSE;
+
+  self->stream_types = DEFAULT_STREAM_TYPES;
+  self->languages = NULL;
+  self->prune_streams = DEFAULT_PRUNE_STREAMS;
+  self->n_demuxed = 0;
+  self->deferred = NULL;
+
+  self->start_time = 0;
+  self->stop_time = GST_CLOCK_TIME_NONE;
+  self->run_start = 0;
+  self->run_stop = GST_CLOCK_TIME_NONE;
+  self->run_base = 0;
+  self->seek_state = SEEK_NONE;
+  self->seek_thread = NULL;
+  self->clips = NULL;
+
+  self->checkpoint_location = NULL;
+  self->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+  self->resume_position = 0;
+  self->resume_offset = 0;
+  self->appendable = FALSE;
+  self->out_offset = 0;
+  self->last_checkpoint = GST_CLOCK_TIME_NONE;
+  self->last_checkpoint_offset = 0;
+
+  self->task_pool = NULL;
+  self->pool_threads = 0;
+  self->pin_threads = FALSE;
+  self->shared_pool = FALSE;
+  self->own_pool = NULL;
+  self->pool = NULL;
+
+  self->old_ebin = NULL;
+  self->n_switching = 0;
+  self->n_switched = 0;
+  self->old_eos_probe = 0;
+  self->switch_timeout = NULL;
+  self->switch_start = GST_CLOCK_TIME_NONE;
+  self->switch_latency = GST_CLOCK_TIME_NONE;
+  self->retired = NULL;
+  self->retire_thread = NULL;
+
+  self->preview_pad = NULL;
+  self->preview_interval = DEFAULT_PREVIEW_INTERVAL;
+  self->preview_keyframes = DEFAULT_PREVIEW_KEYFRAMES;
+  self->preview_width = DEFAULT_PREVIEW_WIDTH;
+  self->preview_format = DEFAULT_PREVIEW_FORMAT;
+  self->preview_linked = FALSE;
+  self->preview_next = GST_CLOCK_TIME_NONE;
+
+  self->uri = NULL;
+  self->source = NULL;
+
+  self->segment_duration = DEFAULT_SEGMENT_DURATION;
+  self->segment_location = g_strdup (DEFAULT_SEGMENT_LOCATION);
+  self->segmenting = FALSE;
+  self->seg_index = 0;
+  self->seg_start = GST_CLOCK_TIME_NONE;
+  self->seg_end = GST_CLOCK_TIME_NONE;
+  self->seg_offset = 0;
+  self->seg_out = 0;
+  self->seg_key_requested = FALSE;
+  self->seg_durations = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  self->target_speed = DEFAULT_TARGET_SPEED;
+};
+
+static void
+gst_transcode_bin_set_property (GObject * goself, guint propid,
+    const GValue * val, GParamSpec * pspec)
+{
+  GstTranscodeBin *self = (GstTranscodeBin *) goself;
+
+  switch (propid) {
+    case PROP_PROFILE:{
+      GstEncodingProfile *prof = GST_ENCODING_PROFILE
+          (gst_value_get_mini_object (val));
+
+      if (prof != NULL && self->profile != NULL
+          && GST_STATE (self) >= GST_STATE_PAUSED) {
+        _switch_profile (self, prof);
+        break;
+      }
+
+      g_object_set (G_OBJECT (self->ebin), "profile", prof, NULL);
+
+      GST_OBJECT_LOCK (self);
+      if (self->profile != NULL)
+        gst_encoding_profile_unref (self->profile);
+      self->profile = prof ?
+          GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof)) : NULL;
+      GST_OBJECT_UNLOCK (self);
+
+      _clear_decisions (self);
+      break;
+    }
+    case PROP_STREAM_COPY:
+      self->stream_copy = g_value_get_boolean (val);
+      break;
+    case PROP_PROFILES:{
+      GValueArray *profiles = g_value_dup_boxed (val), *old_profiles;
+
+      GST_OBJECT_LOCK (self);
+      old_profiles = self->profiles;
+      self->profiles = profiles;
+      GST_OBJECT_UNLOCK (self);
+
+      if (old_profiles != NULL)
+        g_value_array_free (old_profiles);
+      _clear_decisions (self);
+      break;
+    }
+    case PROP_QUEUE_MAX_BUFFERS:
+      self->queue_max_buffers = g_value_get_uint (val);
+      break;
+    case PROP_QUEUE_MAX_BYTES:
+      self->queue_max_bytes = g_value_get_uint (val);
+      break;
+    case PROP_QUEUE_MAX_TIME:
+      self->queue_max_time = g_value_get_uint64 (val);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      self->stats_interval = g_value_get_uint64 (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EARLY_CONVERT:
+      self->early_convert = g_value_get_boolean (val);
+      break;
+    case PROP_LATENCY_MODE:{
+      GList *ebins, *iter;
+
+      GST_OBJECT_LOCK (self);
+      self->latency_mode = g_value_get_enum (val);
+      GST_OBJECT_UNLOCK (self);
+
+      _apply_latency_mode (self, self->dbin);
+      ebins = _get_encoders (self);
+      for (iter = ebins; iter; iter = iter->next)
+        _apply_latency_mode (self, (GstElement *) iter->data);
+      _free_encoders (ebins);
+      break;
+    }
+    case PROP_MAX_MEMORY:{
+      GList *ebins, *iter;
+
+      g_mutex_lock (self->mem_lock);
+      self->max_memory = g_value_get_uint64 (val);
+      g_cond_broadcast (self->mem_cond);
+      g_mutex_unlock (self->mem_lock);
+
+      _apply_memory_budget (self, self->dbin);
+      ebins = _get_encoders (self);
+      for (iter = ebins; iter; iter = iter->next)
+        _apply_memory_budget (self, (GstElement *) iter->data);
+      _free_encoders (ebins);
+      break;
+    }
+    case PROP_STREAM_TYPES:
+      GST_OBJECT_LOCK (self);
+      self->stream_types = g_value_get_flags (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LANGUAGES:
+      GST_OBJECT_LOCK (self);
+      g_free (self->languages);
+      self->languages = g_value_dup_string (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PRUNE_STREAMS:
+      GST_OBJECT_LOCK (self);
+      self->prune_streams = g_value_get_boolean (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      self->start_time = g_value_get_uint64 (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      self->stop_time = g_value_get_uint64 (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHECKPOINT_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->checkpoint_location);
+      self->checkpoint_location = g_value_dup_string (val);
+      GST_OBJECT_UNLOCK (self);
+      _load_checkpoint (self);
+      break;
+    case PROP_CHECKPOINT_INTERVAL:
+      self->checkpoint_interval = g_value_get_uint64 (val);
+      break;
+    case PROP_TASK_POOL:
+      GST_OBJECT_LOCK (self);
+      if (self->task_pool != NULL)
+        gst_object_unref (self->task_pool);
+      self->task_pool = g_value_dup_object (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_POOL_THREADS:
+      GST_OBJECT_LOCK (self);
+      self->pool_threads = g_value_get_uint (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PIN_THREADS:
+      GST_OBJECT_LOCK (self);
+      self->pin_threads = g_value_get_boolean (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SHARED_POOL:
+      GST_OBJECT_LOCK (self);
+      self->shared_pool = g_value_get_boolean (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      self->preview_interval = g_value_get_uint64 (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_KEYFRAMES:
+      GST_OBJECT_LOCK (self);
+      self->preview_keyframes = g_value_get_boolean (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_WIDTH:
+      GST_OBJECT_LOCK (self);
+      self->preview_width = g_value_get_uint (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_FORMAT:
+      GST_OBJECT_LOCK (self);
+      self->preview_format = g_value_get_enum (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_URI:
+      _set_uri_property (self, g_value_get_string (val));
+      break;
+    case PROP_LOCATION:{
+      const gchar *location = g_value_get_string (val);
+      GError *err = NULL;
+      gchar *uri;
+
+      if (location == NULL) {
+        _set_uri_property (self, NULL);
+        break;
+      }
+
+      if (g_path_is_absolute (location)) {
+        uri = g_filename_to_uri (location, NULL, &err);
+      } else {
+        gchar *cwd = g_get_current_dir ();
+        gchar *path = g_build_filename (cwd, location, NULL);
+
+        uri = g_filename_to_uri (path, NULL, &err);
+        g_free (path);
+        g_free (cwd);
+      }
+      if (uri == NULL) {
+        GST_ELEMENT_WARNING (self, RESOURCE, SETTINGS,
+            ("Bad location \"%s\"", location), ("%s", err->message));
+        g_error_free (err);
+        break;
+      }
+      _set_uri_property (self, uri);
+      g_free (uri);
+      break;
+    }
+    case PROP_SEGMENT_DURATION:
+      GST_OBJECT_LOCK (self);
+      self->segment_duration = g_value_get_uint64 (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEGMENT_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_free (self->segment_location);
+      self->segment_location = g_value_dup_string (val);
+      if (self->segment_location == NULL)
+        self->segment_location = g_strdup (DEFAULT_SEGMENT_LOCATION);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TARGET_SPEED:
+      GST_OBJECT_LOCK (self);
+      self->target_speed = g_value_get_double (val);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_transcode_bin_get_property (GObject * goself, guint propid,
+    GValue * val, GParamSpec * pspec)
+{
+  GstTranscodeBin *self = (GstTranscodeBin *) goself;
+
+  switch (propid) {
+    case PROP_PROFILE:{
+      GstElement *ebin;
+
+      GST_OBJECT_LOCK (self);
+      ebin = gst_object_ref (self->ebin);
+      GST_OBJECT_UNLOCK (self);
+
+      g_object_get_property (G_OBJECT (ebin), "profile", val);
+      gst_object_unref (ebin);
+      break;
+    }
+    case PROP_SWITCH_LATENCY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->switch_latency);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STREAM_COPY:
+      g_value_set_boolean (val, self->stream_copy);
+      break;
+    case PROP_PROFILES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boxed (val, self->profiles);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_QUEUE_MAX_BUFFERS:
+      g_value_set_uint (val, self->queue_max_buffers);
+      break;
+    case PROP_QUEUE_MAX_BYTES:
+      g_value_set_uint (val, self->queue_max_bytes);
+      break;
+    case PROP_QUEUE_MAX_TIME:
+      g_value_set_uint64 (val, self->queue_max_time);
+      break;
+    case PROP_SETUP_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->setup_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (val, _build_stats (self));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->stats_interval);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_EARLY_CONVERT:
+      g_value_set_boolean (val, self->early_convert);
+      break;
+    case PROP_LATENCY_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (val, self->latency_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_MAX_MEMORY:
+      g_mutex_lock (self->mem_lock);
+      g_value_set_uint64 (val, self->max_memory);
+      g_mutex_unlock (self->mem_lock);
+      break;
+    case PROP_MEMORY:
+      g_mutex_lock (self->mem_lock);
+      g_value_set_uint64 (val, self->memory);
+      g_mutex_unlock (self->mem_lock);
+      break;
+    case PROP_PEAK_MEMORY:
+      g_mutex_lock (self->mem_lock);
+      g_value_set_uint64 (val, self->peak_memory);
+      g_mutex_unlock (self->mem_lock);
+      break;
+    case PROP_STREAM_TYPES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_flags (val, self->stream_types);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LANGUAGES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (val, self->languages);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PRUNE_STREAMS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (val, self->prune_streams);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_START_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->start_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STOP_TIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->stop_time);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHECKPOINT_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (val, self->checkpoint_location);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHECKPOINT_INTERVAL:
+      g_value_set_uint64 (val, self->checkpoint_interval);
+      break;
+    case PROP_RESUME_POSITION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->resume_position);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_RESUME_OFFSET:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->resume_offset);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TASK_POOL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_object (val, self->task_pool);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_POOL_THREADS:
+      g_value_set_uint (val, self->pool_threads);
+      break;
+    case PROP_PIN_THREADS:
+      g_value_set_boolean (val, self->pin_threads);
+      break;
+    case PROP_SHARED_POOL:
+      g_value_set_boolean (val, self->shared_pool);
+      break;
+    case PROP_POOL_STATS:{
+      GstTaskPool *pool;
+
+      GST_OBJECT_LOCK (self);
+      pool = self->pool ? gst_object_ref (self->pool) : NULL;
+      GST_OBJECT_UNLOCK (self);
+
+      if (pool != NULL && GST_IS_TRANSCODE_TASK_POOL (pool)) {
+        g_value_take_boxed (val,
+            gst_transcode_task_pool_get_stats (GST_TRANSCODE_TASK_POOL
+                (pool)));
+      } else {
+        g_value_set_boxed (val, NULL);
+      }
+
+      if (pool != NULL)
+        gst_object_unref (pool);
+      break;
+    }
+    case PROP_PREVIEW_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->preview_interval);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_KEYFRAMES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (val, self->preview_keyframes);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_WIDTH:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (val, self->preview_width);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PREVIEW_FORMAT:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (val, self->preview_format);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_URI:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (val, self->uri);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (self);
+      if (self->uri != NULL && gst_uri_has_protocol (self->uri, "file"))
+        g_value_take_string (val, g_filename_from_uri (self->uri, NULL, NULL));
+      else
+        g_value_set_string (val, NULL);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEGMENT_DURATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (val, self->segment_duration);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SEGMENT_LOCATION:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (val, self->segment_location);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TARGET_SPEED:
+      GST_OBJECT_LOCK (self);
+      g_value_set_double (val, self->target_speed);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_transcode_bin_dispose (GObject * goself)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (goself);
+
+  _release_encoder_pads (self, NULL);
+
+  /* The encodebins themselves go away with the rest of the bin's children */
+  while (self->outputs != NULL) {
+    GstTranscodeOutput *output = (GstTranscodeOutput *) self->outputs->data;
+
+    gst_encoding_profile_unref (output->profile);
+    g_slice_free (GstTranscodeOutput, output);
+
+    self->outputs = g_list_delete_link (self->outputs, self->outputs);
+  }
+
+  if (self->profile != NULL) {
+    gst_encoding_profile_unref (self->profile);
+    self->profile = NULL;
+  }
+
+  if (self->profiles != NULL) {
+    g_value_array_free (self->profiles);
+    self->profiles = NULL;
+  }
+
+  _clear_decisions (self);
+  _free_streams (self);
+  _clear_arrivals (self);
+  _free_deferred (self);
+  _join_seek_thread (self);
+  _free_clips (self);
+
+  /* like the encodebins, the elements go away with the bin */
+  _join_retire_thread (self);
+  g_list_free (self->elements);
+  self->elements = NULL;
+  g_list_free (self->retired);
+  self->retired = NULL;
+
+  GST_OBJECT_LOCK (self);
+  if (self->pool != NULL)
+    gst_object_unref (self->pool);
+  self->pool = NULL;
+  if (self->task_pool != NULL)
+    gst_object_unref (self->task_pool);
+  self->task_pool = NULL;
+  if (self->own_pool != NULL)
+    gst_object_unref (self->own_pool);
+  self->own_pool = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  G_OBJECT_CLASS (parent_class)->dispose (goself);
+};
+
+static void
+gst_transcode_bin_finalize (GObject * goself)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (goself);
+
+  g_mutex_free (self->mem_lock);
+  g_cond_free (self->mem_cond);
+  g_mutex_free (self->link_lock);
+  g_free (self->languages);
+  g_free (self->checkpoint_location);
+  g_free (self->uri);
+  g_free (self->segment_location);
+  g_array_free (self->seg_durations, TRUE);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+/* The lowest index no src_%d pad has taken yet; call with the object lock
+ * held */
+static guint
+_unused_output_index (GstTranscodeBin * self)
+{
+  guint index = 0;
+  GList *iter = self->outputs;
+
+  while (iter != NULL) {
+    if (((GstTranscodeOutput *) iter->data)->index == index) {
+      index++;
+      iter = self->outputs;
+    } else {
+      iter = iter->next;
+    }
+  }
+
+  return index;
+};
+
+/* Whether a src_%d pad has this index; call with the object lock held */
+static gboolean
+_output_taken (GstTranscodeBin * self, guint index)
+{
+  GList *iter;
+
+  for (iter = self->outputs; iter; iter = iter->next) {
+    if (((GstTranscodeOutput *) iter->data)->index == index)
+      return TRUE;
+  }
+
+  return FALSE;
+};
+
+static GstPad *
+gst_transcode_bin_request_new_pad (GstElement * geself,
+    GstPadTemplate * templ, const gchar * name)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (geself);
+  GstTranscodeOutput *output;
+  GstEncodingProfile *prof = NULL;
+  GstPad *isrcpad;
+  gchar *padname;
+  guint index;
+
+  if (templ == gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS
+          (geself), "preview"))
+    return _request_preview_pad (self, templ);
+
+  GST_OBJECT_LOCK (self);
+  if (name == NULL || sscanf (name, "src_%u", &index) != 1)
+    index = _unused_output_index (self);
+
+  if (_output_taken (self, index)) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Pad src_%u was already requested", index);
+    return NULL;
+  }
+
+  if (self->profiles != NULL && index < self->profiles->n_values)
+    prof = GST_ENCODING_PROFILE (gst_value_get_mini_object
+        (g_value_array_get_nth (self->profiles, index)));
+  if (prof != NULL)
+    prof = GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof));
+  GST_OBJECT_UNLOCK (self);
+
+  if (prof == NULL) {
+    GST_WARNING_OBJECT (self, "No profile set for pad src_%u", index);
+    return NULL;
+  }
+
+  output = g_slice_new0 (GstTranscodeOutput);
+  output->index = index;
+  output->profile = prof;
+  output->ebin = gst_element_factory_make (ENCODE_BIN, NULL);
+
+  if (output->ebin == NULL) {
+    GST_WARNING_OBJECT (self, "Could not create " ENCODE_BIN);
+    gst_encoding_profile_unref (output->profile);
+    g_slice_free (GstTranscodeOutput, output);
+    return NULL;
+  }
+
+  g_object_set (G_OBJECT (output->ebin), "profile", prof, NULL);
+  g_signal_connect (output->ebin, "element-added",
+      G_CALLBACK (_ebin_element_added), self);
+  _apply_latency_mode (self, output->ebin);
+  _apply_memory_budget (self, output->ebin);
+  gst_bin_add (GST_BIN (self), output->ebin);
+
+  padname = g_strdup_printf ("src_%u", index);
+  isrcpad = gst_element_get_static_pad (output->ebin, "src");
+  output->srcpad = gst_ghost_pad_new_from_template (padname, isrcpad, templ);
+  gst_pad_set_query_function (output->srcpad,
+      GST_DEBUG_FUNCPTR (_src_query));
+  gst_object_unref (isrcpad);
+  g_free (padname);
+
+  gst_element_sync_state_with_parent (output->ebin);
+
+  /* Another request for the same pad may have got here first */
+  GST_OBJECT_LOCK (self);
+  if (_output_taken (self, index)) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Pad src_%u was already requested", index);
+    gst_object_unref (output->srcpad);
+    gst_element_set_state (output->ebin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), output->ebin);
+    gst_encoding_profile_unref (output->profile);
+    g_slice_free (GstTranscodeOutput, output);
+    return NULL;
+  }
+  self->outputs = g_list_append (self->outputs, output);
+  GST_OBJECT_UNLOCK (self);
+
+  gst_pad_set_active (output->srcpad, TRUE);
+  gst_element_add_pad (geself, output->srcpad);
+
+  return output->srcpad;
+};
+
+static void
+gst_transcode_bin_release_pad (GstElement * geself, GstPad * pad)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (geself);
+  GstTranscodeOutput *output = NULL;
+  GList *iter;
+
+  GST_OBJECT_LOCK (self);
+  if (pad == self->preview_pad) {
+    self->preview_pad = NULL;
+    GST_OBJECT_UNLOCK (self);
+
+    gst_ghost_pad_set_target (GST_GHOST_PAD (pad), NULL);
+    gst_pad_set_active (pad, FALSE);
+    gst_element_remove_pad (geself, pad);
+    return;
+  }
+
+  for (iter = self->outputs; iter; iter = iter->next) {
+    if (((GstTranscodeOutput *) iter->data)->srcpad == pad) {
+      output = (GstTranscodeOutput *) iter->data;
+      self->outputs = g_list_delete_link (self->outputs, iter);
+      break;
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (output == NULL)
+    return;
+
+  _release_encoder_pads (self, output->ebin);
+  _clear_decisions (self);
+
+  gst_element_set_state (output->ebin, GST_STATE_NULL);
+  gst_pad_set_active (output->srcpad, FALSE);
+  gst_element_remove_pad (geself, output->srcpad);
+  gst_bin_remove (GST_BIN (self), output->ebin);
+
+  gst_encoding_profile_unref (output->profile);
+  g_slice_free (GstTranscodeOutput, output);
+};
+
+static GstElement *
+_make_source (GstTranscodeBin * self, const gchar * uri)
+{
+  GstElement *source;
+  gchar *location;
+
+  if (!gst_uri_has_protocol (uri, "file")) {
+    GstPad *pad;
+
+    source = gst_element_make_from_uri (GST_URI_SRC, uri, NULL);
+    if (source == NULL)
+      return NULL;
+
+    /* Sources that only add their pads later aren't supported */
+    pad = gst_element_get_static_pad (source, "src");
+    if (pad == NULL) {
+      gst_object_unref (source);
+      return NULL;
+    }
+    gst_object_unref (pad);
+
+    return source;
+  }
+
+  location = g_filename_from_uri (uri, NULL, NULL);
+  if (location == NULL)
+    return NULL;
+
+  /* FIFOs, devices and files too big for the address space are read */
+  if (gst_mapped_file_src_can_map (location))
+    source = g_object_new (GST_TYPE_MAPPED_FILE_SRC, "location", location,
+        NULL);
+  else
+    source = gst_element_make_from_uri (GST_URI_SRC, uri, NULL);
+  g_free (location);
+
+  return source;
+};
+
+/* Swap the source in front of decodebin2, or go back to the sink pad
+ * with no URI */
+static gboolean
+_set_uri (GstTranscodeBin * self, const gchar * uri)
+{
+  GstElement *source = NULL, *old;
+  GstPad *dsink, *ssrc;
+
+  if (GST_STATE (self) > GST_STATE_READY) {
+    GST_WARNING_OBJECT (self, "Can't change the input while running");
+    return FALSE;
+  }
+
+  if (uri != NULL) {
+    if (!gst_uri_is_valid (uri)) {
+      GST_WARNING_OBJECT (self, "Invalid URI %s", uri);
+      return FALSE;
+    }
+
+    source = _make_source (self, uri);
+    if (source == NULL) {
+      GST_WARNING_OBJECT (self, "No source element for %s", uri);
+      return FALSE;
+    }
+  }
+
+  GST_OBJECT_LOCK (self);
+  old = self->source;
+  self->source = NULL;
+  g_free (self->uri);
+  self->uri = g_strdup (uri);
+  GST_OBJECT_UNLOCK (self);
+
+  if (old != NULL) {
+    gst_element_set_state (old, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), old);
+  }
+
+  dsink = gst_element_get_static_pad (self->dbin, "sink");
+
+  if (source == NULL) {
+    gst_ghost_pad_set_target (GST_GHOST_PAD (self->sinkpad), dsink);
+  } else {
+    GST_DEBUG_OBJECT (self, "reading from %s with %s", uri,
+        GST_ELEMENT_NAME (source));
+
+    gst_ghost_pad_set_target (GST_GHOST_PAD (self->sinkpad), NULL);
+    gst_bin_add (GST_BIN (self), source);
+
+    ssrc = gst_element_get_static_pad (source, "src");
+    gst_pad_link (ssrc, dsink);
+    gst_pad_add_buffer_probe (ssrc, G_CALLBACK (_sink_probe_arrival), self);
+    gst_object_unref (ssrc);
+
+    gst_element_sync_state_with_parent (source);
+
+    GST_OBJECT_LOCK (self);
+    self->source = source;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  gst_object_unref (dsink);
+
+  return TRUE;
+};
+
+/* Setting the uri or location property has no way to fail, so say so on
+ * the bus */
+static void
+_set_uri_property (GstTranscodeBin * self, const gchar * uri)
+{
+  if (!_set_uri (self, uri)) {
+    GST_ELEMENT_WARNING (self, RESOURCE, SETTINGS,
+        ("Could not change the input to \"%s\"", GST_STR_NULL (uri)),
+        ("The input can only be changed in NULL or READY, to a URI a "
+            "source element handles"));
+  }
+};
+
+/* Only a target-less ghost pad at first; the first decoded video stream
+ * gets linked to it */
+static GstPad *
+_request_preview_pad (GstTranscodeBin * self, GstPadTemplate * templ)
+{
+  GstPad *pad;
+
+  GST_OBJECT_LOCK (self);
+  if (self->preview_pad != NULL) {
+    GST_OBJECT_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Pad preview was already requested");
+    return NULL;
+  }
+
+  pad = gst_ghost_pad_new_no_target_from_template ("preview", templ);
+  self->preview_pad = pad;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_pad_set_active (pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), pad);
+
+  return pad;
+};
+
+static GstStateChangeReturn
+gst_transcode_bin_change_state (GstElement * geself,
+    GstStateChange transition)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (geself);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      GST_OBJECT_LOCK (self);
+      self->setup_time = 0;
+      self->last_stats_post = gst_util_get_timestamp ();
+      self->n_demuxed = 0;
+      /* The output starts from start-time, moved on by a checkpoint being
+       * resumed; its timestamps stay relative to start-time either way */
+      self->run_start = self->start_time + self->resume_position;
+      self->run_stop = self->stop_time;
+      self->run_base = self->start_time;
+      self->seek_state = SEEK_NONE;
+      self->appendable = self->checkpoint_location != NULL
+          && gst_transcode_profile_is_appendable (self->profile);
+      self->out_offset = self->resume_offset;
+      self->last_checkpoint = self->resume_position > 0 ?
+          self->resume_position : GST_CLOCK_TIME_NONE;
+      self->last_checkpoint_offset = 0;
+      self->preview_next = GST_CLOCK_TIME_NONE;
+      if (self->checkpoint_location != NULL && !self->appendable)
+        GST_WARNING_OBJECT (self, "Output can't be appended to, "
+            "not checkpointing");
+      self->segmenting = self->segment_duration > 0
+          && gst_transcode_profile_is_appendable (self->profile);
+      if (self->segment_duration > 0 && !self->segmenting)
+        GST_WARNING_OBJECT (self, "Output can't be cut into segments, "
+            "not segmenting");
+      self->seg_index = 0;
+      self->seg_start = GST_CLOCK_TIME_NONE;
+      self->seg_end = GST_CLOCK_TIME_NONE;
+      self->seg_offset = 0;
+      self->seg_out = 0;
+      self->seg_key_requested = FALSE;
+      g_array_set_size (self->seg_durations, 0);
+      GST_OBJECT_UNLOCK (self);
+      _clear_arrivals (self);
+
+      g_mutex_lock (self->mem_lock);
+      self->peak_memory = self->memory;
+      g_mutex_unlock (self->mem_lock);
+      _memory_set_flushing (self, FALSE);
+      _update_task_pool (self);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* Let go of decoder threads waiting for memory so they can stop */
+      _memory_set_flushing (self, TRUE);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (geself, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      _reset_streams (self);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+};
+
+/* Back in READY, decodebin2 has dropped its decoder chains and pads. Undo
+ * our side of the linking too so the bin can take another input, keeping
+ * decodebin2, the encodebins and the decision cache. */
+static void
+_reset_streams (GstTranscodeBin * self)
+{
+  GList *elements;
+  GstPad *preview;
+
+  _retire_encoders (self);
+  _release_encoder_pads (self, NULL);
+  _free_streams (self);
+  _free_deferred (self);
+  _join_seek_thread (self);
+  _free_clips (self);
+
+  g_mutex_lock (self->mem_lock);
+  self->memory = 0;
+  g_mutex_unlock (self->mem_lock);
+
+  GST_OBJECT_LOCK (self);
+  elements = self->elements;
+  self->elements = NULL;
+  preview = self->preview_pad ? gst_object_ref (self->preview_pad) : NULL;
+  self->preview_linked = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
+  if (preview != NULL) {
+    gst_ghost_pad_set_target (GST_GHOST_PAD (preview), NULL);
+    gst_object_unref (preview);
+  }
+
+  while (elements != NULL) {
+    GstElement *element = GST_ELEMENT (elements->data);
+
+    gst_element_set_state (element, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), element);
+
+    elements = g_list_delete_link (elements, elements);
+  }
+};
+
+static void
+_add_element (GstTranscodeBin * self, GstElement * element)
+{
+  GST_OBJECT_LOCK (self);
+  self->elements = g_list_prepend (self->elements, element);
+  GST_OBJECT_UNLOCK (self);
+};
+
+/* Release the encodebin request pads we linked, either all of them or only
+ * those of one encodebin. */
+static void
+_release_encoder_pads (GstTranscodeBin * self, GstElement * ebin)
+{
+  GList *release = NULL, *iter;
+
+  /* Take them off the list first, releasing happens without the lock */
+  GST_OBJECT_LOCK (self);
+  iter = self->reqpads;
+  while (iter != NULL) {
+    GList *next = iter->next;
+
+    if (ebin == NULL || GST_OBJECT_PARENT (iter->data) == GST_OBJECT (ebin)) {
+      self->reqpads = g_list_remove_link (self->reqpads, iter);
+      release = g_list_concat (iter, release);
+    }
+    iter = next;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  for (iter = release; iter; iter = iter->next) {
+    GstPad *pad = GST_PAD (iter->data);
+    GstElement *parent = gst_pad_get_parent_element (pad);
+
+    if (parent != NULL) {
+      gst_element_release_request_pad (parent, pad);
+      gst_object_unref (parent);
+    }
+    gst_object_unref (pad);
+  }
+  g_list_free (release);
+};
+
+/* Forget a request pad we just linked, and give it back to the encodebin */
+static void
+_release_encoder_pad (GstTranscodeBin * self, GstElement * ebin, GstPad * pad)
+{
+  GList *reqpad;
+
+  GST_OBJECT_LOCK (self);
+  reqpad = g_list_find (self->reqpads, pad);
+  if (reqpad != NULL)
+    self->reqpads = g_list_delete_link (self->reqpads, reqpad);
+  GST_OBJECT_UNLOCK (self);
+
+  if (reqpad != NULL) {
+    gst_element_release_request_pad (ebin, pad);
+    gst_object_unref (pad);
+  }
+};
+
+/* Raw media is what decodebin2 stops at on its own; anything else reaching
+ * the encodebin has been deliberately left encoded. */
+static gboolean
+_caps_is_raw (const GstCaps * caps)
+{
+  const gchar *name;
+
+  if (caps == NULL || gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return FALSE;
+
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  return g_str_has_prefix (name, "video/x-raw")
+      || g_str_has_prefix (name, "audio/x-raw");
+};
+
+static gboolean
+_caps_is_raw_video (const GstCaps * caps)
+{
+  return _caps_is_raw (caps) && g_str_has_prefix (gst_structure_get_name
+      (gst_caps_get_structure (caps, 0)), "video/x-raw");
+};
+
+static gboolean
+_structure_field_fits (GQuark field, const GValue * val, gpointer user_data)
+{
+  const GstStructure *stream = (const GstStructure *) user_data;
+  const GValue *other = gst_structure_id_get_value (stream, field);
+
+  /* Fields the stream doesn't carry can't be checked without decoding, so
+   * only reject on an actual mismatch. */
+  return other == NULL || gst_value_can_intersect (val, other);
+};
+
+/* Restrictions are expressed in raw caps (width, height, rate, channels...),
+ * so compare them field by field against the encoded stream's caps. */
+static gboolean
+_caps_satisfy_restriction (const GstCaps * caps, const GstCaps * restriction)
+{
+  const GstStructure *stream;
+  guint i;
+
+  if (restriction == NULL || gst_caps_is_any (restriction))
+    return TRUE;
+
+  stream = gst_caps_get_structure (caps, 0);
+
+  for (i = 0; i < gst_caps_get_size (restriction); i++) {
+    GstStructure *rs = gst_caps_get_structure (restriction, i);
+
+    if (gst_structure_foreach (rs, _structure_field_fits, (gpointer) stream))
+      return TRUE;
+  }
+
+  return FALSE;
+};
+
+static gboolean
+_stream_profile_accepts (GstEncodingProfile * sprof, const GstCaps * caps)
+{
+  const GstCaps *format = gst_encoding_profile_get_format (sprof);
+
+  if (format == NULL || !gst_caps_can_intersect (caps, format))
+    return FALSE;
+
+  return _caps_satisfy_restriction (caps,
+      gst_encoding_profile_get_restriction (sprof));
+};
+
+typedef gboolean (*GstStreamProfileFunc) (GstEncodingProfile * sprof,
+    gpointer user_data);
+
+/* The first of a profile's stream profiles func picks. A profile without
+ * a container is its own only stream profile. */
+static GstEncodingProfile *
+_find_stream_profile (GstEncodingProfile * prof, GstStreamProfileFunc func,
+    gpointer user_data)
+{
+  const GList *iter;
+
+  if (prof == NULL)
+    return NULL;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (prof))
+    return func (prof, user_data) ? prof : NULL;
+
+  for (iter = gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (prof)); iter; iter = iter->next) {
+    if (func ((GstEncodingProfile *) iter->data, user_data))
+      return (GstEncodingProfile *) iter->data;
+  }
+
+  return NULL;
+};
+
+static gboolean
+_stream_profile_copies (GstEncodingProfile * sprof, gpointer user_data)
+{
+  return _stream_profile_accepts (sprof, (const GstCaps *) user_data);
+};
+
+/* A stream for _stream_profile_matches: stream profiles of its kind match,
+ * and with by_format so do those whose format intersects its caps */
+typedef struct _GstStreamMatch
+{
+  const GstCaps *caps;
+  GstTranscodeStreamType type;
+  gboolean by_format;
+} GstStreamMatch;
+
+static gboolean
+_stream_profile_matches (GstEncodingProfile * sprof, gpointer user_data)
+{
+  GstStreamMatch *match = (GstStreamMatch *) user_data;
+  const GstCaps *format;
+
+  if (GST_IS_ENCODING_VIDEO_PROFILE (sprof)
+      && match->type == GST_TRANSCODE_STREAM_VIDEO)
+    return TRUE;
+  if (GST_IS_ENCODING_AUDIO_PROFILE (sprof)
+      && match->type == GST_TRANSCODE_STREAM_AUDIO)
+    return TRUE;
+  if (!match->by_format)
+    return FALSE;
+
+  format = gst_encoding_profile_get_format (sprof);
+  return format != NULL && gst_caps_can_intersect (match->caps, format);
+};
+
+/* Does any elementary stream of the profile take these encoded caps as-is?
+ * The container format itself is deliberately not considered here, since
+ * decodebin2 also asks about the demuxer's input. */
+static gboolean
+_profile_accepts_stream (GstEncodingProfile * prof, const GstCaps * caps)
+{
+  if (caps == NULL || gst_caps_is_empty (caps) || gst_caps_is_any (caps)
+      || _caps_is_raw (caps))
+    return FALSE;
+
+  return _find_stream_profile (prof, _stream_profile_copies,
+      (gpointer) caps) != NULL;
+};
+
+/* Whether the profile has any stream these caps could end up in, either
+ * as they are or after decoding. Streams it hasn't are never offered to its
+ * encodebin. */
+static gboolean
+_profile_has_stream_for (GstEncodingProfile * prof, const GstCaps * caps)
+{
+  GstStreamMatch match = { caps, GST_TRANSCODE_STREAM_OTHER, TRUE };
+  const gchar *name;
+
+  if (caps == NULL || gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return FALSE;
+
+  /* Encoders only take raw streams */
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (name, "video/x-raw"))
+    match.type = GST_TRANSCODE_STREAM_VIDEO;
+  else if (g_str_has_prefix (name, "audio/x-raw"))
+    match.type = GST_TRANSCODE_STREAM_AUDIO;
+
+  return _find_stream_profile (prof, _stream_profile_matches, &match) != NULL;
+};
+
+static void
+_free_decision (GstAutoplugDecision * d)
+{
+  gst_encoding_profile_unref (d->profile);
+  gst_caps_unref (d->caps);
+  g_slice_free (GstAutoplugDecision, d);
+};
+
+static void
+_clear_decisions (GstTranscodeBin * self)
+{
+  GST_OBJECT_LOCK (self);
+  while (self->decisions != NULL) {
+    _free_decision ((GstAutoplugDecision *) self->decisions->data);
+
+    self->decisions = g_list_delete_link (self->decisions, self->decisions);
+  }
+  self->n_decisions = 0;
+  GST_OBJECT_UNLOCK (self);
+};
+
+/* Look up (or work out and remember) what a profile makes of some caps. The
+ * same few caps come up again and again, both within one input's decoder
+ * chains and across inputs. */
+static GstAutoplugDecision
+_decide (GstTranscodeBin * self, GstEncodingProfile * prof, GstCaps * caps)
+{
+  GstAutoplugDecision result, *d;
+  GList *iter;
+
+  GST_OBJECT_LOCK (self);
+  for (iter = self->decisions; iter; iter = iter->next) {
+    d = (GstAutoplugDecision *) iter->data;
+
+    if (d->profile == prof && gst_caps_is_equal (d->caps, caps)) {
+      result = *d;
+
+      /* keep recently used decisions at the front */
+      if (iter != self->decisions) {
+        self->decisions = g_list_remove_link (self->decisions, iter);
+        self->decisions = g_list_concat (iter, self->decisions);
+      }
+      GST_OBJECT_UNLOCK (self);
+
+      return result;
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  result.profile = prof;
+  result.caps = caps;
+  result.stream_copy = _profile_accepts_stream (prof, caps);
+  result.usable = result.stream_copy || _profile_has_stream_for (prof, caps);
+
+  GST_DEBUG_OBJECT (self, "caps %" GST_PTR_FORMAT ": stream copy %d, "
+      "usable %d", caps, result.stream_copy, result.usable);
+
+  d = g_slice_new (GstAutoplugDecision);
+  *d = result;
+  d->profile = GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof));
+  d->caps = gst_caps_ref (caps);
+
+  GST_OBJECT_LOCK (self);
+  self->decisions = g_list_prepend (self->decisions, d);
+  if (++self->n_decisions > MAX_DECISIONS) {
+    GList *last = g_list_last (self->decisions);
+
+    _free_decision ((GstAutoplugDecision *) last->data);
+    self->decisions = g_list_delete_link (self->decisions, last);
+    self->n_decisions--;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return result;
+};
+
+static GstTranscodeTarget *
+_new_target (GstEncodingProfile * prof, GstElement * ebin)
+{
+  GstTranscodeTarget *target = g_slice_new (GstTranscodeTarget);
+
+  target->profile = GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof));
+  target->ebin = gst_object_ref (ebin);
+
+  return target;
+};
+
+/* The profile in use and every output's, with their encodebins. Taken
+ * under the object lock and reffed, as a profile change or a released
+ * src_%d pad may drop them while a streaming thread is looking. */
+static GList *
+_get_targets (GstTranscodeBin * self)
+{
+  GList *targets = NULL, *iter;
+
+  GST_OBJECT_LOCK (self);
+  for (iter = self->outputs; iter; iter = iter->next) {
+    GstTranscodeOutput *output = (GstTranscodeOutput *) iter->data;
+
+    targets = g_list_prepend (targets,
+        _new_target (output->profile, output->ebin));
+  }
+  targets = g_list_reverse (targets);
+  if (self->profile != NULL)
+    targets = g_list_prepend (targets, _new_target (self->profile,
+            self->ebin));
+  GST_OBJECT_UNLOCK (self);
+
+  return targets;
+};
+
+static void
+_free_targets (GList * targets)
+{
+  while (targets != NULL) {
+    GstTranscodeTarget *target = (GstTranscodeTarget *) targets->data;
+
+    gst_encoding_profile_unref (target->profile);
+    gst_object_unref (target->ebin);
+    g_slice_free (GstTranscodeTarget, target);
+
+    targets = g_list_delete_link (targets, targets);
+  }
+};
+
+/* Every encodebin, with or without a profile yet, reffed under the object
+ * lock for setting them up */
+static GList *
+_get_encoders (GstTranscodeBin * self)
+{
+  GList *ebins = NULL, *iter;
+
+  GST_OBJECT_LOCK (self);
+  for (iter = self->outputs; iter; iter = iter->next) {
+    GstTranscodeOutput *output = (GstTranscodeOutput *) iter->data;
+
+    ebins = g_list_prepend (ebins, gst_object_ref (output->ebin));
+  }
+  if (self->ebin != NULL)
+    ebins = g_list_prepend (ebins, gst_object_ref (self->ebin));
+  GST_OBJECT_UNLOCK (self);
+
+  return ebins;
+};
+
+static void
+_free_encoders (GList * ebins)
+{
+  g_list_foreach (ebins, (GFunc) gst_object_unref, NULL);
+  g_list_free (ebins);
+};
+
+/* Stream copy only makes sense when every rendition can take the stream
+ * as-is, since the decision is taken once per input stream. */
+static gboolean
+_all_profiles_accept_stream (GstTranscodeBin * self, GstCaps * caps)
+{
+  GList *targets = _get_targets (self), *iter;
+  gboolean all = targets != NULL;
+
+  for (iter = targets; iter && all; iter = iter->next) {
+    GstTranscodeTarget *target = (GstTranscodeTarget *) iter->data;
+
+    all = _decide (self, target->profile, caps).stream_copy;
+  }
+  _free_targets (targets);
+
+  return all;
+};
+
+static void
+_post_stream_decision (GstTranscodeBin * self, GstPad * pad,
+    gboolean stream_copy)
+{
+  GstStructure *s;
+  GstCaps *caps;
+  gchar *padname;
+
+  caps = gst_pad_get_negotiated_caps (pad);
+  if (caps == NULL)
+    caps = gst_pad_get_caps (pad);
+  padname = gst_pad_get_name (pad);
+
+  s = gst_structure_new ("transcodebin-stream",
+      "pad", G_TYPE_STRING, padname,
+      "caps", GST_TYPE_CAPS, caps,
+      "stream-copy", G_TYPE_BOOLEAN, stream_copy, NULL);
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self), s));
+
+  gst_caps_unref (caps);
+  g_free (padname);
+};
+
+/* Ask encodebin for a pad by the stream's caps rather than by the caps of
+ * the pad feeding it: a queue or converter in front of it has ANY caps
+ * until its own sink pad is linked, and would match the first template
+ * encodebin has. The pad is remembered for releasing; call with the
+ * link_lock held. */
+static GstPad *
+_request_encoder_pad (GstTranscodeBin * self, GstElement * ebin,
+    GstCaps * caps)
+{
+  GstPad *encode_sink = NULL;
+
+  g_signal_emit_by_name (ebin, "request-pad", caps, &encode_sink, NULL);
+
+  if (encode_sink != NULL) {
+    GST_OBJECT_LOCK (self);
+    self->reqpads = g_list_prepend (self->reqpads,
+        gst_object_ref (encode_sink));
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return encode_sink;
+};
+
+/* Call with the link_lock held, otherwise two streams could be handed the
+ * same free encodebin pad */
+static gboolean
+_link_encoder (GstTranscodeBin * self, GstElement * ebin, GstPad * pad,
+    GstCaps * caps)
+{
+  GstPad *encode_sink;
+  gboolean link_ok;
+
+  encode_sink = _request_encoder_pad (self, ebin, caps);
+
+  if (encode_sink == NULL) {
+    GST_DEBUG_OBJECT (self, "No compatible encodebin pad found for pad "
+        "%s:%s with caps %" GST_PTR_FORMAT ", ignoring...",
+        GST_DEBUG_PAD_NAME (pad), caps);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "pad %s:%s with caps %" GST_PTR_FORMAT
+      " is compatible with %s:%s", GST_DEBUG_PAD_NAME (pad), caps,
+      GST_DEBUG_PAD_NAME (encode_sink));
+
+  link_ok = (gst_pad_link (pad, encode_sink) == GST_PAD_LINK_OK);
+
+  if (!link_ok) {
+    GST_WARNING_OBJECT (self, "Failed to link pad %s:%s to %s:%s",
+        GST_DEBUG_PAD_NAME (pad), GST_DEBUG_PAD_NAME (encode_sink));
+    _release_encoder_pad (self, ebin, encode_sink);
+  }
+  gst_object_unref (encode_sink);
+
+  return link_ok;
+};
+
+static void
+_stream_queue_level (GstTranscodeStream * stream, guint64 * buffers,
+    guint64 * bytes)
+{
+  if (stream->leaky_queue != NULL) {
+    guint level_buffers, level_bytes;
+
+    g_object_get (G_OBJECT (stream->leaky_queue),
+        "current-level-buffers", &level_buffers,
+        "current-level-bytes", &level_bytes, NULL);
+    *buffers = level_buffers;
+    *bytes = level_bytes;
+  } else {
+    *buffers = stream->in_buffers - stream->out_buffers;
+    *bytes = stream->in_bytes - stream->out_bytes;
+  }
+};
+
+static gboolean
+_stream_queue_full (GstTranscodeStream * stream)
+{
+  guint64 buffers, bytes;
+
+  _stream_queue_level (stream, &buffers, &bytes);
+
+  return (stream->max_buffers > 0 && buffers >= stream->max_buffers)
+      || (stream->max_bytes > 0 && bytes >= stream->max_bytes);
+};
+
+static gboolean
+_stream_probe_in (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstClockTime now;
+
+  /* Backpressure: hold the decoder until there's room again */
+  if (stream->leaky_queue == NULL
+      && !_memory_reserve (stream->self, stream, GST_BUFFER_SIZE (buf)))
+    return FALSE;
+
+  now = gst_util_get_timestamp ();
+
+  g_mutex_lock (stream->lock);
+  /* The time since the previous buffer went in was spent decoding, unless
+   * the queue is full and the decoder was just waiting for the encoder. */
+  if (stream->in_buffers == 0)
+    stream->first_wall = now;
+  else if (!_stream_queue_full (stream))
+    stream->decode_time += now - stream->last_in_wall;
+
+  stream->last_in_wall = now;
+  stream->in_buffers++;
+  stream->in_bytes += GST_BUFFER_SIZE (buf);
+  g_mutex_unlock (stream->lock);
+
+  if (stream->pool != NULL)
+    gst_transcode_buffer_pool_mark_decoded (stream->pool, buf);
+
+  /* Without timestamps on the input, decoded frames are the closest */
+  if (GST_BUFFER_TIMESTAMP_IS_VALID (buf)) {
+    gboolean untimed;
+
+    GST_OBJECT_LOCK (stream->self);
+    untimed = stream->self->latency_mode == GST_TRANSCODE_LATENCY_LIVE
+        && !stream->self->timed_input;
+    GST_OBJECT_UNLOCK (stream->self);
+
+    if (untimed)
+      _record_arrival (stream->self, GST_BUFFER_TIMESTAMP (buf), now);
+  }
+
+  return TRUE;
+};
+
+static void
+_maybe_post_stats (GstTranscodeBin * self, GstClockTime now)
+{
+  gboolean post = FALSE;
+
+  if (self->stats_interval == 0)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  if (self->stats_interval > 0
+      && now - self->last_stats_post >= self->stats_interval) {
+    self->last_stats_post = now;
+    post = TRUE;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (post) {
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self), _build_stats (self)));
+  }
+};
+
+static gboolean
+_stream_probe_out (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstClockTime now = gst_util_get_timestamp ();
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  guint64 level_buffers, level_bytes;
+
+  g_mutex_lock (stream->lock);
+  /* With more data still waiting, the encoder side was busy all along.
+   * Our own counters still include the buffer on its way out. */
+  _stream_queue_level (stream, &level_buffers, &level_bytes);
+  if (stream->leaky_queue == NULL)
+    level_buffers--;
+  if (stream->out_buffers > 0 && level_buffers > 0)
+    stream->encode_time += now - stream->last_out_wall;
+
+  stream->last_out_wall = now;
+  stream->out_buffers++;
+  stream->out_bytes += GST_BUFFER_SIZE (buf);
+
+  if (GST_CLOCK_TIME_IS_VALID (ts)) {
+    if (!GST_CLOCK_TIME_IS_VALID (stream->first_ts))
+      stream->first_ts = ts;
+    if (GST_BUFFER_DURATION_IS_VALID (buf))
+      ts += GST_BUFFER_DURATION (buf);
+    if (!GST_CLOCK_TIME_IS_VALID (stream->last_ts) || ts > stream->last_ts)
+      stream->last_ts = ts;
+  }
+  g_mutex_unlock (stream->lock);
+
+  if (stream->leaky_queue == NULL)
+    _memory_release (stream->self, stream, GST_BUFFER_SIZE (buf));
+
+  if (stream->controlled)
+    _control_speed (stream, now);
+
+  _maybe_post_stats (stream->self, now);
+
+  return TRUE;
+};
+
+/* A flushed queue drops what it holds without it ever coming out */
+static gboolean
+_stream_probe_event (GstPad * pad, GstEvent * event, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstTranscodeBin *self = stream->self;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      g_mutex_lock (self->mem_lock);
+      stream->flushing = TRUE;
+      g_cond_broadcast (self->mem_cond);
+      g_mutex_unlock (self->mem_lock);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (self->mem_lock);
+      stream->flushing = FALSE;
+      self->memory -= MIN (self->memory, stream->held_bytes);
+      stream->held_bytes = 0;
+      g_cond_broadcast (self->mem_cond);
+      g_mutex_unlock (self->mem_lock);
+      break;
+    default:
+      break;
+  }
+
+  return TRUE;
+};
+
+static void
+_add_stream (GstTranscodeBin * self, GstElement * queue, GstPad * dpad,
+    GstElement * ebin, GstCaps * caps, GstTranscodeBufferPool * pool)
+{
+  GstTranscodeStream *stream = g_slice_new0 (GstTranscodeStream);
+  GstPad *qsrc;
+
+  stream->self = self;
+  stream->name = g_strdup_printf ("%s:%s", GST_OBJECT_NAME (dpad),
+      GST_OBJECT_NAME (ebin));
+  stream->stream_copy = !_caps_is_raw (caps);
+  stream->qsink = gst_element_get_static_pad (queue, "sink");
+  g_object_get (G_OBJECT (queue), "max-size-buffers", &stream->max_buffers,
+      "max-size-bytes", &stream->max_bytes, NULL);
+  stream->leaky_queue = _is_live (self) ? queue : NULL;
+  stream->lock = g_mutex_new ();
+  stream->first_ts = GST_CLOCK_TIME_NONE;
+  stream->last_ts = GST_CLOCK_TIME_NONE;
+  stream->controlled = _caps_is_raw_video (caps);
+  stream->ctl_wall = GST_CLOCK_TIME_NONE;
+
+  qsrc = gst_element_get_static_pad (queue, "src");
+  stream->qsrc = qsrc;
+  stream->ebin = ebin;
+  stream->caps = gst_caps_ref (caps);
+  stream->segment = NULL;
+  stream->switch_pending = FALSE;
+  stream->pool = pool;
+
+  gst_pad_add_buffer_probe (stream->qsink, G_CALLBACK (_stream_probe_in),
+      stream);
+  gst_pad_add_event_probe (stream->qsink, G_CALLBACK (_stream_probe_event),
+      stream);
+  gst_pad_add_buffer_probe (qsrc, G_CALLBACK (_stream_probe_out), stream);
+  gst_pad_add_buffer_probe (qsrc, G_CALLBACK (_stream_probe_switch), stream);
+  gst_pad_add_event_probe (qsrc, G_CALLBACK (_stream_probe_segment), stream);
+  gst_pad_add_event_probe (qsrc, G_CALLBACK (_stream_probe_switch_event),
+      stream);
+  if (stream->controlled)
+    gst_pad_add_buffer_probe (qsrc, G_CALLBACK (_stream_probe_decimate),
+        stream);
+
+  GST_OBJECT_LOCK (self);
+  self->streams = g_list_append (self->streams, stream);
+  GST_OBJECT_UNLOCK (self);
+};
+
+static void
+_free_streams (GstTranscodeBin * self)
+{
+  GST_OBJECT_LOCK (self);
+  while (self->streams != NULL) {
+    GstTranscodeStream *stream = (GstTranscodeStream *) self->streams->data;
+
+    g_free (stream->name);
+    gst_object_unref (stream->qsink);
+    gst_object_unref (stream->qsrc);
+    gst_caps_unref (stream->caps);
+    if (stream->segment != NULL)
+      gst_event_unref (stream->segment);
+    if (stream->switch_sink != NULL)
+      gst_object_unref (stream->switch_sink);
+    if (stream->pool != NULL) {
+      gst_transcode_buffer_pool_set_flushing (stream->pool, TRUE);
+      gst_object_unref (stream->pool);
+    }
+    g_mutex_free (stream->lock);
+    g_slice_free (GstTranscodeStream, stream);
+
+    self->streams = g_list_delete_link (self->streams, self->streams);
+  }
+  GST_OBJECT_UNLOCK (self);
+};
+
+static GstStructure *
+_build_stats (GstTranscodeBin * self)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstClockTime position = GST_CLOCK_TIME_NONE;
+  GstClockTime eta = GST_CLOCK_TIME_NONE;
+  GstClockTime setup_time, latency, max_latency;
+  guint64 memory, peak_memory;
+  GstFormat fmt = GST_FORMAT_TIME;
+  gint64 duration = -1;
+  gdouble rtf = 0.0;
+  GstPad *qsink = NULL;
+  GValue streams = { 0, };
+  GstStructure *s;
+  GList *iter;
+
+  g_value_init (&streams, GST_TYPE_ARRAY);
+
+  GST_OBJECT_LOCK (self);
+  for (iter = self->streams; iter; iter = iter->next) {
+    GstTranscodeStream *stream = (GstTranscodeStream *) iter->data;
+    GValue v = { 0, };
+    GstStructure *ss;
+    GstClockTime wall = 0, done = 0;
+    gdouble fps = 0.0, srtf = 0.0;
+    guint64 level_buffers, level_bytes;
+
+    g_mutex_lock (stream->lock);
+    _stream_queue_level (stream, &level_buffers, &level_bytes);
+    if (stream->in_buffers > 0)
+      wall = now - stream->first_wall;
+    if (GST_CLOCK_TIME_IS_VALID (stream->last_ts))
+      done = stream->last_ts - stream->first_ts;
+    if (wall > 0) {
+      fps = (gdouble) stream->out_buffers * GST_SECOND / wall;
+      srtf = (gdouble) done / wall;
+    }
+
+    ss = gst_structure_new ("stream",
+        "name", G_TYPE_STRING, stream->name,
+        "stream-copy", G_TYPE_BOOLEAN, stream->stream_copy,
+        "buffers", G_TYPE_UINT64, stream->out_buffers,
+        "bytes", G_TYPE_UINT64, stream->out_bytes,
+        "fps", G_TYPE_DOUBLE, fps,
+        "decode-time", G_TYPE_UINT64, stream->decode_time,
+        "encode-time", G_TYPE_UINT64, stream->encode_time,
+        "queue-buffers", G_TYPE_UINT64, level_buffers,
+        "queue-bytes", G_TYPE_UINT64, level_bytes,
+        "position", G_TYPE_UINT64, stream->last_ts,
+        "real-time-factor", G_TYPE_DOUBLE, srtf, NULL);
+
+    if (stream->pool != NULL) {
+      guint64 allocated, recycled, copies;
+
+      gst_transcode_buffer_pool_get_counts (stream->pool, &allocated,
+          &recycled, &copies);
+      gst_structure_set (ss, "copies", G_TYPE_UINT64, copies,
+          "pooled-buffers", G_TYPE_UINT64, allocated,
+          "recycled-buffers", G_TYPE_UINT64, recycled, NULL);
+    }
+    if (stream->controlled)
+      gst_structure_set (ss, "dropped-frames", G_TYPE_UINT64, stream->dropped,
+          NULL);
+
+    /* The whole transcode is only as far along as its slowest stream */
+    if (GST_CLOCK_TIME_IS_VALID (stream->last_ts)) {
+      if (!GST_CLOCK_TIME_IS_VALID (position) || stream->last_ts < position) {
+        position = stream->last_ts;
+        rtf = srtf;
+      }
+    }
+    g_mutex_unlock (stream->lock);
+
+    if (qsink == NULL)
+      qsink = gst_object_ref (stream->qsink);
+
+    g_value_init (&v, GST_TYPE_STRUCTURE);
+    gst_value_set_structure (&v, ss);
+    gst_value_array_append_value (&streams, &v);
+    g_value_unset (&v);
+    gst_structure_free (ss);
+  }
+  setup_time = self->setup_time;
+  latency = self->latency;
+  max_latency = self->max_latency;
+  GST_OBJECT_UNLOCK (self);
+
+  g_mutex_lock (self->mem_lock);
+  memory = self->memory;
+  peak_memory = self->peak_memory;
+  g_mutex_unlock (self->mem_lock);
+
+  if (qsink != NULL) {
+    if (!gst_pad_query_peer_duration (qsink, &fmt, &duration))
+      duration = -1;
+    gst_object_unref (qsink);
+  }
+
+  if (duration > 0 && GST_CLOCK_TIME_IS_VALID (position) && rtf > 0.0) {
+    eta = (GstClockTime) (MAX (duration - (gint64) position, 0) / rtf);
+  }
+
+  s = gst_structure_new ("transcodebin-stats",
+      "position", G_TYPE_UINT64, position,
+      "duration", G_TYPE_UINT64,
+      duration >= 0 ? (GstClockTime) duration : GST_CLOCK_TIME_NONE,
+      "real-time-factor", G_TYPE_DOUBLE, rtf,
+      "eta", G_TYPE_UINT64, eta,
+      "setup-time", G_TYPE_UINT64, setup_time,
+      "latency", G_TYPE_UINT64, latency,
+      "max-latency", G_TYPE_UINT64, max_latency,
+      "memory", G_TYPE_UINT64, memory,
+      "peak-memory", G_TYPE_UINT64, peak_memory, NULL);
+  gst_structure_set_value (s, "streams", &streams);
+  g_value_unset (&streams);
+
+  return s;
+};
+
+/* Call with the object lock held */
+static GstEncodingProfile *
+_profile_for_encoder (GstTranscodeBin * self, GstElement * ebin)
+{
+  GList *iter;
+
+  if (ebin == self->ebin)
+    return self->profile;
+
+  for (iter = self->outputs; iter; iter = iter->next) {
+    GstTranscodeOutput *output = (GstTranscodeOutput *) iter->data;
+
+    if (output->ebin == ebin)
+      return output->profile;
+  }
+
+  return NULL;
+};
+
+/* The same, for streaming threads: a ref, or NULL */
+static GstEncodingProfile *
+_get_profile_for_encoder (GstTranscodeBin * self, GstElement * ebin)
+{
+  GstEncodingProfile *prof;
+
+  GST_OBJECT_LOCK (self);
+  prof = _profile_for_encoder (self, ebin);
+  if (prof != NULL)
+    gst_encoding_profile_ref (prof);
+  GST_OBJECT_UNLOCK (self);
+
+  return prof;
+};
+
+static GstEncodingProfile *
+_video_profile (GstEncodingProfile * prof)
+{
+  const GList *iter;
+
+  if (prof == NULL)
+    return NULL;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (prof))
+    return GST_IS_ENCODING_VIDEO_PROFILE (prof) ? prof : NULL;
+
+  for (iter = gst_encoding_container_profile_get_profiles
+      (GST_ENCODING_CONTAINER_PROFILE (prof)); iter; iter = iter->next) {
+    if (GST_IS_ENCODING_VIDEO_PROFILE (iter->data))
+      return GST_ENCODING_PROFILE (iter->data);
+  }
+
+  return NULL;
+};
+
+static const GstCaps *
+_video_restriction (GstEncodingProfile * prof)
+{
+  GstEncodingProfile *vprof = _video_profile (prof);
+
+  return vprof ? gst_encoding_profile_get_restriction (vprof) : NULL;
+};
+
+/* The part of a video restriction that is applied early: size and frame
+ * rate, and I420 when the fused converter takes care of the colorspace too.
+ * Otherwise the decoder's own raw format is kept. */
+static GstCaps *
+_early_caps (const GstCaps * restriction, const GstCaps * raw, gboolean fused)
+{
+  static const gchar *fields[] = { "width", "height", "framerate", NULL };
+  const GstStructure *rs;
+  GstStructure *es;
+  GstCaps *early;
+  gboolean any = FALSE;
+  guint i;
+
+  if (restriction == NULL || gst_caps_is_any (restriction)
+      || gst_caps_is_empty (restriction))
+    return NULL;
+
+  rs = gst_caps_get_structure (restriction, 0);
+
+  if (fused) {
+    es = gst_structure_new ("video/x-raw-yuv", "format", GST_TYPE_FOURCC,
+        GST_MAKE_FOURCC ('I', '4', '2', '0'), NULL);
+    any = TRUE;
+  } else {
+    es = gst_structure_empty_new (gst_structure_get_name
+        (gst_caps_get_structure (raw, 0)));
+  }
+
+  for (i = 0; fields[i] != NULL; i++) {
+    const GValue *val = gst_structure_get_value (rs, fields[i]);
+
+    if (val != NULL) {
+      gst_structure_set_value (es, fields[i], val);
+      any = TRUE;
+    }
+  }
+
+  if (!any) {
+    gst_structure_free (es);
+    return NULL;
+  }
+
+  early = gst_caps_new_empty ();
+  gst_caps_append_structure (early, es);
+
+  return early;
+};
+
+/* Whether the convertscale element can do colorspace conversion and scaling
+ * in one go for these caps: it takes the common decoder outputs and only
+ * produces I420, so the restriction has to allow that */
+static gboolean
+_can_fuse (GstElement * convert, const GstCaps * caps,
+    const GstCaps * restriction)
+{
+  GstCaps *i420;
+  GstPad *sink;
+  gboolean ret;
+
+  if (convert == NULL || restriction == NULL)
+    return FALSE;
+
+  sink = gst_element_get_static_pad (convert, "sink");
+  ret = gst_pad_accept_caps (sink, (GstCaps *) caps);
+  gst_object_unref (sink);
+
+  if (ret) {
+    i420 = gst_caps_from_string ("video/x-raw-yuv, format=(fourcc)I420");
+    ret = gst_caps_can_intersect (restriction, i420);
+    gst_caps_unref (i420);
+  }
+
+  return ret;
+};
+
+/* videorate ! convertscale ! capsfilter, so that surplus frames are dropped
+ * before anything else is done with them and the remaining ones are
+ * converted and scaled in a single pass instead of separate colorspace and
+ * videoscale passes. Falls back to videoscale, leaving the colorspace to
+ * encodebin, for formats convertscale can't take. NULL when the stream
+ * already fits or there's nothing to restrict. */
+static GstElement *
+_make_early_convert (GstTranscodeBin * self, GstElement * ebin,
+    GstCaps * caps)
+{
+  GstElement *bin, *rate, *scale, *filter;
+  GstEncodingProfile *prof;
+  const GstCaps *restriction;
+  GstPad *pad;
+  GstCaps *early;
+  gboolean fused;
+
+  if (!self->early_convert || !_caps_is_raw (caps)
+      || !g_str_has_prefix (gst_structure_get_name
+          (gst_caps_get_structure (caps, 0)), "video/"))
+    return NULL;
+
+  prof = _get_profile_for_encoder (self, ebin);
+  restriction = prof ? _video_restriction (prof) : NULL;
+
+  scale = gst_element_factory_make ("convertscale", NULL);
+  fused = _can_fuse (scale, caps, restriction);
+  if (!fused) {
+    if (scale != NULL)
+      gst_object_unref (scale);
+    scale = gst_element_factory_make ("videoscale", NULL);
+  }
+
+  early = _early_caps (restriction, caps, fused);
+  if (prof != NULL)
+    gst_encoding_profile_unref (prof);
+  if (early == NULL || gst_caps_is_subset (caps, early)) {
+    if (early != NULL)
+      gst_caps_unref (early);
+    if (scale != NULL)
+      gst_object_unref (scale);
+    return NULL;
+  }
+
+  rate = gst_element_factory_make ("videorate", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+
+  if (rate == NULL || scale == NULL || filter == NULL) {
+    GST_WARNING_OBJECT (self, "Missing videorate or videoscale, "
+        "leaving conversion to encodebin");
+    if (rate != NULL)
+      gst_object_unref (rate);
+    if (scale != NULL)
+      gst_object_unref (scale);
+    if (filter != NULL)
+      gst_object_unref (filter);
+    gst_caps_unref (early);
+    return NULL;
+  }
+
+  GST_DEBUG_OBJECT (self, "converting %" GST_PTR_FORMAT " to %"
+      GST_PTR_FORMAT " early with %s", caps, early,
+      fused ? "convertscale" : "videoscale");
+
+  g_object_set (G_OBJECT (filter), "caps", early, NULL);
+  gst_caps_unref (early);
+
+  bin = gst_bin_new (NULL);
+  gst_bin_add_many (GST_BIN (bin), rate, scale, filter, NULL);
+  gst_element_link_many (rate, scale, filter, NULL);
+
+  pad = gst_element_get_static_pad (rate, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (filter, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+
+  return bin;
+};
+
+/* Put a queue in front of the encodebin so that the encoder runs in its own
+ * streaming thread instead of the decoder's (or the demuxer's). */
+static gboolean
+_link_encoder_queued (GstTranscodeBin * self, GstElement * ebin,
+    GstPad * dpad, GstPad * pad, GstCaps * caps)
+{
+  GstElement *queue, *early;
+  GstPad *qsink, *qsrc, *epad;
+  GstCaps *ecaps;
+  GstTranscodeBufferPool *pool = NULL;
+  gboolean link_ok;
+
+  queue = gst_element_factory_make ("queue", NULL);
+  if (queue == NULL) {
+    GST_WARNING_OBJECT (self, "Could not create queue, linking directly");
+    g_mutex_lock (self->link_lock);
+    link_ok = _link_encoder (self, ebin, pad, caps);
+    g_mutex_unlock (self->link_lock);
+    return link_ok;
+  }
+
+  /* Linking and adding the stream are one step to a profile change, which
+   * moves every stream of the encodebin it replaces */
+  g_mutex_lock (self->link_lock);
+  GST_OBJECT_LOCK (self);
+  if (ebin == self->old_ebin)
+    ebin = self->ebin;
+  GST_OBJECT_UNLOCK (self);
+
+  _configure_queue (self, queue);
+
+  gst_bin_add (GST_BIN (self), queue);
+
+  qsink = gst_element_get_static_pad (queue, "sink");
+  qsrc = gst_element_get_static_pad (queue, "src");
+
+  /* The early conversion sits behind the queue, in the encoder's thread */
+  early = _make_early_convert (self, ebin, caps);
+  if (early != NULL) {
+    GstPad *esink = gst_element_get_static_pad (early, "sink");
+
+    gst_bin_add (GST_BIN (self), early);
+    gst_pad_link (qsrc, esink);
+    gst_object_unref (esink);
+
+    epad = gst_element_get_static_pad (early, "src");
+    ecaps = gst_pad_get_caps (epad);
+  } else {
+    epad = gst_object_ref (qsrc);
+    ecaps = gst_caps_ref (caps);
+  }
+
+  if (_caps_is_raw_video (caps))
+    pool = gst_transcode_buffer_pool_new (POOL_MAX_FREE);
+
+  g_static_private_set (&stream_pool, pool, NULL);
+  link_ok = _link_encoder (self, ebin, epad, ecaps);
+  g_static_private_set (&stream_pool, NULL, NULL);
+
+  if (link_ok) {
+    if (early != NULL)
+      gst_element_sync_state_with_parent (early);
+    gst_element_sync_state_with_parent (queue);
+    link_ok = (gst_pad_link (pad, qsink) == GST_PAD_LINK_OK);
+
+    /* Don't leave an encodebin pad behind that will never get data */
+    if (!link_ok) {
+      GstPad *encode_sink = gst_pad_get_peer (epad);
+
+      gst_pad_unlink (epad, encode_sink);
+      _release_encoder_pad (self, ebin, encode_sink);
+      gst_object_unref (encode_sink);
+    }
+  }
+
+  gst_object_unref (qsink);
+  gst_object_unref (qsrc);
+  gst_object_unref (epad);
+  gst_caps_unref (ecaps);
+
+  if (!link_ok) {
+    gst_element_set_state (queue, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), queue);
+    if (early != NULL) {
+      gst_element_set_state (early, GST_STATE_NULL);
+      gst_bin_remove (GST_BIN (self), early);
+    }
+    if (pool != NULL) {
+      gst_transcode_buffer_pool_set_flushing (pool, TRUE);
+      gst_object_unref (pool);
+    }
+  } else {
+    _add_element (self, queue);
+    if (early != NULL)
+      _add_element (self, early);
+    _add_stream (self, queue, dpad, ebin, caps, pool);
+  }
+  g_mutex_unlock (self->link_lock);
+
+  return link_ok;
+};
+
+/* Picks the frames for the preview in the decoder's thread, so the ones
+ * left out cost nothing more */
+static gboolean
+_preview_probe (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  gboolean keep;
+
+  GST_OBJECT_LOCK (self);
+  if (self->preview_keyframes
+      && GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    keep = FALSE;
+  } else if (self->preview_interval == 0) {
+    keep = TRUE;
+  } else if (!GST_CLOCK_TIME_IS_VALID (ts)) {
+    /* No telling how far along this is, only take the first one */
+    keep = !GST_CLOCK_TIME_IS_VALID (self->preview_next);
+    if (keep)
+      self->preview_next = 0;
+  } else {
+    keep = !GST_CLOCK_TIME_IS_VALID (self->preview_next)
+        || ts >= self->preview_next;
+    /* On the interval's grid, so skipped keyframes don't shift it */
+    if (keep)
+      self->preview_next = ts - ts % self->preview_interval
+          + self->preview_interval;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return keep;
+};
+
+/* Scaling, conversion and the image encoder, behind a queue that drops
+ * rather than holds up the decoder when the encoder can't keep up */
+static GstElement *
+_make_preview (GstTranscodeBin * self)
+{
+  GstElement *bin, *queue, *scale, *filter, *convert, *enc;
+  GstCaps *caps;
+  GstPad *pad;
+  guint width;
+  gboolean png;
+
+  GST_OBJECT_LOCK (self);
+  width = self->preview_width;
+  png = self->preview_format == GST_TRANSCODE_PREVIEW_PNG;
+  GST_OBJECT_UNLOCK (self);
+
+  queue = gst_element_factory_make ("queue", NULL);
+  scale = gst_element_factory_make ("videoscale", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+  convert = gst_element_factory_make ("ffmpegcolorspace", NULL);
+  enc = gst_element_factory_make (png ? "pngenc" : "jpegenc", NULL);
+
+  if (queue == NULL || scale == NULL || filter == NULL || convert == NULL
+      || enc == NULL) {
+    GST_WARNING_OBJECT (self, "Missing elements for the preview, "
+        "not making any");
+    if (queue != NULL)
+      gst_object_unref (queue);
+    if (scale != NULL)
+      gst_object_unref (scale);
+    if (filter != NULL)
+      gst_object_unref (filter);
+    if (convert != NULL)
+      gst_object_unref (convert);
+    if (enc != NULL)
+      gst_object_unref (enc);
+    return NULL;
+  }
+
+  g_object_set (G_OBJECT (queue), "max-size-buffers", 1,
+      "max-size-bytes", 0, "max-size-time", (guint64) 0, "leaky", 2, NULL);
+
+  /* videoscale works out the height from the aspect ratio */
+  if (width > 0) {
+    caps = gst_caps_new_empty ();
+    gst_caps_append_structure (caps, gst_structure_new ("video/x-raw-yuv",
+            "width", G_TYPE_INT, (gint) width, NULL));
+    gst_caps_append_structure (caps, gst_structure_new ("video/x-raw-rgb",
+            "width", G_TYPE_INT, (gint) width, NULL));
+    g_object_set (G_OBJECT (filter), "caps", caps, NULL);
+    gst_caps_unref (caps);
+  }
+
+  /* pngenc stops after one image otherwise */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (enc), "snapshot"))
+    g_object_set (G_OBJECT (enc), "snapshot", FALSE, NULL);
+
+  bin = gst_bin_new (NULL);
+  gst_bin_add_many (GST_BIN (bin), queue, scale, filter, convert, enc, NULL);
+  gst_element_link_many (queue, scale, filter, convert, enc, NULL);
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (enc, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+
+  return bin;
+};
+
+/* Whether this stream is the one to feed the preview pad */
+static gboolean
+_claim_preview (GstTranscodeBin * self, GstCaps * caps)
+{
+  gboolean claimed = FALSE;
+
+  if (!_caps_is_raw_video (caps))
+    return FALSE;
+
+  GST_OBJECT_LOCK (self);
+  if (self->preview_pad != NULL && !self->preview_linked) {
+    self->preview_linked = TRUE;
+    claimed = TRUE;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return claimed;
+};
+
+static gboolean
+_link_preview (GstTranscodeBin * self, GstElement * tee)
+{
+  GstElement *preview;
+  GstPad *teesrc, *psink, *psrc, *ghost;
+  gboolean link_ok = FALSE;
+
+  preview = _make_preview (self);
+  if (preview == NULL)
+    return FALSE;
+
+  gst_bin_add (GST_BIN (self), preview);
+
+  teesrc = gst_element_get_request_pad (tee, "src%d");
+  psink = gst_element_get_static_pad (preview, "sink");
+  psrc = gst_element_get_static_pad (preview, "src");
+
+  GST_OBJECT_LOCK (self);
+  ghost = self->preview_pad ? gst_object_ref (self->preview_pad) : NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (ghost != NULL && gst_pad_link (teesrc, psink) == GST_PAD_LINK_OK) {
+    gst_pad_add_buffer_probe (teesrc, G_CALLBACK (_preview_probe), self);
+    link_ok = gst_ghost_pad_set_target (GST_GHOST_PAD (ghost), psrc);
+    if (!link_ok)
+      gst_pad_unlink (teesrc, psink);
+  }
+
+  if (link_ok) {
+    gst_element_sync_state_with_parent (preview);
+    _add_element (self, preview);
+  } else {
+    GST_WARNING_OBJECT (self, "Could not link the preview");
+    gst_element_release_request_pad (tee, teesrc);
+    gst_bin_remove (GST_BIN (self), preview);
+  }
+
+  if (ghost != NULL)
+    gst_object_unref (ghost);
+  gst_object_unref (teesrc);
+  gst_object_unref (psink);
+  gst_object_unref (psrc);
+
+  return link_ok;
+};
+
+/* Decode once, encode many: split the decoded stream with a tee so that
+ * each encodebin gets its own branch, plus one for the preview pad when
+ * this stream feeds it. */
+static gboolean
+_fan_out (GstTranscodeBin * self, GList * ebins, GstPad * pad,
+    GstCaps * caps, gboolean preview)
+{
+  GstElement *tee;
+  GstPad *teesink, *allocpad = NULL;
+  gboolean linked = FALSE;
+  GList *iter;
+
+  tee = gst_element_factory_make ("tee", NULL);
+  if (tee == NULL) {
+    GST_WARNING_OBJECT (self, "Could not create tee, can't share streams");
+    return FALSE;
+  }
+
+  gst_bin_add (GST_BIN (self), tee);
+  teesink = gst_element_get_static_pad (tee, "sink");
+
+  if (gst_pad_link (pad, teesink) == GST_PAD_LINK_OK) {
+    for (iter = ebins; iter; iter = iter->next) {
+      GstPad *teesrc = gst_element_get_request_pad (tee, "src%d");
+
+      if (_link_encoder_queued (self, GST_ELEMENT (iter->data), pad, teesrc,
+              caps)) {
+        linked = TRUE;
+        if (allocpad == NULL)
+          allocpad = gst_object_ref (teesrc);
+      } else {
+        gst_element_release_request_pad (tee, teesrc);
+      }
+
+      gst_object_unref (teesrc);
+    }
+
+    if (linked && preview) {
+      /* The decoder should write into the encoder's buffers, not the
+       * preview's, which only gets a frame now and then */
+      if (g_object_class_find_property (G_OBJECT_GET_CLASS (tee),
+              "alloc-pad"))
+        g_object_set (G_OBJECT (tee), "alloc-pad", allocpad, NULL);
+
+      if (!_link_preview (self, tee)) {
+        GST_OBJECT_LOCK (self);
+        self->preview_linked = FALSE;
+        GST_OBJECT_UNLOCK (self);
+      }
+    }
+
+    if (!linked)
+      gst_pad_unlink (pad, teesink);
+  }
+
+  gst_object_unref (teesink);
+  if (allocpad != NULL)
+    gst_object_unref (allocpad);
+
+  if (!linked) {
+    gst_bin_remove (GST_BIN (self), tee);
+    return FALSE;
+  }
+
+  gst_element_sync_state_with_parent (tee);
+  _add_element (self, tee);
+
+  return TRUE;
+};
+
+static gboolean
+_cast_autoplug_spell (GstTranscodeBin * self, GstPad * pad)
+{
+  GList *targets, *ebins = NULL, *iter;
+  gboolean link_ok = FALSE, preview;
+  GstCaps *caps;
+
+  caps = gst_pad_get_caps (pad);
+
+  /* The targets hold the encodebins until we're done linking */
+  targets = _get_targets (self);
+  for (iter = targets; iter; iter = iter->next) {
+    GstTranscodeTarget *target = (GstTranscodeTarget *) iter->data;
+
+    if (_decide (self, target->profile, caps).usable)
+      ebins = g_list_append (ebins, target->ebin);
+  }
+
+  if (ebins == NULL) {
+    GST_DEBUG_OBJECT (self, "No profile has a stream for pad %s:%s, "
+        "ignoring...", GST_DEBUG_PAD_NAME (pad));
+    _free_targets (targets);
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  preview = _claim_preview (self, caps);
+
+  if (ebins->next == NULL && !preview)
+    link_ok = _link_encoder_queued (self, GST_ELEMENT (ebins->data), pad,
+        pad, caps);
+  else
+    link_ok = _fan_out (self, ebins, pad, caps, preview);
+
+  if (preview && !link_ok) {
+    GST_OBJECT_LOCK (self);
+    self->preview_linked = FALSE;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  gst_caps_unref (caps);
+  g_list_free (ebins);
+  _free_targets (targets);
+
+  return link_ok;
+};
+
+/* How much less decoding the restriction allows for encoded video caps:
+ * ffmpeg style "lowres" halvings of the picture size and, when fewer than
+ * a third of the frames are kept, skipping B-frames altogether (for the
+ * common IBBP pattern that still leaves enough frames for videorate). */
+static void
+_decoder_hint_for (GstTranscodeBin * self, GstCaps * caps,
+    GstDecoderHint * hint)
+{
+  GstEncodingProfile *prof = NULL;
+  const GstStructure *cs, *rs;
+  const GstCaps *restriction;
+  gint w, h, rw, rh, n, d, rn, rd;
+
+  hint->lowres = 0;
+  hint->skip_frame = 0;
+
+  if (caps == NULL || gst_caps_get_size (caps) == 0 || _caps_is_raw (caps))
+    return;
+
+  cs = gst_caps_get_structure (caps, 0);
+  if (!g_str_has_prefix (gst_structure_get_name (cs), "video/"))
+    return;
+
+  /* The profile can be changed while running */
+  GST_OBJECT_LOCK (self);
+  if (self->early_convert && self->profile != NULL && self->outputs == NULL)
+    prof = GST_ENCODING_PROFILE (gst_encoding_profile_ref (self->profile));
+  GST_OBJECT_UNLOCK (self);
+
+  if (prof == NULL)
+    return;
+
+  restriction = _video_restriction (prof);
+  if (restriction == NULL || gst_caps_is_any (restriction)
+      || gst_caps_is_empty (restriction)) {
+    gst_encoding_profile_unref (prof);
+    return;
+  }
+  rs = gst_caps_get_structure (restriction, 0);
+
+  if (gst_structure_get_int (cs, "width", &w)
+      && gst_structure_get_int (cs, "height", &h)
+      && gst_structure_get_int (rs, "width", &rw)
+      && gst_structure_get_int (rs, "height", &rh) && rw > 0 && rh > 0) {
+    while (hint->lowres < 2 && w >= rw * 2 && h >= rh * 2) {
+      hint->lowres++;
+      w /= 2;
+      h /= 2;
+    }
+  }
+
+  if (gst_structure_get_fraction (cs, "framerate", &n, &d)
+      && gst_structure_get_fraction (rs, "framerate", &rn, &rd)
+      && n > 0 && d > 0 && rn > 0 && rd > 0) {
+    if ((gint64) rn * d * 3 <= (gint64) n * rd)
+      hint->skip_frame = 1;
+  }
+
+  gst_encoding_profile_unref (prof);
+};
+
+static void
+_add_setup_time (GstTranscodeBin * self, GstClockTime start)
+{
+  GstClockTime spent = gst_util_get_timestamp () - start;
+
+  GST_OBJECT_LOCK (self);
+  self->setup_time += spent;
+  GST_OBJECT_UNLOCK (self);
+};
+
+static gboolean
+_dbin_autoplug_continue (GstElement * bin, GstPad * pad, GstCaps *
+    caps, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime start = gst_util_get_timestamp ();
+  gboolean ret = TRUE;
+
+  /* Unwanted or not yet selected streams stay undecoded; pad-added then
+   * discards or holds them */
+  if (_select_stream (self, pad, caps) != SELECT_KEEP) {
+    _add_setup_time (self, start);
+    return FALSE;
+  }
+
+  /* Stop autoplugging here and let decodebin2 expose the encoded pad; the
+   * actual linking happens in pad-added on the exposed pad. */
+  if (self->stream_copy && _all_profiles_accept_stream (self, caps))
+    ret = FALSE;
+
+  /* A decoder for these caps is likely to be added next, in this thread */
+  if (ret) {
+    GstDecoderHint *hint = g_static_private_get (&decoder_hint);
+
+    if (hint == NULL) {
+      hint = g_new0 (GstDecoderHint, 1);
+      g_static_private_set (&decoder_hint, hint, g_free);
+    }
+    _decoder_hint_for (self, caps, hint);
+  }
+
+  _add_setup_time (self, start);
+
+  return ret;
+};
+
+static void
+_dbin_pad_added (GstElement * bin, GstPad * pad, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime start = gst_util_get_timestamp ();
+  GstClipStream *clip = NULL;
+  GstCaps *caps;
+  gboolean stream_copy, clipped;
+
+  switch (_pad_selection (pad)) {
+    case SELECT_DROP:
+      _discard_pad (self, pad);
+      _add_setup_time (self, start);
+      return;
+    case SELECT_DEFER:
+      _defer_pad (self, pad);
+      _add_setup_time (self, start);
+      return;
+    default:
+      break;
+  }
+
+  caps = gst_pad_get_caps (pad);
+  stream_copy = !_caps_is_raw (caps);
+  gst_caps_unref (caps);
+
+  GST_OBJECT_LOCK (self);
+  clipped = self->run_start > 0 || GST_CLOCK_TIME_IS_VALID (self->run_stop);
+  GST_OBJECT_UNLOCK (self);
+
+  /* In place before anything is linked, so no data gets past unclipped */
+  if (clipped)
+    clip = _add_clip (self, pad, stream_copy);
+
+  if (_cast_autoplug_spell (self, pad))
+    _post_stream_decision (self, pad, stream_copy);
+  else if (clip != NULL)
+    _remove_clip (self, clip);
+
+  _add_setup_time (self, start);
+};
+
+static void
+_dbin_element_added (GstBin * bin, GstElement * element, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstDecoderHint *hint = g_static_private_get (&decoder_hint);
+  GObjectClass *kls = G_OBJECT_GET_CLASS (element);
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (hint == NULL || (hint->lowres == 0 && hint->skip_frame == 0))
+    return;
+
+  /* Parsers can come between the caps and the decoder */
+  if (factory == NULL
+      || strstr (gst_element_factory_get_klass (factory), "Decoder") == NULL)
+    return;
+
+  if (hint->lowres > 0 && g_object_class_find_property (kls, "lowres")) {
+    GST_DEBUG_OBJECT (self, "asking %s for lowres %d",
+        GST_ELEMENT_NAME (element), hint->lowres);
+    g_object_set (G_OBJECT (element), "lowres", hint->lowres, NULL);
+  }
+
+  if (hint->skip_frame > 0
+      && g_object_class_find_property (kls, "skip-frame")) {
+    GST_DEBUG_OBJECT (self, "asking %s to skip B-frames",
+        GST_ELEMENT_NAME (element));
+    g_object_set (G_OBJECT (element), "skip-frame", hint->skip_frame, NULL);
+  }
+
+  /* Only for the first decoder after the caps the hint was made for */
+  hint->lowres = 0;
+  hint->skip_frame = 0;
+};
+
+static guint64
+_live_limit (guint64 value, guint64 cap)
+{
+  return (value == 0 || value > cap) ? cap : value;
+};
+
+/* Whether the bin is in live latency mode; without the object lock */
+static gboolean
+_is_live (GstTranscodeBin * self)
+{
+  gboolean live;
+
+  GST_OBJECT_LOCK (self);
+  live = self->latency_mode == GST_TRANSCODE_LATENCY_LIVE;
+  GST_OBJECT_UNLOCK (self);
+
+  return live;
+};
+
+static void
+_configure_queue (GstTranscodeBin * self, GstElement * queue)
+{
+  if (_is_live (self)) {
+    /* Drop the oldest data rather than hold up a live source */
+    g_object_set (G_OBJECT (queue),
+        "max-size-buffers",
+        (guint) _live_limit (self->queue_max_buffers, LIVE_QUEUE_MAX_BUFFERS),
+        "max-size-bytes", self->queue_max_bytes,
+        "max-size-time",
+        _live_limit (self->queue_max_time, LIVE_QUEUE_MAX_TIME),
+        "leaky", 2, NULL);
+  } else {
+    g_object_set (G_OBJECT (queue),
+        "max-size-buffers", self->queue_max_buffers,
+        "max-size-bytes", self->queue_max_bytes,
+        "max-size-time", self->queue_max_time, NULL);
+  }
+};
+
+/* Set a property if the element has it, to the given value or, without
+ * one, back to its default */
+static void
+_set_if_present (GstElement * element, const gchar * name,
+    const gchar * value)
+{
+  GParamSpec *pspec =
+      g_object_class_find_property (G_OBJECT_GET_CLASS (element), name);
+
+  if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE))
+    return;
+
+  if (value != NULL) {
+    gst_util_set_object_arg (G_OBJECT (element), name, value);
+  } else {
+    GValue val = { 0, };
+
+    g_value_init (&val, G_PARAM_SPEC_VALUE_TYPE (pspec));
+    g_param_value_set_default (pspec, &val);
+    g_object_set_property (G_OBJECT (element), name, &val);
+    g_value_unset (&val);
+  }
+};
+
+/* Size decodebin2's multiqueue and encodebin's queues for the mode */
+static void
+_apply_latency_mode (GstTranscodeBin * self, GstElement * bin)
+{
+  gboolean live = _is_live (self);
+  gchar *buffers = g_strdup_printf ("%u", LIVE_QUEUE_MAX_BUFFERS);
+  gchar *time = g_strdup_printf ("%" G_GUINT64_FORMAT, LIVE_QUEUE_MAX_TIME);
+
+  if (_is_decodebin (bin)) {
+    _set_if_present (bin, "max-size-buffers", live ? buffers : NULL);
+    _set_if_present (bin, "max-size-time", live ? time : NULL);
+  } else {
+    _set_if_present (bin, "queue-buffers-max", live ? buffers : NULL);
+    _set_if_present (bin, "queue-time-max", live ? time : NULL);
+  }
+
+  g_free (buffers);
+  g_free (time);
+};
+
+static gboolean
+_profile_has_preset (GstEncodingProfile * prof)
+{
+  const GList *iter;
+
+  if (prof == NULL)
+    return FALSE;
+
+  if (gst_encoding_profile_get_preset (prof) != NULL)
+    return TRUE;
+
+  if (GST_IS_ENCODING_CONTAINER_PROFILE (prof)) {
+    for (iter = gst_encoding_container_profile_get_profiles
+        (GST_ENCODING_CONTAINER_PROFILE (prof)); iter; iter = iter->next) {
+      if (gst_encoding_profile_get_preset (iter->data) != NULL)
+        return TRUE;
+    }
+  }
+
+  return FALSE;
+};
+
+static GstFlowReturn
+_encoder_buffer_alloc (GstPad * pad, guint64 offset, guint size,
+    GstCaps * caps, GstBuffer ** buf)
+{
+  GstTranscodeBufferPool *pool =
+      g_object_get_qdata (G_OBJECT (pad), _buffer_pool_quark ());
+
+  return gst_transcode_buffer_pool_alloc (pool, offset, size, caps, buf);
+};
+
+static gboolean
+_encoder_probe_copies (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  gst_transcode_buffer_pool_check_encoded (GST_TRANSCODE_BUFFER_POOL
+      (user_data), buf);
+
+  return TRUE;
+};
+
+/* Downstream allocation goes through the queue, the early conversion and
+ * encodebin's ghost pads, and passthrough conversions in encodebin, until
+ * it reaches the encoder, which has nothing to say about it; there the
+ * stream's pool answers instead, so that the decoder writes into buffers
+ * that are recycled after encoding. Frames that arrive elsewhere than the
+ * decoder wrote them were copied. */
+static void
+_attach_buffer_pool (GstTranscodeBin * self, GstElement * encoder,
+    GstTranscodeBufferPool * pool)
+{
+  GstPad *sink = gst_element_get_static_pad (encoder, "sink");
+
+  if (sink == NULL)
+    return;
+
+  if (GST_PAD_BUFFERALLOCFUNC (sink) == NULL) {
+    GST_DEBUG_OBJECT (self, "allocating for %s", GST_ELEMENT_NAME (encoder));
+    g_object_set_qdata_full (G_OBJECT (sink), _buffer_pool_quark (),
+        gst_object_ref (pool), gst_object_unref);
+    gst_pad_set_bufferalloc_function (sink, _encoder_buffer_alloc);
+  }
+
+  gst_pad_add_buffer_probe_full (sink, G_CALLBACK (_encoder_probe_copies),
+      gst_object_ref (pool), gst_object_unref);
+
+  gst_object_unref (sink);
+};
+
+/* encodebin adds its encoders itself; in live mode take their lookahead
+ * away, unless the profile asks for a preset, which then wins */
+static void
+_ebin_element_added (GstBin * bin, GstElement * element, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstElementFactory *factory = gst_element_get_factory (element);
+  GstTranscodeBufferPool *pool = g_static_private_get (&stream_pool);
+  GstEncodingProfile *prof;
+  gboolean preset;
+  guint i;
+
+  if (factory == NULL
+      || strstr (gst_element_factory_get_klass (factory), "Encoder") == NULL)
+    return;
+
+  if (pool != NULL)
+    _attach_buffer_pool (self, element, pool);
+
+  if (!_is_live (self))
+    return;
+
+  prof = _get_profile_for_encoder (self, GST_ELEMENT (bin));
+  preset = _profile_has_preset (prof);
+  if (prof != NULL)
+    gst_encoding_profile_unref (prof);
+
+  if (preset) {
+    GST_DEBUG_OBJECT (self, "profile has a preset, not tuning %s",
+        GST_ELEMENT_NAME (element));
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "tuning %s for low latency",
+      GST_ELEMENT_NAME (element));
+
+  for (i = 0; live_encoder_settings[i].name != NULL; i++) {
+    _set_if_present (element, live_encoder_settings[i].name,
+        live_encoder_settings[i].value);
+  }
+};
+
+/* The encoder at the end of a stream's path, through the early conversion
+ * and encodebin; the videoscales on the way are added to @scalers */
+static GstElement *
+_stream_encoder (GstTranscodeStream * stream, GList ** scalers)
+{
+  GstPad *src = gst_object_ref (stream->qsrc);
+  GstElement *encoder = NULL;
+  guint i;
+
+  for (i = 0; src != NULL && i < MAX_PATH_ELEMENTS; i++) {
+    GstPad *peer = gst_pad_get_peer (src);
+    GstElementFactory *factory;
+    GstElement *element;
+    GstObject *parent;
+
+    gst_object_unref (src);
+    src = NULL;
+
+    /* Into a bin, on to whatever its ghost pad leads to */
+    while (peer != NULL && GST_IS_GHOST_PAD (peer)) {
+      GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (peer));
+
+      gst_object_unref (peer);
+      peer = target;
+    }
+    if (peer == NULL)
+      break;
+
+    parent = gst_object_get_parent (GST_OBJECT (peer));
+    gst_object_unref (peer);
+    if (parent == NULL)
+      break;
+
+    /* Out of a bin, the internal pad belongs to its ghost pad */
+    if (GST_IS_PAD (parent)) {
+      src = GST_PAD (parent);
+      continue;
+    }
+
+    element = GST_ELEMENT (parent);
+    factory = gst_element_get_factory (element);
+    if (factory != NULL
+        && strstr (gst_element_factory_get_klass (factory), "Encoder")) {
+      encoder = element;
+      break;
+    }
+    if (factory != NULL
+        && strcmp (GST_PLUGIN_FEATURE_NAME (factory), "videoscale") == 0)
+      *scalers = g_list_prepend (*scalers, gst_object_ref (element));
+
+    src = gst_element_get_static_pad (element, "src");
+    gst_object_unref (element);
+  }
+
+  if (src != NULL)
+    gst_object_unref (src);
+
+  return encoder;
+};
+
+/* Move the encoder one setting towards faster (or back, for a negative
+ * @direction), on the first speed property it has and takes while
+ * playing; most only read theirs when they start */
+static gboolean
+_step_encoder_speed (GstElement * encoder, gint direction)
+{
+  guint i;
+
+  for (i = 0; encoder_speed_settings[i].name != NULL; i++) {
+    GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS
+        (encoder), encoder_speed_settings[i].name);
+    gint step = direction * encoder_speed_settings[i].faster;
+    gint limit = encoder_speed_settings[i].limit;
+    GValue val = { 0, };
+    gint value, min, max;
+    gboolean ok;
+
+    if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE)
+        || !(pspec->flags & GST_PARAM_MUTABLE_PLAYING))
+      continue;
+
+    g_value_init (&val, G_PARAM_SPEC_VALUE_TYPE (pspec));
+    g_object_get_property (G_OBJECT (encoder), pspec->name, &val);
+
+    if (G_IS_PARAM_SPEC_ENUM (pspec)) {
+      GEnumClass *eclass = G_PARAM_SPEC_ENUM (pspec)->enum_class;
+
+      value = g_value_get_enum (&val);
+      min = eclass->minimum;
+      max = eclass->maximum;
+    } else if (G_IS_PARAM_SPEC_INT (pspec)) {
+      value = g_value_get_int (&val);
+      min = G_PARAM_SPEC_INT (pspec)->minimum;
+      max = G_PARAM_SPEC_INT (pspec)->maximum;
+    } else if (G_IS_PARAM_SPEC_UINT (pspec)) {
+      value = (gint) MIN (g_value_get_uint (&val), G_MAXINT);
+      min = (gint) MIN (G_PARAM_SPEC_UINT (pspec)->minimum, G_MAXINT);
+      max = (gint) MIN (G_PARAM_SPEC_UINT (pspec)->maximum, G_MAXINT);
+    } else {
+      g_value_unset (&val);
+      continue;
+    }
+
+    /* The limit only bounds the faster end */
+    if (encoder_speed_settings[i].faster < 0)
+      min = MAX (min, limit);
+    else
+      max = MIN (max, limit);
+
+    value += step;
+    ok = value >= min && value <= max;
+    if (ok && G_IS_PARAM_SPEC_ENUM (pspec))
+      ok = g_enum_get_value (G_PARAM_SPEC_ENUM (pspec)->enum_class,
+          value) != NULL;
+
+    if (ok) {
+      if (G_IS_PARAM_SPEC_ENUM (pspec))
+        g_value_set_enum (&val, value);
+      else if (G_IS_PARAM_SPEC_INT (pspec))
+        g_value_set_int (&val, value);
+      else
+        g_value_set_uint (&val, value);
+
+      GST_DEBUG_OBJECT (encoder, "%s now %d", pspec->name, value);
+      g_object_set_property (G_OBJECT (encoder), pspec->name, &val);
+    }
+    g_value_unset (&val);
+
+    return ok;
+  }
+
+  return FALSE;
+};
+
+/* Take every videoscale @level methods down from the one it was set up
+ * with, which is remembered the first time */
+static void
+_set_scale_level (GList * scalers, gint level)
+{
+  GList *iter;
+
+  for (iter = scalers; iter; iter = iter->next) {
+    GObject *scale = G_OBJECT (iter->data);
+    gpointer orig = g_object_get_qdata (scale, scale_method_quark);
+    gint method;
+
+    if (orig == NULL) {
+      g_object_get (scale, "method", &method, NULL);
+      g_object_set_qdata (scale, scale_method_quark,
+          GINT_TO_POINTER (method + 1));
+    } else {
+      method = GPOINTER_TO_INT (orig) - 1;
+    }
+
+    g_object_set (scale, "method", MAX (method - level, 0), NULL);
+  }
+};
+
+/* encodebin only leaves dropped frames out for variable frame rate, and
+ * the early conversion fills them in for a frame rate restriction */
+static gboolean
+_can_decimate (GstEncodingProfile * prof)
+{
+  GstEncodingProfile *vprof = _video_profile (prof);
+  const GstCaps *restriction;
+  guint i;
+
+  if (vprof == NULL || !gst_encoding_video_profile_get_variableframerate
+      (GST_ENCODING_VIDEO_PROFILE (vprof)))
+    return FALSE;
+
+  restriction = gst_encoding_profile_get_restriction (vprof);
+  if (restriction == NULL)
+    return TRUE;
+
+  for (i = 0; i < gst_caps_get_size (restriction); i++) {
+    if (gst_structure_has_field (gst_caps_get_structure (restriction, i),
+            "framerate"))
+      return FALSE;
+  }
+
+  return TRUE;
+};
+
+/* Hold a re-encoded video stream to the target speed, in its encoder's
+ * thread. Once per window, the media time that got through is compared
+ * to the wall time spent; short of the target, with the encoder busy,
+ * one thing is made cheaper: the encoder's speed setting, then scaling,
+ * then the frame rate. Well ahead of it, the last of those is undone. */
+static void
+_control_speed (GstTranscodeStream * stream, GstClockTime now)
+{
+  GstTranscodeBin *self = stream->self;
+  GstEncodingProfile *prof;
+  GstElement *encoder;
+  GList *scalers = NULL;
+  const gchar *control = NULL;
+  gdouble target, speed, busy;
+  gboolean faster, tune_encoder, decimate;
+  gint level = 0;
+
+  g_mutex_lock (stream->lock);
+  if (!GST_CLOCK_TIME_IS_VALID (stream->ctl_wall)
+      || !GST_CLOCK_TIME_IS_VALID (stream->ctl_ts)) {
+    stream->ctl_wall = now;
+    stream->ctl_ts = stream->last_ts;
+    stream->ctl_encode = stream->encode_time;
+    g_mutex_unlock (stream->lock);
+    return;
+  }
+  if (now - stream->ctl_wall < SPEED_WINDOW) {
+    g_mutex_unlock (stream->lock);
+    return;
+  }
+
+  speed = (gdouble) (stream->last_ts - stream->ctl_ts)
+      / (now - stream->ctl_wall);
+  busy = (gdouble) (stream->encode_time - stream->ctl_encode)
+      / (now - stream->ctl_wall);
+  stream->ctl_wall = now;
+  stream->ctl_ts = stream->last_ts;
+  stream->ctl_encode = stream->encode_time;
+  g_mutex_unlock (stream->lock);
+
+  GST_OBJECT_LOCK (self);
+  target = self->target_speed;
+  prof = _profile_for_encoder (self, stream->ebin);
+  tune_encoder = !_profile_has_preset (prof);
+  decimate = _can_decimate (prof);
+  GST_OBJECT_UNLOCK (self);
+
+  if (target <= 0.0)
+    return;
+
+  if (speed < target * SPEED_SLOW) {
+    if (busy < SPEED_MIN_BUSY) {
+      GST_LOG_OBJECT (self, "%s at %.2fx, but its encoder is idle",
+          stream->name, speed);
+      return;
+    }
+    faster = TRUE;
+  } else if (speed > target * SPEED_FAST) {
+    faster = FALSE;
+  } else {
+    return;
+  }
+
+  encoder = _stream_encoder (stream, &scalers);
+
+  /* The levels only change in this thread; the lock is for the stats and
+   * the decimation probe */
+  g_mutex_lock (stream->lock);
+  if (faster) {
+    if (tune_encoder && encoder != NULL
+        && _step_encoder_speed (encoder, 1)) {
+      control = "encoder-speed";
+      level = ++stream->speed_steps;
+    } else if (scalers != NULL && stream->scale_level < MAX_SCALE_LEVEL) {
+      control = "scaling";
+      level = ++stream->scale_level;
+    } else if (decimate && stream->decimate_level < MAX_DECIMATE_LEVEL) {
+      control = "decimation";
+      level = ++stream->decimate_level;
+    }
+  } else {
+    if (stream->decimate_level > 0) {
+      control = "decimation";
+      level = --stream->decimate_level;
+    } else if (scalers != NULL && stream->scale_level > 0) {
+      control = "scaling";
+      level = --stream->scale_level;
+    } else if (stream->speed_steps > 0 && encoder != NULL
+        && _step_encoder_speed (encoder, -1)) {
+      control = "encoder-speed";
+      level = --stream->speed_steps;
+    }
+  }
+  g_mutex_unlock (stream->lock);
+
+  if (control != NULL && strcmp (control, "scaling") == 0)
+    _set_scale_level (scalers, level);
+
+  if (encoder != NULL)
+    gst_object_unref (encoder);
+  g_list_foreach (scalers, (GFunc) gst_object_unref, NULL);
+  g_list_free (scalers);
+
+  if (control == NULL) {
+    GST_LOG_OBJECT (self, "%s at %.2fx of %.2fx, nothing left to adjust",
+        stream->name, speed, target);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "%s at %.2fx of %.2fx, %s now %d", stream->name,
+      speed, target, control, level);
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-speed",
+              "stream", G_TYPE_STRING, stream->name,
+              "control", G_TYPE_STRING, control,
+              "level", G_TYPE_INT, level,
+              "real-time-factor", G_TYPE_DOUBLE, speed,
+              "target-speed", G_TYPE_DOUBLE, target, NULL)));
+};
+
+/* Drops one frame in every few for the speed controller */
+static gboolean
+_stream_probe_decimate (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  gboolean keep = TRUE;
+
+  g_mutex_lock (stream->lock);
+  if (stream->decimate_level > 0) {
+    stream->decimate_count++;
+    if (stream->decimate_count % (MAX_DECIMATE_LEVEL + 2 -
+            stream->decimate_level) == 0) {
+      stream->dropped++;
+      keep = FALSE;
+    }
+  }
+  g_mutex_unlock (stream->lock);
+
+  return keep;
+};
+
+/* What the elements report doesn't always cover what they really hold on
+ * to, so in live mode the latency the bin adds is at least the measured
+ * one. */
+static gboolean
+_src_query (GstPad * pad, GstQuery * query)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (gst_pad_get_parent (pad));
+  GstClockTime min, max, up_min, up_max, in_bin, measured;
+  gboolean res, live, up_live;
+  GstQuery *upstream;
+
+  if (self == NULL)
+    return FALSE;
+
+  res = self->proxy_query (pad, query);
+
+  if (!res || GST_QUERY_TYPE (query) != GST_QUERY_LATENCY)
+    goto done;
+
+  GST_OBJECT_LOCK (self);
+  live = self->latency_mode == GST_TRANSCODE_LATENCY_LIVE;
+  measured = self->latency;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!live || !GST_CLOCK_TIME_IS_VALID (measured))
+    goto done;
+
+  upstream = gst_query_new_latency ();
+  if (gst_pad_peer_query (self->sinkpad, upstream)) {
+    gst_query_parse_latency (query, &live, &min, &max);
+    gst_query_parse_latency (upstream, &up_live, &up_min, &up_max);
+
+    in_bin = min > up_min ? min - up_min : 0;
+    if (measured > in_bin) {
+      GST_DEBUG_OBJECT (self, "reported %" GST_TIME_FORMAT ", measured %"
+          GST_TIME_FORMAT, GST_TIME_ARGS (in_bin), GST_TIME_ARGS (measured));
+
+      min += measured - in_bin;
+      if (GST_CLOCK_TIME_IS_VALID (max))
+        max += measured - in_bin;
+      gst_query_set_latency (query, live, min, max);
+    }
+  }
+  gst_query_unref (upstream);
+
+done:
+  gst_object_unref (self);
+
+  return res;
+};
+
+static void
+_record_arrival (GstTranscodeBin * self, GstClockTime ts, GstClockTime wall)
+{
+  GstTranscodeArrival *arrival = g_slice_new (GstTranscodeArrival);
+
+  arrival->ts = ts;
+  arrival->wall = wall;
+
+  GST_OBJECT_LOCK (self);
+  if (g_queue_get_length (&self->arrivals) >= MAX_ARRIVALS) {
+    g_slice_free (GstTranscodeArrival, g_queue_pop_head (&self->arrivals));
+  }
+  g_queue_push_tail (&self->arrivals, arrival);
+  GST_OBJECT_UNLOCK (self);
+};
+
+static void
+_clear_arrivals (GstTranscodeBin * self)
+{
+  GST_OBJECT_LOCK (self);
+  while (!g_queue_is_empty (&self->arrivals)) {
+    g_slice_free (GstTranscodeArrival, g_queue_pop_head (&self->arrivals));
+  }
+  self->timed_input = FALSE;
+  self->latency = GST_CLOCK_TIME_NONE;
+  self->max_latency = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (self);
+};
+
+static gboolean
+_sink_probe_arrival (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+
+  if (!GST_BUFFER_TIMESTAMP_IS_VALID (buf) || !_is_live (self))
+    return TRUE;
+
+  GST_OBJECT_LOCK (self);
+  self->timed_input = TRUE;
+  GST_OBJECT_UNLOCK (self);
+
+  _record_arrival (self, GST_BUFFER_TIMESTAMP (buf), gst_util_get_timestamp ());
+
+  return TRUE;
+};
+
+/* Match an output buffer with the input buffer that carried the same
+ * timestamp; the time between them is the latency through the bin */
+static gboolean
+_src_probe_latency (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  GstClockTime wall = GST_CLOCK_TIME_NONE, latency;
+
+  if (!GST_CLOCK_TIME_IS_VALID (ts) || !_is_live (self))
+    return TRUE;
+
+  GST_OBJECT_LOCK (self);
+  while (!g_queue_is_empty (&self->arrivals)) {
+    GstTranscodeArrival *arrival = g_queue_peek_head (&self->arrivals);
+
+    if (arrival->ts > ts)
+      break;
+
+    wall = arrival->wall;
+    g_slice_free (GstTranscodeArrival, g_queue_pop_head (&self->arrivals));
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (wall)) {
+    latency = gst_util_get_timestamp () - wall;
+
+    /* Smoothed, so one slow frame doesn't make the figure jump */
+    if (GST_CLOCK_TIME_IS_VALID (self->latency))
+      self->latency = (7 * self->latency + latency) / 8;
+    else
+      self->latency = latency;
+
+    if (!GST_CLOCK_TIME_IS_VALID (self->max_latency)
+        || latency > self->max_latency)
+      self->max_latency = latency;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+};
+
+/* Limit decodebin2's multiqueue and encodebin's queues to a share of the
+ * budget; their byte limits are per queue */
+static void
+_apply_memory_budget (GstTranscodeBin * self, GstElement * bin)
+{
+  gchar *bytes = NULL;
+  guint64 max_memory;
+
+  g_mutex_lock (self->mem_lock);
+  max_memory = self->max_memory;
+  g_mutex_unlock (self->mem_lock);
+
+  if (max_memory > 0) {
+    bytes = g_strdup_printf ("%u",
+        (guint) MIN (max_memory / INTERNAL_MEMORY_SHARE, G_MAXUINT));
+  }
+
+  _set_if_present (bin, _is_decodebin (bin) ? "max-size-bytes" :
+      "queue-bytes-max", bytes);
+
+  g_free (bytes);
+};
+
+static gboolean
+_memory_reserve (GstTranscodeBin * self, GstTranscodeStream * stream,
+    guint size)
+{
+  gboolean ok;
+
+  g_mutex_lock (self->mem_lock);
+  /* A stream with nothing queued always gets through: whatever is
+   * downstream may well be waiting for exactly that stream */
+  while (self->max_memory > 0 && !self->mem_flushing && !stream->flushing
+      && stream->held_bytes > 0 && self->memory + size > self->max_memory) {
+    GST_LOG_OBJECT (self, "%s waiting for memory, %" G_GUINT64_FORMAT
+        " bytes held", stream->name, self->memory);
+    g_cond_wait (self->mem_cond, self->mem_lock);
+  }
+
+  ok = !self->mem_flushing && !stream->flushing;
+  if (ok) {
+    stream->held_bytes += size;
+    self->memory += size;
+    if (self->memory > self->peak_memory)
+      self->peak_memory = self->memory;
+  }
+  g_mutex_unlock (self->mem_lock);
+
+  return ok;
+};
+
+static void
+_memory_release (GstTranscodeBin * self, GstTranscodeStream * stream,
+    guint size)
+{
+  g_mutex_lock (self->mem_lock);
+  size = MIN (size, stream->held_bytes);
+  stream->held_bytes -= size;
+  self->memory -= MIN (self->memory, size);
+  g_cond_broadcast (self->mem_cond);
+  g_mutex_unlock (self->mem_lock);
+};
+
+static void
+_memory_set_flushing (GstTranscodeBin * self, gboolean flushing)
+{
+  g_mutex_lock (self->mem_lock);
+  self->mem_flushing = flushing;
+  g_cond_broadcast (self->mem_cond);
+  g_mutex_unlock (self->mem_lock);
+};
+
+static gboolean
+_is_decodebin (GstElement * element)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  return factory != NULL
+      && strcmp (GST_PLUGIN_FEATURE_NAME (factory), DECODE_BIN) == 0;
+};
+
+static GstTranscodeStreamType
+_stream_type (const GstCaps * caps)
+{
+  const gchar *name;
+
+  if (caps == NULL || gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return GST_TRANSCODE_STREAM_OTHER;
+
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  if (g_str_has_prefix (name, "video/"))
+    return GST_TRANSCODE_STREAM_VIDEO;
+  if (g_str_has_prefix (name, "audio/"))
+    return GST_TRANSCODE_STREAM_AUDIO;
+  if (g_str_has_prefix (name, "text/") || g_str_has_prefix (name, "subpicture/")
+      || g_str_has_prefix (name, "application/x-ssa")
+      || g_str_has_prefix (name, "application/x-ass")
+      || g_str_has_prefix (name, "application/x-subtitle"))
+    return GST_TRANSCODE_STREAM_TEXT;
+
+  return GST_TRANSCODE_STREAM_OTHER;
+};
+
+/* Whether a profile has a stream of the same kind, before decoding */
+static gboolean
+_profile_wants_stream (GstEncodingProfile * prof, const GstCaps * caps)
+{
+  GstStreamMatch match = { caps, _stream_type (caps), TRUE };
+
+  return _find_stream_profile (prof, _stream_profile_matches, &match) != NULL;
+};
+
+static gboolean
+_any_profile_wants_stream (GstTranscodeBin * self, const GstCaps * caps)
+{
+  GList *targets = _get_targets (self), *iter;
+  gboolean wanted = FALSE;
+
+  for (iter = targets; iter && !wanted; iter = iter->next) {
+    GstTranscodeTarget *target = (GstTranscodeTarget *) iter->data;
+
+    wanted = _profile_wants_stream (target->profile, caps);
+  }
+  _free_targets (targets);
+
+  return wanted;
+};
+
+/* decodebin2 hands out its own ghost pads; the demuxer is behind them */
+static gboolean
+_pad_is_demuxed (GstPad * pad)
+{
+  GstPad *target = NULL;
+  GstElement *parent;
+  GstElementFactory *factory;
+  gboolean ret = FALSE;
+
+  if (GST_IS_GHOST_PAD (pad))
+    target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+  if (target == NULL)
+    target = gst_object_ref (pad);
+
+  parent = gst_pad_get_parent_element (target);
+  if (parent != NULL) {
+    factory = gst_element_get_factory (parent);
+    ret = factory != NULL
+        && strstr (gst_element_factory_get_klass (factory), "Demux") != NULL;
+    gst_object_unref (parent);
+  }
+  gst_object_unref (target);
+
+  return ret;
+};
+
+static GstStreamSelection
+_select_stream (GstTranscodeBin * self, GstPad * pad, GstCaps * caps)
+{
+  GstStreamSelection selection = _pad_selection (pad);
+  GstTranscodeStreamType type, types;
+  gboolean selected = TRUE, prune, by_language;
+  guint index;
+
+  if (selection != SELECT_UNDECIDED)
+    return selection;
+
+  if (!_pad_is_demuxed (pad))
+    return SELECT_KEEP;
+
+  /* The properties may change while streams are being found; each stream
+   * is decided on one set of them */
+  GST_OBJECT_LOCK (self);
+  index = self->n_demuxed++;
+  types = self->stream_types;
+  prune = self->prune_streams;
+  by_language = self->languages != NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  type = _stream_type (caps);
+
+  if (!(types & type)) {
+    GST_DEBUG_OBJECT (self, "stream %u: type not selected", index);
+    selection = SELECT_DROP;
+  } else if (prune && !_any_profile_wants_stream (self, caps)) {
+    GST_DEBUG_OBJECT (self, "stream %u: no profile has a use for %"
+        GST_PTR_FORMAT, index, caps);
+    selection = SELECT_DROP;
+  } else {
+    if (g_signal_has_handler_pending (self,
+            transcode_bin_signals[SIGNAL_SELECT_STREAM], 0, FALSE)) {
+      g_signal_emit (self, transcode_bin_signals[SIGNAL_SELECT_STREAM], 0,
+          pad, caps, index, &selected);
+    }
+
+    if (!selected) {
+      GST_DEBUG_OBJECT (self, "stream %u: rejected by select-stream", index);
+      selection = SELECT_DROP;
+    } else if (by_language && (type == GST_TRANSCODE_STREAM_AUDIO
+            || type == GST_TRANSCODE_STREAM_TEXT)) {
+      selection = SELECT_DEFER;
+    } else {
+      selection = SELECT_KEEP;
+    }
+  }
+
+  g_object_set_qdata (G_OBJECT (pad), selection_quark,
+      GINT_TO_POINTER (selection));
+  if (GST_IS_GHOST_PAD (pad)) {
+    GstPad *target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+
+    if (target != NULL) {
+      g_object_set_qdata (G_OBJECT (target), selection_quark,
+          GINT_TO_POINTER (selection));
+      gst_object_unref (target);
+    }
+  }
+
+  return selection;
+};
+
+/* Set on the pad autoplug-continue got, looked up again on the pad
+ * decodebin2 exposes; check the pad behind it as well */
+static GstStreamSelection
+_pad_selection (GstPad * pad)
+{
+  GstStreamSelection selection;
+  GstPad *target;
+
+  selection = GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (pad),
+          selection_quark));
+
+  if (selection == SELECT_UNDECIDED && GST_IS_GHOST_PAD (pad)) {
+    target = gst_ghost_pad_get_target (GST_GHOST_PAD (pad));
+    if (target != NULL) {
+      selection = GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (target),
+              selection_quark));
+      gst_object_unref (target);
+    }
+  }
+
+  return selection;
+};
+
+/* Unlinked pads would make the demuxer stop with not-linked */
+static void
+_discard_pad (GstTranscodeBin * self, GstPad * pad)
+{
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *sinkpad;
+
+  if (sink == NULL)
+    return;
+
+  GST_DEBUG_OBJECT (self, "discarding %s:%s", GST_DEBUG_PAD_NAME (pad));
+
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (self), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (sink);
+  _add_element (self, sink);
+};
+
+static gboolean
+_language_selected (GstTranscodeBin * self, const gchar * language)
+{
+  gchar **langs;
+  gboolean ret = FALSE;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  langs = self->languages ? g_strsplit (self->languages, ",", -1) : NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (langs == NULL)
+    return TRUE;
+
+  for (i = 0; langs[i] != NULL && !ret; i++)
+    ret = g_ascii_strcasecmp (g_strstrip (langs[i]), language) == 0;
+
+  g_strfreev (langs);
+
+  return ret;
+};
+
+static void
+_free_deferred_stream (GstDeferredStream * deferred)
+{
+  gst_pad_remove_buffer_probe (deferred->pad, deferred->buffer_probe);
+  gst_pad_remove_event_probe (deferred->pad, deferred->event_probe);
+  g_list_foreach (deferred->events, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (deferred->events);
+  gst_object_unref (deferred->pad);
+  g_free (deferred->language);
+  g_slice_free (GstDeferredStream, deferred);
+};
+
+/* Decide on a deferred stream, in its streaming thread: plug a decodebin2
+ * that goes through the usual autoplugging, or throw it away. The events
+ * held back so far go to whichever it is. */
+static void
+_decide_deferred (GstDeferredStream * deferred)
+{
+  GstTranscodeBin *self = deferred->self;
+  GstElement *element;
+  GstPad *sinkpad;
+  GList *iter;
+
+  GST_OBJECT_LOCK (self);
+  self->deferred = g_list_remove (self->deferred, deferred);
+  GST_OBJECT_UNLOCK (self);
+
+  if (deferred->language == NULL
+      || _language_selected (self, deferred->language)) {
+    GST_DEBUG_OBJECT (self, "selecting %s:%s (%s)",
+        GST_DEBUG_PAD_NAME (deferred->pad),
+        deferred->language ? deferred->language : "untagged");
+
+    element = gst_element_factory_make (DECODE_BIN, NULL);
+    if (element != NULL) {
+      g_signal_connect (element, "autoplug-continue",
+          G_CALLBACK (_dbin_autoplug_continue), self);
+      g_signal_connect (element, "pad-added",
+          G_CALLBACK (_dbin_pad_added), self);
+      g_signal_connect (element, "element-added",
+          G_CALLBACK (_dbin_element_added), self);
+      _apply_latency_mode (self, element);
+      _apply_memory_budget (self, element);
+
+      gst_bin_add (GST_BIN (self), element);
+      sinkpad = gst_element_get_static_pad (element, "sink");
+      gst_pad_link (deferred->pad, sinkpad);
+      gst_element_sync_state_with_parent (element);
+      _add_element (self, element);
+
+      for (iter = deferred->events; iter; iter = iter->next)
+        gst_pad_send_event (sinkpad, GST_EVENT (iter->data));
+      g_list_free (deferred->events);
+      deferred->events = NULL;
+
+      gst_object_unref (sinkpad);
+    }
+  } else {
+    GST_DEBUG_OBJECT (self, "discarding %s:%s (%s)",
+        GST_DEBUG_PAD_NAME (deferred->pad), deferred->language);
+    _discard_pad (self, deferred->pad);
+  }
+
+  _free_deferred_stream (deferred);
+};
+
+static gboolean
+_deferred_probe_event (GstPad * pad, GstEvent * event, gpointer user_data)
+{
+  GstDeferredStream *deferred = (GstDeferredStream *) user_data;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_TAG:{
+      GstTagList *tags;
+      gchar *language = NULL;
+
+      gst_event_parse_tag (event, &tags);
+      if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &language)) {
+        g_free (deferred->language);
+        deferred->language = language;
+      }
+    }
+      /* fall through */
+    case GST_EVENT_NEWSEGMENT:
+      /* Nothing to send these to yet */
+      deferred->events = g_list_append (deferred->events,
+          gst_event_ref (event));
+      return FALSE;
+    case GST_EVENT_EOS:
+      _decide_deferred (deferred);
+      return TRUE;
+    default:
+      return TRUE;
+  }
+};
+
+static gboolean
+_deferred_probe_buffer (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  /* The buffer goes on to whatever was just linked */
+  _decide_deferred ((GstDeferredStream *) user_data);
+
+  return TRUE;
+};
+
+static void
+_defer_pad (GstTranscodeBin * self, GstPad * pad)
+{
+  GstDeferredStream *deferred = g_slice_new0 (GstDeferredStream);
+
+  GST_DEBUG_OBJECT (self, "waiting for the language of %s:%s",
+      GST_DEBUG_PAD_NAME (pad));
+
+  deferred->self = self;
+  deferred->pad = gst_object_ref (pad);
+  deferred->buffer_probe = gst_pad_add_buffer_probe (pad,
+      G_CALLBACK (_deferred_probe_buffer), deferred);
+  deferred->event_probe = gst_pad_add_event_probe (pad,
+      G_CALLBACK (_deferred_probe_event), deferred);
+
+  GST_OBJECT_LOCK (self);
+  self->deferred = g_list_prepend (self->deferred, deferred);
+  GST_OBJECT_UNLOCK (self);
+};
+
+/* Streams that never got as far as a decision */
+static void
+_free_deferred (GstTranscodeBin * self)
+{
+  GList *deferred;
+
+  GST_OBJECT_LOCK (self);
+  deferred = self->deferred;
+  self->deferred = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  g_list_foreach (deferred, (GFunc) _free_deferred_stream, NULL);
+  g_list_free (deferred);
+};
+
+static gpointer
+_seek_thread (gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime start, stop;
+  GstEvent *seek;
+
+  GST_OBJECT_LOCK (self);
+  start = self->run_start;
+  stop = self->run_stop;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "seeking to %" GST_TIME_FORMAT " - %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (start), GST_TIME_ARGS (stop));
+
+  seek = gst_event_new_seek (1.0, GST_FORMAT_TIME,
+      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+      GST_SEEK_TYPE_SET, start,
+      GST_CLOCK_TIME_IS_VALID (stop) ? GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE,
+      stop);
+
+  if (gst_element_send_event (self->dbin, seek)) {
+    GST_OBJECT_LOCK (self);
+    self->seek_state = SEEK_DONE;
+    GST_OBJECT_UNLOCK (self);
+  } else {
+    GST_WARNING_OBJECT (self, "Input can't seek, clipping as it goes");
+
+    GST_OBJECT_LOCK (self);
+    self->seek_state = SEEK_FAILED;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return NULL;
+};
+
+static void
+_join_seek_thread (GstTranscodeBin * self)
+{
+  GThread *thread;
+
+  GST_OBJECT_LOCK (self);
+  thread = self->seek_thread;
+  self->seek_thread = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (thread != NULL)
+    g_thread_join (thread);
+};
+
+/* Whether a buffer at this position belongs in the output; with the
+ * object lock held */
+static gboolean
+_clip_keep (GstClipStream * clip, GstBuffer * buf)
+{
+  GstTranscodeBin *self = clip->self;
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  GstClockTime end = ts;
+
+  if (!GST_CLOCK_TIME_IS_VALID (ts))
+    return clip->started;
+
+  if (GST_BUFFER_DURATION_IS_VALID (buf))
+    end += GST_BUFFER_DURATION (buf);
+
+  if (GST_CLOCK_TIME_IS_VALID (self->run_stop) && ts >= self->run_stop)
+    return FALSE;
+
+  if (!clip->started) {
+    /* Copied streams can only start on a keyframe */
+    if (clip->stream_copy) {
+      if (ts < self->run_start
+          || GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+        return FALSE;
+    } else if (GST_BUFFER_DURATION_IS_VALID (buf) ?
+        end <= self->run_start : ts < self->run_start) {
+      return FALSE;
+    }
+    clip->started = TRUE;
+  }
+
+  return TRUE;
+};
+
+/* Whether a stream the input couldn't seek for has gone past stop-time;
+ * with the object lock held */
+static gboolean
+_clip_past_stop (GstClipStream * clip, GstBuffer * buf)
+{
+  GstTranscodeBin *self = clip->self;
+
+  return self->seek_state == SEEK_FAILED
+      && GST_CLOCK_TIME_IS_VALID (self->run_stop)
+      && GST_BUFFER_TIMESTAMP_IS_VALID (buf)
+      && GST_BUFFER_TIMESTAMP (buf) >= self->run_stop;
+};
+
+static gboolean
+_clip_probe_buffer (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstClipStream *clip = (GstClipStream *) user_data;
+  GstTranscodeBin *self = clip->self;
+  GstClockTime base;
+  gboolean keep = FALSE, end = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  if (self->seek_state == SEEK_FAILED)
+    clip->seeked = TRUE;
+
+  if (clip->ended) {
+    keep = FALSE;
+  } else if (clip->seeked) {
+    keep = _clip_keep (clip, buf);
+    end = clip->ended = _clip_past_stop (clip, buf);
+  } else if (self->seek_state == SEEK_NONE) {
+    /* First data out of decodebin2: now the input can seek. Not from this
+     * thread though, the seek flushes it. */
+    self->seek_state = SEEK_SENT;
+    self->seek_thread = g_thread_create (_seek_thread, self, TRUE, NULL);
+  }
+  base = self->run_base;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Nothing more will be kept, the encoders can finish while the rest of
+   * the input is read and thrown away */
+  if (end) {
+    GstPad *peer = gst_pad_get_peer (pad);
+
+    GST_DEBUG_OBJECT (self, "%s:%s is past stop-time, ending it",
+        GST_DEBUG_PAD_NAME (pad));
+    if (peer != NULL) {
+      gst_pad_send_event (peer, gst_event_new_eos ());
+      gst_object_unref (peer);
+    }
+    return FALSE;
+  }
+
+  if (!keep || base == 0 || !GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+    return keep;
+
+  /* Others may hold on to the buffer too; rebase a copy of its metadata
+   * then and, as with events, send that on ourselves */
+  if (!gst_buffer_is_metadata_writable (buf)) {
+    GstPad *peer = gst_pad_get_peer (pad);
+
+    if (peer == NULL)
+      return FALSE;
+
+    buf = gst_buffer_make_metadata_writable (gst_buffer_ref (buf));
+    GST_BUFFER_TIMESTAMP (buf) = _rebase (GST_BUFFER_TIMESTAMP (buf), base);
+    gst_pad_chain (peer, buf);
+    gst_object_unref (peer);
+
+    return FALSE;
+  }
+
+  GST_BUFFER_TIMESTAMP (buf) = _rebase (GST_BUFFER_TIMESTAMP (buf), base);
+
+  return TRUE;
+};
+
+static GstClockTime
+_rebase (GstClockTime t, GstClockTime start)
+{
+  if (!GST_CLOCK_TIME_IS_VALID (t))
+    return t;
+
+  return t > start ? t - start : 0;
+};
+
+static gboolean
+_clip_probe_event (GstPad * pad, GstEvent * event, gpointer user_data)
+{
+  GstClipStream *clip = (GstClipStream *) user_data;
+  GstTranscodeBin *self = clip->self;
+  GstClockTime base;
+  gboolean seeked, ended;
+
+  GST_OBJECT_LOCK (self);
+  seeked = clip->seeked;
+  ended = clip->ended;
+  base = self->run_base;
+  GST_OBJECT_UNLOCK (self);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+      /* Already sent when the stream went past stop-time */
+      return !ended;
+    case GST_EVENT_FLUSH_START:
+      /* The encoders have seen nothing yet, keep the flush from them */
+      return seeked;
+    case GST_EVENT_FLUSH_STOP:
+      if (!seeked) {
+        GST_OBJECT_LOCK (self);
+        clip->seeked = self->seek_state != SEEK_NONE;
+        GST_OBJECT_UNLOCK (self);
+      }
+      return seeked;
+    case GST_EVENT_NEWSEGMENT:{
+      gboolean update;
+      gdouble rate, arate;
+      GstFormat format;
+      gint64 start, stop, position;
+      GstPad *peer;
+
+      if (!seeked || base == 0)
+        return TRUE;
+
+      gst_event_parse_new_segment_full (event, &update, &rate, &arate,
+          &format, &start, &stop, &position);
+      if (format != GST_FORMAT_TIME)
+        return TRUE;
+
+      /* Probes can't replace events, so send the rebased one on ourselves */
+      peer = gst_pad_get_peer (pad);
+      if (peer == NULL)
+        return TRUE;
+
+      gst_pad_send_event (peer, gst_event_new_new_segment_full (update, rate,
+              arate, format, _rebase (start, base), _rebase (stop, base),
+              _rebase (position, base)));
+      gst_object_unref (peer);
+
+      return FALSE;
+    }
+    default:
+      return TRUE;
+  }
+};
+
+static GstClipStream *
+_add_clip (GstTranscodeBin * self, GstPad * pad, gboolean stream_copy)
+{
+  GstClipStream *clip = g_slice_new0 (GstClipStream);
+
+  clip->self = self;
+  clip->pad = gst_object_ref (pad);
+  clip->stream_copy = stream_copy;
+
+  GST_OBJECT_LOCK (self);
+  /* Pads showing up after the seek already get data from the range */
+  clip->seeked = self->seek_state == SEEK_DONE
+      || self->seek_state == SEEK_FAILED;
+  self->clips = g_list_prepend (self->clips, clip);
+  GST_OBJECT_UNLOCK (self);
+
+  clip->buffer_probe = gst_pad_add_buffer_probe (pad,
+      G_CALLBACK (_clip_probe_buffer), clip);
+  clip->event_probe = gst_pad_add_event_probe (pad,
+      G_CALLBACK (_clip_probe_event), clip);
+
+  return clip;
+};
+
+static void
+_free_clip (GstClipStream * clip)
+{
+  gst_pad_remove_buffer_probe (clip->pad, clip->buffer_probe);
+  gst_pad_remove_event_probe (clip->pad, clip->event_probe);
+  gst_object_unref (clip->pad);
+  g_slice_free (GstClipStream, clip);
+};
+
+static void
+_remove_clip (GstTranscodeBin * self, GstClipStream * clip)
+{
+  GST_OBJECT_LOCK (self);
+  self->clips = g_list_remove (self->clips, clip);
+  GST_OBJECT_UNLOCK (self);
+
+  _free_clip (clip);
+};
+
+static void
+_free_clips (GstTranscodeBin * self)
+{
+  GList *clips;
+
+  GST_OBJECT_LOCK (self);
+  clips = self->clips;
+  self->clips = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  g_list_foreach (clips, (GFunc) _free_clip, NULL);
+  g_list_free (clips);
+};
+
+/* The stream profile a stream would end up in: the one it can be copied
+ * into, or else the first one of its kind */
+static GstEncodingProfile *
+_stream_profile_for (GstEncodingProfile * prof, const GstCaps * caps,
+    gboolean stream_copy)
+{
+  GstStreamMatch match = { caps, _stream_type (caps), FALSE };
+  GstEncodingProfile *sprof = NULL;
+
+  if (stream_copy)
+    sprof = _find_stream_profile (prof, _stream_profile_copies,
+        (gpointer) caps);
+
+  if (sprof == NULL)
+    sprof = _find_stream_profile (prof, _stream_profile_matches, &match);
+
+  return sprof;
+};
+
+static gboolean
+_factories_handle (GList * factories, const GstCaps * caps,
+    GstPadDirection direction)
+{
+  GList *found;
+  gboolean ret;
+
+  if (caps == NULL)
+    return FALSE;
+
+  found = gst_element_factory_list_filter (factories, caps, direction, FALSE);
+  ret = found != NULL;
+  gst_plugin_feature_list_free (found);
+
+  return ret;
+};
+
+/* Pixel rate relative to 720p30, from the fixed parts of the caps */
+static gdouble
+_pixel_rate (const GstCaps * caps, const GstCaps * restriction)
+{
+  gint width = 1280, height = 720, fps_n = 30, fps_d = 1;
+  const GstStructure *s;
+
+  if (caps != NULL && gst_caps_get_size (caps) > 0) {
+    s = gst_caps_get_structure (caps, 0);
+    gst_structure_get_int (s, "width", &width);
+    gst_structure_get_int (s, "height", &height);
+    gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d);
+  }
+
+  if (restriction != NULL && !gst_caps_is_any (restriction)
+      && gst_caps_get_size (restriction) > 0) {
+    s = gst_caps_get_structure (restriction, 0);
+    gst_structure_get_int (s, "width", &width);
+    gst_structure_get_int (s, "height", &height);
+    gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d);
+  }
+
+  if (fps_d <= 0 || fps_n <= 0) {
+    fps_n = 30;
+    fps_d = 1;
+  }
+
+  return (gdouble) width * height * fps_n / fps_d / REFERENCE_PIXEL_RATE;
+};
+
+typedef struct _GstCheckFactories
+{
+  GList *decoders;
+  GList *encoders;
+  GList *muxers;
+} GstCheckFactories;
+
+static GstStructure *
+_check_profile (GstTranscodeBin * self, GstEncodingProfile * prof,
+    const GstCaps * streams, GstCheckFactories * factories)
+{
+  GValue results = { 0, };
+  GString *missing = g_string_new (NULL);
+  gboolean achievable = TRUE, any = FALSE;
+  gdouble total = 0.0;
+  GstStructure *s;
+  guint i;
+
+  g_value_init (&results, GST_TYPE_ARRAY);
+
+  if (GST_IS_ENCODING_CONTAINER_PROFILE (prof)
+      && !_factories_handle (factories->muxers,
+          gst_encoding_profile_get_format (prof), GST_PAD_SRC)) {
+    achievable = FALSE;
+    g_string_append (missing, "muxer; ");
+  }
+
+  for (i = 0; i < gst_caps_get_size (streams); i++) {
+    GstCaps *caps = gst_caps_copy_nth (streams, i);
+    GstTranscodeStreamType type = _stream_type (caps);
+    GstEncodingProfile *sprof;
+    const gchar *action;
+    gboolean copy;
+    gdouble cost = 0.0;
+    GValue v = { 0, };
+    GstStructure *ss;
+
+    /* Not through the decision cache: the profiles we're asked about
+     * aren't ours to keep, and shouldn't push out the running ones */
+    copy = self->stream_copy && _profile_accepts_stream (prof, caps);
+    sprof = _stream_profile_for (prof, caps, copy);
+
+    if (sprof == NULL) {
+      action = "drop";
+    } else if (copy) {
+      action = "copy";
+      cost = COST_COPY;
+    } else {
+      const GstCaps *restriction = gst_encoding_profile_get_restriction (sprof);
+      gboolean raw = _caps_is_raw (caps);
+      gdouble scale = type == GST_TRANSCODE_STREAM_VIDEO ?
+          _pixel_rate (caps, NULL) : 1.0;
+
+      action = "encode";
+
+      if (!raw
+          && !_factories_handle (factories->decoders, caps, GST_PAD_SINK)) {
+        action = "unsupported";
+        g_string_append_printf (missing, "decoder for stream %u; ", i);
+      }
+      if (!_factories_handle (factories->encoders,
+              gst_encoding_profile_get_format (sprof), GST_PAD_SRC)) {
+        action = "unsupported";
+        g_string_append_printf (missing, "encoder for stream %u; ", i);
+      }
+
+      if (type == GST_TRANSCODE_STREAM_VIDEO) {
+        cost = (raw ? 0.0 : COST_VIDEO_DECODE * scale)
+            + COST_VIDEO_ENCODE * _pixel_rate (caps, restriction);
+      } else {
+        cost = (raw ? 0.0 : COST_AUDIO_DECODE) + COST_AUDIO_ENCODE;
+      }
+    }
+
+    if (strcmp (action, "unsupported") == 0)
+      achievable = FALSE;
+    else if (sprof != NULL)
+      any = TRUE;
+    total += cost;
+
+    ss = gst_structure_new ("stream",
+        "index", G_TYPE_UINT, i,
+        "caps", GST_TYPE_CAPS, caps,
+        "action", G_TYPE_STRING, action, "cost", G_TYPE_DOUBLE, cost, NULL);
+
+    g_value_init (&v, GST_TYPE_STRUCTURE);
+    gst_value_set_structure (&v, ss);
+    gst_value_array_append_value (&results, &v);
+    g_value_unset (&v);
+    gst_structure_free (ss);
+    gst_caps_unref (caps);
+  }
+
+  if (!any) {
+    achievable = FALSE;
+    g_string_append (missing, "no usable stream; ");
+  }
+
+  s = gst_structure_new ("profile",
+      "name", G_TYPE_STRING, gst_encoding_profile_get_name (prof),
+      "achievable", G_TYPE_BOOLEAN, achievable,
+      "cost", G_TYPE_DOUBLE, total,
+      "missing", G_TYPE_STRING, missing->str, NULL);
+  gst_structure_set_value (s, "streams", &results);
+  g_value_unset (&results);
+  g_string_free (missing, TRUE);
+
+  return s;
+};
+
+/**
+ * gst_transcode_bin_check_profiles:
+ * @bin: a #GstTranscodeBin
+ * @streams: caps of the input's streams, one structure per stream, for
+ * example as found by #GstDiscoverer
+ * @profiles: a #GValueArray of #GstEncodingProfile
+ *
+ * Works out what transcoding an input with these streams into each of the
+ * profiles would take, using only the registry: nothing is instantiated.
+ * Uses the bin's stream-copy setting.
+ *
+ * The result is a "transcodebin-check" structure whose "profiles" field
+ * is an array with, per profile, its "name", whether it's "achievable",
+ * what's "missing" if not, an estimated relative "cost" (copying a stream
+ * is 1, re-encoding 720p30 video about 125) and a "streams" array saying
+ * for every stream whether it would be copied, encoded, dropped for lack
+ * of a stream profile or is unsupported.
+ *
+ * Returns: a new #GstStructure, free with gst_structure_free()
+ */
+GstStructure *
+gst_transcode_bin_check_profiles (GstTranscodeBin * bin,
+    const GstCaps * streams, const GValueArray * profiles)
+{
+  GstCheckFactories factories;
+  GValue results = { 0, };
+  GstStructure *s;
+  guint i;
+
+  g_return_val_if_fail (GST_IS_TRANSCODE_BIN (bin), NULL);
+  g_return_val_if_fail (GST_IS_CAPS (streams), NULL);
+
+  factories.decoders =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_DECODER,
+      GST_RANK_MARGINAL);
+  factories.encoders =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      GST_RANK_NONE);
+  factories.muxers =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_MUXER,
+      GST_RANK_NONE);
+
+  g_value_init (&results, GST_TYPE_ARRAY);
+
+  for (i = 0; profiles != NULL && i < profiles->n_values; i++) {
+    GstEncodingProfile *prof = GST_ENCODING_PROFILE (gst_value_get_mini_object
+        (g_value_array_get_nth ((GValueArray *) profiles, i)));
+    GValue v = { 0, };
+    GstStructure *ps;
+
+    if (prof == NULL)
+      continue;
+
+    ps = _check_profile (bin, prof, streams, &factories);
+
+    g_value_init (&v, GST_TYPE_STRUCTURE);
+    gst_value_set_structure (&v, ps);
+    gst_value_array_append_value (&results, &v);
+    g_value_unset (&v);
+    gst_structure_free (ps);
+  }
+
+  gst_plugin_feature_list_free (factories.decoders);
+  gst_plugin_feature_list_free (factories.encoders);
+  gst_plugin_feature_list_free (factories.muxers);
+
+  s = gst_structure_empty_new ("transcodebin-check");
+  gst_structure_set_value (s, "profiles", &results);
+  g_value_unset (&results);
+
+  return s;
+};
+
+/**
+ * gst_transcode_profile_is_appendable:
+ * @prof: a #GstEncodingProfile, or %NULL
+ *
+ * Whether output made with @prof can be cut at a keyframe and have more
+ * output appended to it later, so separately encoded pieces can simply be
+ * concatenated. That's the case for MPEG-TS and for profiles without a
+ * container.
+ *
+ * Returns: %TRUE if the output can be appended to
+ */
+gboolean
+gst_transcode_profile_is_appendable (GstEncodingProfile * prof)
+{
+  GstCaps *appendable;
+  gboolean ret;
+
+  if (prof == NULL)
+    return FALSE;
+
+  if (!GST_IS_ENCODING_CONTAINER_PROFILE (prof))
+    return TRUE;
+
+  appendable = gst_caps_from_string (APPENDABLE_CONTAINERS);
+  ret = gst_caps_can_intersect (gst_encoding_profile_get_format (prof),
+      appendable);
+  gst_caps_unref (appendable);
+
+  return ret;
+};
+
+/* Pick up where a previous run left off, if the journal says so */
+static void
+_load_checkpoint (GstTranscodeBin * self)
+{
+  GKeyFile *journal = g_key_file_new ();
+  GstClockTime position = 0;
+  guint64 offset = 0;
+  gchar *location;
+
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->checkpoint_location);
+  GST_OBJECT_UNLOCK (self);
+
+  if (location != NULL
+      && g_key_file_load_from_file (journal, location, G_KEY_FILE_NONE,
+          NULL)) {
+    gchar *str;
+
+    str = g_key_file_get_value (journal, CHECKPOINT_GROUP, "position", NULL);
+    if (str != NULL)
+      position = g_ascii_strtoull (str, NULL, 10);
+    g_free (str);
+
+    str = g_key_file_get_value (journal, CHECKPOINT_GROUP, "offset", NULL);
+    if (str != NULL)
+      offset = g_ascii_strtoull (str, NULL, 10);
+    g_free (str);
+
+    if (offset == 0)
+      position = 0;
+
+    GST_INFO_OBJECT (self, "resuming from %" GST_TIME_FORMAT " at byte %"
+        G_GUINT64_FORMAT, GST_TIME_ARGS (position), offset);
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->resume_position = position;
+  self->resume_offset = offset;
+  GST_OBJECT_UNLOCK (self);
+
+  g_key_file_free (journal);
+  g_free (location);
+};
+
+static void
+_write_checkpoint (GstTranscodeBin * self, const gchar * location,
+    GstClockTime position, guint64 offset)
+{
+  GKeyFile *journal = g_key_file_new ();
+  GError *err = NULL;
+  gchar *str, *data;
+  gsize len;
+
+  str = g_strdup_printf ("%" G_GUINT64_FORMAT, position);
+  g_key_file_set_value (journal, CHECKPOINT_GROUP, "position", str);
+  g_free (str);
+
+  str = g_strdup_printf ("%" G_GUINT64_FORMAT, offset);
+  g_key_file_set_value (journal, CHECKPOINT_GROUP, "offset", str);
+  g_free (str);
+
+  data = g_key_file_to_data (journal, &len, NULL);
+
+  /* Written to a temporary file and renamed, so a crash while writing
+   * leaves the previous checkpoint */
+  if (!g_file_set_contents (location, data, len, &err)) {
+    GST_WARNING_OBJECT (self, "Could not write checkpoint: %s",
+        err->message);
+    g_error_free (err);
+  } else {
+    GST_DEBUG_OBJECT (self, "checkpoint at %" GST_TIME_FORMAT ", byte %"
+        G_GUINT64_FORMAT, GST_TIME_ARGS (position), offset);
+  }
+
+  g_free (data);
+  g_key_file_free (journal);
+};
+
+/* Every keyframe in the output is a point the output can be cut at and
+ * the input seeked back to. The journal gets the one before the latest,
+ * as the sink may not have written a buffer yet when it is pushed, but has
+ * by the time a whole interval more went after it. */
+static gboolean
+_src_probe_checkpoint (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  GstClockTime position = GST_CLOCK_TIME_NONE;
+  gchar *location = NULL;
+  guint64 offset, written = 0;
+
+  GST_OBJECT_LOCK (self);
+  if (!self->appendable) {
+    GST_OBJECT_UNLOCK (self);
+    return TRUE;
+  }
+
+  offset = self->out_offset;
+  self->out_offset += GST_BUFFER_SIZE (buf);
+
+  if (GST_CLOCK_TIME_IS_VALID (ts)
+      && !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)
+      && !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS)
+      && offset > 0
+      && (!GST_CLOCK_TIME_IS_VALID (self->last_checkpoint)
+          || ts >= self->last_checkpoint + self->checkpoint_interval)) {
+    if (self->last_checkpoint_offset > 0) {
+      position = self->last_checkpoint;
+      written = self->last_checkpoint_offset;
+      location = g_strdup (self->checkpoint_location);
+    }
+    self->last_checkpoint = ts;
+    self->last_checkpoint_offset = offset;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (location != NULL) {
+    _write_checkpoint (self, location, position, written);
+    g_free (location);
+  }
+
+  return TRUE;
+};
+
+/* What to announce about a finished segment, taken under the lock */
+typedef struct _GstSegmentDone
+{
+  GstStructure *segment;
+  gchar *playlist;
+  guint n_segments;
+  gboolean complete;
+} GstSegmentDone;
+
+/* A playlist in HLS form of the segments so far; call with the object
+ * lock held */
+static gchar *
+_build_playlist (GstTranscodeBin * self, gboolean complete)
+{
+  GString *playlist = g_string_new ("#EXTM3U\n#EXT-X-VERSION:3\n");
+  GstClockTime longest = self->segment_duration;
+  guint i;
+
+  for (i = 0; i < self->seg_durations->len; i++)
+    longest = MAX (longest, g_array_index (self->seg_durations,
+            GstClockTime, i));
+
+  g_string_append_printf (playlist, "#EXT-X-TARGETDURATION:%u\n"
+      "#EXT-X-MEDIA-SEQUENCE:0\n",
+      (guint) ((longest + GST_SECOND - 1) / GST_SECOND));
+
+  for (i = 0; i < self->seg_durations->len; i++) {
+    guint64 ms = g_array_index (self->seg_durations, GstClockTime, i)
+        / GST_MSECOND;
+    gchar *name = g_strdup_printf (self->segment_location, i);
+
+    g_string_append_printf (playlist, "#EXTINF:%u.%03u,\n%s\n",
+        (guint) (ms / 1000), (guint) (ms % 1000), name);
+    g_free (name);
+  }
+
+  if (complete)
+    g_string_append (playlist, "#EXT-X-ENDLIST\n");
+
+  return g_string_free (playlist, FALSE);
+};
+
+/* Close the current segment at end; call with the object lock held */
+static void
+_finish_segment (GstTranscodeBin * self, GstClockTime end,
+    gboolean complete, GstSegmentDone * done)
+{
+  GstClockTime duration = end > self->seg_start ? end - self->seg_start : 0;
+  gchar *name = g_strdup_printf (self->segment_location, self->seg_index);
+
+  done->segment = gst_structure_new ("transcodebin-segment",
+      "index", G_TYPE_UINT, self->seg_index,
+      "location", G_TYPE_STRING, name,
+      "start", G_TYPE_UINT64, self->seg_start,
+      "duration", G_TYPE_UINT64, duration,
+      "offset", G_TYPE_UINT64, self->seg_offset,
+      "size", G_TYPE_UINT64, self->seg_out - self->seg_offset, NULL);
+  g_free (name);
+
+  g_array_append_val (self->seg_durations, duration);
+  done->playlist = _build_playlist (self, complete);
+  done->n_segments = self->seg_durations->len;
+  done->complete = complete;
+
+  self->seg_index++;
+  self->seg_start = end;
+  self->seg_offset = self->seg_out;
+  self->seg_key_requested = FALSE;
+};
+
+static void
+_post_segment_done (GstTranscodeBin * self, GstSegmentDone * done)
+{
+  GST_DEBUG_OBJECT (self, "finished %" GST_PTR_FORMAT, done->segment);
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self), done->segment));
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-playlist",
+              "playlist", G_TYPE_STRING, done->playlist,
+              "segments", G_TYPE_UINT, done->n_segments,
+              "complete", G_TYPE_BOOLEAN, done->complete, NULL)));
+  g_free (done->playlist);
+};
+
+/* Cut the output at the first keyframe past each segment's duration. The
+ * muxer only knows where keyframes are, not when one is wanted, so the
+ * encoders are asked for one upstream once the segment is long enough;
+ * the cut itself is marked downstream right before the keyframe, with the
+ * headers repeated so each segment decodes on its own. */
+static gboolean
+_src_probe_segment (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  GstSegmentDone done = { NULL, };
+  gboolean request = FALSE;
+  guint count = 0;
+
+  GST_OBJECT_LOCK (self);
+  if (!self->segmenting) {
+    GST_OBJECT_UNLOCK (self);
+    return TRUE;
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (ts)) {
+    if (!GST_CLOCK_TIME_IS_VALID (self->seg_start)) {
+      self->seg_start = ts;
+    } else if (ts >= self->seg_start + self->segment_duration) {
+      if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)
+          && !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS)) {
+        _finish_segment (self, ts, FALSE, &done);
+        count = self->seg_index;
+      } else if (!self->seg_key_requested) {
+        self->seg_key_requested = TRUE;
+        request = TRUE;
+        count = self->seg_index + 1;
+      }
+    }
+
+    self->seg_end = ts;
+    if (GST_BUFFER_DURATION_IS_VALID (buf))
+      self->seg_end += GST_BUFFER_DURATION (buf);
+  }
+  self->seg_out += GST_BUFFER_SIZE (buf);
+  GST_OBJECT_UNLOCK (self);
+
+  if (request) {
+    GST_DEBUG_OBJECT (self, "asking for a keyframe for segment %u", count);
+    gst_pad_send_event (pad, gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+            gst_structure_new ("GstForceKeyUnit",
+                "running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+                "all-headers", G_TYPE_BOOLEAN, TRUE,
+                "count", G_TYPE_UINT, count, NULL)));
+  }
+
+  if (done.segment != NULL) {
+    gst_pad_push_event (pad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+            gst_structure_new ("GstForceKeyUnit",
+                "timestamp", G_TYPE_UINT64, ts,
+                "stream-time", G_TYPE_UINT64, ts,
+                "running-time", G_TYPE_UINT64, ts,
+                "all-headers", G_TYPE_BOOLEAN, TRUE,
+                "count", G_TYPE_UINT, count, NULL)));
+    _post_segment_done (self, &done);
+  }
+
+  return TRUE;
+};
+
+/* The output is complete, nothing left to resume and the last segment
+ * ends here */
+static gboolean
+_src_probe_event (GstPad * pad, GstEvent * event, gpointer user_data)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
+  GstSegmentDone done = { NULL, };
+  gchar *location = NULL;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_EOS)
+    return TRUE;
+
+  GST_OBJECT_LOCK (self);
+  if (self->segmenting && GST_CLOCK_TIME_IS_VALID (self->seg_start)
+      && self->seg_out > self->seg_offset)
+    _finish_segment (self, self->seg_end, TRUE, &done);
+  GST_OBJECT_UNLOCK (self);
+
+  if (done.segment != NULL)
+    _post_segment_done (self, &done);
+
+  GST_OBJECT_LOCK (self);
+  if (self->appendable) {
+    location = g_strdup (self->checkpoint_location);
+    self->resume_position = 0;
+    self->resume_offset = 0;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (location != NULL) {
+    g_unlink (location);
+    g_free (location);
+  }
+
+  return TRUE;
+};
+
+/* Work out which pool the streaming threads come from this time round */
+static void
+_update_task_pool (GstTranscodeBin * self)
+{
+  GstTaskPool *pool = NULL, *old;
+  guint threads;
+  gboolean pin, own = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  threads = self->pool_threads;
+  pin = self->pin_threads;
+
+  if (self->task_pool != NULL) {
+    pool = gst_object_ref (self->task_pool);
+  } else if (self->shared_pool) {
+    pool = gst_transcode_task_pool_get_shared (pin);
+  } else if (threads > 0) {
+    if (self->own_pool == NULL)
+      self->own_pool = gst_transcode_task_pool_new (threads, pin);
+    pool = gst_object_ref (self->own_pool);
+    own = TRUE;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  /* The settings may have changed since the pool was made */
+  if (own)
+    g_object_set (pool, "max-threads", threads, "pin-threads", pin, NULL);
+
+  GST_OBJECT_LOCK (self);
+  old = self->pool;
+  self->pool = pool;
+  GST_OBJECT_UNLOCK (self);
+
+  if (old != NULL)
+    gst_object_unref (old);
+};
+
+/* Streaming threads of every element in the bin, however deeply nested,
+ * are announced here before they start, which is where they can be
+ * pointed at another pool */
+static void
+gst_transcode_bin_handle_message (GstBin * bin, GstMessage * message)
+{
+  GstTranscodeBin *self = GST_TRANSCODE_BIN (bin);
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STREAM_STATUS) {
+    GstStreamStatusType type;
+    GstElement *owner;
+    const GValue *val;
+    GstTaskPool *pool = NULL;
+
+    gst_message_parse_stream_status (message, &type, &owner);
+    val = gst_message_get_stream_status_object (message);
+
+    GST_OBJECT_LOCK (self);
+    if (self->pool != NULL)
+      pool = gst_object_ref (self->pool);
+    GST_OBJECT_UNLOCK (self);
+
+    if (pool != NULL && type == GST_STREAM_STATUS_TYPE_CREATE && val != NULL
+        && G_VALUE_TYPE (val) == GST_TYPE_TASK) {
+      GST_DEBUG_OBJECT (self, "task of %s from %" GST_PTR_FORMAT,
+          GST_OBJECT_NAME (owner), pool);
+      gst_task_set_pool (GST_TASK (g_value_get_object (val)), pool);
+    }
+
+    if (pool != NULL)
+      gst_object_unref (pool);
+  }
+
+  GST_BIN_CLASS (parent_class)->handle_message (bin, message);
+};
+
+static void
+_switch_pad_blocked (GstPad * pad, gboolean blocked, gpointer user_data)
+{
+  GST_DEBUG_OBJECT (pad, "blocked: %d", blocked);
+};
+
+/* Remember the stream's segment, the new encodebin needs it too */
+static gboolean
+_stream_probe_segment (GstPad * pad, GstEvent * event, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstTranscodeBin *self = stream->self;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_NEWSEGMENT) {
+    GST_OBJECT_LOCK (self);
+    gst_event_replace (&stream->segment, event);
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return TRUE;
+};
+
+/* Set up everything a stream will go through in the new encodebin while
+ * it still feeds the old one, and return the pad it moves to. All of the
+ * new muxer's pads have to exist before any data reaches it, as muxers
+ * take their list of streams from the pads they have by then. Call with
+ * the link_lock held. */
+static GstPad *
+_prepare_stream_switch (GstTranscodeBin * self, GstElement * ebin,
+    GstTranscodeStream * stream)
+{
+  GstElement *early;
+  GstPad *encode_sink, *pad;
+  GstCaps *ecaps;
+
+  early = _make_early_convert (self, ebin, stream->caps);
+  if (early != NULL) {
+    pad = gst_element_get_static_pad (early, "src");
+    ecaps = gst_pad_get_caps (pad);
+    gst_object_unref (pad);
+  } else {
+    ecaps = gst_caps_ref (stream->caps);
+  }
+
+  g_static_private_set (&stream_pool, stream->pool, NULL);
+  encode_sink = _request_encoder_pad (self, ebin, ecaps);
+  g_static_private_set (&stream_pool, NULL, NULL);
+  gst_caps_unref (ecaps);
+
+  if (encode_sink == NULL) {
+    GST_WARNING_OBJECT (self, "No pad for %s in the new profile",
+        stream->name);
+    if (early != NULL)
+      gst_object_unref (early);
+    return NULL;
+  }
+
+  if (early == NULL)
+    return encode_sink;
+
+  gst_bin_add (GST_BIN (self), early);
+  pad = gst_element_get_static_pad (early, "src");
+  gst_pad_link (pad, encode_sink);
+  gst_object_unref (pad);
+  gst_object_unref (encode_sink);
+  gst_element_sync_state_with_parent (early);
+  _add_element (self, early);
+
+  return gst_element_get_static_pad (early, "sink");
+};
+
+/* Move one stream from the old encodebin to the pad waiting for it in the
+ * new one, in its encoder thread between two buffers. The old branch gets
+ * an EOS to drain. */
+static void
+_relink_stream (GstTranscodeBin * self, GstTranscodeStream * stream)
+{
+  GstElement *ebin;
+  GstPad *old_peer, *sink;
+  GstEvent *segment;
+  gboolean link_ok;
+
+  GST_OBJECT_LOCK (self);
+  ebin = gst_object_ref (self->ebin);
+  segment = stream->segment ? gst_event_ref (stream->segment) : NULL;
+  sink = stream->switch_sink;
+  stream->switch_sink = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  old_peer = gst_pad_get_peer (stream->qsrc);
+  if (old_peer != NULL)
+    gst_pad_unlink (stream->qsrc, old_peer);
+
+  link_ok = sink != NULL
+      && gst_pad_link (stream->qsrc, sink) == GST_PAD_LINK_OK;
 
   if (!link_ok) {
-    GST_WARNING ("Failed to link pad '%s' to '%s'", padname, epadname);
+    GST_WARNING_OBJECT (self, "Could not move %s to the new profile",
+        stream->name);
+  } else if (segment != NULL) {
+    gst_pad_push_event (stream->qsrc, gst_event_ref (segment));
   }
 
-  g_free (padname);
-  g_free (decaps);
-  g_free (epadname);
+  if (old_peer != NULL) {
+    gst_pad_send_event (old_peer, gst_event_new_eos ());
+    gst_object_unref (old_peer);
+  }
 
-  return link_ok;
+  /* The new encodebin starts out with its own encoder and scaling */
+  g_mutex_lock (stream->lock);
+  stream->ctl_wall = GST_CLOCK_TIME_NONE;
+  stream->speed_steps = 0;
+  stream->scale_level = 0;
+  g_mutex_unlock (stream->lock);
+
+  GST_OBJECT_LOCK (self);
+  stream->ebin = ebin;
+  stream->switch_pending = FALSE;
+  self->n_switching--;
+  if (link_ok)
+    self->n_switched++;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "moved %s to %s", stream->name,
+      GST_OBJECT_NAME (ebin));
+
+  if (segment != NULL)
+    gst_event_unref (segment);
+  if (sink != NULL)
+    gst_object_unref (sink);
+  gst_object_unref (ebin);
 };
 
 static gboolean
-_dbin_autoplug_continue (GstElement * bin, GstPad * pad, GstCaps *
-    caps, gpointer user_data)
+_stream_probe_switch (GstPad * pad, GstBuffer * buf, gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstTranscodeBin *self = stream->self;
+  gboolean pending;
+
+  GST_OBJECT_LOCK (self);
+  pending = stream->switch_pending;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!pending)
+    return TRUE;
+
+  /* Copied streams can only be cut at a keyframe; encoders start a new
+   * stream with one anyway */
+  if (stream->stream_copy
+      && GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    return TRUE;
+
+  _relink_stream (self, stream);
+
+  return TRUE;
+};
+
+/* A stream that ends moves over with its EOS, so the new encodebin ends
+ * it too; one that got nothing in time moves with our event, which goes
+ * no further */
+static gboolean
+_stream_probe_switch_event (GstPad * pad, GstEvent * event,
+    gpointer user_data)
+{
+  GstTranscodeStream *stream = (GstTranscodeStream *) user_data;
+  GstTranscodeBin *self = stream->self;
+  gboolean ours, pending;
+
+  ours = GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM
+      && gst_structure_has_name (gst_event_get_structure (event),
+      SWITCH_EVENT);
+  if (!ours && GST_EVENT_TYPE (event) != GST_EVENT_EOS)
+    return TRUE;
+
+  GST_OBJECT_LOCK (self);
+  pending = stream->switch_pending;
+  GST_OBJECT_UNLOCK (self);
+
+  if (pending)
+    _relink_stream (self, stream);
+
+  return !ours;
+};
+
+/* Sparse or stalled streams may not see another buffer for a long time,
+ * and the new muxer waits for all of its streams. Their queues are sent
+ * an event to move them by; for stream-copied ones that means the new
+ * output may not start on a keyframe. */
+static gboolean
+_switch_timed_out (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
 {
   GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
-  self->dcaps = caps;
+  GList *pending = NULL, *iter;
 
-  return !_cast_autoplug_spell (self, pad);
+  GST_OBJECT_LOCK (self);
+  if (self->switch_timeout == id) {
+    for (iter = self->streams; iter; iter = iter->next) {
+      GstTranscodeStream *stream = (GstTranscodeStream *) iter->data;
+
+      if (stream->switch_pending)
+        pending = g_list_prepend (pending, gst_object_ref (stream->qsink));
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  for (iter = pending; iter; iter = iter->next) {
+    GstPad *qsink = GST_PAD (iter->data);
+
+    GST_DEBUG_OBJECT (self, "moving %s:%s after the timeout",
+        GST_DEBUG_PAD_NAME (qsink));
+    gst_pad_send_event (qsink, gst_event_new_custom
+        (GST_EVENT_CUSTOM_DOWNSTREAM, gst_structure_empty_new (SWITCH_EVENT)));
+    gst_object_unref (qsink);
+  }
+  g_list_free (pending);
+
+  return TRUE;
+};
+
+/* Done with the old encodebin; returns how many streams moved over */
+static guint
+_end_switch (GstTranscodeBin * self, GstPad * old_src)
+{
+  GstClockID timeout;
+  guint switched;
+  gulong probe;
+
+  GST_OBJECT_LOCK (self);
+  timeout = self->switch_timeout;
+  self->switch_timeout = NULL;
+  switched = self->n_switched;
+  if (self->old_ebin != NULL)
+    self->retired = g_list_prepend (self->retired, self->old_ebin);
+  self->old_ebin = NULL;
+  self->n_switching = 0;
+  probe = self->old_eos_probe;
+  self->old_eos_probe = 0;
+  GST_OBJECT_UNLOCK (self);
+
+  /* Takes the pad's lock, not to be nested in ours */
+  if (probe != 0)
+    gst_pad_remove_event_probe (old_src, probe);
+
+  if (timeout != NULL) {
+    gst_clock_id_unschedule (timeout);
+    gst_clock_id_unref (timeout);
+  }
+
+  return switched;
 };
 
+/* Continue the output with the new encodebin, held back until now */
 static void
-_dbin_pad_added (GstElement * bin, GstPad * pad, gpointer user_data)
+_take_over (GstTranscodeBin * self, guint switched)
+{
+  GstElement *ebin;
+  GstPad *new_src;
+  GstClockTime latency;
+
+  GST_OBJECT_LOCK (self);
+  ebin = gst_object_ref (self->ebin);
+  GST_OBJECT_UNLOCK (self);
+
+  new_src = gst_element_get_static_pad (ebin, "src");
+  gst_ghost_pad_set_target (GST_GHOST_PAD (self->srcpad), new_src);
+  gst_pad_set_blocked_async (new_src, FALSE, _switch_pad_blocked, NULL);
+
+  GST_OBJECT_LOCK (self);
+  latency = gst_util_get_timestamp () - self->switch_start;
+  self->switch_latency = latency;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_INFO_OBJECT (self, "profile change took %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (latency));
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("transcodebin-profile-switch",
+              "latency", G_TYPE_UINT64, latency,
+              "streams", G_TYPE_UINT, switched, NULL)));
+
+  gst_object_unref (new_src);
+  gst_object_unref (ebin);
+};
+
+/* The old encodebin has written everything */
+static gboolean
+_old_ebin_probe_eos (GstPad * pad, GstEvent * event, gpointer user_data)
 {
   GstTranscodeBin *self = GST_TRANSCODE_BIN (user_data);
-  _cast_autoplug_spell (self, pad);
+  guint switched;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_EOS)
+    return TRUE;
+
+  switched = _end_switch (self, pad);
+  _take_over (self, switched);
+
+  /* Input ended before any stream moved over: the new encodebin never
+   * gets an EOS, pass on the old one now that it is retired */
+  if (switched == 0) {
+    GST_WARNING_OBJECT (self, "Input ended before the profile change");
+    gst_pad_push_event (self->srcpad, gst_event_ref (event));
+  }
+
+  /* Not from here, shutting the old encodebin down waits for this thread */
+  _join_retire_thread (self);
+  GST_OBJECT_LOCK (self);
+  self->retire_thread = g_thread_create (_retire_thread, self, TRUE, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  /* Downstream only gets the new encodebin's EOS */
+  return FALSE;
+};
+
+static void
+_switch_profile (GstTranscodeBin * self, GstEncodingProfile * prof)
+{
+  GstElement *ebin, *old_ebin;
+  GstPad *new_src, *old_src;
+  GstClock *clock;
+  GList *iter, *copied = NULL, *moving = NULL;
+  gboolean refuse = FALSE, restartable;
+  guint n = 0;
+
+  /* No stream is linked to the old encodebin until the new one takes
+   * over, as all of them have to be ready to move by then */
+  g_mutex_lock (self->link_lock);
+
+  GST_OBJECT_LOCK (self);
+  if (self->old_ebin != NULL) {
+    GST_OBJECT_UNLOCK (self);
+    g_mutex_unlock (self->link_lock);
+    GST_WARNING_OBJECT (self, "Profile change already in progress");
+    return;
+  }
+  /* The new output is appended to the old one, container and all */
+  restartable = gst_transcode_profile_is_appendable (self->profile)
+      && gst_transcode_profile_is_appendable (prof);
+  for (iter = self->streams; iter; iter = iter->next) {
+    GstTranscodeStream *stream = (GstTranscodeStream *) iter->data;
+
+    if (stream->ebin != self->ebin)
+      continue;
+    moving = g_list_prepend (moving, stream);
+    if (stream->stream_copy)
+      copied = g_list_prepend (copied, gst_caps_ref (stream->caps));
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  /* Copied streams have no decoder to feed an encoder from */
+  for (iter = copied; iter; iter = iter->next) {
+    if (!_profile_accepts_stream (prof, (GstCaps *) iter->data))
+      refuse = TRUE;
+    gst_caps_unref ((GstCaps *) iter->data);
+  }
+  g_list_free (copied);
+
+  if (refuse) {
+    GST_WARNING_OBJECT (self, "Stream-copied streams don't fit the new "
+        "profile, keeping the old one");
+    g_list_free (moving);
+    g_mutex_unlock (self->link_lock);
+    return;
+  }
+
+  if (!restartable) {
+    GST_WARNING_OBJECT (self, "The container can't be restarted in the "
+        "output, keeping the old profile");
+    g_list_free (moving);
+    g_mutex_unlock (self->link_lock);
+    return;
+  }
+
+  ebin = gst_element_factory_make (ENCODE_BIN, NULL);
+  if (ebin == NULL) {
+    GST_WARNING_OBJECT (self, "Could not create " ENCODE_BIN);
+    g_list_free (moving);
+    g_mutex_unlock (self->link_lock);
+    return;
+  }
+
+  g_object_set (G_OBJECT (ebin), "profile", prof, NULL);
+  g_signal_connect (ebin, "element-added", G_CALLBACK (_ebin_element_added),
+      self);
+  _apply_latency_mode (self, ebin);
+  _apply_memory_budget (self, ebin);
+  gst_bin_add (GST_BIN (self), ebin);
+
+  /* Held back until the old encodebin is drained */
+  new_src = gst_element_get_static_pad (ebin, "src");
+  gst_pad_set_blocked_async (new_src, TRUE, _switch_pad_blocked, NULL);
+  gst_object_unref (new_src);
+
+  gst_element_sync_state_with_parent (ebin);
+
+  /* Streams are only added in READY or by autoplugging, which links and
+   * adds them under the link_lock, so the list is safe to walk without
+   * the object lock here */
+  for (iter = moving; iter; iter = iter->next) {
+    GstTranscodeStream *stream = (GstTranscodeStream *) iter->data;
+    GstPad *sink = _prepare_stream_switch (self, ebin, stream);
+
+    GST_OBJECT_LOCK (self);
+    stream->switch_sink = sink;
+    GST_OBJECT_UNLOCK (self);
+  }
+  g_list_free (moving);
+
+  GST_OBJECT_LOCK (self);
+  old_ebin = self->ebin;
+  old_src = gst_element_get_static_pad (old_ebin, "src");
+  self->old_eos_probe = gst_pad_add_event_probe (old_src,
+      G_CALLBACK (_old_ebin_probe_eos), self);
+  self->old_ebin = old_ebin;
+  self->ebin = ebin;
+  if (self->profile != NULL)
+    gst_encoding_profile_unref (self->profile);
+  self->profile = GST_ENCODING_PROFILE (gst_encoding_profile_ref (prof));
+  self->switch_start = gst_util_get_timestamp ();
+  self->n_switched = 0;
+
+  for (iter = self->streams; iter; iter = iter->next) {
+    GstTranscodeStream *stream = (GstTranscodeStream *) iter->data;
+
+    if (stream->ebin == old_ebin) {
+      stream->switch_pending = TRUE;
+      n++;
+    }
+  }
+  self->n_switching = n;
+
+  if (n > 0) {
+    clock = gst_system_clock_obtain ();
+    self->switch_timeout = gst_clock_new_single_shot_id (clock,
+        gst_clock_get_time (clock) + SWITCH_TIMEOUT);
+    gst_clock_id_wait_async_full (self->switch_timeout, _switch_timed_out,
+        gst_object_ref (self), (GDestroyNotify) gst_object_unref);
+    gst_object_unref (clock);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  _clear_decisions (self);
+  g_mutex_unlock (self->link_lock);
+
+  GST_INFO_OBJECT (self, "switching %u streams to profile %s", n,
+      gst_encoding_profile_get_name (prof));
+
+  /* Nothing linked yet: the new encodebin takes over right away */
+  if (n == 0) {
+    _end_switch (self, old_src);
+    _take_over (self, 0);
+    _remove_retired (self);
+  }
+  gst_object_unref (old_src);
+};
+
+/* Shut down and remove the encodebins that were switched away from */
+static void
+_remove_retired (GstTranscodeBin * self)
+{
+  GList *retired;
+
+  GST_OBJECT_LOCK (self);
+  retired = self->retired;
+  self->retired = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  while (retired != NULL) {
+    GstElement *ebin = GST_ELEMENT (retired->data);
+
+    _release_encoder_pads (self, ebin);
+    gst_element_set_state (ebin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (self), ebin);
+
+    retired = g_list_delete_link (retired, retired);
+  }
+};
+
+static gpointer
+_retire_thread (gpointer user_data)
+{
+  _remove_retired (GST_TRANSCODE_BIN (user_data));
+
+  return NULL;
+};
+
+static void
+_join_retire_thread (GstTranscodeBin * self)
+{
+  GThread *thread;
+
+  GST_OBJECT_LOCK (self);
+  thread = self->retire_thread;
+  self->retire_thread = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (thread != NULL)
+    g_thread_join (thread);
+};
+
+/* Encodebins that were switched away from, drained by now; a switch that
+ * didn't get to finish is cut short */
+static void
+_retire_encoders (GstTranscodeBin * self)
+{
+  GstElement *old_ebin;
+
+  _join_retire_thread (self);
+
+  GST_OBJECT_LOCK (self);
+  old_ebin = self->old_ebin ? gst_object_ref (self->old_ebin) : NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (old_ebin != NULL) {
+    GstPad *old_src = gst_element_get_static_pad (old_ebin, "src");
+    GstPad *new_src = gst_element_get_static_pad (self->ebin, "src");
+
+    _end_switch (self, old_src);
+    gst_ghost_pad_set_target (GST_GHOST_PAD (self->srcpad), new_src);
+    gst_pad_set_blocked_async (new_src, FALSE, _switch_pad_blocked, NULL);
+
+    gst_object_unref (new_src);
+    gst_object_unref (old_src);
+    gst_object_unref (old_ebin);
+  }
+
+  _remove_retired (self);
 };
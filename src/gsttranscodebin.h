@@ -21,6 +21,7 @@
 #define __GST_TRANSCODE_BIN_H__
 
 #include <gst/gst.h>
+#include <gst/pbutils/encoding-profile.h>
 
 G_BEGIN_DECLS
 
@@ -31,8 +32,83 @@ G_BEGIN_DECLS
  * conformant to a particular #GstEncodingProfile. Internally, it's an autoplug
  * wrapper around #GstDecodeBin2 and #GstEncodeBin, providing similar pads
  * to said bins.
+ *
+ * Instead of being fed through its sink pad, the bin can read its input
+ * itself from #GstTranscodeBin:uri or #GstTranscodeBin:location; it is a
+ * #GstURIHandler for file URIs. Local files are memory-mapped rather
+ * than read.
+ *
+ * Additional "src_\%d" request pads each produce another rendition of the
+ * same input, using the matching entry of the "profiles" property; the input
+ * is still only demuxed and decoded once.
+ *
+ * A "preview" request pad gives downscaled JPEG or PNG stills of the first
+ * decoded video stream, one per #GstTranscodeBin:preview-interval, taken
+ * from the frames decoded for the encoder. Video that is stream-copied
+ * isn't decoded, so it has no previews.
+ *
+ * With #GstTranscodeBin:segment-duration set, MPEG-TS output is cut into
+ * segments that each start with a keyframe, marked by downstream
+ * "GstForceKeyUnit" events (for multifilesink's key-unit-event mode) and
+ * announced in "transcodebin-segment" and "transcodebin-playlist" element
+ * messages as they are finished.
+ *
+ * #GstTranscodeBin:target-speed keeps re-encoded video at a real-time
+ * factor by trading quality for speed while it falls behind.
+ *
+ * Streams coming out of a demuxer can be left out by type, language or
+ * index, and by default are left out when no profile has a use for them.
+ * Those streams are never decoded.
+ *
+ * Setting the bin back to %GST_STATE_READY unlinks everything set up for
+ * the previous input while keeping the internal bins, so it can be reused
+ * for the next input without being rebuilt.
  */
 
+/**
+ * GstTranscodeLatencyMode:
+ * @GST_TRANSCODE_LATENCY_BATCH: throughput first, with the default buffering
+ * @GST_TRANSCODE_LATENCY_LIVE: small leaky queues and zero-lookahead
+ * encoders, for live sources
+ */
+typedef enum
+{
+    GST_TRANSCODE_LATENCY_BATCH,
+    GST_TRANSCODE_LATENCY_LIVE
+} GstTranscodeLatencyMode;
+
+#define GST_TYPE_TRANSCODE_LATENCY_MODE     (gst_transcode_latency_mode_get_type ())
+
+/**
+ * GstTranscodeStreamType:
+ * @GST_TRANSCODE_STREAM_VIDEO: video streams
+ * @GST_TRANSCODE_STREAM_AUDIO: audio streams
+ * @GST_TRANSCODE_STREAM_TEXT: subtitle streams
+ * @GST_TRANSCODE_STREAM_OTHER: anything else
+ */
+typedef enum
+{
+    GST_TRANSCODE_STREAM_VIDEO = (1 << 0),
+    GST_TRANSCODE_STREAM_AUDIO = (1 << 1),
+    GST_TRANSCODE_STREAM_TEXT = (1 << 2),
+    GST_TRANSCODE_STREAM_OTHER = (1 << 3)
+} GstTranscodeStreamType;
+
+#define GST_TYPE_TRANSCODE_STREAM_TYPE      (gst_transcode_stream_type_get_type ())
+
+/**
+ * GstTranscodePreviewFormat:
+ * @GST_TRANSCODE_PREVIEW_JPEG: JPEG images
+ * @GST_TRANSCODE_PREVIEW_PNG: PNG images
+ */
+typedef enum
+{
+    GST_TRANSCODE_PREVIEW_JPEG,
+    GST_TRANSCODE_PREVIEW_PNG
+} GstTranscodePreviewFormat;
+
+#define GST_TYPE_TRANSCODE_PREVIEW_FORMAT   (gst_transcode_preview_format_get_type ())
+
 #define GST_TYPE_TRANSCODE_BIN              (gst_transcode_bin_get_type ())
 #define GST_TRANSCODE_BIN(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_TRANSCODE_BIN, GstTranscodeBin))
 #define GST_IS_TRANSCODE_BIN(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_TRANSCODE_BIN))
@@ -51,15 +127,150 @@ typedef struct _GstTranscodeBin
     
     GstPad* srcpad;
     GstPad* sinkpad;
+    /* the source ghost pad's own query function, chained up to from ours */
+    GstPadQueryFunction proxy_query;
+
+    /* own input, replacing the sink pad's target while set; protected by
+     * the object lock */
+    gchar* uri;
+    GstElement* source;
     
-    GstCaps* dcaps;
+    /* encodebin request pads we linked, protected by the object lock;
+     * link_lock serializes requesting and linking them, as decodebin2
+     * exposes pads from several streaming threads at once */
     GList* reqpads;
+    GMutex* link_lock;
+
+    GstEncodingProfile* profile;
+    gboolean stream_copy;
+
+    GValueArray* profiles;
+    GList* outputs;
+
+    guint queue_max_buffers;
+    guint queue_max_bytes;
+    guint64 queue_max_time;
+
+    /* autoplug decisions, protected by the object lock */
+    GList* decisions;
+    guint n_decisions;
+    GstClockTime setup_time;
+
+    /* per-stream statistics, list protected by the object lock */
+    GList* streams;
+    GstClockTime stats_interval;
+    GstClockTime last_stats_post;
+
+    /* per-stream queues and tees, dropped when going back to READY */
+    GList* elements;
+
+    gboolean early_convert;
+
+    /* latency mode, input arrival times and the measured latency,
+     * protected by the object lock */
+    GstTranscodeLatencyMode latency_mode;
+    GQueue arrivals;
+    gboolean timed_input;
+    GstClockTime latency;
+    GstClockTime max_latency;
+
+    /* bytes held in the per-stream queues against max_memory */
+    GMutex* mem_lock;
+    GCond* mem_cond;
+    guint64 max_memory;
+    guint64 memory;
+    guint64 peak_memory;
+    gboolean mem_flushing;
+
+    /* stream selection, protected by the object lock */
+    GstTranscodeStreamType stream_types;
+    gchar* languages;
+    gboolean prune_streams;
+    guint n_demuxed;
+    GList* deferred;
+
+    /* time range, protected by the object lock; the run_ ones are what
+     * this run clips to, taken when going to PAUSED */
+    GstClockTime start_time;
+    GstClockTime stop_time;
+    GstClockTime run_start;
+    GstClockTime run_stop;
+    GstClockTime run_base;
+    gint seek_state;
+    GThread* seek_thread;
+    GList* clips;
+
+    /* checkpointing; all but the interval protected by the object lock */
+    gchar* checkpoint_location;
+    GstClockTime checkpoint_interval;
+    GstClockTime resume_position;
+    guint64 resume_offset;
+    gboolean appendable;
+    guint64 out_offset;
+    GstClockTime last_checkpoint;
+    guint64 last_checkpoint_offset;
+
+    /* streaming thread pool; pool is the one handed to tasks, chosen when
+     * going to PAUSED, all protected by the object lock */
+    GstTaskPool* task_pool;
+    guint pool_threads;
+    gboolean pin_threads;
+    gboolean shared_pool;
+    GstTaskPool* own_pool;
+    GstTaskPool* pool;
+
+    /* profile switch while running: the encodebin being drained, how many
+     * of its streams are still to move over, the deadline for moving them,
+     * the encodebins done with and the thread removing them, protected by
+     * the object lock */
+    GstElement* old_ebin;
+    guint n_switching;
+    guint n_switched;
+    gulong old_eos_probe;
+    GstClockID switch_timeout;
+    GstClockTime switch_start;
+    GstClockTime switch_latency;
+    GList* retired;
+    GThread* retire_thread;
+
+    /* still images on the preview pad; all protected by the object lock,
+     * preview_linked is set once a video stream feeds it */
+    GstPad* preview_pad;
+    GstClockTime preview_interval;
+    gboolean preview_keyframes;
+    guint preview_width;
+    GstTranscodePreviewFormat preview_format;
+    gboolean preview_linked;
+    GstClockTime preview_next;
+
+    /* segmented output, all protected by the object lock; seg_durations
+     * holds the GstClockTime of every finished segment */
+    GstClockTime segment_duration;
+    gchar* segment_location;
+    gboolean segmenting;
+    guint seg_index;
+    GstClockTime seg_start;
+    GstClockTime seg_end;
+    guint64 seg_offset;
+    guint64 seg_out;
+    gboolean seg_key_requested;
+    GArray* seg_durations;
+
+    /* speed control, protected by the object lock */
+    gdouble target_speed;
 } GstTranscodeBin;
 
 typedef GstBinClass GstTranscodeBinClass;
 
+GType gst_transcode_latency_mode_get_type(void);
+GType gst_transcode_stream_type_get_type(void);
+GType gst_transcode_preview_format_get_type(void);
 GType gst_transcode_bin_get_type(void);
 
+GstStructure* gst_transcode_bin_check_profiles(GstTranscodeBin* bin,
+        const GstCaps* streams, const GValueArray* profiles);
+gboolean gst_transcode_profile_is_appendable(GstEncodingProfile* prof);
+
 G_END_DECLS
 
 #endif
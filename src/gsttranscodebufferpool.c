@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "gsttranscodebufferpool.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (transcode_buffer_pool_debug);
+#define GST_CAT_DEFAULT transcode_buffer_pool_debug
+
+GST_BOILERPLATE (GstTranscodeBufferPool, gst_transcode_buffer_pool, GstObject,
+    GST_TYPE_OBJECT);
+
+/* A buffer that goes back to its pool when the last ref is dropped */
+typedef struct _GstTranscodeBuffer
+{
+  GstBuffer buffer;
+  GstTranscodeBufferPool *pool;
+  guint8 *memory;
+  guint memory_size;
+} GstTranscodeBuffer;
+
+static GstMiniObjectClass *buffer_parent_class = NULL;
+
+static void gst_transcode_buffer_pool_class_init (GstTranscodeBufferPoolClass *
+    kls);
+static void gst_transcode_buffer_pool_init (GstTranscodeBufferPool * self,
+    GstTranscodeBufferPoolClass * kls);
+static void gst_transcode_buffer_pool_finalize (GObject * goself);
+
+static void
+gst_transcode_buffer_finalize (GstTranscodeBuffer * tbuf)
+{
+  GstTranscodeBufferPool *pool = tbuf->pool;
+  gboolean recycle;
+
+  GST_OBJECT_LOCK (pool);
+  recycle = !pool->flushing && tbuf->memory_size == pool->size
+      && GST_BUFFER_MALLOCDATA (tbuf) == tbuf->memory
+      && pool->n_free < pool->max_free;
+  if (recycle) {
+    /* Bring it back to life, the pool holds the ref now */
+    gst_buffer_ref (GST_BUFFER_CAST (tbuf));
+    pool->free = g_slist_prepend (pool->free, tbuf);
+    pool->n_free++;
+  }
+  GST_OBJECT_UNLOCK (pool);
+
+  if (recycle)
+    return;
+
+  tbuf->pool = NULL;
+  gst_object_unref (pool);
+
+  buffer_parent_class->finalize (GST_MINI_OBJECT_CAST (tbuf));
+};
+
+static void
+gst_transcode_buffer_class_init (gpointer g_class, gpointer class_data)
+{
+  GstMiniObjectClass *mokls = GST_MINI_OBJECT_CLASS (g_class);
+
+  buffer_parent_class = g_type_class_peek_parent (g_class);
+  mokls->finalize = (GstMiniObjectFinalizeFunction)
+      gst_transcode_buffer_finalize;
+};
+
+static GType
+gst_transcode_buffer_get_type (void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter (&type)) {
+    static const GTypeInfo info = {
+      sizeof (GstBufferClass),
+      NULL,
+      NULL,
+      gst_transcode_buffer_class_init,
+      NULL,
+      NULL,
+      sizeof (GstTranscodeBuffer),
+      0,
+      NULL,
+      NULL
+    };
+    GType t = g_type_register_static (GST_TYPE_BUFFER, "GstTranscodeBuffer",
+        &info, 0);
+
+    g_once_init_leave (&type, t);
+  }
+
+  return type;
+};
+
+static void
+gst_transcode_buffer_pool_base_init (gpointer gpkls)
+{
+};
+
+static void
+gst_transcode_buffer_pool_class_init (GstTranscodeBufferPoolClass * kls)
+{
+  GObjectClass *gokls = G_OBJECT_CLASS (kls);
+
+  gokls->finalize = gst_transcode_buffer_pool_finalize;
+
+  GST_DEBUG_CATEGORY_INIT (transcode_buffer_pool_debug,
+      "transcodebufferpool", 0, "Frame buffer recycling for transcodebin");
+};
+
+static void
+gst_transcode_buffer_pool_init (GstTranscodeBufferPool * self,
+    GstTranscodeBufferPoolClass * kls)
+{
+  self->max_free = 0;
+  self->flushing = FALSE;
+  self->size = 0;
+  self->free = NULL;
+  self->n_free = 0;
+
+  self->allocated = 0;
+  self->recycled = 0;
+  self->frames = 0;
+  self->copies = 0;
+
+  memset (self->seen, 0, sizeof (self->seen));
+  self->seen_pos = 0;
+};
+
+static void
+gst_transcode_buffer_pool_finalize (GObject * goself)
+{
+  GstTranscodeBufferPool *self = GST_TRANSCODE_BUFFER_POOL (goself);
+
+  /* Every recycled buffer holds a ref on us, so none can be left here */
+  g_warn_if_fail (self->free == NULL);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+/* Unref the buffers taken off the free list, outside the object lock as
+ * they come back through their finalize */
+static void
+_release_buffers (GSList * buffers)
+{
+  while (buffers != NULL) {
+    gst_buffer_unref (GST_BUFFER_CAST (buffers->data));
+    buffers = g_slist_delete_link (buffers, buffers);
+  }
+};
+
+/**
+ * gst_transcode_buffer_pool_new:
+ * @max_free: buffers to keep for reuse while nobody uses them
+ *
+ * Returns: a new #GstTranscodeBufferPool
+ */
+GstTranscodeBufferPool *
+gst_transcode_buffer_pool_new (guint max_free)
+{
+  GstTranscodeBufferPool *pool =
+      g_object_new (GST_TYPE_TRANSCODE_BUFFER_POOL, NULL);
+
+  pool->max_free = max_free;
+
+  return pool;
+};
+
+/**
+ * gst_transcode_buffer_pool_alloc:
+ * @pool: a #GstTranscodeBufferPool
+ * @offset: offset for the new buffer
+ * @size: size of the new buffer
+ * @caps: caps of the new buffer
+ * @buf: where to put the new buffer
+ *
+ * Hands out a recycled buffer if one of the right size is free and a new
+ * one otherwise; a new size drops the free ones. Has the signature of a
+ * #GstPadBufferAllocFunction minus the pad. Once the pool is flushing,
+ * buffers are plain allocations.
+ *
+ * Returns: #GST_FLOW_OK
+ */
+GstFlowReturn
+gst_transcode_buffer_pool_alloc (GstTranscodeBufferPool * pool,
+    guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf)
+{
+  GstTranscodeBuffer *tbuf = NULL;
+  GSList *stale = NULL;
+
+  g_return_val_if_fail (GST_IS_TRANSCODE_BUFFER_POOL (pool), GST_FLOW_ERROR);
+
+  GST_OBJECT_LOCK (pool);
+  if (pool->flushing) {
+    GST_OBJECT_UNLOCK (pool);
+    *buf = gst_buffer_new_and_alloc (size);
+    GST_BUFFER_OFFSET (*buf) = offset;
+    gst_buffer_set_caps (*buf, caps);
+    return GST_FLOW_OK;
+  }
+
+  /* New frame size, the free buffers are no use anymore */
+  if (size != pool->size) {
+    GST_DEBUG_OBJECT (pool, "now allocating %u bytes for %" GST_PTR_FORMAT,
+        size, caps);
+    stale = pool->free;
+    pool->free = NULL;
+    pool->n_free = 0;
+    pool->size = size;
+  }
+
+  if (pool->free != NULL) {
+    tbuf = (GstTranscodeBuffer *) pool->free->data;
+    pool->free = g_slist_delete_link (pool->free, pool->free);
+    pool->n_free--;
+    pool->recycled++;
+  }
+  pool->allocated++;
+  GST_OBJECT_UNLOCK (pool);
+
+  _release_buffers (stale);
+
+  if (tbuf == NULL) {
+    tbuf = (GstTranscodeBuffer *)
+        gst_mini_object_new (gst_transcode_buffer_get_type ());
+    tbuf->pool = gst_object_ref (pool);
+    tbuf->memory = g_malloc (size);
+    tbuf->memory_size = size;
+    GST_BUFFER_MALLOCDATA (tbuf) = tbuf->memory;
+  } else {
+    /* Whoever had it last may have left anything behind */
+    GST_MINI_OBJECT_FLAGS (tbuf) = 0;
+    GST_BUFFER_TIMESTAMP (tbuf) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION (tbuf) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_OFFSET_END (tbuf) = GST_BUFFER_OFFSET_NONE;
+  }
+
+  GST_BUFFER_DATA (tbuf) = tbuf->memory;
+  GST_BUFFER_SIZE (tbuf) = size;
+  GST_BUFFER_OFFSET (tbuf) = offset;
+  gst_buffer_set_caps (GST_BUFFER_CAST (tbuf), caps);
+
+  *buf = GST_BUFFER_CAST (tbuf);
+
+  return GST_FLOW_OK;
+};
+
+/**
+ * gst_transcode_buffer_pool_set_flushing:
+ * @pool: a #GstTranscodeBufferPool
+ * @flushing: whether to stop recycling
+ *
+ * A flushing pool frees its idle buffers and lets the ones still in use
+ * be freed when they're done, which breaks the refs they hold on the pool.
+ */
+void
+gst_transcode_buffer_pool_set_flushing (GstTranscodeBufferPool * pool,
+    gboolean flushing)
+{
+  GSList *stale = NULL;
+
+  g_return_if_fail (GST_IS_TRANSCODE_BUFFER_POOL (pool));
+
+  GST_OBJECT_LOCK (pool);
+  pool->flushing = flushing;
+  if (flushing) {
+    stale = pool->free;
+    pool->free = NULL;
+    pool->n_free = 0;
+  }
+  GST_OBJECT_UNLOCK (pool);
+
+  _release_buffers (stale);
+};
+
+/**
+ * gst_transcode_buffer_pool_mark_decoded:
+ * @pool: a #GstTranscodeBufferPool
+ * @buf: a frame as it comes out of the decoder
+ *
+ * Remembers where the decoder put the frame.
+ */
+void
+gst_transcode_buffer_pool_mark_decoded (GstTranscodeBufferPool * pool,
+    GstBuffer * buf)
+{
+  GST_OBJECT_LOCK (pool);
+  pool->seen[pool->seen_pos] = GST_BUFFER_DATA (buf);
+  pool->seen_pos = (pool->seen_pos + 1) % GST_TRANSCODE_BUFFER_POOL_SEEN;
+  GST_OBJECT_UNLOCK (pool);
+};
+
+/**
+ * gst_transcode_buffer_pool_check_encoded:
+ * @pool: a #GstTranscodeBufferPool
+ * @buf: a frame as it goes into the encoder
+ *
+ * Counts the frame as copied unless it's still where the decoder put it.
+ */
+void
+gst_transcode_buffer_pool_check_encoded (GstTranscodeBufferPool * pool,
+    GstBuffer * buf)
+{
+  gpointer data = GST_BUFFER_DATA (buf);
+  guint i;
+
+  GST_OBJECT_LOCK (pool);
+  pool->frames++;
+  for (i = 0; i < GST_TRANSCODE_BUFFER_POOL_SEEN; i++) {
+    if (pool->seen[i] == data) {
+      pool->seen[i] = NULL;
+      break;
+    }
+  }
+  if (i == GST_TRANSCODE_BUFFER_POOL_SEEN)
+    pool->copies++;
+  GST_OBJECT_UNLOCK (pool);
+};
+
+/**
+ * gst_transcode_buffer_pool_get_counts:
+ * @pool: a #GstTranscodeBufferPool
+ * @allocated: (out) (allow-none): buffers handed out
+ * @recycled: (out) (allow-none): of those, how many were reused
+ * @copies: (out) (allow-none): frames the encoder got in other memory than
+ *     the decoder wrote them to
+ */
+void
+gst_transcode_buffer_pool_get_counts (GstTranscodeBufferPool * pool,
+    guint64 * allocated, guint64 * recycled, guint64 * copies)
+{
+  g_return_if_fail (GST_IS_TRANSCODE_BUFFER_POOL (pool));
+
+  GST_OBJECT_LOCK (pool);
+  if (allocated)
+    *allocated = pool->allocated;
+  if (recycled)
+    *recycled = pool->recycled;
+  if (copies)
+    *copies = pool->copies;
+  GST_OBJECT_UNLOCK (pool);
+};
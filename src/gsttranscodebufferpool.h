@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_TRANSCODE_BUFFER_POOL_H__
+#define __GST_TRANSCODE_BUFFER_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstTranscodeBufferPool:
+ *
+ * Recycled frame buffers for one stream of a transcodebin. It answers the
+ * buffer-alloc requests that reach the encoder, so the decoder and any
+ * conversion in between write into buffers that come back to the pool
+ * once the encoder is done with them instead of being freed.
+ *
+ * It also counts the frames that reach the encoder in other memory than
+ * the decoder wrote them to, i.e. that were copied or converted on the way.
+ */
+
+#define GST_TYPE_TRANSCODE_BUFFER_POOL              (gst_transcode_buffer_pool_get_type ())
+#define GST_TRANSCODE_BUFFER_POOL(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_TRANSCODE_BUFFER_POOL, GstTranscodeBufferPool))
+#define GST_IS_TRANSCODE_BUFFER_POOL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_TRANSCODE_BUFFER_POOL))
+#define GST_TRANSCODE_BUFFER_POOL_CLASS(kls)        (G_TYPE_CHECK_CLASS_CAST ((kls), GST_TYPE_TRANSCODE_BUFFER_POOL, GstTranscodeBufferPoolClass))
+#define GST_IS_TRANSCODE_BUFFER_POOL_CLASS(kls)     (G_TYPE_CHECK_CLASS_TYPE ((kls), GST_TYPE_TRANSCODE_BUFFER_POOL))
+
+/* Decoded frames remembered for spotting copies; more than any queue in
+ * the bin holds */
+#define GST_TRANSCODE_BUFFER_POOL_SEEN 64
+
+typedef struct _GstTranscodeBufferPool
+{
+    GstObject parent_instance;
+
+    /* protected by the object lock */
+    guint max_free;
+    gboolean flushing;
+    guint size;
+    GSList* free;
+    guint n_free;
+
+    guint64 allocated;
+    guint64 recycled;
+    guint64 frames;
+    guint64 copies;
+
+    gpointer seen[GST_TRANSCODE_BUFFER_POOL_SEEN];
+    guint seen_pos;
+} GstTranscodeBufferPool;
+
+typedef GstObjectClass GstTranscodeBufferPoolClass;
+
+GType gst_transcode_buffer_pool_get_type(void);
+
+GstTranscodeBufferPool* gst_transcode_buffer_pool_new(guint max_free);
+GstFlowReturn gst_transcode_buffer_pool_alloc(GstTranscodeBufferPool* pool, guint64 offset, guint size, GstCaps* caps, GstBuffer** buf);
+void gst_transcode_buffer_pool_set_flushing(GstTranscodeBufferPool* pool, gboolean flushing);
+
+void gst_transcode_buffer_pool_mark_decoded(GstTranscodeBufferPool* pool, GstBuffer* buf);
+void gst_transcode_buffer_pool_check_encoded(GstTranscodeBufferPool* pool, GstBuffer* buf);
+void gst_transcode_buffer_pool_get_counts(GstTranscodeBufferPool* pool, guint64* allocated, guint64* recycled, guint64* copies);
+
+G_END_DECLS
+
+#endif
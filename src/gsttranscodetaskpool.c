@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "gsttranscodetaskpool.h"
+
+#include <unistd.h>
+
+GST_DEBUG_CATEGORY_STATIC (transcode_task_pool_debug);
+#define GST_CAT_DEFAULT transcode_task_pool_debug
+
+GST_BOILERPLATE (GstTranscodeTaskPool, gst_transcode_task_pool, GstTaskPool,
+    GST_TYPE_TASK_POOL);
+
+enum
+{
+  PROP_0,
+  PROP_MAX_THREADS,
+  PROP_PIN_THREADS,
+  PROP_STATS
+};
+
+/* One task handed to the pool; lives until it's joined */
+typedef struct _GstPoolJob
+{
+  GstTaskPoolFunction func;
+  gpointer user_data;
+  gboolean done;
+} GstPoolJob;
+
+typedef struct _GstPoolWorker
+{
+  GstTranscodeTaskPool *pool;
+  GCond *cond;
+  gint cpu;
+  GstPoolJob *job;
+  gboolean quit;
+} GstPoolWorker;
+
+static void gst_transcode_task_pool_class_init (GstTranscodeTaskPoolClass *
+    kls);
+static void gst_transcode_task_pool_init (GstTranscodeTaskPool * self,
+    GstTranscodeTaskPoolClass * kls);
+static void gst_transcode_task_pool_set_property (GObject * goself,
+    guint propid, const GValue * val, GParamSpec * pspec);
+static void gst_transcode_task_pool_get_property (GObject * goself,
+    guint propid, GValue * val, GParamSpec * pspec);
+static void gst_transcode_task_pool_finalize (GObject * goself);
+
+static void gst_transcode_task_pool_prepare (GstTaskPool * pool,
+    GError ** error);
+static void gst_transcode_task_pool_cleanup (GstTaskPool * pool);
+static gpointer gst_transcode_task_pool_push (GstTaskPool * pool,
+    GstTaskPoolFunction func, gpointer user_data, GError ** error);
+static void gst_transcode_task_pool_join (GstTaskPool * pool, gpointer id);
+
+static guint
+_n_cpus (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (guint) n : 1;
+};
+
+static void
+gst_transcode_task_pool_base_init (gpointer gpkls)
+{
+};
+
+static void
+gst_transcode_task_pool_class_init (GstTranscodeTaskPoolClass * kls)
+{
+  GObjectClass *gokls = G_OBJECT_CLASS (kls);
+  GstTaskPoolClass *tpkls = GST_TASK_POOL_CLASS (kls);
+
+  gokls->set_property = gst_transcode_task_pool_set_property;
+  gokls->get_property = gst_transcode_task_pool_get_property;
+  gokls->finalize = gst_transcode_task_pool_finalize;
+
+  tpkls->prepare = gst_transcode_task_pool_prepare;
+  tpkls->cleanup = gst_transcode_task_pool_cleanup;
+  tpkls->push = gst_transcode_task_pool_push;
+  tpkls->join = gst_transcode_task_pool_join;
+
+  GST_DEBUG_CATEGORY_INIT (transcode_task_pool_debug, "transcodetaskpool", 0,
+      "Streaming thread pool for transcodebin");
+
+  /** GstTranscodeTaskPool:max-threads:
+   *
+   * Threads kept around between tasks. 0 uses one per CPU.
+   */
+  g_object_class_install_property (gokls, PROP_MAX_THREADS,
+      g_param_spec_uint ("max-threads", "max threads",
+          "Idle threads kept for reuse (0 = one per CPU)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeTaskPool:pin-threads:
+   *
+   * Pin every thread to one CPU, taking the CPUs in turn. Only on Linux.
+   */
+  g_object_class_install_property (gokls, PROP_PIN_THREADS,
+      g_param_spec_boolean ("pin-threads", "pin threads",
+          "Pin each thread to a CPU", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /** GstTranscodeTaskPool:stats:
+   *
+   * Utilization so far, see gst_transcode_task_pool_get_stats().
+   */
+  g_object_class_install_property (gokls, PROP_STATS,
+      g_param_spec_boxed ("stats", "stats", "Thread pool utilization",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+};
+
+static void
+gst_transcode_task_pool_init (GstTranscodeTaskPool * self,
+    GstTranscodeTaskPoolClass * kls)
+{
+  self->max_threads = _n_cpus ();
+  self->pin_threads = FALSE;
+
+  self->lock = g_mutex_new ();
+  self->done = g_cond_new ();
+  self->idle = NULL;
+  self->n_threads = 0;
+  self->busy = 0;
+  self->peak_busy = 0;
+  self->pushed = 0;
+  self->oversubscribed = 0;
+  self->next_cpu = 0;
+};
+
+static void
+gst_transcode_task_pool_set_property (GObject * goself, guint propid,
+    const GValue * val, GParamSpec * pspec)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (goself);
+
+  switch (propid) {
+    case PROP_MAX_THREADS:
+      g_mutex_lock (self->lock);
+      self->max_threads = g_value_get_uint (val);
+      if (self->max_threads == 0)
+        self->max_threads = _n_cpus ();
+      g_mutex_unlock (self->lock);
+      break;
+    case PROP_PIN_THREADS:
+      g_mutex_lock (self->lock);
+      self->pin_threads = g_value_get_boolean (val);
+      g_mutex_unlock (self->lock);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_transcode_task_pool_get_property (GObject * goself, guint propid,
+    GValue * val, GParamSpec * pspec)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (goself);
+
+  switch (propid) {
+    case PROP_MAX_THREADS:
+      g_value_set_uint (val, self->max_threads);
+      break;
+    case PROP_PIN_THREADS:
+      g_value_set_boolean (val, self->pin_threads);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (val, gst_transcode_task_pool_get_stats (self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (goself, propid, pspec);
+      break;
+  }
+};
+
+static void
+gst_transcode_task_pool_finalize (GObject * goself)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (goself);
+
+  gst_transcode_task_pool_cleanup (GST_TASK_POOL (self));
+
+  g_mutex_free (self->lock);
+  g_cond_free (self->done);
+
+  G_OBJECT_CLASS (parent_class)->finalize (goself);
+};
+
+static gpointer
+_worker_thread (gpointer user_data)
+{
+  GstPoolWorker *worker = (GstPoolWorker *) user_data;
+  GstTranscodeTaskPool *self = worker->pool;
+
+#ifdef __linux__
+  if (worker->cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO (&set);
+    CPU_SET (worker->cpu, &set);
+    if (sched_setaffinity (0, sizeof (set), &set) != 0)
+      GST_WARNING_OBJECT (self, "Could not pin thread to CPU %d",
+          worker->cpu);
+  }
+#endif
+
+  g_mutex_lock (self->lock);
+  while (TRUE) {
+    GstPoolJob *job;
+
+    while (worker->job == NULL && !worker->quit)
+      g_cond_wait (worker->cond, self->lock);
+
+    if (worker->quit)
+      break;
+
+    job = worker->job;
+    g_mutex_unlock (self->lock);
+
+    job->func (job->user_data);
+
+    g_mutex_lock (self->lock);
+    job->done = TRUE;
+    worker->job = NULL;
+    self->busy--;
+    g_cond_broadcast (self->done);
+
+    /* Only keep as many threads around as asked for */
+    if (g_list_length (self->idle) >= self->max_threads)
+      break;
+
+    self->idle = g_list_prepend (self->idle, worker);
+  }
+
+  self->n_threads--;
+  g_cond_broadcast (self->done);
+  g_mutex_unlock (self->lock);
+
+  g_cond_free (worker->cond);
+  g_slice_free (GstPoolWorker, worker);
+
+  return NULL;
+};
+
+static void
+gst_transcode_task_pool_prepare (GstTaskPool * pool, GError ** error)
+{
+  /* Threads are made as tasks come in */
+};
+
+/* Let go of the idle threads; tasks still running keep theirs */
+static void
+gst_transcode_task_pool_cleanup (GstTaskPool * pool)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (pool);
+  GList *iter;
+
+  g_mutex_lock (self->lock);
+  for (iter = self->idle; iter != NULL; iter = iter->next) {
+    GstPoolWorker *worker = (GstPoolWorker *) iter->data;
+
+    worker->quit = TRUE;
+    g_cond_signal (worker->cond);
+  }
+  g_list_free (self->idle);
+  self->idle = NULL;
+
+  while (self->n_threads > self->busy)
+    g_cond_wait (self->done, self->lock);
+  g_mutex_unlock (self->lock);
+};
+
+static gpointer
+gst_transcode_task_pool_push (GstTaskPool * pool, GstTaskPoolFunction func,
+    gpointer user_data, GError ** error)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (pool);
+  GstPoolJob *job = g_slice_new0 (GstPoolJob);
+  GstPoolWorker *worker = NULL;
+
+  job->func = func;
+  job->user_data = user_data;
+
+  g_mutex_lock (self->lock);
+  self->pushed++;
+  self->busy++;
+  self->peak_busy = MAX (self->peak_busy, self->busy);
+
+  if (self->busy > self->max_threads) {
+    self->oversubscribed++;
+    GST_DEBUG_OBJECT (self, "%u tasks running on %u threads", self->busy,
+        self->max_threads);
+  }
+
+  if (self->idle != NULL) {
+    worker = (GstPoolWorker *) self->idle->data;
+    self->idle = g_list_delete_link (self->idle, self->idle);
+    worker->job = job;
+    g_cond_signal (worker->cond);
+  } else {
+    worker = g_slice_new0 (GstPoolWorker);
+    worker->pool = self;
+    worker->cond = g_cond_new ();
+    worker->cpu = self->pin_threads ? (gint) (self->next_cpu++ % _n_cpus ())
+        : -1;
+    worker->job = job;
+
+    if (g_thread_create (_worker_thread, worker, FALSE, error) != NULL) {
+      self->n_threads++;
+    } else {
+      g_cond_free (worker->cond);
+      g_slice_free (GstPoolWorker, worker);
+      g_slice_free (GstPoolJob, job);
+      self->busy--;
+      job = NULL;
+    }
+  }
+  g_mutex_unlock (self->lock);
+
+  return job;
+};
+
+static void
+gst_transcode_task_pool_join (GstTaskPool * pool, gpointer id)
+{
+  GstTranscodeTaskPool *self = GST_TRANSCODE_TASK_POOL (pool);
+  GstPoolJob *job = (GstPoolJob *) id;
+
+  if (job == NULL)
+    return;
+
+  g_mutex_lock (self->lock);
+  while (!job->done)
+    g_cond_wait (self->done, self->lock);
+  g_mutex_unlock (self->lock);
+
+  g_slice_free (GstPoolJob, job);
+};
+
+/**
+ * gst_transcode_task_pool_new:
+ * @max_threads: threads to keep around, 0 for one per CPU
+ * @pin_threads: whether to pin each thread to a CPU
+ *
+ * Returns: a new, prepared #GstTranscodeTaskPool
+ */
+GstTaskPool *
+gst_transcode_task_pool_new (guint max_threads, gboolean pin_threads)
+{
+  GstTaskPool *pool = g_object_new (GST_TYPE_TRANSCODE_TASK_POOL,
+      "max-threads", max_threads, "pin-threads", pin_threads, NULL);
+
+  gst_task_pool_prepare (pool, NULL);
+
+  return pool;
+};
+
+/**
+ * gst_transcode_task_pool_get_shared:
+ * @pin_threads: whether to get the pool with pinned threads
+ *
+ * A process-wide pool, with one thread per CPU, for bins that should share
+ * their threads. There is one with each thread pinned to its own CPU and
+ * one without pinning.
+ *
+ * Returns: (transfer full): the shared #GstTranscodeTaskPool
+ */
+GstTaskPool *
+gst_transcode_task_pool_get_shared (gboolean pin_threads)
+{
+  static GstTaskPool *shared[2] = { NULL, NULL };
+  GstTaskPool **pool = &shared[pin_threads ? 1 : 0];
+
+  if (g_once_init_enter ((gsize *) pool)) {
+    GstTaskPool *new_pool = gst_transcode_task_pool_new (0, pin_threads);
+    g_once_init_leave ((gsize *) pool, (gsize) new_pool);
+  }
+
+  return gst_object_ref (*pool);
+};
+
+/**
+ * gst_transcode_task_pool_get_stats:
+ * @pool: a #GstTranscodeTaskPool
+ *
+ * Returns: a "transcode-task-pool-stats" #GstStructure with the number of
+ * "threads", the tasks running now ("busy") and at most ("peak-busy"),
+ * tasks started in total ("pushed"), how many of those found all
+ * "max-threads" threads busy ("oversubscribed"), and "utilization", busy
+ * over max-threads.
+ */
+GstStructure *
+gst_transcode_task_pool_get_stats (GstTranscodeTaskPool * pool)
+{
+  GstStructure *s;
+
+  g_return_val_if_fail (GST_IS_TRANSCODE_TASK_POOL (pool), NULL);
+
+  g_mutex_lock (pool->lock);
+  s = gst_structure_new ("transcode-task-pool-stats",
+      "threads", G_TYPE_UINT, pool->n_threads,
+      "max-threads", G_TYPE_UINT, pool->max_threads,
+      "busy", G_TYPE_UINT, pool->busy,
+      "peak-busy", G_TYPE_UINT, pool->peak_busy,
+      "pushed", G_TYPE_UINT64, pool->pushed,
+      "oversubscribed", G_TYPE_UINT64, pool->oversubscribed,
+      "utilization", G_TYPE_DOUBLE,
+      (gdouble) pool->busy / MAX (pool->max_threads, 1), NULL);
+  g_mutex_unlock (pool->lock);
+
+  return s;
+};
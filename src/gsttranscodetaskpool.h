@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_TRANSCODE_TASK_POOL_H__
+#define __GST_TRANSCODE_TASK_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstTranscodeTaskPool:
+ *
+ * Task pool for the streaming threads of one or more transcodebins. Up to
+ * #GstTranscodeTaskPool:max-threads threads are kept around between tasks,
+ * optionally each pinned to its own CPU, so elements going through READY
+ * and back don't create threads again and the threads of many bins are
+ * spread evenly over the cores.
+ *
+ * A streaming task keeps its thread until it's stopped, so more tasks
+ * than max-threads still each get a thread; those are counted as
+ * oversubscribed in the stats instead of being made to wait.
+ */
+
+#define GST_TYPE_TRANSCODE_TASK_POOL              (gst_transcode_task_pool_get_type ())
+#define GST_TRANSCODE_TASK_POOL(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_TRANSCODE_TASK_POOL, GstTranscodeTaskPool))
+#define GST_IS_TRANSCODE_TASK_POOL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_TRANSCODE_TASK_POOL))
+#define GST_TRANSCODE_TASK_POOL_CLASS(kls)        (G_TYPE_CHECK_CLASS_CAST ((kls), GST_TYPE_TRANSCODE_TASK_POOL, GstTranscodeTaskPoolClass))
+#define GST_IS_TRANSCODE_TASK_POOL_CLASS(kls)     (G_TYPE_CHECK_CLASS_TYPE ((kls), GST_TYPE_TRANSCODE_TASK_POOL))
+#define GST_TRANSCODE_TASK_POOL_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_TRANSCODE_TASK_POOL, GstTranscodeTaskPoolClass))
+
+typedef struct _GstTranscodeTaskPool
+{
+    GstTaskPool parent_instance;
+
+    /* properties */
+    guint max_threads;
+    gboolean pin_threads;
+
+    /* private state, protected by lock */
+    GMutex* lock;
+    GCond* done;
+    GList* idle;
+    guint n_threads;
+    guint busy;
+    guint peak_busy;
+    guint64 pushed;
+    guint64 oversubscribed;
+    guint next_cpu;
+} GstTranscodeTaskPool;
+
+typedef GstTaskPoolClass GstTranscodeTaskPoolClass;
+
+GType gst_transcode_task_pool_get_type(void);
+
+GstTaskPool* gst_transcode_task_pool_new(guint max_threads, gboolean pin_threads);
+GstTaskPool* gst_transcode_task_pool_get_shared(gboolean pin_threads);
+GstStructure* gst_transcode_task_pool_get_stats(GstTranscodeTaskPool* pool);
+
+G_END_DECLS
+
+#endif
@@ -20,10 +20,16 @@
 #include <gst/gst.h>
 
 #include "gsttranscodebin.h"
+#include "gstparalleltranscode.h"
+#include "gstconvertscale.h"
+#include "gstmappedfilesrc.h"
 #include "config.h"
 
 static gboolean plugin_init (GstPlugin* plugin) {
-    return gst_element_register (plugin, "transcodebin", GST_RANK_NONE, GST_TYPE_TRANSCODE_BIN);
+    return gst_element_register (plugin, "transcodebin", GST_RANK_NONE, GST_TYPE_TRANSCODE_BIN)
+        && gst_element_register (plugin, "paralleltranscode", GST_RANK_NONE, GST_TYPE_PARALLEL_TRANSCODE)
+        && gst_element_register (plugin, "convertscale", GST_RANK_NONE, GST_TYPE_CONVERT_SCALE)
+        && gst_element_register (plugin, "mappedfilesrc", GST_RANK_NONE, GST_TYPE_MAPPED_FILE_SRC);
 };
 
 GST_PLUGIN_DEFINE (
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Autoplugging stress test.
+ *
+ * Makes a muxed audio+video file, then transcodes it with many
+ * transcodebins at once in one process, several rounds over, reusing the
+ * pipelines from READY. Every run has to reach EOS with both streams
+ * linked; half the pipelines stream-copy and half re-encode, so both ways
+ * through pad-added race each other, and half of each also write a second
+ * rendition from a src_%d request pad. Exits with 77 (automake's "skipped")
+ * if the encoders or muxer aren't installed.
+ */
+
+#include "test-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RUN_TIMEOUT (120 * GST_SECOND)
+
+static gint pipelines = 16;
+static gint rounds = 4;
+static gint frames = 30;
+
+static GOptionEntry entries[] = {
+    { "pipelines", 'p', 0, G_OPTION_ARG_INT, &pipelines, "Transcodes running at once", "N" },
+    { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds, "Times every pipeline runs", "N" },
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames in the input", "N" },
+    { NULL }
+};
+
+typedef struct {
+    gint index;
+    const gchar* input;
+    GstElement* pipe;
+    GstElement* xcode;
+    GThread* thread;
+    gint failures;
+} StressRun;
+
+static GstEncodingProfile* make_profile(void) {
+    return test_make_profile("ogg", "application/ogg", "video/x-theora", "audio/x-vorbis", NULL);
+};
+
+/* A second output from the same transcodebin, linked to its own sink */
+static gboolean add_output(StressRun* run, GstEncodingProfile* prof) {
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    GValueArray* profiles = g_value_array_new(1);
+    GValue val = { 0, };
+
+    if (sink == NULL) {
+        g_value_array_free(profiles);
+        return FALSE;
+    }
+
+    g_value_init(&val, GST_TYPE_ENCODING_PROFILE);
+    gst_value_set_mini_object(&val, GST_MINI_OBJECT (prof));
+    g_value_array_append(profiles, &val);
+    g_value_unset(&val);
+    g_object_set(G_OBJECT (run->xcode), "profiles", profiles, NULL);
+    g_value_array_free(profiles);
+
+    g_object_set(G_OBJECT (sink), "sync", FALSE, NULL);
+    gst_bin_add(GST_BIN (run->pipe), sink);
+
+    return gst_element_link_pads(run->xcode, "src_%d", sink, "sink");
+};
+
+static gboolean build_run(StressRun* run, GstEncodingProfile* prof) {
+    GstElement* src = gst_element_factory_make("filesrc", NULL);
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+
+    run->pipe = gst_pipeline_new(NULL);
+    run->xcode = gst_element_factory_make("transcodebin", NULL);
+
+    if (src == NULL || sink == NULL || run->xcode == NULL) {
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (src), "location", run->input, NULL);
+    g_object_set(G_OBJECT (sink), "sync", FALSE, NULL);
+    g_object_set(G_OBJECT (run->xcode), "profile", prof, "stream-copy", run->index % 2 == 0, NULL);
+
+    gst_bin_add_many(GST_BIN (run->pipe), src, run->xcode, sink, NULL);
+
+    if (!gst_element_link_many(src, run->xcode, sink, NULL)) {
+        return FALSE;
+    }
+
+    return run->index % 4 < 2 || add_output(run, prof);
+};
+
+/* One pass over the input; counts the streams transcodebin linked */
+static gboolean run_once(StressRun* run, gint round) {
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (run->pipe));
+    gint linked = 0;
+    gboolean ok = FALSE;
+
+    gst_element_set_state(run->pipe, GST_STATE_PLAYING);
+
+    while (TRUE) {
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, RUN_TIMEOUT,
+                GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_ELEMENT);
+
+        if (msg == NULL) {
+            fprintf(stderr, "pipeline %d round %d timed out\n", run->index, round);
+            break;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ELEMENT) {
+            const GstStructure* s = gst_message_get_structure(msg);
+
+            if (s != NULL && gst_structure_has_name(s, "transcodebin-stream")) {
+                linked++;
+            }
+            gst_message_unref(msg);
+            continue;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            ok = linked == 2;
+            if (!ok) {
+                fprintf(stderr, "pipeline %d round %d linked %d streams\n", run->index, round, linked);
+            }
+        } else {
+            GError* err = NULL;
+            gchar* dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            fprintf(stderr, "pipeline %d round %d: %s (%s)\n", run->index, round, err->message, dbg ? dbg : "");
+            g_error_free(err);
+            g_free(dbg);
+        }
+
+        gst_message_unref(msg);
+        break;
+    }
+
+    gst_element_set_state(run->pipe, GST_STATE_READY);
+    gst_bus_set_flushing(bus, TRUE);
+    gst_bus_set_flushing(bus, FALSE);
+    gst_object_unref(bus);
+
+    return ok;
+};
+
+static gpointer run_thread(gpointer user_data) {
+    StressRun* run = (StressRun*) user_data;
+    gint round;
+
+    for (round = 0; round < rounds; round++) {
+        if (!run_once(run, round)) {
+            run->failures++;
+        }
+    }
+
+    return NULL;
+};
+
+int main(int argc, char** argv) {
+    gchar* path = NULL;
+    StressRun* runs;
+    gint i, failures = 0;
+
+    if (!test_init(&argc, &argv, "- transcode with many transcodebins at once", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (pipelines <= 0 || rounds <= 0 || frames <= 0) {
+        fprintf(stderr, "--pipelines, --rounds and --frames must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    gint fd = g_file_open_tmp("autoplug-stress-XXXXXX.ogg", &path, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    GstEncodingProfile* prof = make_profile();
+    if (path == NULL || !test_generate_input(path, prof, frames, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not make the input, skipping\n");
+        if (path != NULL) {
+            unlink(path);
+        }
+        gst_encoding_profile_unref(prof);
+        return EXIT_SKIPPED;
+    }
+
+    runs = g_new0(StressRun, pipelines);
+
+    for (i = 0; i < pipelines; i++) {
+        runs[i].index = i;
+        runs[i].input = path;
+        if (!build_run(&runs[i], prof)) {
+            fprintf(stderr, "Could not build pipeline %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    gst_encoding_profile_unref(prof);
+
+    for (i = 0; i < pipelines; i++) {
+        runs[i].thread = g_thread_create(run_thread, &runs[i], TRUE, NULL);
+    }
+
+    for (i = 0; i < pipelines; i++) {
+        if (runs[i].thread != NULL) {
+            g_thread_join(runs[i].thread);
+        } else {
+            runs[i].failures = rounds;
+        }
+        failures += runs[i].failures;
+
+        gst_element_set_state(runs[i].pipe, GST_STATE_NULL);
+        gst_object_unref(runs[i].pipe);
+    }
+
+    printf("{\"pipelines\": %d, \"rounds\": %d, \"failures\": %d}\n", pipelines, rounds, failures);
+
+    g_free(runs);
+    unlink(path);
+    g_free(path);
+
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+};
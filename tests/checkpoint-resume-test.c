@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Resuming a transcode from its checkpoint journal.
+ *
+ * Makes an MPEG-TS file and transcodes it in a child process, paced to
+ * real time, which is killed once it has written a checkpoint. The output
+ * is then cut to the checkpoint's offset and the transcode resumed into
+ * it. The run has to reach EOS and remove the journal, and the output has
+ * to decode to as many frames as the input with timestamps that neither
+ * go back nor skip across the seam. Exits with 77 (automake's "skipped")
+ * if no MPEG-TS profile can be encoded.
+ */
+
+#include "test-common.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RUN_TIMEOUT (300 * GST_SECOND)
+
+#define CHECKPOINT_INTERVAL (500 * GST_MSECOND)
+
+/* The encoders may drop or repeat a frame at either end */
+#define FRAME_TOLERANCE 2
+
+/* Two frames at 30fps, one dropped at the seam is fine */
+#define MAX_STEP (2 * GST_SECOND / 30 + GST_MSECOND)
+
+static gint frames = 300;
+
+/* For the child process doing the interrupted run */
+static gchar* child_input = NULL;
+static gchar* child_output = NULL;
+static gchar* child_journal = NULL;
+static gchar* child_video = NULL;
+static gchar* child_audio = NULL;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames in the input", "N" },
+    { "child-input", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &child_input, NULL, NULL },
+    { "child-output", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &child_output, NULL, NULL },
+    { "child-journal", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &child_journal, NULL, NULL },
+    { "child-video", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &child_video, NULL, NULL },
+    { "child-audio", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &child_audio, NULL, NULL },
+    { NULL }
+};
+
+/* filesrc ! transcodebin ! filesink, checkpointing to journal */
+static GstElement* make_pipeline(const char* in, const char* out, const char* journal, GstEncodingProfile* prof,
+        gboolean resume, GstElement** transcodebin) {
+    GstElement* pipe = gst_pipeline_new("checkpoint");
+    GstElement* src = gst_element_factory_make("filesrc", NULL);
+    GstElement* xcode = gst_element_factory_make("transcodebin", NULL);
+    GstElement* sink = gst_element_factory_make("filesink", NULL);
+
+    if (src == NULL || xcode == NULL || sink == NULL) {
+        fprintf(stderr, "transcodebin element not found\n");
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (xcode != NULL) {
+            gst_object_unref(xcode);
+        }
+        if (sink != NULL) {
+            gst_object_unref(sink);
+        }
+        gst_object_unref(pipe);
+        return NULL;
+    }
+
+    g_object_set(G_OBJECT (src), "location", in, NULL);
+    g_object_set(G_OBJECT (xcode), "profile", prof, "checkpoint-location", journal,
+            "checkpoint-interval", (guint64) CHECKPOINT_INTERVAL, NULL);
+    /* The interrupted run goes at the input's pace, so it gets killed
+     * part way, and writes everything it's given at once */
+    g_object_set(G_OBJECT (sink), "location", out, "sync", !resume, "append", resume, NULL);
+    if (!resume) {
+        g_object_set(G_OBJECT (sink), "buffer-mode", 2, NULL);
+    }
+
+    gst_bin_add_many(GST_BIN (pipe), src, xcode, sink, NULL);
+    if (!gst_element_link_many(src, xcode, sink, NULL)) {
+        gst_object_unref(pipe);
+        return NULL;
+    }
+
+    if (transcodebin != NULL) {
+        *transcodebin = xcode;
+    }
+
+    return pipe;
+};
+
+static gboolean run_pipeline(GstElement* pipe) {
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+    gboolean ok = FALSE;
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (msg != NULL) {
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            ok = TRUE;
+        } else {
+            GError* err = NULL;
+            gchar* dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            fprintf(stderr, "%s (%s)\n", err->message, dbg ? dbg : "");
+            g_error_free(err);
+            g_free(dbg);
+        }
+        gst_message_unref(msg);
+    } else {
+        fprintf(stderr, "Timed out\n");
+    }
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(bus);
+
+    return ok;
+};
+
+static int run_child(void) {
+    GstEncodingProfile* prof = test_make_profile("ts", "video/mpegts", child_video, child_audio, NULL);
+    GstElement* pipe = make_pipeline(child_input, child_output, child_journal, prof, FALSE, NULL);
+    gboolean ok = pipe != NULL && run_pipeline(pipe);
+
+    if (pipe != NULL) {
+        gst_object_unref(pipe);
+    }
+    gst_encoding_profile_unref(prof);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+};
+
+/* Start the child and kill it as soon as the journal shows up */
+static gboolean run_interrupted(const char* self, const char* in, const char* out, const char* journal,
+        const TestTsCodecs* codecs) {
+    gchar* argv[] = {
+        (gchar*) self,
+        g_strconcat("--child-input=", in, NULL),
+        g_strconcat("--child-output=", out, NULL),
+        g_strconcat("--child-journal=", journal, NULL),
+        g_strconcat("--child-video=", codecs->video, NULL),
+        g_strconcat("--child-audio=", codecs->audio, NULL),
+        NULL
+    };
+    GError* err = NULL;
+    GPid pid;
+    GstClockTime waited = 0;
+    gboolean ok = FALSE;
+    gint i, status;
+
+    if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &err)) {
+        fprintf(stderr, "Could not start the child: %s\n", err->message);
+        g_error_free(err);
+        for (i = 1; argv[i] != NULL; i++) {
+            g_free(argv[i]);
+        }
+        return FALSE;
+    }
+    for (i = 1; argv[i] != NULL; i++) {
+        g_free(argv[i]);
+    }
+
+    while (waited < RUN_TIMEOUT) {
+        if (g_file_test(journal, G_FILE_TEST_EXISTS)) {
+            ok = TRUE;
+            break;
+        }
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "The child ended before writing a checkpoint\n");
+            g_spawn_close_pid(pid);
+            return FALSE;
+        }
+        g_usleep(10000);
+        waited += 10 * GST_MSECOND;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    g_spawn_close_pid(pid);
+
+    if (!ok) {
+        fprintf(stderr, "No checkpoint written in time\n");
+    }
+
+    return ok;
+};
+
+/* Cut the output back to the checkpoint and carry on from there */
+static gboolean run_resumed(const char* in, const char* out, const char* journal, const TestTsCodecs* codecs,
+        GstClockTime* position, guint64* offset) {
+    GstEncodingProfile* prof = test_make_profile("ts", "video/mpegts", codecs->video, codecs->audio, NULL);
+    GstElement* xcode = NULL;
+    GstElement* pipe = make_pipeline(in, out, journal, prof, TRUE, &xcode);
+    struct stat st;
+    gboolean ok = FALSE;
+
+    gst_encoding_profile_unref(prof);
+    if (pipe == NULL) {
+        return FALSE;
+    }
+
+    g_object_get(G_OBJECT (xcode), "resume-position", position, "resume-offset", offset, NULL);
+
+    if (*offset == 0 || *position == 0) {
+        fprintf(stderr, "Nothing to resume from in the journal\n");
+    } else if (stat(out, &st) != 0 || (guint64) st.st_size < *offset) {
+        fprintf(stderr, "Checkpoint at byte %" G_GUINT64_FORMAT " is past the end of the output\n", *offset);
+    } else if (truncate(out, *offset) != 0) {
+        fprintf(stderr, "Could not cut the output to %" G_GUINT64_FORMAT " bytes\n", *offset);
+    } else {
+        ok = run_pipeline(pipe);
+    }
+
+    gst_object_unref(pipe);
+
+    return ok;
+};
+
+static int check_resume(const char* self, const char* in, const char* out, const char* journal,
+        const TestTsCodecs* codecs) {
+    TestVideoSpan in_span, out_span;
+    GstClockTime position = 0;
+    guint64 offset = 0;
+
+    if (!test_measure_video(in, &in_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the input, skipping\n");
+        return EXIT_SKIPPED;
+    }
+
+    if (!run_interrupted(self, in, out, journal, codecs)
+            || !run_resumed(in, out, journal, codecs, &position, &offset)) {
+        return EXIT_FAILURE;
+    }
+
+    if (g_file_test(journal, G_FILE_TEST_EXISTS)) {
+        fprintf(stderr, "The journal is left after the output completed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!test_measure_video(out, &out_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the output\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\"resume_position_ns\": %" G_GUINT64_FORMAT ", \"resume_offset\": %" G_GUINT64_FORMAT
+            ", \"input_frames\": %d, \"output_frames\": %d, \"max_step_ns\": %" G_GUINT64_FORMAT
+            ", \"backwards\": %d}\n", position, offset, in_span.frames, out_span.frames, out_span.max_step,
+            out_span.backwards);
+
+    if (ABS(out_span.frames - in_span.frames) > FRAME_TOLERANCE) {
+        fprintf(stderr, "Output has %d frames, input %d\n", out_span.frames, in_span.frames);
+        return EXIT_FAILURE;
+    }
+
+    if (out_span.backwards > 0 || out_span.max_step > MAX_STEP) {
+        fprintf(stderr, "Output timestamps jump: %d go back, largest step %" GST_TIME_FORMAT "\n",
+                out_span.backwards, GST_TIME_ARGS(out_span.max_step));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+};
+
+int main(int argc, char** argv) {
+    gchar* in = NULL;
+    gchar* out = NULL;
+    gchar* journal = NULL;
+    const TestTsCodecs* codecs;
+    int ret;
+
+    if (!test_init(&argc, &argv, "- resume an interrupted transcode from its checkpoint", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (child_input != NULL) {
+        return run_child();
+    }
+
+    if (frames <= 0) {
+        fprintf(stderr, "--frames must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    gint fd = g_file_open_tmp("checkpoint-resume-XXXXXX.ts", &in, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = g_file_open_tmp("checkpoint-resume-out-XXXXXX.ts", &out, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = g_file_open_tmp("checkpoint-resume-XXXXXX.journal", &journal, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (in == NULL || out == NULL || journal == NULL) {
+        fprintf(stderr, "Could not make temporary files\n");
+        return EXIT_FAILURE;
+    }
+    /* Only the name is wanted, the child's first checkpoint makes it */
+    unlink(journal);
+
+    codecs = test_generate_ts_input(in, frames, RUN_TIMEOUT);
+    if (codecs == NULL) {
+        fprintf(stderr, "Could not make an MPEG-TS input, skipping\n");
+        ret = EXIT_SKIPPED;
+    } else {
+        ret = check_resume(argv[0], in, out, journal, codecs);
+    }
+
+    unlink(in);
+    unlink(out);
+    unlink(journal);
+    g_free(in);
+    g_free(out);
+    g_free(journal);
+
+    return ret;
+};
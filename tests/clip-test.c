@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* start-time and stop-time.
+ *
+ * Makes an MPEG-TS file and transcodes a range out of the middle of it
+ * three ways: re-encoded from a seekable file, stream-copied (which cuts
+ * at a keyframe), and re-encoded from a pipe that can't seek, so the bin
+ * has to drop what's outside the range and end the streams itself. Every
+ * run has to reach EOS, and the output has to decode to the range's
+ * frames with timestamps that neither go back nor skip. Exits with 77
+ * (automake's "skipped") if no MPEG-TS profile can be encoded.
+ */
+
+#include "test-common.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define RUN_TIMEOUT (300 * GST_SECOND)
+
+#define FRAME_DURATION (GST_SECOND / 30)
+
+/* The encoders may drop or repeat a frame at either end */
+#define FRAME_TOLERANCE 2
+
+/* Two frames, one dropped is fine */
+#define MAX_STEP (2 * FRAME_DURATION + GST_MSECOND)
+
+static gint frames = 300;
+static gint start_seconds = 2;
+static gint stop_seconds = 6;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames in the input", "N" },
+    { "start", 's', 0, G_OPTION_ARG_INT, &start_seconds, "start-time in seconds", "S" },
+    { "stop", 'e', 0, G_OPTION_ARG_INT, &stop_seconds, "stop-time in seconds", "S" },
+    { NULL }
+};
+
+typedef struct {
+    const char* path;
+    gint fd;
+} PipeFeed;
+
+/* Write the file into the pipe, until it ends or the reader goes away */
+static gpointer feed_thread(gpointer user_data) {
+    PipeFeed* feed = (PipeFeed*) user_data;
+    FILE* f = fopen(feed->path, "rb");
+    gchar buf[65536];
+    size_t len;
+
+    if (f != NULL) {
+        while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+            gchar* p = buf;
+
+            while (len > 0) {
+                ssize_t n = write(feed->fd, p, len);
+
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    goto done;
+                }
+                p += n;
+                len -= n;
+            }
+        }
+done:
+        fclose(f);
+    }
+    close(feed->fd);
+
+    return NULL;
+};
+
+/* Transcode the range into out. With seekable FALSE, the input is read
+ * from a pipe. */
+static gboolean run_clip(const char* in, const char* out, GstEncodingProfile* prof, gboolean stream_copy,
+        gboolean seekable) {
+    GstElement* pipeline = gst_pipeline_new("clip");
+    GstElement* src = gst_element_factory_make(seekable ? "filesrc" : "fdsrc", NULL);
+    GstElement* xcode = gst_element_factory_make("transcodebin", NULL);
+    GstElement* sink = gst_element_factory_make("filesink", NULL);
+    GThread* feeder = NULL;
+    PipeFeed feed = { in, -1 };
+    gboolean ok = FALSE;
+    gint fds[2];
+
+    if (src == NULL || xcode == NULL || sink == NULL) {
+        fprintf(stderr, "transcodebin element not found\n");
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (xcode != NULL) {
+            gst_object_unref(xcode);
+        }
+        if (sink != NULL) {
+            gst_object_unref(sink);
+        }
+        gst_object_unref(pipeline);
+        return FALSE;
+    }
+
+    if (seekable) {
+        g_object_set(G_OBJECT (src), "location", in, NULL);
+    } else {
+        if (pipe(fds) != 0) {
+            fprintf(stderr, "Could not make a pipe\n");
+            gst_object_unref(src);
+            gst_object_unref(xcode);
+            gst_object_unref(sink);
+            gst_object_unref(pipeline);
+            return FALSE;
+        }
+        feed.fd = fds[1];
+        g_object_set(G_OBJECT (src), "fd", fds[0], NULL);
+    }
+
+    g_object_set(G_OBJECT (xcode), "profile", prof, "stream-copy", stream_copy,
+            "start-time", (guint64) start_seconds * GST_SECOND, "stop-time", (guint64) stop_seconds * GST_SECOND, NULL);
+    g_object_set(G_OBJECT (sink), "location", out, NULL);
+
+    gst_bin_add_many(GST_BIN (pipeline), src, xcode, sink, NULL);
+    if (gst_element_link_many(src, xcode, sink, NULL)) {
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipeline));
+
+        if (!seekable) {
+            feeder = g_thread_create(feed_thread, &feed, TRUE, NULL);
+        }
+
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg != NULL) {
+            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+                ok = TRUE;
+            } else {
+                GError* err = NULL;
+                gchar* dbg = NULL;
+
+                gst_message_parse_error(msg, &err, &dbg);
+                fprintf(stderr, "%s (%s)\n", err->message, dbg ? dbg : "");
+                g_error_free(err);
+                g_free(dbg);
+            }
+            gst_message_unref(msg);
+        } else {
+            fprintf(stderr, "Timed out\n");
+        }
+        gst_object_unref(bus);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    if (!seekable) {
+        /* The feeder sees the reader gone and stops */
+        close(fds[0]);
+        if (feeder != NULL) {
+            g_thread_join(feeder);
+        } else {
+            close(fds[1]);
+        }
+    }
+
+    return ok;
+};
+
+static int check_clip(const char* name, const char* in, const char* out, GstEncodingProfile* prof,
+        gboolean stream_copy, gboolean seekable) {
+    GstClockTime range = (GstClockTime) (stop_seconds - start_seconds) * GST_SECOND;
+    gint expected = (stop_seconds - start_seconds) * 30;
+    TestVideoSpan span;
+
+    if (!run_clip(in, out, prof, stream_copy, seekable)) {
+        fprintf(stderr, "%s: transcodebin failed\n", name);
+        return EXIT_FAILURE;
+    }
+
+    if (!test_measure_video(out, &span, RUN_TIMEOUT)) {
+        fprintf(stderr, "%s: could not decode the output\n", name);
+        return EXIT_FAILURE;
+    }
+
+    printf("{\"run\": \"%s\", \"frames\": %d, \"duration_ns\": %" G_GUINT64_FORMAT ", \"max_step_ns\": %"
+            G_GUINT64_FORMAT ", \"backwards\": %d}\n", name, span.frames, span.end - span.first, span.max_step,
+            span.backwards);
+
+    if (span.backwards > 0 || span.max_step > MAX_STEP) {
+        fprintf(stderr, "%s: timestamps jump: %d go back, largest step %" GST_TIME_FORMAT "\n", name,
+                span.backwards, GST_TIME_ARGS(span.max_step));
+        return EXIT_FAILURE;
+    }
+
+    /* A copy starts at the first keyframe in the range, so it may be
+     * short by up to a keyframe interval but never longer */
+    if (stream_copy) {
+        if (span.frames > expected + FRAME_TOLERANCE
+                || span.end - span.first > range + FRAME_TOLERANCE * FRAME_DURATION) {
+            fprintf(stderr, "%s: %d frames over %" GST_TIME_FORMAT ", more than the range\n", name, span.frames,
+                    GST_TIME_ARGS(span.end - span.first));
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (ABS(span.frames - expected) > FRAME_TOLERANCE) {
+        fprintf(stderr, "%s: %d frames, expected %d\n", name, span.frames, expected);
+        return EXIT_FAILURE;
+    }
+
+    if (ABS(GST_CLOCK_DIFF(range, span.end - span.first)) > FRAME_TOLERANCE * FRAME_DURATION) {
+        fprintf(stderr, "%s: output lasts %" GST_TIME_FORMAT ", expected %" GST_TIME_FORMAT "\n", name,
+                GST_TIME_ARGS(span.end - span.first), GST_TIME_ARGS(range));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+};
+
+int main(int argc, char** argv) {
+    gchar* in = NULL;
+    gchar* out = NULL;
+    const TestTsCodecs* codecs;
+    int ret = EXIT_SUCCESS;
+
+    if (!test_init(&argc, &argv, "- transcode a time range of the input", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (frames <= 0 || start_seconds < 0 || stop_seconds <= start_seconds || stop_seconds * 30 > frames) {
+        fprintf(stderr, "--start and --stop have to be a range within the --frames of input\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The bin closes the pipe before the feeder is done with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    gint fd = g_file_open_tmp("clip-XXXXXX.ts", &in, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = g_file_open_tmp("clip-out-XXXXXX.ts", &out, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Could not make temporary files\n");
+        return EXIT_FAILURE;
+    }
+
+    codecs = test_generate_ts_input(in, frames, RUN_TIMEOUT);
+    if (codecs == NULL) {
+        fprintf(stderr, "Could not make an MPEG-TS input, skipping\n");
+        ret = EXIT_SKIPPED;
+    } else {
+        GstEncodingProfile* prof = test_make_profile("ts", "video/mpegts", codecs->video, codecs->audio, NULL);
+
+        if (check_clip("reencode", in, out, prof, FALSE, TRUE) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+        if (check_clip("copy", in, out, prof, TRUE, TRUE) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+        if (check_clip("unseekable", in, out, prof, FALSE, FALSE) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+        gst_encoding_profile_unref(prof);
+    }
+
+    unlink(in);
+    unlink(out);
+    g_free(in);
+    g_free(out);
+
+    return ret;
+};
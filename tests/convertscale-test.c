@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* convertscale against ffmpegcolorspace ! videoscale.
+ *
+ * Every case runs the same videotestsrc frames through convertscale and
+ * through the reference elements and compares the I420 output. Frames
+ * that keep their size must match almost exactly, scaled ones closely
+ * (the bilinear filters differ in rounding and edge handling). With
+ * --bench the output isn't compared; instead both chains are timed and
+ * one JSON line per case is printed.
+ */
+
+#include "test-common.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Minimum PSNR over all planes, in dB */
+#define MIN_PSNR_SAME_SIZE 45.0
+#define MIN_PSNR_SCALED 30.0
+
+typedef struct {
+    const char* format;
+    gint in_width, in_height;
+    gint out_width, out_height;
+} ConvertCase;
+
+static const ConvertCase cases[] = {
+    { "I420", 1280, 720, 640, 360 },
+    { "YV12", 1280, 720, 640, 360 },
+    { "YV12", 640, 360, 640, 360 },
+    { "NV12", 1280, 720, 1280, 720 },
+    { "NV12", 1920, 1080, 640, 360 },
+    { "YUY2", 720, 576, 720, 576 },
+    { "YUY2", 1280, 720, 854, 480 },
+    { "I420", 640, 360, 1280, 720 },
+    { NULL, }
+};
+
+static gint frames = 10;
+static gboolean bench = FALSE;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per case", "N" },
+    { "bench", 'b', 0, G_OPTION_ARG_NONE, &bench, "Time both chains instead of comparing them", NULL },
+    { NULL }
+};
+
+static void collect_handoff(GstElement* sink, GstBuffer* buf, GstPad* pad, gpointer user_data) {
+    GList** out = (GList**) user_data;
+
+    if (out != NULL) {
+        *out = g_list_append(*out, gst_buffer_ref(buf));
+    }
+};
+
+/* Run videotestsrc ! <in caps> ! <chain> ! <out caps> ! fakesink, keeping
+ * the output buffers if asked to. Returns FALSE if the chain can't be
+ * built or the pipeline errors out. */
+static gboolean run_chain(const ConvertCase* cc, const char* chain, GList** out, GstClockTime* wall) {
+    gchar* desc = g_strdup_printf(
+            "videotestsrc pattern=smpte num-buffers=%d "
+            "! video/x-raw-yuv,format=(fourcc)%s,width=%d,height=%d,framerate=30/1 "
+            "! %s ! video/x-raw-yuv,format=(fourcc)I420,width=%d,height=%d "
+            "! fakesink name=sink sync=false signal-handoffs=true",
+            frames, cc->format, cc->in_width, cc->in_height, chain,
+            cc->out_width, cc->out_height);
+    GError* err = NULL;
+    GstElement* pipe = gst_parse_launch(desc, &err);
+    gboolean ok = FALSE;
+
+    g_free(desc);
+    if (pipe == NULL || err != NULL) {
+        fprintf(stderr, "%s: %s\n", chain, err ? err->message : "could not build pipeline");
+        if (err != NULL) {
+            g_error_free(err);
+        }
+        if (pipe != NULL) {
+            gst_object_unref(pipe);
+        }
+        return FALSE;
+    }
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN (pipe), "sink");
+    g_signal_connect(sink, "handoff", G_CALLBACK (collect_handoff), out);
+    gst_object_unref(sink);
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+    GstClockTime start = gst_util_get_timestamp();
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+            GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+        ok = TRUE;
+    } else {
+        GError* merr = NULL;
+        gchar* dbg = NULL;
+
+        gst_message_parse_error(msg, &merr, &dbg);
+        fprintf(stderr, "%s: %s (%s)\n", chain, merr->message, dbg ? dbg : "");
+        g_error_free(merr);
+        g_free(dbg);
+    }
+    gst_message_unref(msg);
+
+    if (wall != NULL) {
+        *wall = gst_util_get_timestamp() - start;
+    }
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipe);
+
+    return ok;
+};
+
+static void free_buffers(GList* bufs) {
+    g_list_foreach(bufs, (GFunc) gst_mini_object_unref, NULL);
+    g_list_free(bufs);
+};
+
+static gdouble psnr(GstBuffer* a, GstBuffer* b) {
+    const guint8* pa = GST_BUFFER_DATA(a);
+    const guint8* pb = GST_BUFFER_DATA(b);
+    guint size = MIN(GST_BUFFER_SIZE(a), GST_BUFFER_SIZE(b));
+    guint64 sse = 0;
+    guint i;
+
+    for (i = 0; i < size; i++) {
+        gint d = (gint) pa[i] - (gint) pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0) {
+        return INFINITY;
+    }
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+};
+
+static int check_case(const ConvertCase* cc) {
+    GList* fused = NULL;
+    GList* reference = NULL;
+    GList* fa;
+    GList* ra;
+    gdouble worst = INFINITY;
+    gdouble limit = cc->in_width == cc->out_width && cc->in_height == cc->out_height ?
+            MIN_PSNR_SAME_SIZE : MIN_PSNR_SCALED;
+    int ret = EXIT_SUCCESS;
+
+    if (!run_chain(cc, "ffmpegcolorspace ! videoscale method=bilinear", &reference, NULL)) {
+        printf("SKIP %s %dx%d -> %dx%d: reference chain unavailable\n",
+                cc->format, cc->in_width, cc->in_height, cc->out_width, cc->out_height);
+        free_buffers(reference);
+        return EXIT_SKIPPED;
+    }
+
+    if (!run_chain(cc, "convertscale", &fused, NULL)) {
+        free_buffers(reference);
+        free_buffers(fused);
+        return EXIT_FAILURE;
+    }
+
+    if (g_list_length(fused) != g_list_length(reference)) {
+        fprintf(stderr, "%s: %u frames, reference has %u\n", cc->format,
+                g_list_length(fused), g_list_length(reference));
+        ret = EXIT_FAILURE;
+    }
+
+    for (fa = fused, ra = reference; fa && ra; fa = fa->next, ra = ra->next) {
+        if (GST_BUFFER_SIZE(fa->data) != GST_BUFFER_SIZE(ra->data)) {
+            fprintf(stderr, "%s: frame size %u, reference has %u\n", cc->format,
+                    GST_BUFFER_SIZE(fa->data), GST_BUFFER_SIZE(ra->data));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        worst = MIN(worst, psnr(fa->data, ra->data));
+    }
+
+    if (worst < limit) {
+        ret = EXIT_FAILURE;
+    }
+
+    printf("%s %s %dx%d -> %dx%d: min PSNR %.2f dB (limit %.0f)\n",
+            ret == EXIT_SUCCESS ? "PASS" : "FAIL", cc->format,
+            cc->in_width, cc->in_height, cc->out_width, cc->out_height, worst, limit);
+
+    free_buffers(fused);
+    free_buffers(reference);
+
+    return ret;
+};
+
+/* With only the width given, the height has to keep the display aspect
+ * ratio (1920x1080 to 640x360), as videoscale picks it, instead of
+ * staying at the input's and stretching the pixels */
+static int check_fixate(void) {
+    GstElement* pipe = gst_parse_launch(
+            "videotestsrc num-buffers=1 "
+            "! video/x-raw-yuv,format=(fourcc)I420,width=1920,height=1080,pixel-aspect-ratio=1/1 "
+            "! convertscale ! video/x-raw-yuv,width=640 ! fakesink name=sink", NULL);
+    gint width = 0, height = 0, par_n = 0, par_d = 0;
+    int ret = EXIT_FAILURE;
+
+    if (pipe == NULL) {
+        return EXIT_SKIPPED;
+    }
+
+    gst_element_set_state(pipe, GST_STATE_PAUSED);
+    if (gst_element_get_state(pipe, NULL, NULL, 10 * GST_SECOND) == GST_STATE_CHANGE_SUCCESS) {
+        GstElement* sink = gst_bin_get_by_name(GST_BIN (pipe), "sink");
+        GstPad* pad = gst_element_get_static_pad(sink, "sink");
+        GstCaps* caps = gst_pad_get_negotiated_caps(pad);
+
+        if (caps != NULL) {
+            GstStructure* s = gst_caps_get_structure(caps, 0);
+
+            gst_structure_get_int(s, "width", &width);
+            gst_structure_get_int(s, "height", &height);
+            gst_structure_get_fraction(s, "pixel-aspect-ratio", &par_n, &par_d);
+            gst_caps_unref(caps);
+        }
+        gst_object_unref(pad);
+        gst_object_unref(sink);
+
+        if (width == 640 && height == 360 && par_n == 1 && par_d == 1) {
+            ret = EXIT_SUCCESS;
+        }
+    }
+
+    printf("%s fixate 1920x1080 -> width 640: %dx%d, PAR %d/%d\n",
+            ret == EXIT_SUCCESS ? "PASS" : "FAIL", width, height, par_n, par_d);
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    return ret;
+};
+
+static int bench_case(const ConvertCase* cc) {
+    GstClockTime fused = 0, reference = 0;
+
+    if (!run_chain(cc, "convertscale", NULL, &fused)
+            || !run_chain(cc, "ffmpegcolorspace ! videoscale method=bilinear", NULL, &reference)) {
+        return EXIT_SKIPPED;
+    }
+
+    printf("{\"format\": \"%s\", \"in\": \"%dx%d\", \"out\": \"%dx%d\", \"frames\": %d, "
+            "\"fused_ns\": %" G_GUINT64_FORMAT ", \"reference_ns\": %" G_GUINT64_FORMAT ", "
+            "\"fused_fps\": %.2f, \"reference_fps\": %.2f}\n",
+            cc->format, cc->in_width, cc->in_height, cc->out_width, cc->out_height, frames,
+            fused, reference,
+            fused > 0 ? (gdouble) frames * GST_SECOND / fused : 0.0,
+            reference > 0 ? (gdouble) frames * GST_SECOND / reference : 0.0);
+    fflush(stdout);
+
+    return EXIT_SUCCESS;
+};
+
+int main(int argc, char** argv) {
+    const ConvertCase* cc;
+    int failed = 0, ran = 0;
+
+    if (!test_init(&argc, &argv, "- compare convertscale with the reference elements", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (frames <= 0) {
+        fprintf(stderr, "--frames must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    GstElementFactory* factory = gst_element_factory_find("convertscale");
+    if (factory == NULL) {
+        fprintf(stderr, "convertscale element not found\n");
+        return EXIT_FAILURE;
+    }
+    gst_object_unref(factory);
+
+    for (cc = cases; cc->format != NULL; cc++) {
+        int ret = bench ? bench_case(cc) : check_case(cc);
+
+        if (ret == EXIT_SKIPPED) {
+            continue;
+        }
+        ran++;
+        if (ret != EXIT_SUCCESS) {
+            failed++;
+        }
+    }
+
+    if (!bench) {
+        int ret = check_fixate();
+
+        if (ret != EXIT_SKIPPED) {
+            ran++;
+        }
+        if (ret == EXIT_FAILURE) {
+            failed++;
+        }
+    }
+
+    if (failed > 0) {
+        return EXIT_FAILURE;
+    }
+
+    return ran > 0 ? EXIT_SUCCESS : EXIT_SKIPPED;
+};
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* paralleltranscode end to end.
+ *
+ * Makes an MPEG-TS file, transcodes it with paralleltranscode cut into
+ * short segments spread over several workers, and checks that the output
+ * decodes to as many video frames as the input, lasting as long, with
+ * timestamps that neither go back nor skip where segments meet. Also checks
+ * that a profile whose container can't be concatenated is refused. Exits
+ * with 77 (automake's "skipped") if no MPEG-TS profile can be encoded.
+ */
+
+#include "test-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define RUN_TIMEOUT (300 * GST_SECOND)
+
+/* Output and input may differ by a frame at either end */
+#define FRAME_TOLERANCE 2
+#define DURATION_TOLERANCE (FRAME_TOLERANCE * GST_SECOND / 30)
+
+/* Two frames at 30fps, one dropped at a seam is fine */
+#define MAX_STEP (2 * GST_SECOND / 30 + GST_MSECOND)
+
+static gint frames = 150;
+static gint workers = 3;
+static gint segment_seconds = 1;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames in the input", "N" },
+    { "workers", 'w', 0, G_OPTION_ARG_INT, &workers, "Segments transcoded at once", "N" },
+    { "segment-duration", 's', 0, G_OPTION_ARG_INT, &segment_seconds, "Segment length in seconds", "S" },
+    { NULL }
+};
+
+/* Run paralleltranscode into a file; FALSE if it posted an error */
+static gboolean run_parallel(const char* in, const char* out, GstEncodingProfile* prof) {
+    GstElement* pipe = gst_pipeline_new("parallel");
+    GstElement* src = gst_element_factory_make("paralleltranscode", NULL);
+    GstElement* sink = gst_element_factory_make("filesink", NULL);
+    gboolean ok = FALSE;
+
+    if (src == NULL || sink == NULL) {
+        fprintf(stderr, "paralleltranscode element not found\n");
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (sink != NULL) {
+            gst_object_unref(sink);
+        }
+        gst_object_unref(pipe);
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (src), "location", in, "profile", prof, "workers", (guint) workers,
+            "segment-duration", (guint64) segment_seconds * GST_SECOND, NULL);
+    g_object_set(G_OBJECT (sink), "location", out, NULL);
+
+    gst_bin_add_many(GST_BIN (pipe), src, sink, NULL);
+    if (gst_element_link(src, sink)) {
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+
+        gst_element_set_state(pipe, GST_STATE_PLAYING);
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg != NULL) {
+            ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+    }
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    return ok;
+};
+
+static int check_output(const char* in, const char* out, GstEncodingProfile* prof) {
+    TestVideoSpan in_span, out_span;
+
+    if (!test_measure_video(in, &in_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the input, skipping\n");
+        return EXIT_SKIPPED;
+    }
+
+    if (!run_parallel(in, out, prof)) {
+        fprintf(stderr, "paralleltranscode failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!test_measure_video(out, &out_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the output\n");
+        return EXIT_FAILURE;
+    }
+
+    GstClockTime in_duration = in_span.end - in_span.first;
+    GstClockTime out_duration = out_span.end - out_span.first;
+
+    printf("{\"input_frames\": %d, \"output_frames\": %d, \"input_ns\": %" G_GUINT64_FORMAT ", \"output_ns\": %"
+            G_GUINT64_FORMAT ", \"max_step_ns\": %" G_GUINT64_FORMAT ", \"backwards\": %d, \"workers\": %d}\n",
+            in_span.frames, out_span.frames, in_duration, out_duration, out_span.max_step, out_span.backwards,
+            workers);
+
+    if (ABS(out_span.frames - in_span.frames) > FRAME_TOLERANCE) {
+        fprintf(stderr, "Output has %d frames, input %d\n", out_span.frames, in_span.frames);
+        return EXIT_FAILURE;
+    }
+
+    if (out_span.backwards > 0 || out_span.max_step > MAX_STEP) {
+        fprintf(stderr, "Output timestamps jump: %d go back, largest step %" GST_TIME_FORMAT "\n",
+                out_span.backwards, GST_TIME_ARGS(out_span.max_step));
+        return EXIT_FAILURE;
+    }
+
+    if (ABS(GST_CLOCK_DIFF(in_duration, out_duration)) > DURATION_TOLERANCE) {
+        fprintf(stderr, "Output lasts %" GST_TIME_FORMAT ", input %" GST_TIME_FORMAT "\n",
+                GST_TIME_ARGS(out_duration), GST_TIME_ARGS(in_duration));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+};
+
+/* Segments of a Matroska file can't just be appended to each other */
+static int check_refuses_matroska(const char* in, const char* out, const TestTsCodecs* codecs) {
+    GstEncodingProfile* prof = test_make_profile("mkv", "video/x-matroska",
+            codecs->video, codecs->audio, NULL);
+    gboolean ok = run_parallel(in, out, prof);
+
+    gst_encoding_profile_unref(prof);
+
+    if (ok) {
+        fprintf(stderr, "paralleltranscode accepted a Matroska profile\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+};
+
+int main(int argc, char** argv) {
+    gchar* in = NULL;
+    gchar* out = NULL;
+    GstEncodingProfile* prof;
+    const TestTsCodecs* codecs;
+    int ret;
+
+    if (!test_init(&argc, &argv, "- check paralleltranscode's output", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (frames <= 0 || workers <= 0 || segment_seconds <= 0) {
+        fprintf(stderr, "--frames, --workers and --segment-duration must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    gint fd = g_file_open_tmp("parallel-transcode-XXXXXX.ts", &in, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = g_file_open_tmp("parallel-transcode-out-XXXXXX.ts", &out, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Could not make temporary files\n");
+        return EXIT_FAILURE;
+    }
+
+    codecs = test_generate_ts_input(in, frames, RUN_TIMEOUT);
+    if (codecs == NULL) {
+        fprintf(stderr, "Could not make an MPEG-TS input, skipping\n");
+        ret = EXIT_SKIPPED;
+    } else {
+        prof = test_make_profile("ts", "video/mpegts", codecs->video, codecs->audio, NULL);
+        ret = check_output(in, out, prof);
+        if (ret != EXIT_SKIPPED && check_refuses_matroska(in, out, codecs) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+        gst_encoding_profile_unref(prof);
+    }
+
+    unlink(in);
+    unlink(out);
+    g_free(in);
+    g_free(out);
+
+    return ret;
+};
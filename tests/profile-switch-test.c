@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Profile change in the middle of a transcode.
+ *
+ * Makes an MPEG-TS file and transcodes it, holding the input back half
+ * way through to set a second MPEG-TS profile with a smaller picture.
+ * The run has to reach EOS and post transcodebin-profile-switch with
+ * the streams it moved, and the output has to decode to as many frames
+ * as the input with timestamps that neither go back nor skip across the
+ * change. Exits with 77 (automake's "skipped") if no MPEG-TS profile can
+ * be encoded.
+ */
+
+#include "test-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define RUN_TIMEOUT (300 * GST_SECOND)
+
+/* The encoders may drop or repeat a frame at either end */
+#define FRAME_TOLERANCE 2
+
+/* Two frames at 30fps, one dropped at the change is fine */
+#define MAX_STEP (2 * GST_SECOND / 30 + GST_MSECOND)
+
+static gint frames = 300;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames in the input", "N" },
+    { NULL }
+};
+
+typedef struct {
+    guint64 switch_offset;
+    gulong probe;
+    volatile gint blocked;
+} SwitchPoint;
+
+static void src_blocked(GstPad* pad, gboolean blocked, gpointer user_data) {
+    SwitchPoint* point = (SwitchPoint*) user_data;
+
+    if (blocked) {
+        g_atomic_int_set(&point->blocked, 1);
+    }
+};
+
+/* Hold the input back once half of it has gone in */
+static gboolean src_probe(GstPad* pad, GstBuffer* buf, gpointer user_data) {
+    SwitchPoint* point = (SwitchPoint*) user_data;
+
+    if (GST_BUFFER_OFFSET_IS_VALID(buf) && GST_BUFFER_OFFSET(buf) >= point->switch_offset) {
+        gst_pad_remove_buffer_probe(pad, point->probe);
+        gst_pad_set_blocked_async(pad, TRUE, src_blocked, point);
+    }
+
+    return TRUE;
+};
+
+static gboolean run_switch(const char* in, const char* out, GstEncodingProfile* first, GstEncodingProfile* second,
+        guint* switched) {
+    GstElement* pipe = gst_pipeline_new("switch");
+    GstElement* src = gst_element_factory_make("filesrc", NULL);
+    GstElement* xcode = gst_element_factory_make("transcodebin", NULL);
+    GstElement* sink = gst_element_factory_make("filesink", NULL);
+    SwitchPoint point = { 0, 0, 0 };
+    gboolean ok = FALSE, changed = FALSE;
+    gint64 size = 0;
+    GstClockTime waited = 0;
+
+    *switched = 0;
+
+    if (src == NULL || xcode == NULL || sink == NULL) {
+        fprintf(stderr, "transcodebin element not found\n");
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (xcode != NULL) {
+            gst_object_unref(xcode);
+        }
+        if (sink != NULL) {
+            gst_object_unref(sink);
+        }
+        gst_object_unref(pipe);
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (src), "location", in, NULL);
+    g_object_set(G_OBJECT (xcode), "profile", first, NULL);
+    g_object_set(G_OBJECT (sink), "location", out, NULL);
+
+    gst_bin_add_many(GST_BIN (pipe), src, xcode, sink, NULL);
+    if (!gst_element_link_many(src, xcode, sink, NULL)) {
+        gst_object_unref(pipe);
+        return FALSE;
+    }
+
+    GstPad* srcpad = gst_element_get_static_pad(src, "src");
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+    GstFormat fmt = GST_FORMAT_BYTES;
+
+    gst_element_set_state(pipe, GST_STATE_PAUSED);
+    gst_element_get_state(pipe, NULL, NULL, RUN_TIMEOUT);
+    if (!gst_element_query_duration(src, &fmt, &size) || size <= 0) {
+        fprintf(stderr, "Could not get the input's size\n");
+        goto done;
+    }
+    point.switch_offset = size / 2;
+    point.probe = gst_pad_add_buffer_probe(srcpad, G_CALLBACK (src_probe), &point);
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+    while (TRUE) {
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND,
+                GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_ELEMENT);
+
+        if (!changed && g_atomic_int_get(&point.blocked)) {
+            changed = TRUE;
+            g_object_set(G_OBJECT (xcode), "profile", second, NULL);
+            gst_pad_set_blocked_async(srcpad, FALSE, src_blocked, &point);
+        }
+
+        if (msg == NULL) {
+            waited += 100 * GST_MSECOND;
+            if (waited >= RUN_TIMEOUT) {
+                fprintf(stderr, "Timed out\n");
+                break;
+            }
+            continue;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ELEMENT) {
+            const GstStructure* s = gst_message_get_structure(msg);
+
+            if (s != NULL && gst_structure_has_name(s, "transcodebin-profile-switch")) {
+                gst_structure_get_uint(s, "streams", switched);
+            }
+            gst_message_unref(msg);
+            continue;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            ok = TRUE;
+        } else {
+            GError* err = NULL;
+            gchar* dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            fprintf(stderr, "%s (%s)\n", err->message, dbg ? dbg : "");
+            g_error_free(err);
+            g_free(dbg);
+        }
+
+        gst_message_unref(msg);
+        break;
+    }
+
+    if (ok && !changed) {
+        fprintf(stderr, "Input ended before the profile change\n");
+        ok = FALSE;
+    }
+
+done:
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(srcpad);
+    gst_object_unref(pipe);
+
+    return ok;
+};
+
+static int check_switch(const char* in, const char* out, const TestTsCodecs* codecs) {
+    GstEncodingProfile* first = test_make_profile("ts", "video/mpegts", codecs->video, codecs->audio, NULL);
+    GstEncodingProfile* second = test_make_profile("ts-small", "video/mpegts", codecs->video, codecs->audio,
+            "video/x-raw-yuv,width=160,height=120");
+    TestVideoSpan in_span, out_span;
+    guint switched;
+    gboolean ran;
+
+    if (!test_measure_video(in, &in_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the input, skipping\n");
+        gst_encoding_profile_unref(first);
+        gst_encoding_profile_unref(second);
+        return EXIT_SKIPPED;
+    }
+
+    ran = run_switch(in, out, first, second, &switched);
+    gst_encoding_profile_unref(first);
+    gst_encoding_profile_unref(second);
+
+    if (!ran) {
+        fprintf(stderr, "transcodebin failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!test_measure_video(out, &out_span, RUN_TIMEOUT)) {
+        fprintf(stderr, "Could not decode the output\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\"switched\": %u, \"input_frames\": %d, \"output_frames\": %d, \"max_step_ns\": %" G_GUINT64_FORMAT
+            ", \"backwards\": %d}\n", switched, in_span.frames, out_span.frames, out_span.max_step,
+            out_span.backwards);
+
+    if (switched == 0) {
+        fprintf(stderr, "No streams moved to the new profile\n");
+        return EXIT_FAILURE;
+    }
+
+    if (ABS(out_span.frames - in_span.frames) > FRAME_TOLERANCE) {
+        fprintf(stderr, "Output has %d frames, input %d\n", out_span.frames, in_span.frames);
+        return EXIT_FAILURE;
+    }
+
+    if (out_span.backwards > 0 || out_span.max_step > MAX_STEP) {
+        fprintf(stderr, "Output timestamps jump: %d go back, largest step %" GST_TIME_FORMAT "\n",
+                out_span.backwards, GST_TIME_ARGS(out_span.max_step));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+};
+
+int main(int argc, char** argv) {
+    gchar* in = NULL;
+    gchar* out = NULL;
+    const TestTsCodecs* codecs;
+    int ret;
+
+    if (!test_init(&argc, &argv, "- change transcodebin's profile mid-stream", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (frames <= 0) {
+        fprintf(stderr, "--frames must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    gint fd = g_file_open_tmp("profile-switch-XXXXXX.ts", &in, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = g_file_open_tmp("profile-switch-out-XXXXXX.ts", &out, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Could not make temporary files\n");
+        return EXIT_FAILURE;
+    }
+
+    codecs = test_generate_ts_input(in, frames, RUN_TIMEOUT);
+    if (codecs == NULL) {
+        fprintf(stderr, "Could not make an MPEG-TS input, skipping\n");
+        ret = EXIT_SKIPPED;
+    } else {
+        ret = check_switch(in, out, codecs);
+    }
+
+    unlink(in);
+    unlink(out);
+    g_free(in);
+    g_free(out);
+
+    return ret;
+};
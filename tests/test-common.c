@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Setup and fixtures shared by the tests in this directory. */
+
+#include "test-common.h"
+
+#include <stdio.h>
+
+gboolean test_init(int* argc, char*** argv, const char* summary, const GOptionEntry* entries) {
+    GOptionContext* ctx = g_option_context_new(summary);
+    GError* err = NULL;
+
+    if (!g_thread_supported()) {
+        g_thread_init(NULL);
+    }
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    g_option_context_add_group(ctx, gst_init_get_option_group());
+    if (!g_option_context_parse(ctx, argc, argv, &err)) {
+        fprintf(stderr, "%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(ctx);
+        return FALSE;
+    }
+    g_option_context_free(ctx);
+
+    return TRUE;
+};
+
+GstEncodingProfile* test_make_profile(const char* name, const char* container,
+        const char* video, const char* audio, const char* restriction) {
+    GstCaps* caps = gst_caps_from_string(container);
+    GstEncodingContainerProfile* cprof = gst_encoding_container_profile_new(name, NULL, caps, NULL);
+    gst_caps_unref(caps);
+
+    GstCaps* vcaps = gst_caps_from_string(video);
+    GstCaps* rcaps = restriction ? gst_caps_from_string(restriction) : NULL;
+    gst_encoding_container_profile_add_profile(cprof,
+            (GstEncodingProfile*) gst_encoding_video_profile_new(vcaps, NULL, rcaps, 0));
+    gst_caps_unref(vcaps);
+    if (rcaps != NULL) {
+        gst_caps_unref(rcaps);
+    }
+
+    GstCaps* acaps = gst_caps_from_string(audio);
+    gst_encoding_container_profile_add_profile(cprof,
+            (GstEncodingProfile*) gst_encoding_audio_profile_new(acaps, NULL, NULL, 0));
+    gst_caps_unref(acaps);
+
+    return (GstEncodingProfile*) cprof;
+};
+
+gboolean test_generate_input(const char* path, GstEncodingProfile* prof, gint frames, GstClockTime timeout) {
+    GstElement* pipe = gst_pipeline_new("generate");
+    GstElement* vsrc = gst_element_factory_make("videotestsrc", NULL);
+    GstElement* asrc = gst_element_factory_make("audiotestsrc", NULL);
+    GstElement* ebin = gst_element_factory_make("encodebin", NULL);
+    GstElement* sink = gst_element_factory_make("filesink", NULL);
+    gboolean ok = FALSE;
+
+    if (vsrc == NULL || asrc == NULL || ebin == NULL || sink == NULL) {
+        if (vsrc != NULL) {
+            gst_object_unref(vsrc);
+        }
+        if (asrc != NULL) {
+            gst_object_unref(asrc);
+        }
+        if (ebin != NULL) {
+            gst_object_unref(ebin);
+        }
+        if (sink != NULL) {
+            gst_object_unref(sink);
+        }
+        gst_object_unref(pipe);
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (ebin), "profile", prof, NULL);
+    g_object_set(G_OBJECT (vsrc), "num-buffers", frames, NULL);
+    /* 1024 samples at 44.1kHz per buffer, about as long as the video */
+    g_object_set(G_OBJECT (asrc), "num-buffers", frames * 44100 / 30 / 1024, NULL);
+    g_object_set(G_OBJECT (sink), "location", path, NULL);
+
+    gst_bin_add_many(GST_BIN (pipe), vsrc, asrc, ebin, sink, NULL);
+
+    if (gst_element_link_pads(vsrc, "src", ebin, "video_%d")
+            && gst_element_link_pads(asrc, "src", ebin, "audio_%d")
+            && gst_element_link(ebin, sink)) {
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+
+        gst_element_set_state(pipe, GST_STATE_PLAYING);
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg != NULL) {
+            ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+    }
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    return ok;
+};
+
+/* Tried in order, the first one that can be encoded is used */
+static const TestTsCodecs ts_codecs[] = {
+    { "video/mpeg,mpegversion=2,systemstream=false", "audio/mpeg,mpegversion=1,layer=2" },
+    { "video/x-h264", "audio/mpeg,mpegversion=4" },
+    { NULL, }
+};
+
+const TestTsCodecs* test_generate_ts_input(const char* path, gint frames, GstClockTime timeout) {
+    const TestTsCodecs* codecs;
+
+    for (codecs = ts_codecs; codecs->video != NULL; codecs++) {
+        GstEncodingProfile* prof = test_make_profile("ts", "video/mpegts", codecs->video, codecs->audio, NULL);
+        gboolean ok = test_generate_input(path, prof, frames, timeout);
+
+        gst_encoding_profile_unref(prof);
+        if (ok) {
+            return codecs;
+        }
+    }
+
+    return NULL;
+};
+
+typedef struct {
+    GstElement* pipe;
+    TestVideoSpan* span;
+    GstClockTime last;
+    gboolean have_video;
+} MeasureState;
+
+static void measure_handoff(GstElement* sink, GstBuffer* buf, GstPad* pad, gpointer user_data) {
+    MeasureState* state = (MeasureState*) user_data;
+    TestVideoSpan* span = state->span;
+    GstClockTime ts = GST_BUFFER_TIMESTAMP(buf);
+
+    span->frames++;
+    if (!GST_CLOCK_TIME_IS_VALID(ts)) {
+        return;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID(state->last)) {
+        if (ts < state->last) {
+            span->backwards++;
+        } else if (ts - state->last > span->max_step) {
+            span->max_step = ts - state->last;
+        }
+    }
+    state->last = ts;
+
+    if (!GST_CLOCK_TIME_IS_VALID(span->first) || ts < span->first) {
+        span->first = ts;
+    }
+    if (GST_BUFFER_DURATION_IS_VALID(buf)) {
+        ts += GST_BUFFER_DURATION(buf);
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(span->end) || ts > span->end) {
+        span->end = ts;
+    }
+};
+
+/* Watch the first video stream, throw the rest away */
+static void measure_pad_added(GstElement* dbin, GstPad* pad, gpointer user_data) {
+    MeasureState* state = (MeasureState*) user_data;
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    GstCaps* caps = gst_pad_get_caps(pad);
+    gboolean is_video = FALSE;
+
+    if (caps != NULL && gst_caps_get_size(caps) > 0) {
+        is_video = g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/");
+    }
+    if (caps != NULL) {
+        gst_caps_unref(caps);
+    }
+
+    if (sink == NULL) {
+        return;
+    }
+
+    g_object_set(G_OBJECT (sink), "sync", FALSE, NULL);
+    if (is_video && !state->have_video) {
+        state->have_video = TRUE;
+        g_object_set(G_OBJECT (sink), "signal-handoffs", TRUE, NULL);
+        g_signal_connect(sink, "handoff", G_CALLBACK (measure_handoff), state);
+    }
+
+    gst_bin_add(GST_BIN (state->pipe), sink);
+    gst_element_sync_state_with_parent(sink);
+
+    GstPad* sinkpad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_link(pad, sinkpad);
+    gst_object_unref(sinkpad);
+};
+
+gboolean test_measure_video(const char* path, TestVideoSpan* span, GstClockTime timeout) {
+    MeasureState state = { NULL, span, GST_CLOCK_TIME_NONE, FALSE };
+    GstElement* src = gst_element_factory_make("filesrc", NULL);
+    GstElement* dbin = gst_element_factory_make("decodebin2", NULL);
+    gboolean ok = FALSE;
+
+    span->frames = 0;
+    span->first = GST_CLOCK_TIME_NONE;
+    span->end = GST_CLOCK_TIME_NONE;
+    span->max_step = 0;
+    span->backwards = 0;
+
+    state.pipe = gst_pipeline_new("measure");
+    if (src == NULL || dbin == NULL) {
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (dbin != NULL) {
+            gst_object_unref(dbin);
+        }
+        gst_object_unref(state.pipe);
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (src), "location", path, NULL);
+    g_signal_connect(dbin, "pad-added", G_CALLBACK (measure_pad_added), &state);
+
+    gst_bin_add_many(GST_BIN (state.pipe), src, dbin, NULL);
+    if (gst_element_link(src, dbin)) {
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (state.pipe));
+
+        gst_element_set_state(state.pipe, GST_STATE_PLAYING);
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg != NULL) {
+            ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS && GST_CLOCK_TIME_IS_VALID(span->first);
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+    }
+
+    gst_element_set_state(state.pipe, GST_STATE_NULL);
+    gst_object_unref(state.pipe);
+
+    return ok;
+};
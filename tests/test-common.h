@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TEST_COMMON_H__
+#define __TEST_COMMON_H__
+
+#include <glib-object.h>
+#include <gst/gst.h>
+#include <gst/pbutils/encoding-profile.h>
+
+G_BEGIN_DECLS
+
+/* automake's exit status for a skipped test */
+#define EXIT_SKIPPED 77
+
+/* Set up threads and GStreamer and parse the command line. Prints the
+ * problem and returns FALSE if the options don't parse. */
+gboolean test_init(int* argc, char*** argv, const char* summary, const GOptionEntry* entries);
+
+/* Container profile with one video and one audio stream; restriction
+ * applies to the video stream and may be NULL. */
+GstEncodingProfile* test_make_profile(const char* name, const char* container,
+        const char* video, const char* audio, const char* restriction);
+
+/* Encode frames of videotestsrc and about as much audiotestsrc with prof
+ * into the file at path. Returns FALSE if an element is missing or the
+ * pipeline doesn't reach EOS within timeout. */
+gboolean test_generate_input(const char* path, GstEncodingProfile* prof, gint frames, GstClockTime timeout);
+
+/* Codecs of an MPEG-TS input, see test_generate_ts_input() */
+typedef struct {
+    const char* video;
+    const char* audio;
+} TestTsCodecs;
+
+/* test_generate_input() with an MPEG-TS profile, trying a few codec
+ * pairs in turn. Returns the pair that could be encoded, or NULL. */
+const TestTsCodecs* test_generate_ts_input(const char* path, gint frames, GstClockTime timeout);
+
+/* What the first video stream of a file decodes to */
+typedef struct {
+    gint frames;
+    GstClockTime first;     /* earliest timestamp */
+    GstClockTime end;       /* latest timestamp plus duration */
+    GstClockTime max_step;  /* largest step from one frame to the next */
+    gint backwards;         /* frames stamped before the one they follow */
+} TestVideoSpan;
+
+/* Decode the file at path and fill in span. Returns FALSE if it doesn't
+ * decode to EOS within timeout or has no timestamped video. */
+gboolean test_measure_video(const char* path, TestVideoSpan* span, GstClockTime timeout);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Non-interactive transcodebin benchmark.
+ *
+ * Runs every source against every built-in profile, each case in its own
+ * child process so that CPU time and peak RSS are per case, and prints one
+ * JSON object per case on stdout. Cases whose encoders or muxers aren't
+ * installed are reported as skipped. Exits non-zero if any case failed, or
+ * with 77 (automake's "skipped") if none could run at all.
+ */
+
+#include "test-common.h"
+
+#include <gst/pbutils/missing-plugins.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* How long a single case may run before it counts as failed */
+#define CASE_TIMEOUT (600 * GST_SECOND)
+
+typedef struct {
+    const char* name;
+    const char* container;
+    const char* video;
+    const char* audio;
+    const char* restriction;
+} BenchProfile;
+
+static const BenchProfile profiles[] = {
+    { "ogg-theora-vorbis", "application/ogg", "video/x-theora", "audio/x-vorbis", NULL },
+    { "ogg-theora-vorbis-360p", "application/ogg", "video/x-theora", "audio/x-vorbis", "video/x-raw-yuv,width=640,height=360" },
+    { "webm-vp8-vorbis", "video/webm", "video/x-vp8", "audio/x-vorbis", NULL },
+    { "mp4-h264-aac", "video/quicktime,variant=iso", "video/x-h264", "audio/mpeg,mpegversion=4", NULL },
+    { NULL, }
+};
+
+static const char* sources[] = { "video", "audio", "file", NULL };
+
+static gint frames = 100;
+static gchar* run_source = NULL;
+static gchar* run_profile = NULL;
+static gchar* input = NULL;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Video frames (or audio buffers) per case", "N" },
+    { "run-source", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &run_source, NULL, NULL },
+    { "run-profile", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &run_profile, NULL, NULL },
+    { "input", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &input, NULL, NULL },
+    { NULL }
+};
+
+static GstEncodingProfile* make_profile(const BenchProfile* bp) {
+    return test_make_profile(bp->name, bp->container, bp->video, bp->audio, bp->restriction);
+};
+
+static const BenchProfile* find_profile(const char* name) {
+    const BenchProfile* bp;
+
+    for (bp = profiles; bp->name != NULL; bp++) {
+        if (strcmp(bp->name, name) == 0) {
+            return bp;
+        }
+    }
+
+    return NULL;
+};
+
+static GstClockTime cpu_time(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return GST_TIMEVAL_TO_TIME(ru.ru_utime) + GST_TIMEVAL_TO_TIME(ru.ru_stime);
+};
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+};
+
+/* Raw test sources, capped to a fixed number of buffers so every case
+ * does the same amount of work. */
+static GstElement* make_source(GstBin* pipe, const char* source) {
+    GstElement* src;
+    GstElement* filter = gst_element_factory_make("capsfilter", NULL);
+    GstCaps* caps;
+
+    if (strcmp(source, "video") == 0) {
+        src = gst_element_factory_make("videotestsrc", NULL);
+        caps = gst_caps_from_string("video/x-raw-yuv,format=(fourcc)I420,width=1280,height=720,framerate=30/1");
+    } else if (strcmp(source, "audio") == 0) {
+        src = gst_element_factory_make("audiotestsrc", NULL);
+        caps = gst_caps_from_string("audio/x-raw-int,rate=48000,channels=2");
+    } else {
+        src = gst_element_factory_make("filesrc", NULL);
+        if (filter != NULL) {
+            gst_object_unref(filter);
+        }
+        if (src == NULL) {
+            return NULL;
+        }
+        g_object_set(G_OBJECT (src), "location", input, NULL);
+        gst_bin_add(pipe, src);
+        return src;
+    }
+
+    if (src == NULL || filter == NULL) {
+        if (src != NULL) {
+            gst_object_unref(src);
+        }
+        if (filter != NULL) {
+            gst_object_unref(filter);
+        }
+        gst_caps_unref(caps);
+        return NULL;
+    }
+
+    g_object_set(G_OBJECT (src), "num-buffers", frames, NULL);
+    g_object_set(G_OBJECT (filter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    gst_bin_add_many(pipe, src, filter, NULL);
+    gst_element_link(src, filter);
+
+    return filter;
+};
+
+typedef struct {
+    GstClockTime started;
+    GstClockTime first_buffer;
+    guint64 bytes;
+} SinkCounter;
+
+static void sink_handoff(GstElement* sink, GstBuffer* buf, GstPad* pad, gpointer user_data) {
+    SinkCounter* counter = (SinkCounter*) user_data;
+
+    if (!GST_CLOCK_TIME_IS_VALID(counter->first_buffer)) {
+        counter->first_buffer = gst_util_get_timestamp() - counter->started;
+    }
+    counter->bytes += GST_BUFFER_SIZE(buf);
+};
+
+static void print_result(const char* source, const char* profile, const char* status,
+        GstClockTime wall, GstClockTime cpu, GstClockTime ttfb, GstClockTime setup, guint64 bytes) {
+    gdouble fps = wall > 0 ? (gdouble) frames * GST_SECOND / wall : 0.0;
+
+    printf("{\"source\": \"%s\", \"profile\": \"%s\", \"status\": \"%s\", \"frames\": %d, "
+            "\"wall_ns\": %" G_GUINT64_FORMAT ", \"fps\": %.2f, \"cpu_ns\": %" G_GUINT64_FORMAT ", "
+            "\"peak_rss_kb\": %ld, \"ttfb_ns\": %" G_GINT64_FORMAT ", \"setup_ns\": %" G_GUINT64_FORMAT ", "
+            "\"output_bytes\": %" G_GUINT64_FORMAT "}\n",
+            source, profile, status, frames, wall, fps, cpu, peak_rss_kb(),
+            GST_CLOCK_TIME_IS_VALID(ttfb) ? (gint64) ttfb : (gint64) -1, setup, bytes);
+    fflush(stdout);
+};
+
+/* Child side: run one case and report it. */
+static int run_case(const char* source, const char* profile_name) {
+    const BenchProfile* bp = find_profile(profile_name);
+    if (bp == NULL) {
+        fprintf(stderr, "Unknown profile %s\n", profile_name);
+        return EXIT_FAILURE;
+    }
+
+    GstClockTime cpu_start = cpu_time();
+    SinkCounter counter = { gst_util_get_timestamp(), GST_CLOCK_TIME_NONE, 0 };
+
+    GstBin* pipe = GST_BIN (gst_pipeline_new("bench"));
+    GstElement* src = make_source(pipe, source);
+    GstElement* xcode = gst_element_factory_make("transcodebin", NULL);
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+
+    if (src == NULL || xcode == NULL || sink == NULL) {
+        print_result(source, profile_name, "skipped", 0, 0, GST_CLOCK_TIME_NONE, 0, 0);
+        return EXIT_SKIPPED;
+    }
+
+    GstEncodingProfile* prof = make_profile(bp);
+    g_object_set(G_OBJECT (xcode), "profile", prof, NULL);
+    gst_encoding_profile_unref(prof);
+
+    g_object_set(G_OBJECT (sink), "sync", FALSE, "signal-handoffs", TRUE, NULL);
+    g_signal_connect(sink, "handoff", G_CALLBACK (sink_handoff), &counter);
+
+    gst_bin_add_many(pipe, xcode, sink, NULL);
+    if (!gst_element_link_many(src, xcode, sink, NULL)) {
+        print_result(source, profile_name, "failed", 0, 0, GST_CLOCK_TIME_NONE, 0, 0);
+        return EXIT_FAILURE;
+    }
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+    gboolean missing = FALSE;
+    const char* status = "failed";
+
+    gst_element_set_state(GST_ELEMENT (pipe), GST_STATE_PLAYING);
+
+    while (TRUE) {
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, CASE_TIMEOUT,
+                GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_ELEMENT);
+        if (msg == NULL) {
+            fprintf(stderr, "%s/%s timed out\n", source, profile_name);
+            break;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ELEMENT) {
+            missing = missing || gst_is_missing_plugin_message(msg);
+            gst_message_unref(msg);
+            continue;
+        }
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            status = "ok";
+        } else if (missing) {
+            status = "skipped";
+        } else {
+            GError* err = NULL;
+            gchar* dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            fprintf(stderr, "%s/%s: %s (%s)\n", source, profile_name, err->message, dbg ? dbg : "");
+            g_error_free(err);
+            g_free(dbg);
+        }
+
+        gst_message_unref(msg);
+        break;
+    }
+
+    GstClockTime wall = gst_util_get_timestamp() - counter.started;
+    guint64 setup = 0;
+    g_object_get(G_OBJECT (xcode), "setup-time", &setup, NULL);
+
+    gst_element_set_state(GST_ELEMENT (pipe), GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipe);
+
+    print_result(source, profile_name, status, wall, cpu_time() - cpu_start,
+            counter.first_buffer, setup, counter.bytes);
+
+    if (strcmp(status, "ok") == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    return strcmp(status, "skipped") == 0 ? EXIT_SKIPPED : EXIT_FAILURE;
+};
+
+/* Make a muxed audio+video file with the first profile to use as the
+ * "file" source, so demuxing, decoding and stream copy get exercised. */
+static gboolean generate_input(const char* path) {
+    GstEncodingProfile* prof = make_profile(&profiles[0]);
+    gboolean ok = test_generate_input(path, prof, frames, CASE_TIMEOUT);
+
+    gst_encoding_profile_unref(prof);
+
+    return ok;
+};
+
+/* Parent side: run every case in a child process. */
+static int run_matrix(const char* self_path) {
+    int failed = 0, ran = 0;
+    gchar* path = NULL;
+    gchar* frames_arg = g_strdup_printf("--frames=%d", frames);
+    const char** source;
+    const BenchProfile* bp;
+
+    gint fd = g_file_open_tmp("transcode-bench-XXXXXX.ogg", &path, NULL);
+    if (fd >= 0) {
+        close(fd);
+    }
+    gboolean have_file = path != NULL && generate_input(path);
+
+    for (source = sources; *source != NULL; source++) {
+        for (bp = profiles; bp->name != NULL; bp++) {
+            if (strcmp(*source, "file") == 0 && !have_file) {
+                print_result(*source, bp->name, "skipped", 0, 0, GST_CLOCK_TIME_NONE, 0, 0);
+                continue;
+            }
+
+            gchar* argv[] = { (gchar*) self_path, frames_arg,
+                "--run-source", (gchar*) *source, "--run-profile", (gchar*) bp->name,
+                "--input", path ? path : "", NULL };
+            gint exit_status = 0;
+            GError* err = NULL;
+
+            /* The child's report goes straight to our stdout */
+            if (!g_spawn_sync(NULL, argv, NULL, G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL,
+                    NULL, NULL, &exit_status, &err)) {
+                fprintf(stderr, "Could not run %s/%s: %s\n", *source, bp->name, err->message);
+                g_error_free(err);
+                failed++;
+                continue;
+            }
+
+            if (WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == EXIT_SKIPPED) {
+                continue;
+            }
+
+            ran++;
+            if (!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != EXIT_SUCCESS) {
+                if (!WIFEXITED(exit_status)) {
+                    print_result(*source, bp->name, "crashed", 0, 0, GST_CLOCK_TIME_NONE, 0, 0);
+                }
+                failed++;
+            }
+        }
+    }
+
+    if (path != NULL) {
+        unlink(path);
+        g_free(path);
+    }
+    g_free(frames_arg);
+
+    if (failed > 0) {
+        return EXIT_FAILURE;
+    }
+
+    return ran > 0 ? EXIT_SUCCESS : EXIT_SKIPPED;
+};
+
+int main(int argc, char** argv) {
+    if (!test_init(&argc, &argv, "- benchmark transcodebin", entries)) {
+        return EXIT_FAILURE;
+    }
+
+    if (frames <= 0) {
+        fprintf(stderr, "--frames must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (run_source != NULL && run_profile != NULL) {
+        return run_case(run_source, run_profile);
+    }
+
+    return run_matrix(argv[0]);
+};
@@ -269,7 +269,7 @@ int main (int argc, char** argv) {
                 gst_query_parse_duration(duration, NULL, &durcnt);
                 gst_query_parse_position(position, NULL, &poscnt);
 
-                progress = (gfloat)durcnt / (gfloat)poscnt;
+                progress = (gfloat)poscnt / (gfloat)durcnt;
 
                 printf("Encoding progress %.2f%%\n", progress * 100.0f);
 
@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Batch transcoder.
+ *
+ * Keeps a pool of transcodebin ! filesink pipelines, one per worker
+ * thread, and feeds files through them; transcodebin maps each input
+ * file itself. Between files a pipeline only goes back to READY, so
+ * elements, loaded plugins and transcodebin's autoplug cache are
+ * reused. Prints one JSON line per file with the time spent getting to
+ * PAUSED (setup) and from there to EOS (processing).
+ *
+ * Files are taken from the command line, or one per line from stdin.
+ *
+ * With --cache-dir, outputs are kept in a content-addressed cache and a
+ * file that was already transcoded with the same profile is served from
+ * there instead; hit/miss totals are printed as a last JSON line.
+ */
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/encoding-profile.h>
+#include <gst/pbutils/encoding-target.h>
+
+#include "transcode-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static gchar* target_file = NULL;
+static gchar* profile_name = NULL;
+static gchar* output_dir = NULL;
+static gchar* suffix = NULL;
+static gint jobs = 0;
+static gchar* cache_dir = NULL;
+static gint cache_size = 4096;
+static gboolean shared_pool = FALSE;
+
+static GOptionEntry entries[] = {
+    { "target", 't', 0, G_OPTION_ARG_FILENAME, &target_file, "Encoding target file holding the profile", "FILE" },
+    { "profile", 'p', 0, G_OPTION_ARG_STRING, &profile_name, "Name of the profile in the target", "NAME" },
+    { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Directory for the output files (default: next to the input)", "DIR" },
+    { "suffix", 's', 0, G_OPTION_ARG_STRING, &suffix, "Suffix appended to output file names (default: .out)", "SUFFIX" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Number of pipelines (default: one per CPU)", "N" },
+    { "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir, "Reuse earlier outputs kept in this directory", "DIR" },
+    { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size, "Disk budget of the cache in MiB (default: 4096)", "MIB" },
+    { "shared-pool", 0, 0, G_OPTION_ARG_NONE, &shared_pool, "Run all pipelines' streaming threads on one CPU-pinned pool", NULL },
+    { NULL }
+};
+
+typedef struct {
+    GMutex* lock;
+    gchar** files;
+    guint next;
+    guint failed;
+    GstEncodingProfile* profile;
+    TranscodeCache* cache;
+    gchar* profile_digest;
+} BatchQueue;
+
+typedef struct {
+    BatchQueue* queue;
+    GstElement* pipe;
+    GstElement* xcode;
+    GstElement* filesink;
+    GThread* thread;
+} BatchWorker;
+
+static gboolean worker_build(BatchWorker* worker) {
+    worker->pipe = gst_pipeline_new(NULL);
+    worker->xcode = gst_element_factory_make("transcodebin", NULL);
+    worker->filesink = gst_element_factory_make("filesink", NULL);
+
+    if (worker->xcode == NULL || worker->filesink == NULL) {
+        fprintf(stderr, "Could not create pipeline elements\n");
+        return FALSE;
+    }
+
+    g_object_set(G_OBJECT (worker->xcode), "profile", worker->queue->profile,
+            "shared-task-pool", shared_pool, "pin-threads", shared_pool, NULL);
+
+    gst_bin_add_many(GST_BIN (worker->pipe), worker->xcode, worker->filesink, NULL);
+    if (!gst_element_link(worker->xcode, worker->filesink)) {
+        fprintf(stderr, "Could not link pipeline\n");
+        return FALSE;
+    }
+
+    /* Load plugins and allocate everything up front */
+    return gst_element_set_state(worker->pipe, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE;
+};
+
+static gchar* output_name(const gchar* input) {
+    const gchar* sfx = suffix ? suffix : ".out";
+
+    if (output_dir != NULL) {
+        gchar* base = g_path_get_basename(input);
+        gchar* name = g_strconcat(base, sfx, NULL);
+        gchar* path = g_build_filename(output_dir, name, NULL);
+
+        g_free(base);
+        g_free(name);
+        return path;
+    }
+
+    return g_strconcat(input, sfx, NULL);
+};
+
+/* Wait for the pipeline to get where it's going, watching for errors */
+static gboolean wait_for(GstElement* pipe, GstMessageType done) {
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE (pipe));
+    gboolean ok = FALSE;
+
+    while (TRUE) {
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                done | GST_MESSAGE_ERROR);
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            GError* err = NULL;
+            gchar* dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            fprintf(stderr, "%s: %s\n", GST_OBJECT_NAME (GST_MESSAGE_SRC(msg)), err->message);
+            g_error_free(err);
+            g_free(dbg);
+            gst_message_unref(msg);
+            break;
+        }
+
+        /* Only the pipeline's own ASYNC_DONE counts */
+        if (GST_MESSAGE_TYPE(msg) == done
+                && (done != GST_MESSAGE_ASYNC_DONE || GST_MESSAGE_SRC(msg) == GST_OBJECT (pipe))) {
+            ok = TRUE;
+            gst_message_unref(msg);
+            break;
+        }
+
+        gst_message_unref(msg);
+    }
+
+    gst_object_unref(bus);
+    return ok;
+};
+
+static gboolean worker_run(BatchWorker* worker, const gchar* input, const gchar* output,
+        GstClockTime* setup, GstClockTime* processing) {
+    GstClockTime start, prerolled;
+    gboolean ok;
+
+    g_object_set(G_OBJECT (worker->xcode), "location", input, NULL);
+    g_object_set(G_OBJECT (worker->filesink), "location", output, NULL);
+
+    start = gst_util_get_timestamp();
+    gst_element_set_state(worker->pipe, GST_STATE_PAUSED);
+    ok = wait_for(worker->pipe, GST_MESSAGE_ASYNC_DONE);
+    prerolled = gst_util_get_timestamp();
+
+    if (ok) {
+        gst_element_set_state(worker->pipe, GST_STATE_PLAYING);
+        ok = wait_for(worker->pipe, GST_MESSAGE_EOS);
+    }
+
+    *setup = prerolled - start;
+    *processing = gst_util_get_timestamp() - prerolled;
+
+    /* Back to READY only, so the next file reuses everything */
+    gst_element_set_state(worker->pipe, GST_STATE_READY);
+    gst_bus_set_flushing(GST_ELEMENT_BUS (worker->pipe), TRUE);
+    gst_bus_set_flushing(GST_ELEMENT_BUS (worker->pipe), FALSE);
+
+    return ok;
+};
+
+/* File names go into the JSON output as they are, bar what JSON needs
+ * escaped; g_strescape() would turn non-ASCII bytes into octal escapes,
+ * which JSON doesn't have */
+static gchar* json_escape(const gchar* str) {
+    GString* out = g_string_sized_new(strlen(str));
+    const guchar* p;
+
+    for (p = (const guchar*) str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *p);
+        } else if (*p < 0x20) {
+            g_string_append_printf(out, "\\u%04x", *p);
+        } else {
+            g_string_append_c(out, *p);
+        }
+    }
+
+    return g_string_free(out, FALSE);
+};
+
+static gpointer worker_thread(gpointer user_data) {
+    BatchWorker* worker = (BatchWorker*) user_data;
+    BatchQueue* queue = worker->queue;
+
+    while (TRUE) {
+        const gchar* input;
+        const gchar* cached = "off";
+        gchar* output;
+        gchar* key = NULL;
+        GstClockTime setup = 0, processing = 0;
+        gboolean ok;
+
+        g_mutex_lock(queue->lock);
+        input = queue->files[queue->next];
+        if (input != NULL) {
+            queue->next++;
+        }
+        g_mutex_unlock(queue->lock);
+
+        if (input == NULL) {
+            break;
+        }
+
+        output = output_name(input);
+
+        if (queue->cache != NULL) {
+            GError* err = NULL;
+
+            key = transcode_cache_key(input, queue->profile_digest, &err);
+            if (key == NULL) {
+                fprintf(stderr, "Not caching %s: %s\n", input, err->message);
+                g_error_free(err);
+            }
+        }
+
+        if (key != NULL) {
+            GstClockTime start = gst_util_get_timestamp();
+
+            cached = "miss";
+            if (transcode_cache_fetch(queue->cache, key, output)) {
+                cached = "hit";
+                ok = TRUE;
+                processing = gst_util_get_timestamp() - start;
+            }
+        }
+
+        if (strcmp(cached, "hit") != 0) {
+            /* An earlier output may be linked into the cache; filesink
+             * would write over that entry */
+            if (queue->cache != NULL) {
+                g_unlink(output);
+            }
+            ok = worker_run(worker, input, output, &setup, &processing);
+            if (ok && key != NULL) {
+                transcode_cache_store(queue->cache, key, output);
+            }
+        }
+
+        g_free(output);
+        g_free(key);
+
+        gchar* file = json_escape(input);
+
+        g_mutex_lock(queue->lock);
+        if (!ok) {
+            queue->failed++;
+        }
+        printf("{\"file\": \"%s\", \"status\": \"%s\", \"cache\": \"%s\", \"setup_ns\": %" G_GUINT64_FORMAT
+                ", \"processing_ns\": %" G_GUINT64_FORMAT "}\n",
+                file, ok ? "ok" : "failed", cached, setup, processing);
+        fflush(stdout);
+        g_mutex_unlock(queue->lock);
+
+        g_free(file);
+    }
+
+    return NULL;
+};
+
+static gchar** read_stdin_files(void) {
+    GPtrArray* files = g_ptr_array_new();
+    char line[4096];
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        g_strstrip(line);
+        if (line[0] != '\0') {
+            g_ptr_array_add(files, g_strdup(line));
+        }
+    }
+    g_ptr_array_add(files, NULL);
+
+    return (gchar**) g_ptr_array_free(files, FALSE);
+};
+
+int main(int argc, char** argv) {
+    GOptionContext* ctx = g_option_context_new("[FILE...] - transcode many files with a pool of pipelines");
+    GError* err = NULL;
+    BatchQueue queue = { NULL, };
+    BatchWorker* workers;
+    gint i;
+
+    if (!g_thread_supported()) {
+        g_thread_init(NULL);
+    }
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    g_option_context_add_group(ctx, gst_init_get_option_group());
+    if (!g_option_context_parse(ctx, &argc, &argv, &err)) {
+        fprintf(stderr, "%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+
+    if (target_file == NULL || profile_name == NULL) {
+        fprintf(stderr, "Both --target and --profile are required\n");
+        return EXIT_FAILURE;
+    }
+
+    GstEncodingTarget* target = gst_encoding_target_load_from_file(target_file, &err);
+    if (target == NULL) {
+        fprintf(stderr, "Could not load %s: %s\n", target_file, err ? err->message : "unknown error");
+        return EXIT_FAILURE;
+    }
+
+    queue.profile = gst_encoding_target_get_profile(target, profile_name);
+    gst_encoding_target_unref(target);
+    if (queue.profile == NULL) {
+        fprintf(stderr, "No profile %s in %s\n", profile_name, target_file);
+        return EXIT_FAILURE;
+    }
+
+    if (cache_dir != NULL) {
+        queue.cache = transcode_cache_new(cache_dir, (guint64) MAX(cache_size, 0) * 1024 * 1024, &err);
+        if (queue.cache == NULL) {
+            fprintf(stderr, "Could not open cache: %s\n", err->message);
+            return EXIT_FAILURE;
+        }
+        queue.profile_digest = transcode_cache_profile_digest(queue.profile);
+    }
+
+    queue.lock = g_mutex_new();
+    queue.files = argc > 1 ? g_strdupv(argv + 1) : read_stdin_files();
+
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (gint) n : 1;
+    }
+    jobs = MIN((guint) jobs, MAX(g_strv_length(queue.files), 1));
+
+    workers = g_new0(BatchWorker, jobs);
+    for (i = 0; i < jobs; i++) {
+        workers[i].queue = &queue;
+        if (!worker_build(&workers[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < jobs; i++) {
+        workers[i].thread = g_thread_create(worker_thread, &workers[i], TRUE, NULL);
+    }
+
+    for (i = 0; i < jobs; i++) {
+        if (workers[i].thread != NULL) {
+            g_thread_join(workers[i].thread);
+        }
+    }
+
+    if (shared_pool) {
+        GstStructure* stats = NULL;
+        gchar* str;
+
+        g_object_get(G_OBJECT (workers[0].xcode), "task-pool-stats", &stats, NULL);
+        if (stats != NULL) {
+            str = gst_structure_to_string(stats);
+            fprintf(stderr, "%s\n", str);
+            g_free(str);
+            gst_structure_free(stats);
+        }
+    }
+
+    for (i = 0; i < jobs; i++) {
+        gst_element_set_state(workers[i].pipe, GST_STATE_NULL);
+        gst_object_unref(workers[i].pipe);
+    }
+
+    if (queue.cache != NULL) {
+        TranscodeCacheStats stats;
+
+        transcode_cache_get_stats(queue.cache, &stats);
+        printf("{\"cache\": {\"hits\": %" G_GUINT64_FORMAT ", \"misses\": %" G_GUINT64_FORMAT
+                ", \"stores\": %" G_GUINT64_FORMAT ", \"evictions\": %" G_GUINT64_FORMAT
+                ", \"bytes_served\": %" G_GUINT64_FORMAT ", \"bytes_stored\": %" G_GUINT64_FORMAT
+                ", \"entries\": %u, \"size\": %" G_GUINT64_FORMAT ", \"budget\": %" G_GUINT64_FORMAT "}}\n",
+                stats.hits, stats.misses, stats.stores, stats.evictions, stats.bytes_served,
+                stats.bytes_stored, stats.entries, stats.size, stats.budget);
+        transcode_cache_free(queue.cache);
+        g_free(queue.profile_digest);
+    }
+
+    g_free(workers);
+    g_strfreev(queue.files);
+    g_mutex_free(queue.lock);
+    gst_encoding_profile_unref(queue.profile);
+
+    return queue.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+};
@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "transcode-cache.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/* Bump when the way outputs are produced changes, so old entries miss */
+#define CACHE_FORMAT "transcode-cache-1"
+
+#define COPY_BLOCK (1024 * 1024)
+
+typedef struct {
+    gchar* key;
+    guint64 size;
+    time_t used;
+} CacheEntry;
+
+struct _TranscodeCache {
+    gchar* dir;
+    GMutex* lock;
+
+    /* Least recently used first; the table maps keys to queue links */
+    GQueue lru;
+    GHashTable* index;
+
+    TranscodeCacheStats stats;
+};
+
+static void entry_free(CacheEntry* entry) {
+    g_free(entry->key);
+    g_slice_free(CacheEntry, entry);
+};
+
+static gint entry_compare_used(gconstpointer a, gconstpointer b) {
+    const CacheEntry* ea = (const CacheEntry*) a;
+    const CacheEntry* eb = (const CacheEntry*) b;
+
+    return ea->used < eb->used ? -1 : ea->used > eb->used ? 1 : 0;
+};
+
+static gboolean is_key(const gchar* name) {
+    const gchar* c;
+
+    for (c = name; *c != '\0'; c++) {
+        if (!g_ascii_isxdigit(*c)) {
+            return FALSE;
+        }
+    }
+
+    return c != name;
+};
+
+/* ".<key>.XXXXXX", a copy into the cache that never got renamed */
+static gboolean is_temp(const gchar* name) {
+    const gchar* dot = strrchr(name, '.');
+    gchar* key;
+    gboolean ret;
+
+    if (name[0] != '.' || dot == name || strlen(dot + 1) != 6) {
+        return FALSE;
+    }
+
+    key = g_strndup(name + 1, dot - name - 1);
+    ret = is_key(key);
+    g_free(key);
+
+    return ret;
+};
+
+/* Copy everything from one descriptor to another, in the kernel where we
+ * can. */
+static gboolean copy_fd(int in, int out, guint64* copied) {
+    gchar* buf = NULL;
+    gssize n;
+
+    *copied = 0;
+
+#ifdef __linux__
+    while ((n = sendfile(out, in, NULL, COPY_BLOCK)) > 0) {
+        *copied += n;
+    }
+    if (n == 0) {
+        return TRUE;
+    }
+    if (*copied > 0 || (errno != EINVAL && errno != ENOSYS)) {
+        return FALSE;
+    }
+#endif
+
+    buf = g_malloc(COPY_BLOCK);
+    while ((n = read(in, buf, COPY_BLOCK)) > 0) {
+        gssize done = 0;
+
+        while (done < n) {
+            gssize w = write(out, buf + done, n - done);
+            if (w < 0) {
+                g_free(buf);
+                return FALSE;
+            }
+            done += w;
+        }
+        *copied += n;
+    }
+    g_free(buf);
+
+    return n == 0;
+};
+
+/* Drop the least recently used entries until we're within budget. Called
+ * with the lock held. */
+static void evict(TranscodeCache* cache) {
+    while (cache->stats.size > cache->stats.budget && !g_queue_is_empty(&cache->lru)) {
+        CacheEntry* entry = (CacheEntry*) g_queue_pop_head(&cache->lru);
+        gchar* path = g_build_filename(cache->dir, entry->key, NULL);
+
+        g_unlink(path);
+        g_free(path);
+
+        cache->stats.size -= entry->size;
+        cache->stats.entries--;
+        cache->stats.evictions++;
+        g_hash_table_remove(cache->index, entry->key);
+        entry_free(entry);
+    }
+};
+
+static void add_entry(TranscodeCache* cache, CacheEntry* entry) {
+    g_queue_push_tail(&cache->lru, entry);
+    g_hash_table_insert(cache->index, entry->key, g_queue_peek_tail_link(&cache->lru));
+    cache->stats.size += entry->size;
+    cache->stats.entries++;
+};
+
+static void remove_entry(TranscodeCache* cache, GList* link) {
+    CacheEntry* entry = (CacheEntry*) link->data;
+
+    g_hash_table_remove(cache->index, entry->key);
+    g_queue_delete_link(&cache->lru, link);
+    cache->stats.size -= entry->size;
+    cache->stats.entries--;
+    entry_free(entry);
+};
+
+TranscodeCache* transcode_cache_new(const gchar* dir, guint64 budget, GError** err) {
+    TranscodeCache* cache;
+    GList* found = NULL;
+    GList* iter;
+    const gchar* name;
+    GDir* d;
+
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Could not create %s: %s", dir, g_strerror(errno));
+        return NULL;
+    }
+
+    d = g_dir_open(dir, 0, err);
+    if (d == NULL) {
+        return NULL;
+    }
+
+    cache = g_new0(TranscodeCache, 1);
+    cache->dir = g_strdup(dir);
+    cache->lock = g_mutex_new();
+    cache->index = g_hash_table_new(g_str_hash, g_str_equal);
+    g_queue_init(&cache->lru);
+    cache->stats.budget = budget;
+
+    /* Rebuild the LRU order from the entries' modification times, which
+     * fetches keep up to date */
+    while ((name = g_dir_read_name(d)) != NULL) {
+        gchar* path = g_build_filename(dir, name, NULL);
+        struct stat st;
+
+        if (is_key(name) && g_stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            CacheEntry* entry = g_slice_new0(CacheEntry);
+
+            entry->key = g_strdup(name);
+            entry->size = st.st_size;
+            entry->used = st.st_mtime;
+            found = g_list_prepend(found, entry);
+        } else if (is_temp(name)) {
+            /* Left behind by a store that was cut short */
+            g_unlink(path);
+        }
+        g_free(path);
+    }
+    g_dir_close(d);
+
+    found = g_list_sort(found, entry_compare_used);
+    for (iter = found; iter != NULL; iter = iter->next) {
+        add_entry(cache, (CacheEntry*) iter->data);
+    }
+    g_list_free(found);
+
+    evict(cache);
+
+    return cache;
+};
+
+void transcode_cache_free(TranscodeCache* cache) {
+    g_queue_foreach(&cache->lru, (GFunc) entry_free, NULL);
+    g_queue_clear(&cache->lru);
+    g_hash_table_destroy(cache->index);
+    g_mutex_free(cache->lock);
+    g_free(cache->dir);
+    g_free(cache);
+};
+
+static void serialize_caps(GString* out, const gchar* field, const GstCaps* caps) {
+    gchar* str = caps ? gst_caps_to_string(caps) : g_strdup("");
+
+    g_string_append_printf(out, "%s=%s\n", field, str);
+    g_free(str);
+};
+
+/* Everything about a profile that changes the output, in a fixed order.
+ * Names and descriptions don't, so they're left out. */
+static void serialize_profile(GString* out, const GstEncodingProfile* profile) {
+    GstEncodingProfile* prof = (GstEncodingProfile*) profile;
+    const gchar* preset = gst_encoding_profile_get_preset(prof);
+
+    if (GST_IS_ENCODING_CONTAINER_PROFILE (prof)) {
+        g_string_append(out, "container\n");
+    } else if (GST_IS_ENCODING_VIDEO_PROFILE (prof)) {
+        g_string_append(out, "video\n");
+    } else if (GST_IS_ENCODING_AUDIO_PROFILE (prof)) {
+        g_string_append(out, "audio\n");
+    } else {
+        g_string_append(out, "stream\n");
+    }
+
+    serialize_caps(out, "format", gst_encoding_profile_get_format(prof));
+    serialize_caps(out, "restriction", gst_encoding_profile_get_restriction(prof));
+    g_string_append_printf(out, "preset=%s\npresence=%u\n", preset ? preset : "",
+            gst_encoding_profile_get_presence(prof));
+
+    if (GST_IS_ENCODING_VIDEO_PROFILE (prof)) {
+        GstEncodingVideoProfile* vprof = GST_ENCODING_VIDEO_PROFILE (prof);
+
+        g_string_append_printf(out, "pass=%u\nvariableframerate=%d\n",
+                gst_encoding_video_profile_get_pass(vprof),
+                gst_encoding_video_profile_get_variableframerate(vprof));
+    }
+
+    if (GST_IS_ENCODING_CONTAINER_PROFILE (prof)) {
+        const GList* iter;
+
+        for (iter = gst_encoding_container_profile_get_profiles(GST_ENCODING_CONTAINER_PROFILE (prof));
+                iter != NULL; iter = iter->next) {
+            serialize_profile(out, (const GstEncodingProfile*) iter->data);
+        }
+        g_string_append(out, "end\n");
+    }
+};
+
+gchar* transcode_cache_profile_digest(const GstEncodingProfile* profile) {
+    GString* out = g_string_new(CACHE_FORMAT "\n");
+    gchar* digest;
+
+    serialize_profile(out, profile);
+    digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, out->str, out->len);
+    g_string_free(out, TRUE);
+
+    return digest;
+};
+
+gchar* transcode_cache_key(const gchar* input, const gchar* profile_digest, GError** err) {
+    GMappedFile* map = g_mapped_file_new(input, FALSE, err);
+    GChecksum* sum;
+    gchar* key;
+
+    if (map == NULL) {
+        return NULL;
+    }
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (const guchar*) profile_digest, -1);
+    if (g_mapped_file_get_length(map) > 0) {
+        g_checksum_update(sum, (const guchar*) g_mapped_file_get_contents(map),
+                g_mapped_file_get_length(map));
+    }
+    key = g_strdup(g_checksum_get_string(sum));
+
+    g_checksum_free(sum);
+    g_mapped_file_unref(map);
+
+    return key;
+};
+
+gboolean transcode_cache_fetch(TranscodeCache* cache, const gchar* key, const gchar* output) {
+    gchar* path = g_build_filename(cache->dir, key, NULL);
+    GList* link;
+    int in = -1, out;
+    guint64 copied = 0;
+    gboolean ok = FALSE;
+
+    g_mutex_lock(cache->lock);
+    link = (GList*) g_hash_table_lookup(cache->index, key);
+    if (link != NULL) {
+        /* Open while locked; once open, an eviction can't take it away */
+        in = g_open(path, O_RDONLY, 0);
+        if (in >= 0) {
+            CacheEntry* entry = (CacheEntry*) link->data;
+
+            g_queue_unlink(&cache->lru, link);
+            g_queue_push_tail_link(&cache->lru, link);
+            entry->used = time(NULL);
+            utime(path, NULL);
+        } else {
+            remove_entry(cache, link);
+        }
+    }
+    if (in < 0) {
+        cache->stats.misses++;
+    }
+    g_mutex_unlock(cache->lock);
+    g_free(path);
+
+    if (in < 0) {
+        return FALSE;
+    }
+
+    /* The output may be the very file that was linked into the cache, so
+     * make a new one rather than truncating the entry we read from */
+    g_unlink(output);
+    out = g_open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out >= 0) {
+        ok = copy_fd(in, out, &copied);
+        ok = close(out) == 0 && ok;
+    }
+    close(in);
+
+    g_mutex_lock(cache->lock);
+    if (ok) {
+        cache->stats.hits++;
+        cache->stats.bytes_served += copied;
+    } else {
+        cache->stats.misses++;
+    }
+    g_mutex_unlock(cache->lock);
+
+    return ok;
+};
+
+/* Account for the file now at the key's path. Called with the lock held. */
+static void commit_entry(TranscodeCache* cache, const gchar* key, guint64 size) {
+    CacheEntry* entry;
+    GList* link;
+
+    link = (GList*) g_hash_table_lookup(cache->index, key);
+    if (link != NULL) {
+        remove_entry(cache, link);
+    }
+
+    entry = g_slice_new0(CacheEntry);
+    entry->key = g_strdup(key);
+    entry->size = size;
+    entry->used = time(NULL);
+    add_entry(cache, entry);
+
+    cache->stats.stores++;
+    cache->stats.bytes_stored += size;
+    evict(cache);
+};
+
+/* Hard link the output in as the entry, replacing an older one for the
+ * same key. Called with the lock held. */
+static gboolean link_entry(const gchar* output, const gchar* path) {
+    if (link(output, path) == 0) {
+        return TRUE;
+    }
+
+    return errno == EEXIST && g_unlink(path) == 0 && link(output, path) == 0;
+};
+
+gboolean transcode_cache_store(TranscodeCache* cache, const gchar* key, const gchar* output) {
+    gchar* path = g_build_filename(cache->dir, key, NULL);
+    gchar* tmp;
+    struct stat st;
+    int in, out;
+    guint64 copied = 0;
+    gboolean ok = FALSE;
+
+    /* Not worth pushing everything else out for */
+    if (g_stat(output, &st) != 0 || !S_ISREG(st.st_mode) || (guint64) st.st_size > cache->stats.budget) {
+        g_free(path);
+        return FALSE;
+    }
+
+    /* Linking costs nothing; the output only has to be copied when the
+     * cache is on another file system */
+    g_mutex_lock(cache->lock);
+    if (link_entry(output, path)) {
+        commit_entry(cache, key, st.st_size);
+        ok = TRUE;
+    }
+    g_mutex_unlock(cache->lock);
+
+    if (ok) {
+        g_free(path);
+        return TRUE;
+    }
+
+    tmp = g_strdup_printf("%s" G_DIR_SEPARATOR_S ".%s.XXXXXX", cache->dir, key);
+    in = g_open(output, O_RDONLY, 0);
+    out = g_mkstemp(tmp);
+    if (in >= 0 && out >= 0) {
+        ok = copy_fd(in, out, &copied);
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    if (out >= 0) {
+        ok = close(out) == 0 && ok;
+    }
+
+    if (!ok || copied > cache->stats.budget) {
+        if (out >= 0) {
+            g_unlink(tmp);
+        }
+        g_free(tmp);
+        g_free(path);
+        return FALSE;
+    }
+
+    g_chmod(tmp, 0644);
+
+    g_mutex_lock(cache->lock);
+    if (g_rename(tmp, path) == 0) {
+        commit_entry(cache, key, copied);
+    } else {
+        g_unlink(tmp);
+        ok = FALSE;
+    }
+    g_mutex_unlock(cache->lock);
+
+    g_free(tmp);
+    g_free(path);
+
+    return ok;
+};
+
+void transcode_cache_get_stats(TranscodeCache* cache, TranscodeCacheStats* stats) {
+    g_mutex_lock(cache->lock);
+    *stats = cache->stats;
+    g_mutex_unlock(cache->lock);
+};
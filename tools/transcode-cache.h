@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 David Wendt <dcrkid@yahoo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TRANSCODE_CACHE_H__
+#define __TRANSCODE_CACHE_H__
+
+#include <glib.h>
+#include <gst/pbutils/encoding-profile.h>
+
+G_BEGIN_DECLS
+
+/* Content-addressed cache of transcode results.
+ *
+ * Entries are files in one directory, named by a hash of the input's
+ * content and of the profile's settings. The least recently used entries
+ * are evicted when the directory grows past its budget. All functions are
+ * safe to call from several threads.
+ *
+ * Stored outputs are hard linked into the directory when they're on the
+ * same file system, so once stored an output has to be replaced, not
+ * rewritten in place, or the entry changes with it.
+ */
+typedef struct _TranscodeCache TranscodeCache;
+
+typedef struct {
+    guint64 hits;
+    guint64 misses;
+    guint64 stores;
+    guint64 evictions;
+    guint64 bytes_served;
+    guint64 bytes_stored;
+    guint entries;
+    guint64 size;
+    guint64 budget;
+} TranscodeCacheStats;
+
+TranscodeCache* transcode_cache_new(const gchar* dir, guint64 budget, GError** err);
+void transcode_cache_free(TranscodeCache* cache);
+
+gchar* transcode_cache_profile_digest(const GstEncodingProfile* profile);
+gchar* transcode_cache_key(const gchar* input, const gchar* profile_digest, GError** err);
+
+gboolean transcode_cache_fetch(TranscodeCache* cache, const gchar* key, const gchar* output);
+gboolean transcode_cache_store(TranscodeCache* cache, const gchar* key, const gchar* output);
+
+void transcode_cache_get_stats(TranscodeCache* cache, TranscodeCacheStats* stats);
+
+G_END_DECLS
+
+#endif